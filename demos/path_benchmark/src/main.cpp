@@ -0,0 +1,425 @@
+
+#include "shl/platform.hpp"
+#include "shl/print.hpp"
+#include "shl/defer.hpp"
+#include "shl/array.hpp"
+#include "shl/string.hpp"
+#include "fs/path.hpp"
+#include "fs/path_template.hpp"
+#include "fs/impl/scan.hpp"
+
+#if Windows
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+static double _now_seconds()
+{
+#if Windows
+    LARGE_INTEGER freq;
+    LARGE_INTEGER count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+#endif
+}
+
+// simple LCG so runs are reproducible
+static u32 _rand(u64 *state)
+{
+    *state = *state * 6364136223846793005ull + 1442695040888963407ull;
+    return (u32)(*state >> 33);
+}
+
+static void _generate_paths(array<fs::path> *out, s64 count)
+{
+    const char *segments[] = {"usr", "home", "user", "..", ".", "projects", "src", "include",
+                              "very_long_directory_name_here", "a", "fs", "build", "lib64"};
+    const s64 segment_count = sizeof(segments) / sizeof(segments[0]);
+    const char *extensions[] = {".cpp", ".hpp", ".tar.gz", "", ".txt"};
+    u64 state = 0x12345678;
+
+    ::init(out, count);
+
+    for (s64 i = 0; i < count; ++i)
+    {
+        fs::path *p = out->data + i;
+        *p = fs::path{};
+        fs::path_set(p, "/");
+
+        // 40 - 200 bytes, the typical length of real paths
+        s64 target = 40 + (s64)(_rand(&state) % 160);
+
+        while ((s64)p->size < target)
+        {
+            fs::path_append(p, segments[_rand(&state) % segment_count]);
+
+            if (_rand(&state) % 8 == 0)
+                fs::path_append(p, "/");
+        }
+
+        fs::path_concat(p, extensions[_rand(&state) % 5]);
+    }
+}
+
+static s64 _total_size(const array<fs::path> *paths)
+{
+    s64 ret = 0;
+
+    for_array(p, paths)
+        ret += p->size;
+
+    return ret;
+}
+
+static void _report(const char *name, double seconds, s64 bytes, s64 checksum)
+{
+    double mbs = (double)bytes / (1024.0 * 1024.0) / seconds;
+    tprint("  %: % ms, % MB/s (checksum %)\n", name, (s64)(seconds * 1000.0), (s64)mbs, checksum);
+}
+
+#define ITERATIONS 50
+
+static void _benchmark(const array<fs::path> *paths)
+{
+    s64 bytes = _total_size(paths) * ITERATIONS;
+    s64 checksum = 0;
+    double start = 0;
+
+    start = _now_seconds();
+    checksum = 0;
+    for (int it = 0; it < ITERATIONS; ++it)
+    for_array(p, paths)
+        checksum += fs::_scan_last_separator(p->data, p->size);
+    _report("last separator", _now_seconds() - start, bytes, checksum);
+
+    start = _now_seconds();
+    checksum = 0;
+    for (int it = 0; it < ITERATIONS; ++it)
+    for_array(p, paths)
+        checksum += fs::filename(p).size;
+    _report("filename", _now_seconds() - start, bytes, checksum);
+
+    start = _now_seconds();
+    checksum = 0;
+    for (int it = 0; it < ITERATIONS; ++it)
+    for_array(p, paths)
+        checksum += fs::file_extension(p).size;
+    _report("file_extension", _now_seconds() - start, bytes, checksum);
+
+    array<fs::const_fs_string> segs{};
+    defer { ::free(&segs); };
+
+    start = _now_seconds();
+    checksum = 0;
+    for (int it = 0; it < ITERATIONS; ++it)
+    for_array(p, paths)
+    {
+        fs::path_segments(p, &segs);
+        checksum += segs.size;
+    }
+    _report("path_segments", _now_seconds() - start, bytes, checksum);
+
+    fs::path tmp{};
+    defer { fs::free(&tmp); };
+
+    start = _now_seconds();
+    checksum = 0;
+    for (int it = 0; it < ITERATIONS; ++it)
+    for_array(p, paths)
+    {
+        fs::path_set(&tmp, p);
+        fs::normalize(&tmp);
+        checksum += tmp.size;
+    }
+    _report("normalize", _now_seconds() - start, bytes, checksum);
+
+    start = _now_seconds();
+    checksum = 0;
+    for (int it = 0; it < ITERATIONS; ++it)
+    for_array(p, paths)
+        checksum += (s64)hash_data(p->data, p->size * sizeof(fs::path_char_t));
+    _report("hash_data", _now_seconds() - start, bytes, checksum);
+
+    start = _now_seconds();
+    checksum = 0;
+    for (int it = 0; it < ITERATIONS; ++it)
+    for_array(p, paths)
+        checksum += (s64)::hash(p);
+    _report("path hash", _now_seconds() - start, bytes, checksum);
+}
+
+// converting path arguments of a different character type, e.g. UTF-16
+// on Linux, like every templated fs function does.
+static void _benchmark_conversion(const array<fs::path> *paths)
+{
+    array<u16string> wide{};
+    defer {
+        for_array(w, &wide)
+            ::free(w);
+
+        ::free(&wide);
+    };
+
+    ::init(&wide, paths->size);
+
+    for (s64 i = 0; i < paths->size; ++i)
+    {
+        wide.data[i] = u16string{};
+        ::string_set(wide.data + i, to_const_string(paths->data + i));
+    }
+
+    s64 bytes = _total_size(paths) * ITERATIONS;
+    s64 checksum = 0;
+    double start = 0;
+
+    start = _now_seconds();
+    checksum = 0;
+    for (int it = 0; it < ITERATIONS; ++it)
+    for_array(w, &wide)
+    {
+        sys_string conv{};
+        ::string_set(&conv, to_const_string(w));
+        checksum += conv.size;
+        ::free(&conv);
+    }
+    _report("string_set conversion", _now_seconds() - start, bytes, checksum);
+
+    start = _now_seconds();
+    checksum = 0;
+    for (int it = 0; it < ITERATIONS; ++it)
+    for_array(w, &wide)
+    {
+        auto conv = fs::get_platform_string(w);
+        checksum += conv.size;
+
+        if constexpr (needs_conversion(u16string))
+            fs::_free_platform_string(&conv);
+    }
+    _report("get_platform_string", _now_seconds() - start, bytes, checksum);
+}
+
+#define EXPANSIONS 100000
+
+// expanding the same few variables over and over, e.g. when loading configs
+static void _benchmark_variable_expansion()
+{
+    const char *templates[] = {"$HOME/.config/app/settings.conf",
+                               "$HOME/.local/share/app/$USER/history",
+                               "$TMPDIR/app/cache/$USER.lock",
+                               "/etc/app/defaults.conf"};
+    const s64 template_count = sizeof(templates) / sizeof(templates[0]);
+    s64 checksum = 0;
+    double start = 0;
+
+    start = _now_seconds();
+    checksum = 0;
+    for (s64 i = 0; i < EXPANSIONS; ++i)
+    {
+        fs::path p = fs::path_new(templates[i % template_count]);
+        checksum += p.size;
+        fs::free(&p);
+    }
+    tprint("  path_new: % ms (checksum %)\n", (s64)((_now_seconds() - start) * 1000.0), checksum);
+
+    fs::variable_cache vars{};
+    fs::init(&vars);
+    defer { fs::free(&vars); };
+
+    start = _now_seconds();
+    checksum = 0;
+    for (s64 i = 0; i < EXPANSIONS; ++i)
+    {
+        fs::path p = fs::path_new(templates[i % template_count], &vars);
+        checksum += p.size;
+        fs::free(&p);
+    }
+    tprint("  path_new with cache: % ms (checksum %)\n", (s64)((_now_seconds() - start) * 1000.0), checksum);
+
+    fs::path_template tmpls[template_count];
+    fs::path out{};
+    defer {
+        for (s64 i = 0; i < template_count; ++i)
+            fs::free(tmpls + i);
+
+        fs::free(&out);
+    };
+
+    for (s64 i = 0; i < template_count; ++i)
+    {
+        fs::init(tmpls + i);
+        fs::path_template_compile(templates[i], tmpls + i);
+    }
+
+    start = _now_seconds();
+    checksum = 0;
+    for (s64 i = 0; i < EXPANSIONS; ++i)
+    {
+        fs::path_template_expand(tmpls + (i % template_count), &vars, &out);
+        checksum += out.size;
+    }
+    tprint("  compiled templates: % ms (checksum %)\n", (s64)((_now_seconds() - start) * 1000.0), checksum);
+}
+
+// the previous create_directories: one exists() per segment from the end to
+// find the longest existing path, then one mkdir per segment after it.
+static bool _create_directories_per_segment(const fs::path *pth)
+{
+    fs::path longest{};
+    fs::path dir{};
+    defer { fs::free(&longest); fs::free(&dir); };
+
+    fs::path_set(&longest, pth);
+    fs::const_fs_string rt = fs::root(&longest);
+
+    while (longest.size > rt.size && fs::exists(&longest) != 1)
+    {
+        s64 i = longest.size - 1;
+
+        while (i > rt.size && longest.data[i] != fs::path_separator)
+            i--;
+
+        longest.size = i;
+        longest.data[i] = '\0';
+    }
+
+    if (longest.size > 0 && !fs::create_directory(&longest))
+        return false;
+
+    fs::path_set(&dir, &longest);
+
+    for_path_segment(seg, pth)
+    {
+        if ((seg->c_str - pth->data) < longest.size)
+            continue;
+
+        fs::path_append(&dir, *seg);
+
+        if (!fs::create_directory(&dir))
+            return false;
+    }
+
+    return true;
+}
+
+#define DIRECTORY_TREES 500
+#define DIRECTORY_DEPTH 12
+
+static void _generate_directory_paths(const char *base, array<fs::path> *out)
+{
+    ::init(out, DIRECTORY_TREES);
+
+    for (s64 i = 0; i < DIRECTORY_TREES; ++i)
+    {
+        fs::path *p = out->data + i;
+        *p = fs::path{};
+        fs::path_set(p, base);
+
+        // trees share their first levels, like typical build output trees
+        fs::path_append(p, i % 4 == 0 ? "a" : "b");
+
+        for (s64 d = 1; d < DIRECTORY_DEPTH; ++d)
+        {
+            char seg[8] = {'d', (char)('0' + (d % 10)), '_', (char)('0' + ((i >> d) % 10)), '\0'};
+            fs::path_append(p, seg);
+        }
+    }
+}
+
+static void _benchmark_create_directories(const char *name, bool(*func)(const fs::path*))
+{
+    const char *base = "/tmp/_path_benchmark_dirs";
+    array<fs::path> paths{};
+    defer {
+        for_array(p, &paths)
+            fs::free(p);
+
+        ::free(&paths);
+    };
+
+    _generate_directory_paths(base, &paths);
+    fs::remove_directory(base);
+
+    double start = _now_seconds();
+    s64 created = 0;
+
+    for_array(p, &paths)
+        created += func(p) ? 1 : 0;
+
+    double create_time = _now_seconds() - start;
+
+    // everything exists now
+    start = _now_seconds();
+
+    for_array(p, &paths)
+        created += func(p) ? 1 : 0;
+
+    double exists_time = _now_seconds() - start;
+
+    tprint("  %: create % ms, existing % ms (% ok)\n", name,
+           (s64)(create_time * 1000.0), (s64)(exists_time * 1000.0), created);
+
+    fs::remove_directory(base);
+}
+
+static bool _create_directories_optimistic(const fs::path *pth)
+{
+    return fs::create_directories(pth);
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc;
+    (void)argv;
+
+    array<fs::path> paths{};
+    defer {
+        for_array(p, &paths)
+            fs::free(p);
+
+        ::free(&paths);
+    };
+
+    _generate_paths(&paths, 100000);
+
+    tprint("% paths, % bytes\n", paths.size, _total_size(&paths));
+
+    const fs::scan_implementation original = fs::get_scan_implementation();
+    const fs::scan_implementation impls[] = {fs::scan_implementation::Scalar,
+                                             fs::scan_implementation::SSE2,
+                                             fs::scan_implementation::AVX2};
+    const char *impl_names[] = {"Scalar", "SSE2", "AVX2"};
+
+    for (int i = 0; i < 3; ++i)
+    {
+        if (!fs::set_scan_implementation(impls[i]))
+        {
+            tprint("%: not supported\n", impl_names[i]);
+            continue;
+        }
+
+        tprint("%:\n", impl_names[i]);
+        _benchmark(&paths);
+    }
+
+    fs::set_scan_implementation(original);
+
+    tprint("conversion:\n");
+    _benchmark_conversion(&paths);
+
+    tprint("variable expansion, % paths:\n", EXPANSIONS);
+    _benchmark_variable_expansion();
+
+#if Linux
+    tprint("create_directories, % trees of depth %:\n", DIRECTORY_TREES, DIRECTORY_DEPTH);
+    _benchmark_create_directories("per segment", _create_directories_per_segment);
+    _benchmark_create_directories("optimistic", _create_directories_optimistic);
+#endif
+
+    return 0;
+}
@@ -36,6 +36,71 @@ enum fs::copy_file_option:
                        Looks at MODIFICATION time.
     SkipExisting:      Skips any existing destination files.
 
+enum fs::copy_strategy:
+    How copy_file copied the contents of a file:
+
+    None:          Nothing was copied, e.g. an existing destination was skipped.
+    Clone:         The destination shares the data of the source (ioctl FICLONE,
+                   e.g. btrfs and XFS), no data was copied.
+    CopyFileRange: The kernel copied the data (copy_file_range).
+    ReadWrite:     The data was read and written through a buffer.
+    CopyFile:      Windows CopyFile.
+    Sparse:        Only the data between the holes of a sparse source was
+                   copied, the holes were recreated at the destination.
+    Direct:        The data was read and written with O_DIRECT through an
+                   aligned buffer, bypassing the page cache.
+
+enum fs::copy_file_flag:
+    Bitmask flags that change how copy_file copies the contents of files:
+
+    None:     Files are copied through the page cache like any other I/O.
+    Bulk:     For large copies which should not evict the page cache of other
+              processes. The source is read with POSIX_FADV_SEQUENTIAL, and
+              every 8 MiB copied are written back and dropped from the page
+              cache of both files (POSIX_FADV_DONTNEED). On Windows, files
+              are copied with COPY_FILE_NO_BUFFERING.
+    DirectIO: Same as Bulk, and files of 64 MiB or more are copied with
+              O_DIRECT (Linux) if both filesystems support it.
+    Verify:   The CRC32C of the contents is computed while they are copied
+              and returned in copy_file_info::checksum.
+    VerifyDestination: Same as Verify, and the destination is read again
+              from the device (with O_DIRECT on Linux if the filesystem
+              supports it) after copying and fails with EIO (ERROR_CRC on
+              Windows) if its CRC32C is different.
+
+struct fs::copy_file_info:
+    Filled by copy_file: the copy_strategy used, the number of bytes copied
+    and, with copy_file_flag::Verify, the CRC32C of the copied contents.
+
+enum fs::copy_directory_method:
+    How copy_directory copies the files of a directory:
+
+    Threads: Files are copied by a number of threads, 1 = only the calling thread.
+    Uring:   Small files are copied by chains of io_uring operations on the
+             calling thread, many files at once (Linux 5.15+). Falls back to
+             Threads when io_uring is not available.
+
+enum fs::copy_directory_flag:
+    Bitmask flags that change what copy_directory copies:
+
+    None:              Every file is copied.
+    Deduplicate:       Files with identical contents are copied once, the
+                       other files are clones of (Linux, if the filesystem
+                       supports it) or hard links to the first copy.
+    PreserveHardLinks: Hard links of the same file in the source are copied
+                       once, the other links are hard linked to the copy.
+    Bulk:              Files are copied with copy_file_flag::Bulk.
+    DirectIO:          Files are copied with copy_file_flag::DirectIO.
+
+struct fs::copy_options:
+    How copy_directory and copy copy files, see copy_directory in
+    fs/path.hpp. The defaults are the same as without copy_options:
+
+    method:       copy_directory_method::Threads
+    thread_count: 1, only the calling thread. 0 = one per hardware thread.
+    flags:        copy_directory_flag::None
+    control:      nullptr, no fs::operation_control.
+
 enum fs::iterate_option:
     Bitmask flags that change the behavior of path iterators. Values:
 
@@ -298,6 +363,63 @@ enum class copy_file_option
     // TODO: UpdateOnly? might be useful
 };
 
+// how the contents of a file were copied
+enum class copy_strategy : u8
+{
+    None,           // nothing was copied, e.g. skipped existing destination.
+    Clone,          // ioctl(FICLONE), extents are shared, no data copied.
+    CopyFileRange,  // copy_file_range, copied by the kernel.
+    ReadWrite,      // read / write through a buffer.
+    CopyFile,       // Windows CopyFile.
+    Sparse,         // data ranges only, holes are kept (SEEK_DATA / SEEK_HOLE).
+    Direct          // read / write with O_DIRECT, bypassing the page cache.
+};
+
+enum class copy_file_flag : u8
+{
+    None     = 0x00,
+    Bulk     = 0x01, // keeps the copied data out of the page cache.
+    DirectIO = 0x02, // Bulk, and large files are copied with O_DIRECT.
+    Verify   = 0x04, // computes the CRC32C of the copied data.
+    VerifyDestination = 0x08, // Verify, and reads the destination again to compare.
+};
+
+enum_flag(copy_file_flag);
+
+struct copy_file_info
+{
+    fs::copy_strategy strategy;
+    s64 bytes_copied;
+    u32 checksum; // CRC32C of the contents with copy_file_flag::Verify, 0 otherwise
+};
+
+enum class copy_directory_method : u8
+{
+    Threads,    // copies files on a number of threads.
+    Uring       // copies small files with io_uring on the calling thread.
+};
+
+enum class copy_directory_flag : u8
+{
+    None              = 0x00,
+    Deduplicate       = 0x01, // identical files are copied once, then cloned or hard linked.
+    PreserveHardLinks = 0x02, // hard links are recreated as hard links instead of copied.
+    Bulk              = 0x04, // files are copied with copy_file_flag::Bulk.
+    DirectIO          = 0x08, // files are copied with copy_file_flag::DirectIO.
+};
+
+enum_flag(copy_directory_flag);
+
+struct operation_control; // fs/operation_control.hpp
+
+struct copy_options
+{
+    fs::copy_directory_method method = fs::copy_directory_method::Threads;
+    s32 thread_count = 1;
+    fs::copy_directory_flag flags = fs::copy_directory_flag::None;
+    fs::operation_control *control = nullptr;
+};
+
 enum class iterate_option : u8
 {
     None            = 0x00, // Does not follow symlinks and does not stop on errors.
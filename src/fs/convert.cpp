@@ -1,66 +1,381 @@
+#include <cstdlib>
 
-#include <stdlib.h>
-
+#include "shl/assert.hpp"
 #include "shl/memory.hpp"
 
 #include "fs/convert.hpp"
 
-#if 0
-void fs::free(fs::converted_string<char> *str)
+#if defined(__x86_64__) || defined(_M_X64)
+#  define FS_CONVERT_SSE2 1
+#  include <emmintrin.h>
+#else
+#  define FS_CONVERT_SSE2 0
+#endif
+
+// platform string scratch memory
+
+// enough for the vast majority of paths, even after conversion
+#define PLATFORM_STRING_INLINE_SIZE 4096
+#define PLATFORM_STRING_ALIGN(X) (((X) + 7) & ~(s64)7)
+
+struct _platform_string_arena
+{
+    u8 *data;
+    s64 size;
+    s64 used;
+    s64 live;  // number of strings not yet freed
+
+    u8 *heap;  // transient buffer for long strings, if any
+    alignas(8) u8 inline_buffer[PLATFORM_STRING_INLINE_SIZE];
+
+    ~_platform_string_arena()
+    {
+        if (heap != nullptr)
+            std::free(heap);
+    }
+};
+
+static thread_local _platform_string_arena _arena{};
+
+void *fs::_platform_string_alloc(s64 bytes)
 {
-    ::dealloc(str->data, str->buffer_size);
+    _platform_string_arena *a = &_arena;
+    bytes = PLATFORM_STRING_ALIGN(bytes);
+
+    if (a->data == nullptr)
+    {
+        a->data = a->inline_buffer;
+        a->size = PLATFORM_STRING_INLINE_SIZE;
+    }
+
+    if (a->used + bytes > a->size)
+    {
+        // other strings still point into the buffer, so the buffer can't
+        // be replaced, allocate this one separately.
+        if (a->live > 0)
+            return std::malloc(bytes);
+
+        s64 new_size = a->size * 2;
+
+        while (new_size < bytes)
+            new_size *= 2;
+
+        if (a->heap != nullptr)
+            std::free(a->heap);
+
+        a->heap = (u8*)std::malloc(new_size);
+
+        if (a->heap == nullptr)
+        {
+            a->data = a->inline_buffer;
+            a->size = PLATFORM_STRING_INLINE_SIZE;
+            return std::malloc(bytes);
+        }
+
+        a->data = a->heap;
+        a->size = new_size;
+        a->used = 0;
+    }
+
+    void *ret = a->data + a->used;
+    a->used += bytes;
+    a->live += 1;
+
+    return ret;
 }
 
-void fs::free(fs::converted_string<wchar_t> *str)
+void fs::_platform_string_free(void *ptr, s64 bytes)
 {
-    ::dealloc(str->data, str->buffer_size);
+    if (ptr == nullptr)
+        return;
+
+    _platform_string_arena *a = &_arena;
+    u8 *p = (u8*)ptr;
+
+    if (a->data == nullptr || p < a->data || p >= a->data + a->size)
+    {
+        std::free(ptr);
+        return;
+    }
+
+    assert(a->live > 0);
+    a->live -= 1;
+
+    if (a->live == 0)
+        a->used = 0;
+    else if (p + PLATFORM_STRING_ALIGN(bytes) == a->data + a->used)
+        a->used = p - a->data;
 }
 
-fs::converted_string<char> fs::convert_string(const wchar_t *cstring, s64 wchar_count)
+// transcoding
+
+#define REPLACEMENT_CHARACTER 0xfffd
+
+static inline bool _is_high_surrogate(u32 c) { return c >= 0xd800 && c <= 0xdbff; }
+static inline bool _is_low_surrogate(u32 c)  { return c >= 0xdc00 && c <= 0xdfff; }
+
+static inline s64 _encode_utf8(u32 cp, c8 *out)
 {
-    fs::converted_string<char> ret;
-    s64 sz = (wchar_count + 1) * sizeof(char);
-    ret.data = (char*)::alloc(sz);
-    ret.buffer_size = sz;
+    if (cp < 0x80)
+    {
+        out[0] = (c8)cp;
+        return 1;
+    }
 
-    ::fill_memory((void*)ret.data, 0, sz);
+    if (cp < 0x800)
+    {
+        out[0] = (c8)(0xc0 | (cp >> 6));
+        out[1] = (c8)(0x80 | (cp & 0x3f));
+        return 2;
+    }
 
-    ret.size = ::wcstombs(ret.data, cstring, wchar_count * sizeof(wchar_t));
+    if (cp >= 0x110000 || (cp >= 0xd800 && cp <= 0xdfff))
+        cp = REPLACEMENT_CHARACTER;
 
-    return ret;
+    if (cp < 0x10000)
+    {
+        out[0] = (c8)(0xe0 | (cp >> 12));
+        out[1] = (c8)(0x80 | ((cp >> 6) & 0x3f));
+        out[2] = (c8)(0x80 | (cp & 0x3f));
+        return 3;
+    }
+
+    out[0] = (c8)(0xf0 | (cp >> 18));
+    out[1] = (c8)(0x80 | ((cp >> 12) & 0x3f));
+    out[2] = (c8)(0x80 | ((cp >> 6) & 0x3f));
+    out[3] = (c8)(0x80 | (cp & 0x3f));
+    return 4;
 }
 
-fs::converted_string<char> fs::convert_string(const wchar_t *cstring)
+static inline s64 _encode_utf16(u32 cp, c16 *out)
 {
-    return fs::convert_string(cstring, ::string_length(cstring));
+    if (cp >= 0x110000 || (cp >= 0xd800 && cp <= 0xdfff))
+        cp = REPLACEMENT_CHARACTER;
+
+    if (cp < 0x10000)
+    {
+        out[0] = (c16)cp;
+        return 1;
+    }
+
+    cp -= 0x10000;
+    out[0] = (c16)(0xd800 + (cp >> 10));
+    out[1] = (c16)(0xdc00 + (cp & 0x3ff));
+    return 2;
 }
 
-fs::converted_string<char> fs::convert_string(const_wstring cstring)
+s64 fs::_utf16_to_utf8(const c16 *in, s64 size, c8 *out)
 {
-    return fs::convert_string(cstring.c_str, cstring.size);
+    s64 i = 0;
+    s64 o = 0;
+
+    while (i < size)
+    {
+#if FS_CONVERT_SSE2
+        // 16 ASCII characters at a time
+        const __m128i non_ascii = _mm_set1_epi16((short)0xff80);
+
+        while (size - i >= 16)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i*)(in + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(in + i + 8));
+            __m128i hi = _mm_and_si128(_mm_or_si128(a, b), non_ascii);
+
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(hi, _mm_setzero_si128())) != 0xffff)
+                break;
+
+            _mm_storeu_si128((__m128i*)(out + o), _mm_packus_epi16(a, b));
+            i += 16;
+            o += 16;
+        }
+
+        if (i >= size)
+            break;
+#endif
+
+        u32 c = (u32)in[i];
+
+        if (c < 0x80)
+        {
+            out[o++] = (c8)c;
+            i += 1;
+            continue;
+        }
+
+        i += 1;
+
+        if (_is_high_surrogate(c) && i < size && _is_low_surrogate((u32)in[i]))
+        {
+            c = 0x10000 + ((c - 0xd800) << 10) + ((u32)in[i] - 0xdc00);
+            i += 1;
+        }
+
+        o += _encode_utf8(c, out + o);
+    }
+
+    return o;
 }
 
-fs::converted_string<wchar_t> fs::convert_string(const char *cstring, s64 char_count)
+s64 fs::_utf32_to_utf8(const c32 *in, s64 size, c8 *out)
 {
-    fs::converted_string<wchar_t> ret;
-    s64 sz = (char_count + 1) * sizeof(wchar_t);
-    ret.data = (wchar_t*)::alloc(sz);
-    ret.buffer_size = sz;
+    s64 i = 0;
+    s64 o = 0;
 
-    ::fill_memory((void*)ret.data, 0, sz);
+    while (i < size)
+    {
+#if FS_CONVERT_SSE2
+        const __m128i non_ascii = _mm_set1_epi32((int)0xffffff80);
 
-    ret.size = ::mbstowcs(ret.data, cstring, char_count * sizeof(char));
+        while (size - i >= 16)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i*)(in + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(in + i + 4));
+            __m128i c = _mm_loadu_si128((const __m128i*)(in + i + 8));
+            __m128i d = _mm_loadu_si128((const __m128i*)(in + i + 12));
+            __m128i any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
 
-    return ret;
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(any, non_ascii), _mm_setzero_si128())) != 0xffff)
+                break;
+
+            // values are < 0x80, so the saturating packs are exact
+            __m128i ab = _mm_packs_epi32(a, b);
+            __m128i cd = _mm_packs_epi32(c, d);
+            _mm_storeu_si128((__m128i*)(out + o), _mm_packus_epi16(ab, cd));
+            i += 16;
+            o += 16;
+        }
+
+        if (i >= size)
+            break;
+#endif
+
+        o += _encode_utf8((u32)in[i], out + o);
+        i += 1;
+    }
+
+    return o;
 }
 
-fs::converted_string<wchar_t> fs::convert_string(const char *cstring)
+// length of the UTF-8 sequence starting with byte C, 0 if C can't start one
+static inline s64 _utf8_sequence_length(u8 c)
 {
-    return fs::convert_string(cstring, ::string_length(cstring));
+    if (c < 0x80) return 1;
+    if (c < 0xc2) return 0;
+    if (c < 0xe0) return 2;
+    if (c < 0xf0) return 3;
+    if (c < 0xf5) return 4;
+    return 0;
 }
 
-fs::converted_string<wchar_t> fs::convert_string(const_string cstring)
+s64 fs::_utf8_to_utf16(const c8 *in, s64 size, c16 *out)
 {
-    return fs::convert_string(cstring.c_str, cstring.size);
+    const u8 *s = (const u8*)in;
+    s64 i = 0;
+    s64 o = 0;
+
+    while (i < size)
+    {
+#if FS_CONVERT_SSE2
+        while (size - i >= 16)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i*)(s + i));
+
+            if (_mm_movemask_epi8(a) != 0)
+                break;
+
+            _mm_storeu_si128((__m128i*)(out + o),     _mm_unpacklo_epi8(a, _mm_setzero_si128()));
+            _mm_storeu_si128((__m128i*)(out + o + 8), _mm_unpackhi_epi8(a, _mm_setzero_si128()));
+            i += 16;
+            o += 16;
+        }
+
+        if (i >= size)
+            break;
+#endif
+
+        s64 len = _utf8_sequence_length(s[i]);
+
+        if (len == 1)
+        {
+            out[o++] = (c16)s[i];
+            i += 1;
+            continue;
+        }
+
+        u32 cp = REPLACEMENT_CHARACTER;
+
+        if (len > 0 && i + len <= size)
+        {
+            cp = s[i] & (0x7f >> len);
+            s64 j = 1;
+
+            for (; j < len; ++j)
+            {
+                if ((s[i + j] & 0xc0) != 0x80)
+                    break;
+
+                cp = (cp << 6) | (s[i + j] & 0x3f);
+            }
+
+            // overlong encodings are invalid
+            if (j < len
+             || (len == 3 && cp < 0x800)
+             || (len == 4 && cp < 0x10000))
+            {
+                cp = REPLACEMENT_CHARACTER;
+                len = j;
+            }
+        }
+        else
+            len = 1;
+
+        i += len;
+        o += _encode_utf16(cp, out + o);
+    }
+
+    return o;
 }
+
+s64 fs::_utf32_to_utf16(const c32 *in, s64 size, c16 *out)
+{
+    s64 i = 0;
+    s64 o = 0;
+
+    while (i < size)
+    {
+#if FS_CONVERT_SSE2
+        const __m128i non_bmp = _mm_set1_epi32((int)0xffff0000);
+        const __m128i surrogate_mask = _mm_set1_epi32((int)0xfffff800);
+        const __m128i surrogate = _mm_set1_epi32(0xd800);
+
+        while (size - i >= 8)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i*)(in + i));
+            __m128i b = _mm_loadu_si128((const __m128i*)(in + i + 4));
+            __m128i big = _mm_and_si128(_mm_or_si128(a, b), non_bmp);
+            __m128i sa = _mm_cmpeq_epi32(_mm_and_si128(a, surrogate_mask), surrogate);
+            __m128i sb = _mm_cmpeq_epi32(_mm_and_si128(b, surrogate_mask), surrogate);
+
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(big, _mm_setzero_si128())) != 0xffff
+             || _mm_movemask_epi8(_mm_or_si128(sa, sb)) != 0)
+                break;
+
+            // no SSE2 unsigned 32 -> 16 pack, shift into signed range and back
+            const __m128i bias32 = _mm_set1_epi32(0x8000);
+            const __m128i bias16 = _mm_set1_epi16((short)0x8000);
+            __m128i packed = _mm_packs_epi32(_mm_sub_epi32(a, bias32), _mm_sub_epi32(b, bias32));
+            _mm_storeu_si128((__m128i*)(out + o), _mm_add_epi16(packed, bias16));
+            i += 8;
+            o += 8;
+        }
+
+        if (i >= size)
+            break;
 #endif
+
+        o += _encode_utf16((u32)in[i], out + o);
+        i += 1;
+    }
+
+    return o;
+}
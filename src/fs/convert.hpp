@@ -23,4 +23,57 @@ template<> struct _needs_conversion<string>    { static constexpr bool value = !
 template<> struct _needs_conversion<u16string> { static constexpr bool value = !is_same(c16, sys_char); };
 template<> struct _needs_conversion<u32string> { static constexpr bool value = !is_same(c32, sys_char); };
 #define needs_conversion(C) fs::_needs_conversion<typename remove_const(typename remove_pointer(C))>::value
+
+/* Conversion of path arguments to the platform character type.
+
+The templated functions convert arguments whose character type is not
+sys_char (e.g. c16 strings on Linux) with get_platform_string. Converted
+strings are allocated with _platform_string_alloc from a thread-local scratch
+buffer, typical paths never touch the heap. Strings that don't fit
+go to a larger transient heap buffer which is reused for later conversions.
+Strings must be freed with _free_platform_string, preferably in reverse order
+of allocation, which makes the memory immediately reusable.
+
+The transcoding functions return the number of characters written to Out,
+Out must have space for at least _transcoded_capacity characters. ASCII runs
+are converted 16 bytes at a time on x86_64, invalid input is replaced with
+U+FFFD.
+*/
+void *_platform_string_alloc(s64 bytes);
+void  _platform_string_free(void *ptr, s64 bytes);
+
+s64 _utf16_to_utf8(const c16 *in, s64 size, c8 *out);
+s64 _utf32_to_utf8(const c32 *in, s64 size, c8 *out);
+s64 _utf8_to_utf16(const c8 *in, s64 size, c16 *out);
+s64 _utf32_to_utf16(const c32 *in, s64 size, c16 *out);
+
+// maximum number of sys_chars (including null terminator) needed to convert
+// Size characters of type C.
+template<typename C>
+constexpr s64 _transcoded_capacity(s64 size)
+{
+    if constexpr (sizeof(sys_char) == 1)
+        return size * (sizeof(C) == 2 ? 3 : 4) + 1;
+    else
+        return size * (sizeof(C) == 1 ? 1 : 2) + 1;
+}
+
+template<typename C>
+s64 _transcode_to_platform(const C *in, s64 size, sys_char *out)
+{
+    if constexpr (sizeof(sys_char) == 1)
+    {
+        if constexpr (sizeof(C) == 2)
+            return fs::_utf16_to_utf8((const c16*)in, size, (c8*)out);
+        else
+            return fs::_utf32_to_utf8((const c32*)in, size, (c8*)out);
+    }
+    else
+    {
+        if constexpr (sizeof(C) == 1)
+            return fs::_utf8_to_utf16((const c8*)in, size, (c16*)out);
+        else
+            return fs::_utf32_to_utf16((const c32*)in, size, (c16*)out);
+    }
+}
 }
@@ -0,0 +1,345 @@
+
+#include "shl/assert.hpp"
+#include "shl/memory.hpp"
+#include "shl/defer.hpp"
+#include "shl/platform.hpp"
+
+#if Windows
+#include <windows.h>
+#else
+#include <errno.h>
+
+#include "shl/impl/linux/syscalls.hpp"
+#include "shl/impl/linux/fs.hpp"
+#include "shl/impl/linux/io.hpp"
+#include "shl/impl/linux/statx.hpp"
+#endif
+
+#include "fs/dir_handle.hpp"
+
+#if Windows
+// name joined to the path of dir, relative functions on Windows use the path functions
+static void _join(const fs::dir_handle *dir, fs::const_fs_string name, fs::path *out)
+{
+    fs::path_set(out, &dir->path);
+
+    if (name.size > 0)
+        fs::path_append(out, name);
+}
+
+#define define_joined_path(Var, Dir, Name) \
+    fs::path Var{};                        \
+    defer { fs::free(&Var); };             \
+    _join((Dir), (Name), &Var);
+#endif
+
+#if Linux
+// sets dir->path to the current path of dir->fd through /proc without
+// resolving any path. if /proc is not available, resolves fallback instead.
+static bool _set_dir_path(fs::dir_handle *dir, fs::const_fs_string fallback, error *err)
+{
+    char link[32] = "/proc/self/fd/";
+    s64 size = 14;
+    char digits[12];
+    s32 digit_count = 0;
+
+    for (u32 fd = (u32)dir->fd; digit_count == 0 || fd > 0; fd /= 10)
+        digits[digit_count++] = (char)('0' + (fd % 10));
+
+    while (digit_count > 0)
+        link[size++] = digits[--digit_count];
+
+    link[size] = '\0';
+
+    if (fs::get_symlink_target(fs::const_fs_string{link, size}, &dir->path))
+        return true;
+
+    return fs::canonical_path(fallback, &dir->path, err);
+}
+#endif
+
+bool fs::_init(fs::dir_handle *dir, fs::const_fs_string pth, error *err)
+{
+    assert(dir != nullptr);
+
+    fill_memory(dir, 0);
+
+#if Windows
+    // BACKUP_SEMANTICS is needed to open directories
+    dir->handle = CreateFile((const sys_native_char*)pth.c_str,
+                             FILE_READ_ATTRIBUTES,
+                             FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE,
+                             nullptr,
+                             OPEN_EXISTING,
+                             FILE_FLAG_BACKUP_SEMANTICS,
+                             nullptr);
+
+    if (dir->handle == INVALID_HANDLE_VALUE)
+    {
+        set_GetLastError_error(err);
+        dir->handle = INVALID_HANDLE_VALUE;
+        return false;
+    }
+
+    if (!fs::canonical_path(pth, &dir->path, err))
+    {
+        fs::free(dir);
+        return false;
+    }
+
+    return true;
+#else
+    // O_PATH only needs search permission on the directory
+    dir->fd = (int)::openat(AT_FDCWD, pth.c_str, O_PATH | O_DIRECTORY | O_CLOEXEC, 0);
+
+    if (dir->fd < 0)
+    {
+        set_error_by_code(err, -dir->fd);
+        dir->fd = -1;
+        return false;
+    }
+
+    if (!_set_dir_path(dir, pth, err))
+    {
+        fs::free(dir);
+        return false;
+    }
+
+    return true;
+#endif
+}
+
+bool fs::_init(fs::dir_handle *dir, const fs::dir_handle *parent, fs::const_fs_string name, error *err)
+{
+    assert(dir != nullptr);
+    assert(parent != nullptr);
+    assert(dir != parent);
+
+#if Windows
+    define_joined_path(pth, parent, name);
+
+    return fs::_init(dir, to_const_string(&pth), err);
+#else
+    fill_memory(dir, 0);
+
+    dir->fd = (int)::openat(parent->fd, name.c_str, O_PATH | O_DIRECTORY | O_CLOEXEC, 0);
+
+    if (dir->fd < 0)
+    {
+        set_error_by_code(err, -dir->fd);
+        dir->fd = -1;
+        return false;
+    }
+
+    fs::path joined{};
+    defer { fs::free(&joined); };
+
+    fs::path_set(&joined, &parent->path);
+    fs::path_append(&joined, name);
+
+    if (!_set_dir_path(dir, to_const_string(&joined), err))
+    {
+        fs::free(dir);
+        return false;
+    }
+
+    return true;
+#endif
+}
+
+void fs::free(fs::dir_handle *dir)
+{
+    if (dir == nullptr)
+        return;
+
+    fs::free(&dir->path);
+
+#if Windows
+    if (dir->handle != INVALID_HANDLE_VALUE && dir->handle != nullptr)
+        CloseHandle(dir->handle);
+
+    dir->handle = INVALID_HANDLE_VALUE;
+#else
+    if (dir->fd >= 0)
+        ::close(dir->fd);
+
+    dir->fd = -1;
+#endif
+}
+
+bool fs::_query_filesystem(const fs::dir_handle *dir, fs::const_fs_string name, fs::filesystem_info *out, bool follow_symlinks, fs::query_flag flags, error *err)
+{
+    assert(dir != nullptr);
+    assert(out != nullptr);
+
+#if Windows
+    if (name.size == 0)
+        return fs::query_filesystem(dir->handle, out, flags, err);
+
+    define_joined_path(pth, dir, name);
+
+    return fs::_query_filesystem(to_const_string(&pth), out, follow_symlinks, flags, err);
+#else
+    int statx_flags = 0;
+
+    if (!follow_symlinks)
+        statx_flags |= AT_SYMLINK_NOFOLLOW;
+
+    if (name.size == 0)
+        statx_flags |= AT_EMPTY_PATH;
+
+    if (sys_int code = ::statx(dir->fd, name.c_str, statx_flags, value(flags) /* mask */, (struct statx*)out); code < 0)
+    {
+        set_error_by_code(err, -code);
+        return false;
+    }
+
+    return true;
+#endif
+}
+
+int fs::_exists(const fs::dir_handle *dir, fs::const_fs_string name, bool follow_symlinks, error *err)
+{
+    assert(dir != nullptr);
+
+#if Windows
+    define_joined_path(pth, dir, name);
+
+    return fs::_exists(to_const_string(&pth), follow_symlinks, err);
+#else
+    int flags = 0;
+
+    if (!follow_symlinks)
+        flags |= AT_SYMLINK_NOFOLLOW;
+
+    if (name.size == 0)
+        flags |= AT_EMPTY_PATH;
+
+    sys_int ret = faccessat2(dir->fd, name.c_str, F_OK, flags);
+
+    if (ret == 0)
+        return 1;
+
+    if (-ret == ENOENT)
+        return 0;
+
+    set_error_by_code(err, -ret);
+
+    return -1;
+#endif
+}
+
+bool fs::_touch(const fs::dir_handle *dir, fs::const_fs_string name, fs::permission perms, error *err)
+{
+    assert(dir != nullptr);
+
+#if Windows
+    define_joined_path(pth, dir, name);
+
+    return fs::_touch(to_const_string(&pth), perms, err);
+#else
+    int fd = (int)::openat(dir->fd, name.c_str, O_CREAT | O_WRONLY | O_CLOEXEC, (int)perms);
+
+    if (fd < 0)
+    {
+        set_error_by_code(err, -fd);
+        return false;
+    }
+
+    defer { ::close(fd); };
+
+    // passing nullptr sets change & mod time to current time
+    if (sys_int code = ::utimensat(fd, nullptr, nullptr, 0); code < 0)
+    {
+        set_error_by_code(err, -code);
+        return false;
+    }
+
+    return true;
+#endif
+}
+
+bool fs::_create_directory(const fs::dir_handle *dir, fs::const_fs_string name, fs::permission perms, error *err)
+{
+    assert(dir != nullptr);
+
+#if Windows
+    define_joined_path(pth, dir, name);
+
+    return fs::_create_directory(to_const_string(&pth), perms, err);
+#else
+    sys_int code = ::mkdirat(dir->fd, name.c_str, (int)perms);
+
+    if (code == 0)
+        return true;
+
+    set_error_by_code(err, -code);
+
+    if (-code != EEXIST)
+        return false;
+
+    // same as create_directory, an existing directory is not an error
+    fs::filesystem_info info;
+
+    if (!fs::_query_filesystem(dir, name, &info, false, fs::query_flag::Type, err))
+        return false;
+
+    return fs::get_filesystem_type(&info) == fs::filesystem_type::Directory;
+#endif
+}
+
+bool fs::_remove_file(const fs::dir_handle *dir, fs::const_fs_string name, error *err)
+{
+    assert(dir != nullptr);
+
+#if Windows
+    define_joined_path(pth, dir, name);
+
+    return fs::_remove_file(to_const_string(&pth), err);
+#else
+    if (sys_int code = ::unlinkat(dir->fd, name.c_str, 0); code < 0)
+    {
+        set_error_by_code(err, -code);
+        return false;
+    }
+
+    return true;
+#endif
+}
+
+bool fs::_move(const fs::dir_handle *from_dir, fs::const_fs_string from, const fs::dir_handle *to_dir, fs::const_fs_string to, error *err)
+{
+    assert(from_dir != nullptr);
+    assert(to_dir != nullptr);
+
+#if Windows
+    define_joined_path(from_pth, from_dir, from);
+    define_joined_path(to_pth, to_dir, to);
+
+    return fs::_move(to_const_string(&from_pth), to_const_string(&to_pth), err);
+#else
+    // flags 0: replaces existing files, same as move(FromPathStr, ToPathStr)
+    if (sys_int code = ::renameat2(from_dir->fd, from.c_str, to_dir->fd, to.c_str, 0); code < 0)
+    {
+        set_error_by_code(err, -code);
+        return false;
+    }
+
+    return true;
+#endif
+}
+
+bool fs::_copy_file(const fs::dir_handle *from_dir, fs::const_fs_string from, const fs::dir_handle *to_dir, fs::const_fs_string to, fs::copy_file_option opt, error *err)
+{
+    assert(from_dir != nullptr);
+    assert(to_dir != nullptr);
+
+#if Windows
+    define_joined_path(from_pth, from_dir, from);
+    define_joined_path(to_pth, to_dir, to);
+
+    return fs::_copy_file(to_const_string(&from_pth), to_const_string(&to_pth), opt, nullptr, fs::copy_file_flag::None, nullptr, err);
+#else
+    return fs::_copy_file_at(from_dir->fd, from.c_str, to_dir->fd, to.c_str, opt, nullptr, fs::copy_file_flag::None, nullptr, err);
+#endif
+}
@@ -0,0 +1,210 @@
+
+/* dir_handle.hpp
+
+Handles to open directories, and filesystem functions relative to them.
+
+The functions in path.hpp resolve every path from the current working
+directory (or the root) on every call. A dir_handle is opened once, and the
+functions below take a name relative to it, so loops over the entries of one
+directory do not resolve the path of the directory again for every entry.
+Since the handle refers to the directory itself, renaming or replacing the
+directory (or any of its parents) while it is open does not change which
+directory the functions operate on.
+
+Example usage:
+
+    fs::dir_handle dir{};
+
+    if (!fs::init(&dir, "/home/user/project/build"))
+        return;
+
+    fs::create_directory(&dir, "obj");
+    fs::touch(&dir, "obj/.stamp");
+    fs::move(&dir, "a.out.tmp", &dir, "a.out");
+
+    for_path(item, &dir)
+        ...
+
+    fs::free(&dir);
+
+On Linux, the handle is a directory file descriptor (O_PATH) and the functions
+use statx, faccessat2, openat, mkdirat, unlinkat and renameat2 on it.
+On Windows, the handle keeps the directory open, but the functions join Name
+to the path of the directory and call the path functions.
+
+Types:
+
+struct dir_handle
+    An open directory. path is the canonical path of the directory at the
+    time it was opened.
+
+Functions:
+
+( Name is anything that can be converted to a const_fs_string, relative to *Dir.
+  Absolute Names ignore *Dir. )
+
+init(*Dir, PathStr[, *err])
+    Opens the directory PathStr.
+    Returns whether or not the function succeeded.
+
+init(*Dir, *ParentDir, Name[, *err])
+    Opens the directory Name inside ParentDir.
+    Returns whether or not the function succeeded.
+
+free(*Dir)
+    Closes Dir.
+
+query_filesystem(*Dir, Name, *Out, FollowSymlinks = true, Flags = fs::query_flag_default[, *err])
+    Same as query_filesystem(PathStr, ...). If Name is empty, queries Dir itself.
+
+exists(*Dir, Name, FollowSymlinks = true[, *err])
+    Same as exists(PathStr, ...), returns 1 if Name exists, 0 if it does not
+    exist and -1 if an error occurred.
+
+touch(*Dir, Name, Permissions = User[, *err])
+    Same as touch(PathStr, ...).
+
+create_directory(*Dir, Name, Permissions = User[, *err])
+    Same as create_directory(PathStr, ...).
+
+remove_file(*Dir, Name[, *err])
+    Same as remove_file(PathStr, ...).
+
+move(*FromDir, FromName, *ToDir, ToName[, *err])
+    Same as move(FromPathStr, ToPathStr, ...). FromDir and ToDir may be the same.
+
+copy_file(*FromDir, FromName, *ToDir, ToName, Options = OverwriteExisting[, *err])
+    Same as copy_file(FromPathStr, ToPathStr, ...).
+
+Iterating:
+    fs_iterator (and for_path) may iterate a dir_handle, e.g.:
+
+        for_path(item, &dir)
+            ...
+
+    On Linux, this opens Dir again through its handle, not through its path.
+*/
+
+#pragma once
+
+#include "fs/path.hpp"
+
+namespace fs
+{
+struct dir_handle
+{
+    fs::path path;
+
+#if Windows
+    io_handle handle;
+#else
+    int fd;
+#endif
+};
+
+bool _init(fs::dir_handle *dir, fs::const_fs_string pth, error *err);
+
+template<typename T>
+auto init(fs::dir_handle *dir, T pth, error *err = nullptr)
+    -> decltype(fs::_init(dir, ::to_const_string(fs::get_platform_string(pth)), err))
+{
+    auto pth_str = fs::get_platform_string(pth);
+    auto ret = fs::_init(dir, ::to_const_string(pth_str), err);
+
+    if constexpr (needs_conversion(T))
+        fs::_free_platform_string(&pth_str);
+
+    return ret;
+}
+
+bool _init(fs::dir_handle *dir, const fs::dir_handle *parent, fs::const_fs_string name, error *err);
+
+template<typename T>
+auto init(fs::dir_handle *dir, const fs::dir_handle *parent, T name, error *err = nullptr)
+    -> decltype(fs::_init(dir, parent, ::to_const_string(fs::get_platform_string(name)), err))
+{
+    auto name_str = fs::get_platform_string(name);
+    auto ret = fs::_init(dir, parent, ::to_const_string(name_str), err);
+
+    if constexpr (needs_conversion(T))
+        fs::_free_platform_string(&name_str);
+
+    return ret;
+}
+
+void free(fs::dir_handle *dir);
+
+// the name is converted and freed the same way as in define_fs_conversion_body
+#define define_dir_handle_conversion_body(Func, Dir, Name, ...)                                             \
+-> decltype(Func(Dir, ::to_const_string(fs::get_platform_string(Name)) __VA_OPT__(,) __VA_ARGS__))          \
+{                                                                                                           \
+    auto name_str = fs::get_platform_string(Name);                                                          \
+    auto ret = Func(Dir, ::to_const_string(name_str) __VA_OPT__(,) __VA_ARGS__);                            \
+                                                                                                            \
+    if constexpr (needs_conversion(T)) fs::_free_platform_string(&name_str);                                \
+                                                                                                            \
+    return ret;                                                                                             \
+}
+
+bool _query_filesystem(const fs::dir_handle *dir, fs::const_fs_string name, fs::filesystem_info *out, bool follow_symlinks, fs::query_flag flags, error *err);
+
+template<typename T>
+auto query_filesystem(const fs::dir_handle *dir, T name, fs::filesystem_info *out, bool follow_symlinks = true, fs::query_flag flags = fs::query_flag_default, error *err = nullptr)
+    define_dir_handle_conversion_body(fs::_query_filesystem, dir, name, out, follow_symlinks, flags, err)
+
+int _exists(const fs::dir_handle *dir, fs::const_fs_string name, bool follow_symlinks, error *err);
+
+template<typename T>
+auto exists(const fs::dir_handle *dir, T name, bool follow_symlinks = true, error *err = nullptr)
+    define_dir_handle_conversion_body(fs::_exists, dir, name, follow_symlinks, err)
+
+bool _touch(const fs::dir_handle *dir, fs::const_fs_string name, fs::permission perms, error *err);
+
+template<typename T>
+auto touch(const fs::dir_handle *dir, T name, fs::permission perms = fs::permission::User, error *err = nullptr)
+    define_dir_handle_conversion_body(fs::_touch, dir, name, perms, err)
+
+bool _create_directory(const fs::dir_handle *dir, fs::const_fs_string name, fs::permission perms, error *err);
+
+template<typename T>
+auto create_directory(const fs::dir_handle *dir, T name, fs::permission perms = fs::permission::User, error *err = nullptr)
+    define_dir_handle_conversion_body(fs::_create_directory, dir, name, perms, err)
+
+bool _remove_file(const fs::dir_handle *dir, fs::const_fs_string name, error *err);
+
+template<typename T>
+auto remove_file(const fs::dir_handle *dir, T name, error *err = nullptr)
+    define_dir_handle_conversion_body(fs::_remove_file, dir, name, err)
+
+bool _move(const fs::dir_handle *from_dir, fs::const_fs_string from, const fs::dir_handle *to_dir, fs::const_fs_string to, error *err);
+
+template<typename T1, typename T2>
+auto move(const fs::dir_handle *from_dir, T1 from, const fs::dir_handle *to_dir, T2 to, error *err = nullptr)
+    -> decltype(fs::_move(from_dir, ::to_const_string(fs::get_platform_string(from)), to_dir, ::to_const_string(fs::get_platform_string(to)), err))
+{
+    auto from_str = fs::get_platform_string(from);
+    auto to_str = fs::get_platform_string(to);
+    auto ret = fs::_move(from_dir, ::to_const_string(from_str), to_dir, ::to_const_string(to_str), err);
+
+    if constexpr (needs_conversion(T2)) fs::_free_platform_string(&to_str);
+    if constexpr (needs_conversion(T1)) fs::_free_platform_string(&from_str);
+
+    return ret;
+}
+
+bool _copy_file(const fs::dir_handle *from_dir, fs::const_fs_string from, const fs::dir_handle *to_dir, fs::const_fs_string to, fs::copy_file_option opt, error *err);
+
+template<typename T1, typename T2>
+auto copy_file(const fs::dir_handle *from_dir, T1 from, const fs::dir_handle *to_dir, T2 to, fs::copy_file_option opt = fs::copy_file_option::OverwriteExisting, error *err = nullptr)
+    -> decltype(fs::_copy_file(from_dir, ::to_const_string(fs::get_platform_string(from)), to_dir, ::to_const_string(fs::get_platform_string(to)), opt, err))
+{
+    auto from_str = fs::get_platform_string(from);
+    auto to_str = fs::get_platform_string(to);
+    auto ret = fs::_copy_file(from_dir, ::to_const_string(from_str), to_dir, ::to_const_string(to_str), opt, err);
+
+    if constexpr (needs_conversion(T2)) fs::_free_platform_string(&to_str);
+    if constexpr (needs_conversion(T1)) fs::_free_platform_string(&from_str);
+
+    return ret;
+}
+}
@@ -221,7 +221,7 @@ void _process_event(fs::filesystem_watcher *watcher, inotify_event *event)
 
         if (dir->only_watch_files)
         {
-            _watched_file *file = ::search_by_hash(&dir->watched_files, ::hash(fname));
+            _watched_file *file = ::search_by_hash(&dir->watched_files, fs::path_hash(fname));
 
             if (file == nullptr)
                 continue;
@@ -426,7 +426,7 @@ bool fs::_filesystem_watcher_watch_file(fs::filesystem_watcher *watcher, fs::con
 
 #elif Linux
     fs::const_fs_string fname = fs::filename(&fcanon);
-    _watched_file *watched = ::search_by_hash(&watched_parent->watched_files, ::hash(fname));
+    _watched_file *watched = ::search_by_hash(&watched_parent->watched_files, fs::path_hash(fname));
 
     if (watched != nullptr)
     {
@@ -522,13 +522,13 @@ bool fs::_filesystem_watcher_unwatch_file(fs::filesystem_watcher *watcher, fs::c
     ::remove_element_by_key(&watched_parent->watched_files, &wfname);
 
 #elif Linux
-    _watched_file *watched = ::search_by_hash(&watched_parent->watched_files, ::hash(fname));
+    _watched_file *watched = ::search_by_hash(&watched_parent->watched_files, fs::path_hash(fname));
 
     if (watched == nullptr)
         return false;
 
     fs::free(&watched->path);
-    remove_element_by_hash(&watched_parent->watched_files, ::hash(fname));
+    remove_element_by_hash(&watched_parent->watched_files, fs::path_hash(fname));
 #endif
 
     if (watched_parent->only_watch_files
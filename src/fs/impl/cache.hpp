@@ -0,0 +1,32 @@
+/* cache.hpp
+
+used internally, you don't need to include this to use fs.
+
+Helpers shared by the caches (resolve_cache, stat_cache, negative_cache).
+
+_is_under(PathStr, PrefixStr)
+    Returns whether PathStr is PrefixStr or inside PrefixStr, e.g. to
+    invalidate every cached path inside a directory. Compares characters,
+    "/a/bc" is not inside "/a/b".
+*/
+
+#pragma once
+
+#include "fs/common.hpp"
+
+namespace fs
+{
+inline bool _is_under(fs::const_fs_string pth, fs::const_fs_string prefix)
+{
+    if (prefix.size == 0 || pth.size < prefix.size)
+        return false;
+
+    for (s64 i = prefix.size - 1; i >= 0; --i)
+        if (pth.c_str[i] != prefix.c_str[i])
+            return false;
+
+    return pth.size == prefix.size
+        || pth.c_str[prefix.size] == fs::path_separator
+        || prefix.c_str[prefix.size - 1] == fs::path_separator;
+}
+}
@@ -0,0 +1,77 @@
+
+/* copy.hpp
+
+used internally, you don't need to include this to use fs.
+
+Copy engine used by copy_file and everything that copies files (copy_directory,
+copy, dir_handle copy_file).
+
+_copy_file_contents(FromFd, ToFd, *Info, Flags, *Control[, err]) (Linux only)
+    Copies the contents of the open file FromFd to the (empty) open file ToFd,
+    from the current file positions up to the end of FromFd. Tries, in order:
+
+    1. ioctl(FICLONE): shares the extents of FromFd with ToFd (btrfs, XFS, ...),
+       no data is copied.
+    2. If FromFd has holes (fewer allocated blocks than its size): only the
+       data between the holes is copied (found with lseek SEEK_DATA /
+       SEEK_HOLE), with copy_file_range or pread / pwrite. The holes stay
+       holes in ToFd, including a hole at the end (ftruncate).
+    3. With copy_file_flag::DirectIO, files of COPY_DIRECT_MIN_SIZE or more
+       starting at position 0: O_DIRECT is set on both files with fcntl, and
+       the data is read and written through a buffer aligned to 4 KiB. The
+       last, partial block is written without O_DIRECT.
+    4. copy_file_range in a loop: the kernel copies the data without moving
+       it to user space, and may offload the copy to the filesystem or storage.
+    5. read / write in a loop with a large buffer.
+
+    With copy_file_flag::Bulk or DirectIO, FromFd is advised to be read
+    sequentially, and the copied data is dropped from the page cache every
+    COPY_BULK_CHUNK_SIZE bytes: the range of FromFd with POSIX_FADV_DONTNEED,
+    the range of ToFd by starting its writeback with sync_file_range, waiting
+    for it one chunk later (so writing and copying overlap) and then
+    POSIX_FADV_DONTNEED. Failures of the advice and writeback are ignored,
+    they don't change the copied data.
+
+    With copy_file_flag::Verify, the CRC32C (see fs/impl/crc32c.hpp) of the
+    data is computed as it passes through the buffer, so only the strategies
+    with a buffer are used (2. with pread / pwrite, 3. and 5.), the holes of
+    sparse files count as zeros. Sets Info->checksum to the CRC32C.
+    With copy_file_flag::VerifyDestination, ToFd must be open for reading as
+    well: after copying, ToFd is written to the device (fdatasync), dropped
+    from the page cache and read again, and the function fails with EIO if
+    its CRC32C is different.
+
+    Later strategies are only used if the earlier ones are not supported by
+    the filesystems or kernel, and continue where the earlier ones stopped.
+    Sets Info (if not nullptr) to the strategy that copied the data and the
+    number of bytes copied (only the data, not the holes, of sparse files).
+    If Control is not nullptr, reports the bytes copied to Control after
+    every chunk and fails with ECANCELED when Control was cancelled,
+    see fs/operation_control.hpp.
+    Returns whether or not the function succeeded.
+
+_clone_file(FromPath, ToPath, Mode, *OutCloned[, err]) (Linux only)
+    Creates the file ToPath with permissions Mode, sharing the data of the file
+    FromPath with ioctl(FICLONE). Fails if ToPath exists.
+    Sets OutCloned to false, without creating ToPath, if the filesystem can't
+    clone the file.
+    Returns whether or not the function succeeded.
+*/
+
+#pragma once
+
+#include "shl/platform.hpp"
+
+#if Linux
+#include "shl/number_types.hpp"
+#include "shl/error.hpp"
+#include "fs/common.hpp"
+
+namespace fs
+{
+struct operation_control;
+
+bool _copy_file_contents(int from_fd, int to_fd, fs::copy_file_info *info, fs::copy_file_flag flags, fs::operation_control *control, error *err = nullptr);
+bool _clone_file(const char *from, const char *to, u32 mode, bool *cloned, error *err = nullptr);
+}
+#endif
@@ -0,0 +1,802 @@
+
+#include "shl/platform.hpp"
+
+#if Linux
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h> // FICLONE
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "shl/assert.hpp"
+#include "shl/defer.hpp"
+#include "fs/impl/copy.hpp"
+#include "fs/impl/crc32c.hpp"
+#include "fs/operation_control.hpp"
+
+// copy_file_range copies at most this much per call, so signals and other
+// threads are not blocked for too long.
+#define COPY_FILE_RANGE_CHUNK_SIZE  (1ll << 30)
+#define COPY_BUFFER_SIZE            (1ll << 20)
+
+// with an operation_control, progress is reported and cancellation is
+// checked after chunks of this size.
+#define COPY_PROGRESS_CHUNK_SIZE    (16ll << 20)
+
+// with copy_file_flag::Bulk, the copied data is dropped from the page cache
+// after chunks of this size.
+#define COPY_BULK_CHUNK_SIZE        (8ll << 20)
+
+// with copy_file_flag::DirectIO, smaller files are not worth the fcntl calls
+// and aligned buffer, and are copied through the page cache.
+#define COPY_DIRECT_MIN_SIZE        (64ll << 20)
+
+// buffer, offset and size alignment of O_DIRECT, 4 KiB is a multiple of the
+// logical block size of practically all devices.
+#define COPY_DIRECT_ALIGNMENT       4096
+
+static inline void _set_info(fs::copy_file_info *info, fs::copy_strategy strategy, s64 bytes)
+{
+    if (info == nullptr)
+        return;
+
+    info->strategy = strategy;
+    info->bytes_copied = bytes;
+}
+
+// errors which mean the strategy is not available for these files,
+// not that copying failed.
+static inline bool _is_unsupported(int code)
+{
+    return code == EXDEV      // different filesystems (before 5.3 / after 5.19 for some)
+        || code == EINVAL     // e.g. not regular files, or unsupported flags
+        || code == ENOSYS     // not implemented by the kernel
+        || code == EOPNOTSUPP // not implemented by the filesystem
+        || code == ETXTBSY
+        || code == EBADF      // e.g. O_APPEND destination
+        || code == EPERM;     // e.g. immutable destination, or seccomp
+}
+
+struct _bulk_range
+{
+    s64 from_offset;
+    s64 to_offset;
+    s64 size;
+};
+
+// copy_file_flag::Bulk: the range which was copied since the last flush, and
+// the range whose writeback was started by the last flush.
+struct _bulk_state
+{
+    int from_fd;
+    int to_fd;
+
+    // where the strategies which copy at the file positions copy next
+    s64 from_position;
+    s64 to_position;
+
+    _bulk_range copied;
+    _bulk_range writing;
+};
+
+// the results are ignored, the data is the same either way
+static void _bulk_flush(_bulk_state *bulk)
+{
+    if (bulk->copied.size > 0)
+    {
+        // clean pages, dropped right away
+        posix_fadvise(bulk->from_fd, bulk->copied.from_offset, bulk->copied.size, POSIX_FADV_DONTNEED);
+        sync_file_range(bulk->to_fd, bulk->copied.to_offset, bulk->copied.size, SYNC_FILE_RANGE_WRITE);
+    }
+
+    // dirty pages can't be dropped before they're written
+    if (bulk->writing.size > 0)
+    {
+        sync_file_range(bulk->to_fd, bulk->writing.to_offset, bulk->writing.size,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(bulk->to_fd, bulk->writing.to_offset, bulk->writing.size, POSIX_FADV_DONTNEED);
+    }
+
+    bulk->writing = bulk->copied;
+    bulk->copied.size = 0;
+}
+
+static void _bulk_copied(_bulk_state *bulk, s64 from_offset, s64 to_offset, s64 size)
+{
+    if (bulk == nullptr || size <= 0)
+        return;
+
+    _bulk_range *r = &bulk->copied;
+
+    if (r->size > 0
+     && (r->from_offset + r->size != from_offset || r->to_offset + r->size != to_offset))
+        _bulk_flush(bulk);
+
+    if (r->size == 0)
+    {
+        r->from_offset = from_offset;
+        r->to_offset = to_offset;
+    }
+
+    r->size += size;
+
+    if (r->size >= COPY_BULK_CHUNK_SIZE)
+        _bulk_flush(bulk);
+}
+
+// copied at the file positions
+static void _bulk_copied(_bulk_state *bulk, s64 size)
+{
+    if (bulk == nullptr)
+        return;
+
+    _bulk_copied(bulk, bulk->from_position, bulk->to_position, size);
+    bulk->from_position += size;
+    bulk->to_position += size;
+}
+
+static void _bulk_finish(_bulk_state *bulk)
+{
+    if (bulk == nullptr)
+        return;
+
+    // the second flush waits for the writeback started by the first
+    _bulk_flush(bulk);
+    _bulk_flush(bulk);
+}
+
+static inline size_t _chunk_size(fs::operation_control *control, _bulk_state *bulk)
+{
+    if (bulk != nullptr)
+        return COPY_BULK_CHUNK_SIZE;
+
+    return (control != nullptr) ? COPY_PROGRESS_CHUNK_SIZE : COPY_FILE_RANGE_CHUNK_SIZE;
+}
+
+static bool _clone(int from_fd, int to_fd)
+{
+    // clones the whole source regardless of file positions, so it's
+    // only used when both files are at the start.
+    if (lseek(from_fd, 0, SEEK_CUR) != 0 || lseek(to_fd, 0, SEEK_CUR) != 0)
+        return false;
+
+    return ioctl(to_fd, FICLONE, from_fd) == 0;
+}
+
+// returns -1 on error, 0 if copy_file_range is not supported, 1 if done.
+static int _copy_file_range(int from_fd, int to_fd, s64 *copied, _bulk_state *bulk, fs::operation_control *control, error *err)
+{
+    size_t chunk_size = _chunk_size(control, bulk);
+
+    while (true)
+    {
+        ssize_t n = copy_file_range(from_fd, nullptr, to_fd, nullptr, chunk_size, 0);
+
+        if (n > 0)
+        {
+            *copied += n;
+            _bulk_copied(bulk, n);
+
+            if (!fs::_operation_bytes_done(control, n, err))
+                return -1;
+
+            continue;
+        }
+
+        if (n == 0)
+        {
+            // some pseudo filesystems (e.g. procfs) report a size of 0 and
+            // copy_file_range copies nothing, reading them works though.
+            if (*copied == 0)
+                return 0;
+
+            return 1;
+        }
+
+        if (errno == EINTR)
+            continue;
+
+        // continues with read / write at the current position
+        if (_is_unsupported(errno))
+            return 0;
+
+        set_error_by_code(err, errno);
+        return -1;
+    }
+}
+
+// copies size bytes at offset of from_fd to the same offset of to_fd.
+// *buf is allocated when copy_file_range can't be used or the data is
+// checksummed (crc not nullptr), and freed by the caller.
+static bool _copy_range(int from_fd, int to_fd, s64 offset, s64 size, u8 **buf, s64 *copied, _bulk_state *bulk, u32 *crc, fs::operation_control *control, error *err)
+{
+    size_t chunk_size = _chunk_size(control, bulk);
+    loff_t off_in = offset;
+    loff_t off_out = offset;
+    s64 end = offset + size;
+
+    if (crc != nullptr && *buf == nullptr)
+    {
+        *buf = (u8*)::malloc(COPY_BUFFER_SIZE);
+
+        if (*buf == nullptr)
+        {
+            set_error_by_code(err, ENOMEM);
+            return false;
+        }
+    }
+
+    while (off_in < end && *buf == nullptr)
+    {
+        size_t len = (size_t)(end - off_in) < chunk_size ? (size_t)(end - off_in) : chunk_size;
+        ssize_t n = copy_file_range(from_fd, &off_in, to_fd, &off_out, len, 0);
+
+        if (n > 0)
+        {
+            *copied += n;
+            _bulk_copied(bulk, off_in - n, off_out - n, n);
+
+            if (!fs::_operation_bytes_done(control, n, err))
+                return false;
+
+            continue;
+        }
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n < 0 && !_is_unsupported(errno))
+        {
+            set_error_by_code(err, errno);
+            return false;
+        }
+
+        // not supported, or the file shrank: continue with pread / pwrite,
+        // which stops at the end of the file.
+        *buf = (u8*)::malloc(COPY_BUFFER_SIZE);
+
+        if (*buf == nullptr)
+        {
+            set_error_by_code(err, ENOMEM);
+            return false;
+        }
+    }
+
+    while (off_in < end)
+    {
+        size_t len = (size_t)(end - off_in) < COPY_BUFFER_SIZE ? (size_t)(end - off_in) : COPY_BUFFER_SIZE;
+        ssize_t n = pread(from_fd, *buf, len, off_in);
+
+        if (n == 0)
+            return true;
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            set_error_by_code(err, errno);
+            return false;
+        }
+
+        ssize_t written = 0;
+
+        while (written < n)
+        {
+            ssize_t w = pwrite(to_fd, *buf + written, (size_t)(n - written), off_in + written);
+
+            if (w < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                set_error_by_code(err, errno);
+                return false;
+            }
+
+            written += w;
+        }
+
+        if (crc != nullptr)
+            *crc = fs::_crc32c(*crc, *buf, n);
+
+        _bulk_copied(bulk, off_in, off_in, n);
+        off_in += n;
+        *copied += n;
+
+        if (!fs::_operation_bytes_done(control, n, err))
+            return false;
+    }
+
+    return true;
+}
+
+// returns -1 on error, 0 if the source has no holes or they can't be found,
+// 1 if done.
+static int _copy_sparse(int from_fd, int to_fd, s64 *copied, _bulk_state *bulk, u32 *crc, fs::operation_control *control, error *err)
+{
+    struct stat st;
+
+    if (fstat(from_fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return 0;
+
+    // fewer allocated bytes than the size means there are holes (st_blocks
+    // is always in units of 512 bytes).
+    if ((s64)st.st_blocks * 512 >= (s64)st.st_size)
+        return 0;
+
+    // offsets of data and holes are absolute
+    if (lseek(from_fd, 0, SEEK_CUR) != 0 || lseek(to_fd, 0, SEEK_CUR) != 0)
+        return 0;
+
+    s64 size = (s64)st.st_size;
+    s64 data = (s64)lseek(from_fd, 0, SEEK_DATA);
+
+    // ENXIO: no data at all. EINVAL: the filesystem can't find holes
+    if (data < 0 && errno != ENXIO)
+        return 0;
+
+    u8 *buf = nullptr;
+    defer { if (buf != nullptr) ::free(buf); };
+
+    // end of the last data range, the holes are checksummed as zeros
+    s64 data_end = 0;
+
+    // the destination is empty, so skipping the holes leaves holes
+    while (data >= 0 && data < size)
+    {
+        s64 hole = (s64)lseek(from_fd, data, SEEK_HOLE);
+
+        if (hole < 0)
+        {
+            set_error_by_code(err, errno);
+            return -1;
+        }
+
+        if (hole > size)
+            hole = size;
+
+        if (crc != nullptr)
+            *crc = fs::_crc32c_zeros(*crc, data - data_end);
+
+        if (!_copy_range(from_fd, to_fd, data, hole - data, &buf, copied, bulk, crc, control, err))
+            return -1;
+
+        data_end = hole;
+
+        data = (s64)lseek(from_fd, hole, SEEK_DATA);
+
+        if (data < 0 && errno != ENXIO)
+        {
+            set_error_by_code(err, errno);
+            return -1;
+        }
+    }
+
+    if (crc != nullptr)
+        *crc = fs::_crc32c_zeros(*crc, size - data_end);
+
+    // trailing hole
+    if (ftruncate(to_fd, (off_t)size) != 0)
+    {
+        set_error_by_code(err, errno);
+        return -1;
+    }
+
+    // same positions as after the other strategies
+    lseek(from_fd, (off_t)size, SEEK_SET);
+    lseek(to_fd, (off_t)size, SEEK_SET);
+
+    return 1;
+}
+
+// returns -1 on error, 0 if O_DIRECT can't be used for these files (or stops
+// working, the rest is then copied by the other strategies), 1 if done.
+static int _copy_direct(int from_fd, int to_fd, s64 *copied, _bulk_state *bulk, u32 *crc, fs::operation_control *control, error *err)
+{
+    struct stat st;
+
+    if (fstat(from_fd, &st) != 0 || !S_ISREG(st.st_mode) || (s64)st.st_size < COPY_DIRECT_MIN_SIZE)
+        return 0;
+
+    // aligned offsets
+    if (lseek(from_fd, 0, SEEK_CUR) != 0 || lseek(to_fd, 0, SEEK_CUR) != 0)
+        return 0;
+
+    int from_flags = fcntl(from_fd, F_GETFL);
+    int to_flags = fcntl(to_fd, F_GETFL);
+
+    if (from_flags < 0 || to_flags < 0)
+        return 0;
+
+    // e.g. tmpfs before 6.6 and some network filesystems reject O_DIRECT
+    if (fcntl(from_fd, F_SETFL, from_flags | O_DIRECT) != 0)
+        return 0;
+
+    defer
+    {
+        fcntl(from_fd, F_SETFL, from_flags);
+        fcntl(to_fd, F_SETFL, to_flags);
+    };
+
+    if (fcntl(to_fd, F_SETFL, to_flags | O_DIRECT) != 0)
+        return 0;
+
+    u8 *buf = nullptr;
+
+    if (posix_memalign((void**)&buf, COPY_DIRECT_ALIGNMENT, COPY_BUFFER_SIZE) != 0)
+    {
+        set_error_by_code(err, ENOMEM);
+        return -1;
+    }
+
+    defer { ::free(buf); };
+
+    while (true)
+    {
+        ssize_t n = read(from_fd, buf, COPY_BUFFER_SIZE);
+
+        if (n == 0)
+            return 1;
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EINVAL)
+                return 0;
+
+            set_error_by_code(err, errno);
+            return -1;
+        }
+
+        // the end of the file is not a whole block
+        if ((n % COPY_DIRECT_ALIGNMENT) != 0 && fcntl(to_fd, F_SETFL, to_flags) != 0)
+        {
+            set_error_by_code(err, errno);
+            return -1;
+        }
+
+        ssize_t written = 0;
+
+        while (written < n)
+        {
+            ssize_t w = write(to_fd, buf + written, (size_t)(n - written));
+
+            if (w >= 0)
+            {
+                written += w;
+                continue;
+            }
+
+            if (errno == EINTR)
+                continue;
+
+            // e.g. a device with larger blocks: the source goes back to
+            // where the destination is, and the rest is copied without O_DIRECT.
+            if (errno == EINVAL && lseek(from_fd, (off_t)(written - n), SEEK_CUR) >= 0)
+            {
+                if (crc != nullptr)
+                    *crc = fs::_crc32c(*crc, buf, written);
+
+                *copied += written;
+                _bulk_copied(bulk, written);
+                return 0;
+            }
+
+            set_error_by_code(err, errno);
+            return -1;
+        }
+
+        if (crc != nullptr)
+            *crc = fs::_crc32c(*crc, buf, n);
+
+        *copied += n;
+        _bulk_copied(bulk, n);
+
+        if (!fs::_operation_bytes_done(control, n, err))
+            return -1;
+    }
+}
+
+static bool _read_write(int from_fd, int to_fd, s64 *copied, _bulk_state *bulk, u32 *crc, fs::operation_control *control, error *err)
+{
+    u8 *buf = (u8*)::malloc(COPY_BUFFER_SIZE);
+
+    if (buf == nullptr)
+    {
+        set_error_by_code(err, ENOMEM);
+        return false;
+    }
+
+    defer { ::free(buf); };
+
+    while (true)
+    {
+        ssize_t n = read(from_fd, buf, COPY_BUFFER_SIZE);
+
+        if (n == 0)
+            return true;
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            set_error_by_code(err, errno);
+            return false;
+        }
+
+        ssize_t written = 0;
+
+        while (written < n)
+        {
+            ssize_t w = write(to_fd, buf + written, (size_t)(n - written));
+
+            if (w < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                set_error_by_code(err, errno);
+                return false;
+            }
+
+            written += w;
+        }
+
+        if (crc != nullptr)
+            *crc = fs::_crc32c(*crc, buf, n);
+
+        *copied += n;
+        _bulk_copied(bulk, n);
+
+        if (!fs::_operation_bytes_done(control, n, err))
+            return false;
+    }
+}
+
+// the strategies, in order. with a crc, only the ones which move the data
+// through a buffer.
+static bool _copy_contents(int from_fd, int to_fd, fs::copy_file_info *info, bool direct, _bulk_state *bulk, u32 *crc, fs::operation_control *control, error *err)
+{
+    s64 copied = 0;
+
+    if (crc == nullptr && _clone(from_fd, to_fd))
+    {
+        // the file positions are not moved by FICLONE
+        off_t size = lseek(from_fd, 0, SEEK_END);
+
+        if (size < 0)
+        {
+            set_error_by_code(err, errno);
+            return false;
+        }
+
+        _set_info(info, fs::copy_strategy::Clone, (s64)size);
+        return fs::_operation_bytes_done(control, (s64)size, err);
+    }
+
+    int ret = _copy_sparse(from_fd, to_fd, &copied, bulk, crc, control, err);
+
+    if (ret < 0)
+        return false;
+
+    if (ret > 0)
+    {
+        _set_info(info, fs::copy_strategy::Sparse, copied);
+        return true;
+    }
+
+    if (direct)
+    {
+        ret = _copy_direct(from_fd, to_fd, &copied, bulk, crc, control, err);
+
+        if (ret < 0)
+            return false;
+
+        if (ret > 0)
+        {
+            _set_info(info, fs::copy_strategy::Direct, copied);
+            return true;
+        }
+    }
+
+    if (crc == nullptr)
+    {
+        ret = _copy_file_range(from_fd, to_fd, &copied, bulk, control, err);
+
+        if (ret < 0)
+            return false;
+
+        if (ret > 0)
+        {
+            _set_info(info, fs::copy_strategy::CopyFileRange, copied);
+            return true;
+        }
+    }
+
+    if (!_read_write(from_fd, to_fd, &copied, bulk, crc, control, err))
+        return false;
+
+    _set_info(info, fs::copy_strategy::ReadWrite, copied);
+    return true;
+}
+
+// copy_file_flag::VerifyDestination: reads to_fd from offset to the end and
+// compares its CRC32C with crc. the data is read with O_DIRECT so it comes
+// from the device, not from the page cache (dropping clean pages is only a
+// hint). filesystems which reject O_DIRECT, and offsets which are not
+// aligned, are read through the page cache after writing it back and
+// dropping it.
+static bool _verify_destination(int to_fd, s64 offset, u32 crc, bool bulk, error *err)
+{
+    if (fdatasync(to_fd) != 0)
+    {
+        set_error_by_code(err, errno);
+        return false;
+    }
+
+    u8 *buf = nullptr;
+
+    if (posix_memalign((void**)&buf, COPY_DIRECT_ALIGNMENT, COPY_BUFFER_SIZE) != 0)
+    {
+        set_error_by_code(err, ENOMEM);
+        return false;
+    }
+
+    defer { ::free(buf); };
+
+    int to_flags = fcntl(to_fd, F_GETFL);
+    bool direct = to_flags >= 0
+               && (offset % COPY_DIRECT_ALIGNMENT) == 0
+               && fcntl(to_fd, F_SETFL, to_flags | O_DIRECT) == 0;
+
+    defer
+    {
+        if (direct)
+            fcntl(to_fd, F_SETFL, to_flags);
+    };
+
+    // written back, so the pages are clean and can be dropped
+    if (!direct)
+        posix_fadvise(to_fd, 0, 0, POSIX_FADV_DONTNEED);
+
+    u32 read_crc = 0;
+
+    while (true)
+    {
+        ssize_t n = pread(to_fd, buf, COPY_BUFFER_SIZE, (off_t)offset);
+
+        if (n == 0)
+            break;
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            // e.g. tmpfs accepts O_DIRECT in fcntl but not in reads, the
+            // rest is read through the page cache.
+            if (errno == EINVAL && direct)
+            {
+                if (fcntl(to_fd, F_SETFL, to_flags) != 0)
+                {
+                    set_error_by_code(err, errno);
+                    return false;
+                }
+
+                direct = false;
+                posix_fadvise(to_fd, 0, 0, POSIX_FADV_DONTNEED);
+                continue;
+            }
+
+            set_error_by_code(err, errno);
+            return false;
+        }
+
+        read_crc = fs::_crc32c(read_crc, buf, n);
+        offset += n;
+    }
+
+    if (bulk && !direct)
+        posix_fadvise(to_fd, 0, 0, POSIX_FADV_DONTNEED);
+
+    if (read_crc != crc)
+    {
+        set_error_by_code(err, EIO);
+        return false;
+    }
+
+    return true;
+}
+
+bool fs::_copy_file_contents(int from_fd, int to_fd, fs::copy_file_info *info, fs::copy_file_flag flags, fs::operation_control *control, error *err)
+{
+    assert(from_fd >= 0);
+    assert(to_fd >= 0);
+
+    _set_info(info, fs::copy_strategy::None, 0);
+
+    if (info != nullptr)
+        info->checksum = 0;
+
+    bool direct = is_flag_set(flags, fs::copy_file_flag::DirectIO);
+    bool verify_destination = is_flag_set(flags, fs::copy_file_flag::VerifyDestination);
+    bool verify = verify_destination || is_flag_set(flags, fs::copy_file_flag::Verify);
+    s64 to_start = (s64)lseek(to_fd, 0, SEEK_CUR);
+
+    _bulk_state bulk_state{};
+    _bulk_state *bulk = nullptr;
+
+    if (direct || is_flag_set(flags, fs::copy_file_flag::Bulk))
+    {
+        bulk_state.from_fd = from_fd;
+        bulk_state.to_fd = to_fd;
+        bulk_state.from_position = (s64)lseek(from_fd, 0, SEEK_CUR);
+        bulk_state.to_position = to_start;
+        bulk = &bulk_state;
+
+        posix_fadvise(from_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    u32 crc = 0;
+    bool ok = ::_copy_contents(from_fd, to_fd, info, direct, bulk, verify ? &crc : nullptr, control, err);
+
+    _bulk_finish(bulk);
+
+    if (!ok || !verify)
+        return ok;
+
+    if (verify_destination && !::_verify_destination(to_fd, to_start, crc, bulk != nullptr, err))
+        return false;
+
+    if (info != nullptr)
+        info->checksum = crc;
+
+    return true;
+}
+
+bool fs::_clone_file(const char *from, const char *to, u32 mode, bool *cloned, error *err)
+{
+    *cloned = false;
+
+    int from_fd = open(from, O_RDONLY | O_CLOEXEC);
+
+    if (from_fd < 0)
+    {
+        set_error_by_code(err, errno);
+        return false;
+    }
+
+    defer { close(from_fd); };
+
+    int to_fd = open(to, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, (mode_t)mode);
+
+    if (to_fd < 0)
+    {
+        set_error_by_code(err, errno);
+        return false;
+    }
+
+    if (ioctl(to_fd, FICLONE, from_fd) == 0)
+    {
+        close(to_fd);
+        *cloned = true;
+        return true;
+    }
+
+    int code = errno;
+    close(to_fd);
+    unlink(to);
+
+    if (_is_unsupported(code))
+        return true;
+
+    set_error_by_code(err, code);
+    return false;
+}
+#endif // if Linux
@@ -0,0 +1,306 @@
+#include "shl/platform.hpp"
+#include "fs/impl/crc32c.hpp"
+
+#include <atomic>
+#include <string.h> // memcpy
+
+#if defined(__x86_64__) || defined(_M_X64)
+#  define FS_CRC32C_X86_64 1
+#  include <immintrin.h>
+#  if defined(_MSC_VER) && !defined(__clang__)
+#    include <intrin.h>
+#  endif
+#else
+#  define FS_CRC32C_X86_64 0
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#  define FS_CRC32C_ARMV8 1
+#  include <arm_acle.h>
+#else
+#  define FS_CRC32C_ARMV8 0
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#  define FS_TARGET_SSE42 __attribute__((target("sse4.2")))
+#else
+#  define FS_TARGET_SSE42
+#endif
+
+// reflected Castagnoli polynomial
+#define CRC32C_POLYNOMIAL 0x82f63b78u
+
+typedef u32 (*_crc32c_function)(u32 crc, const u8 *data, s64 size);
+
+static inline u64 _read64(const u8 *p)
+{
+    u64 ret;
+    memcpy(&ret, p, sizeof(u64));
+    return ret;
+}
+
+// scalar, slicing by 8: table[k][b] is the CRC of byte b followed by k zero bytes
+struct _crc32c_tables
+{
+    u32 table[8][256];
+};
+
+static constexpr _crc32c_tables _make_tables()
+{
+    _crc32c_tables ret{};
+
+    for (u32 b = 0; b < 256; ++b)
+    {
+        u32 crc = b;
+
+        for (int i = 0; i < 8; ++i)
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLYNOMIAL : 0);
+
+        ret.table[0][b] = crc;
+    }
+
+    for (u32 b = 0; b < 256; ++b)
+    for (int k = 1; k < 8; ++k)
+    {
+        u32 prev = ret.table[k - 1][b];
+        ret.table[k][b] = (prev >> 8) ^ ret.table[0][prev & 0xff];
+    }
+
+    return ret;
+}
+
+static constexpr _crc32c_tables _tables = _make_tables();
+
+// the data is little endian on every supported platform
+static u32 _crc32c_scalar(u32 crc, const u8 *p, s64 size)
+{
+    const u32 (*t)[256] = _tables.table;
+
+    while (size >= 8)
+    {
+        u64 v = _read64(p) ^ crc;
+
+        crc = t[7][v & 0xff]
+            ^ t[6][(v >> 8) & 0xff]
+            ^ t[5][(v >> 16) & 0xff]
+            ^ t[4][(v >> 24) & 0xff]
+            ^ t[3][(v >> 32) & 0xff]
+            ^ t[2][(v >> 40) & 0xff]
+            ^ t[1][(v >> 48) & 0xff]
+            ^ t[0][v >> 56];
+
+        p += 8;
+        size -= 8;
+    }
+
+    while (size > 0)
+    {
+        crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xff];
+        ++p;
+        --size;
+    }
+
+    return crc;
+}
+
+#if FS_CRC32C_X86_64
+FS_TARGET_SSE42
+static u32 _crc32c_sse42(u32 crc, const u8 *p, s64 size)
+{
+    u64 crc64 = crc;
+
+    while (size >= 8)
+    {
+        crc64 = _mm_crc32_u64(crc64, _read64(p));
+        p += 8;
+        size -= 8;
+    }
+
+    crc = (u32)crc64;
+
+    while (size > 0)
+    {
+        crc = _mm_crc32_u8(crc, *p);
+        ++p;
+        --size;
+    }
+
+    return crc;
+}
+
+static bool _cpu_supports_sse42()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int regs[4];
+    __cpuid(regs, 1);
+    return (regs[2] & (1 << 20)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+#endif
+}
+#endif // FS_CRC32C_X86_64
+
+#if FS_CRC32C_ARMV8
+static u32 _crc32c_armv8(u32 crc, const u8 *p, s64 size)
+{
+    while (size >= 8)
+    {
+        crc = __crc32cd(crc, _read64(p));
+        p += 8;
+        size -= 8;
+    }
+
+    while (size > 0)
+    {
+        crc = __crc32cb(crc, *p);
+        ++p;
+        --size;
+    }
+
+    return crc;
+}
+#endif // FS_CRC32C_ARMV8
+
+// starts with _crc32c_select, which selects the best kernel on the first call
+static u32 _crc32c_select(u32 crc, const u8 *p, s64 size);
+
+constinit static std::atomic<_crc32c_function> _kernel{_crc32c_select};
+
+static bool _set_kernel(fs::crc32c_implementation impl)
+{
+    switch (impl)
+    {
+    case fs::crc32c_implementation::Scalar:
+        _kernel.store(_crc32c_scalar, std::memory_order_relaxed);
+        return true;
+
+#if FS_CRC32C_X86_64
+    case fs::crc32c_implementation::SSE42:
+        if (!_cpu_supports_sse42())
+            return false;
+
+        _kernel.store(_crc32c_sse42, std::memory_order_relaxed);
+        return true;
+#endif
+
+#if FS_CRC32C_ARMV8
+    case fs::crc32c_implementation::ARMv8:
+        _kernel.store(_crc32c_armv8, std::memory_order_relaxed);
+        return true;
+#endif
+
+    default:
+        return false;
+    }
+}
+
+static fs::crc32c_implementation _best_implementation()
+{
+#if FS_CRC32C_X86_64
+    if (_cpu_supports_sse42())
+        return fs::crc32c_implementation::SSE42;
+#elif FS_CRC32C_ARMV8
+    return fs::crc32c_implementation::ARMv8;
+#endif
+
+    return fs::crc32c_implementation::Scalar;
+}
+
+// selected by the first checksum (or get / set_crc32c_implementation), like
+// the scan kernels, so copying also works in static initializers of other
+// translation units.
+static fs::crc32c_implementation _select_best_implementation()
+{
+    fs::crc32c_implementation impl = _best_implementation();
+    _set_kernel(impl);
+    return impl;
+}
+
+// atomic like the kernel, set_crc32c_implementation may run while other threads
+// call get_crc32c_implementation.
+static std::atomic<fs::crc32c_implementation> *_current_implementation()
+{
+    static std::atomic<fs::crc32c_implementation> impl{_select_best_implementation()};
+    return &impl;
+}
+
+static u32 _crc32c_select(u32 crc, const u8 *p, s64 size)
+{
+    _current_implementation();
+    return _kernel.load(std::memory_order_relaxed)(crc, p, size);
+}
+
+u32 fs::_crc32c(u32 crc, const void *data, s64 size)
+{
+    return ~_kernel.load(std::memory_order_relaxed)(~crc, (const u8*)data, size);
+}
+
+// zeros only shift the CRC register, appending n zero bytes multiplies it by
+// x^(8n) modulo the polynomial. x^(8n) is the product of the powers x^(2^k)
+// of the bits of 8n, so it takes one multiplication per bit of n instead of
+// one step per byte. (all polynomials are reflected, bit 31 is x^0.)
+static constexpr u32 _multiply_mod_polynomial(u32 a, u32 b)
+{
+    u32 ret = 0;
+
+    for (u32 m = 1u << 31; m != 0; m >>= 1)
+    {
+        if (a & m)
+            ret ^= b;
+
+        b = (b & 1) ? (b >> 1) ^ CRC32C_POLYNOMIAL : b >> 1;
+    }
+
+    return ret;
+}
+
+// powers[k] = x^(2^k) mod P, for every bit of 8n with n < 2^63
+struct _crc32c_powers
+{
+    u32 powers[67];
+};
+
+static constexpr _crc32c_powers _make_powers()
+{
+    _crc32c_powers ret{};
+    ret.powers[0] = 1u << 30; // x^1
+
+    for (int k = 1; k < 67; ++k)
+        ret.powers[k] = _multiply_mod_polynomial(ret.powers[k - 1], ret.powers[k - 1]);
+
+    return ret;
+}
+
+static constexpr _crc32c_powers _powers = _make_powers();
+
+u32 fs::_crc32c_zeros(u32 crc, s64 size)
+{
+    if (size <= 0)
+        return crc;
+
+    u32 x = 1u << 31; // x^0
+
+    // 8n: starts at x^(2^3)
+    for (int k = 3; size != 0; ++k, size >>= 1)
+        if (size & 1)
+            x = _multiply_mod_polynomial(_powers.powers[k], x);
+
+    return ~_multiply_mod_polynomial(x, ~crc);
+}
+
+fs::crc32c_implementation fs::get_crc32c_implementation()
+{
+    return _current_implementation()->load(std::memory_order_relaxed);
+}
+
+bool fs::set_crc32c_implementation(fs::crc32c_implementation impl)
+{
+    std::atomic<fs::crc32c_implementation> *current = _current_implementation();
+
+    if (!_set_kernel(impl))
+        return false;
+
+    current->store(impl, std::memory_order_relaxed);
+    return true;
+}
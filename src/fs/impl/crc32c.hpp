@@ -0,0 +1,54 @@
+
+/* crc32c.hpp
+
+used internally, you don't need to include this to use fs.
+
+CRC32C (Castagnoli) kernels used by copy_file with copy_file_flag::Verify to
+checksum the data while it is copied.
+
+On x86_64, the SSE4.2 crc32 instruction is used if the CPU supports it, on
+ARMv8 the CRC32 instructions if the compiler targets them. Otherwise the
+scalar implementation processes 8 bytes at a time with 8 lookup tables.
+The implementation is picked on the first call, like the scan kernels (see
+fs/impl/scan.hpp).
+
+Functions:
+
+_crc32c(Crc, Data, Size)
+    Returns the CRC32C of Size bytes at Data, continuing the CRC32C Crc of
+    the preceding data, 0 for the start. The result is the standard CRC32C
+    (initial value and final xor 0xFFFFFFFF), e.g. the CRC32C of the 9 bytes
+    "123456789" is 0xE3069283.
+
+_crc32c_zeros(Crc, Size)
+    Same as _crc32c with Size zero bytes, e.g. for the holes of sparse files,
+    in O(log Size) instead of reading Size bytes.
+
+get_crc32c_implementation()
+    Returns the CRC32C implementation currently in use.
+
+set_crc32c_implementation(Impl)
+    Sets the CRC32C implementation to use, e.g. to compare them in tests.
+    Returns false if Impl is not supported on this CPU, in which case
+    the implementation is not changed.
+*/
+
+#pragma once
+
+#include "shl/number_types.hpp"
+
+namespace fs
+{
+enum class crc32c_implementation : u8
+{
+    Scalar,
+    SSE42,
+    ARMv8
+};
+
+u32 _crc32c(u32 crc, const void *data, s64 size);
+u32 _crc32c_zeros(u32 crc, s64 size);
+
+fs::crc32c_implementation get_crc32c_implementation();
+bool set_crc32c_implementation(fs::crc32c_implementation impl);
+}
@@ -0,0 +1,91 @@
+
+#include "fs/impl/hash.hpp"
+
+#include <string.h> // memcpy
+
+#define HASH_PRIME1 0x9e3779b185ebca87ull
+#define HASH_PRIME2 0xc2b2ae3d27d4eb4full
+#define HASH_PRIME3 0x165667b19e3779f9ull
+
+static inline u64 _rotl(u64 x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline u64 _read64(const u8 *p)
+{
+    u64 ret;
+    memcpy(&ret, p, sizeof(u64));
+    return ret;
+}
+
+static inline u64 _round(u64 acc, u64 input)
+{
+    acc += input * HASH_PRIME2;
+    acc = _rotl(acc, 31);
+    return acc * HASH_PRIME1;
+}
+
+// final avalanche, every input bit affects every output bit
+static inline u64 _mix(u64 h)
+{
+    h ^= h >> 33;
+    h *= HASH_PRIME2;
+    h ^= h >> 29;
+    h *= HASH_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+u64 fs::_hash_bytes(const void *data, s64 size, u64 seed)
+{
+    const u8 *p = (const u8*)data;
+    const u8 *end = p + size;
+    u64 h;
+
+    if (size >= 32)
+    {
+        u64 lane1 = seed + HASH_PRIME1 + HASH_PRIME2;
+        u64 lane2 = seed + HASH_PRIME2;
+        u64 lane3 = seed;
+        u64 lane4 = seed - HASH_PRIME1;
+
+        do
+        {
+            lane1 = _round(lane1, _read64(p));
+            lane2 = _round(lane2, _read64(p + 8));
+            lane3 = _round(lane3, _read64(p + 16));
+            lane4 = _round(lane4, _read64(p + 24));
+            p += 32;
+        } while (end - p >= 32);
+
+        h = _rotl(lane1, 1) + _rotl(lane2, 7) + _rotl(lane3, 12) + _rotl(lane4, 18);
+    }
+    else
+        h = seed + HASH_PRIME3;
+
+    h += (u64)size;
+
+    while (end - p >= 8)
+    {
+        h ^= _round(0, _read64(p));
+        h = _rotl(h, 27) * HASH_PRIME1 + HASH_PRIME3;
+        p += 8;
+    }
+
+    if (p < end)
+    {
+        // remaining 1 - 7 bytes
+        u64 tail = 0;
+        memcpy(&tail, p, (size_t)(end - p));
+        h ^= _round(0, tail);
+        h = _rotl(h, 27) * HASH_PRIME1 + HASH_PRIME3;
+    }
+
+    return _mix(h);
+}
+
+u64 fs::_hash_combine(u64 hash, u64 value)
+{
+    return _mix(_rotl(hash, 23) ^ (value * HASH_PRIME1));
+}
@@ -0,0 +1,28 @@
+
+/* hash.hpp
+
+used internally, you don't need to include this to use fs.
+
+Hashing kernels used by fs::path_hash and hash(*Path).
+
+Functions:
+
+_hash_bytes(Data, Size, Seed)
+    Returns a 64 bit hash of Size bytes at Data.
+    Inputs of 32 bytes or more are processed 32 bytes at a time in four
+    independent lanes, so the multiplications of the lanes can execute in
+    parallel, shorter inputs (most path segments) 8 bytes at a time.
+
+_hash_combine(Hash, Value)
+    Returns a hash of the ordered pair (Hash, Value).
+*/
+
+#pragma once
+
+#include "shl/number_types.hpp"
+
+namespace fs
+{
+u64 _hash_bytes(const void *data, s64 size, u64 seed);
+u64 _hash_combine(u64 hash, u64 value);
+}
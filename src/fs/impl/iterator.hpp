@@ -75,11 +75,15 @@ auto init(fs::fs_iterator *it, T pth, error *err = nullptr)
     auto ret = fs::_init(it, ::to_const_string(pth_str), err);
 
     if constexpr (needs_conversion(T))
-        free(&pth_str);
+        fs::_free_platform_string(&pth_str);
 
     return ret;
 }
 
+// iterates the directory of an open dir_handle, see fs/dir_handle.hpp
+struct dir_handle;
+bool init(fs::fs_iterator *it, const fs::dir_handle *dir, error *err = nullptr);
+
 bool free(fs::fs_iterator *it, error *err = nullptr);
 
 fs::fs_iterator_item *_iterate(fs::fs_iterator *it, fs::iterate_option opt = fs::iterate_option::None, error *err = nullptr);
@@ -112,7 +116,7 @@ auto init(fs::fs_recursive_iterator *it, T pth, fs::iterate_option opts = fs::it
     auto ret = fs::_init(it, ::to_const_string(pth_str), opts, err);
 
     if constexpr (needs_conversion(T))
-        free(&pth_str);
+        fs::_free_platform_string(&pth_str);
 
     return ret;
 }
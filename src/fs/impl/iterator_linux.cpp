@@ -9,6 +9,7 @@
 #include "shl/assert.hpp"
 #include "shl/macros.hpp" // offset_of
 #include "fs/path.hpp"
+#include "fs/dir_handle.hpp"
 
 #include "shl/impl/linux/error_codes.hpp" // error codes
 #include "shl/impl/linux/syscalls.hpp"
@@ -124,6 +125,36 @@ bool fs::_init(fs::fs_iterator *it, fs::const_fs_string pth, error *err)
     return true;
 }
 
+bool fs::init(fs::fs_iterator *it, const fs::dir_handle *dir, error *err)
+{
+    assert(it != nullptr);
+    assert(dir != nullptr);
+
+    fill_memory(it, 0);
+    it->target_path = to_const_string(&dir->path);
+    fs::init(&it->path_it, it->target_path);
+
+    ::init(&it->_detail.buffer);
+
+    // a new descriptor with its own position, dir->fd is O_PATH and can't be read
+    it->_detail.fd = (int)::openat(dir->fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+
+    if (it->_detail.fd < 0)
+    {
+        set_error_by_code(err, -it->_detail.fd);
+        it->_detail.fd = -1;
+        return false;
+    }
+
+    if (!_get_next_dirents(&it->_detail, err))
+        return false;
+
+    // dir->path is canonical already
+    fs::path_append(&it->path_it, ".");
+
+    return true;
+}
+
 bool fs::free(fs_iterator *it, error *err)
 {
     assert(it != nullptr);
@@ -13,6 +13,7 @@
 #include "shl/memory.hpp"
 #include "shl/assert.hpp"
 #include "fs/path.hpp"
+#include "fs/dir_handle.hpp"
 
 #define as_array_ptr(x)     (::array<fs::path_char_t>*)(x)
 #define as_string_ptr(x)    (::string_base<fs::path_char_t>*)(x)
@@ -109,6 +110,13 @@ bool fs::_init(fs::fs_iterator *it, fs::const_fs_string pth, error *err)
     return true;
 }
 
+bool fs::init(fs::fs_iterator *it, const fs::dir_handle *dir, error *err)
+{
+    assert(dir != nullptr);
+
+    return fs::_init(it, to_const_string(&dir->path), err);
+}
+
 bool fs::free(fs_iterator *it, error *err)
 {
     assert(it != nullptr);
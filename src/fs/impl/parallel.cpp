@@ -0,0 +1,230 @@
+
+#include "shl/platform.hpp"
+#include "fs/impl/parallel.hpp"
+
+#include <atomic>
+
+#if Windows
+#  include <windows.h>
+typedef SRWLOCK _native_mutex;
+typedef CONDITION_VARIABLE _native_condition;
+#else
+#  include <pthread.h>
+#  include <unistd.h>
+typedef pthread_mutex_t _native_mutex;
+typedef pthread_cond_t _native_condition;
+#endif
+
+static_assert(sizeof(_native_mutex) <= sizeof(fs::_mutex::_data));
+static_assert(sizeof(_native_condition) <= sizeof(fs::_condition::_data));
+
+#define _native(M) ((_native_mutex*)((M)->_data))
+
+void fs::_mutex_init(fs::_mutex *m)
+{
+#if Windows
+    InitializeSRWLock(_native(m));
+#else
+    pthread_mutex_init(_native(m), nullptr);
+#endif
+}
+
+void fs::_mutex_free(fs::_mutex *m)
+{
+#if Windows
+    (void)m;
+#else
+    pthread_mutex_destroy(_native(m));
+#endif
+}
+
+void fs::_mutex_lock(fs::_mutex *m)
+{
+#if Windows
+    AcquireSRWLockExclusive(_native(m));
+#else
+    pthread_mutex_lock(_native(m));
+#endif
+}
+
+void fs::_mutex_unlock(fs::_mutex *m)
+{
+#if Windows
+    ReleaseSRWLockExclusive(_native(m));
+#else
+    pthread_mutex_unlock(_native(m));
+#endif
+}
+
+#define _native_cond(C) ((_native_condition*)((C)->_data))
+
+void fs::_condition_init(fs::_condition *c)
+{
+#if Windows
+    InitializeConditionVariable(_native_cond(c));
+#else
+    pthread_cond_init(_native_cond(c), nullptr);
+#endif
+}
+
+void fs::_condition_free(fs::_condition *c)
+{
+#if Windows
+    (void)c;
+#else
+    pthread_cond_destroy(_native_cond(c));
+#endif
+}
+
+void fs::_condition_wait(fs::_condition *c, fs::_mutex *m)
+{
+#if Windows
+    SleepConditionVariableSRW(_native_cond(c), _native(m), INFINITE, 0);
+#else
+    pthread_cond_wait(_native_cond(c), _native(m));
+#endif
+}
+
+void fs::_condition_signal(fs::_condition *c)
+{
+#if Windows
+    WakeConditionVariable(_native_cond(c));
+#else
+    pthread_cond_signal(_native_cond(c));
+#endif
+}
+
+void fs::_condition_broadcast(fs::_condition *c)
+{
+#if Windows
+    WakeAllConditionVariable(_native_cond(c));
+#else
+    pthread_cond_broadcast(_native_cond(c));
+#endif
+}
+
+s32 fs::_hardware_thread_count()
+{
+#if Windows
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    s32 ret = (s32)info.dwNumberOfProcessors;
+#else
+    s32 ret = (s32)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+    return ret < 1 ? 1 : ret;
+}
+
+struct _parallel_context
+{
+    fs::_parallel_function func;
+    void *userdata;
+    s64 count;
+    s64 chunk_size;
+    std::atomic<s64> next;
+};
+
+static void _parallel_work(_parallel_context *ctx)
+{
+    while (true)
+    {
+        s64 begin = ctx->next.fetch_add(ctx->chunk_size);
+
+        if (begin >= ctx->count)
+            break;
+
+        s64 end = begin + ctx->chunk_size;
+
+        if (end > ctx->count)
+            end = ctx->count;
+
+        ctx->func(begin, end, ctx->userdata);
+    }
+}
+
+#if Windows
+static DWORD WINAPI _parallel_thread(LPVOID arg)
+{
+    _parallel_work((_parallel_context*)arg);
+    return 0;
+}
+#else
+static void *_parallel_thread(void *arg)
+{
+    _parallel_work((_parallel_context*)arg);
+    return nullptr;
+}
+#endif
+
+// more threads than this are never useful for filesystem work
+#define MAX_PARALLEL_THREADS 64
+
+void fs::_parallel_for(s64 count, s64 chunk_size, s32 thread_count, fs::_parallel_function func, void *userdata)
+{
+    if (count <= 0)
+        return;
+
+    if (chunk_size < 1)
+        chunk_size = 1;
+
+    if (thread_count <= 0)
+        thread_count = fs::_hardware_thread_count();
+
+    s64 chunks = (count + chunk_size - 1) / chunk_size;
+
+    if (thread_count > chunks)
+        thread_count = (s32)chunks;
+
+    if (thread_count > MAX_PARALLEL_THREADS)
+        thread_count = MAX_PARALLEL_THREADS;
+
+    if (thread_count <= 1)
+    {
+        func(0, count, userdata);
+        return;
+    }
+
+    _parallel_context ctx;
+    ctx.func = func;
+    ctx.userdata = userdata;
+    ctx.count = count;
+    ctx.chunk_size = chunk_size;
+    ctx.next = 0;
+
+#if Windows
+    HANDLE threads[MAX_PARALLEL_THREADS];
+#else
+    pthread_t threads[MAX_PARALLEL_THREADS];
+#endif
+    s32 started = 0;
+
+    // if a thread cannot be created, the remaining threads (and this one)
+    // simply do more of the work.
+    for (s32 i = 0; i < thread_count - 1; ++i)
+    {
+#if Windows
+        threads[started] = CreateThread(nullptr, 0, _parallel_thread, &ctx, 0, nullptr);
+
+        if (threads[started] == nullptr)
+            break;
+#else
+        if (pthread_create(threads + started, nullptr, _parallel_thread, &ctx) != 0)
+            break;
+#endif
+
+        started += 1;
+    }
+
+    _parallel_work(&ctx);
+
+    for (s32 i = 0; i < started; ++i)
+    {
+#if Windows
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], nullptr);
+#endif
+    }
+}
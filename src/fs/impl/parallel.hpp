@@ -0,0 +1,66 @@
+
+/* parallel.hpp
+
+used internally, you don't need to include this to use fs.
+
+Minimal threading primitives used by the batch functions (normalize_all,
+weakly_canonical_all, ...) and the caches that may be shared between threads.
+
+_mutex
+    A plain (non-recursive) mutex, use with _mutex_init, _mutex_lock,
+    _mutex_unlock and _mutex_free.
+
+_condition
+    A condition variable used together with a _mutex, use with _condition_init,
+    _condition_wait, _condition_signal, _condition_broadcast and _condition_free.
+    Like all condition variables, _condition_wait may return spuriously, so
+    wait in a loop that checks the condition.
+
+_hardware_thread_count()
+    Returns the number of threads the process may run on concurrently, at least 1.
+
+_parallel_for(Count, ChunkSize, ThreadCount, Func, Userdata)
+    Calls Func(Begin, End, Userdata) for consecutive chunks of [0, Count),
+    each at most ChunkSize long, from up to ThreadCount threads (including the
+    calling thread). If ThreadCount is 0, uses _hardware_thread_count().
+    Threads take the next free chunk when they are done with their current one,
+    so uneven work per element is balanced out.
+    Returns when all chunks have been processed.
+*/
+
+#pragma once
+
+#include "shl/number_types.hpp"
+
+namespace fs
+{
+struct _mutex
+{
+    // large enough for pthread_mutex_t and SRWLOCK, checked in parallel.cpp.
+    alignas(8) u8 _data[64];
+};
+
+void _mutex_init(fs::_mutex *m);
+void _mutex_free(fs::_mutex *m);
+void _mutex_lock(fs::_mutex *m);
+void _mutex_unlock(fs::_mutex *m);
+
+struct _condition
+{
+    // large enough for pthread_cond_t and CONDITION_VARIABLE, checked in parallel.cpp.
+    alignas(8) u8 _data[64];
+};
+
+void _condition_init(fs::_condition *c);
+void _condition_free(fs::_condition *c);
+// m must be locked, is unlocked while waiting and locked again when this returns
+void _condition_wait(fs::_condition *c, fs::_mutex *m);
+void _condition_signal(fs::_condition *c);
+void _condition_broadcast(fs::_condition *c);
+
+s32 _hardware_thread_count();
+
+typedef void (*_parallel_function)(s64 begin, s64 end, void *userdata);
+
+void _parallel_for(s64 count, s64 chunk_size, s32 thread_count, fs::_parallel_function func, void *userdata);
+}
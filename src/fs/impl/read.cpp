@@ -0,0 +1,158 @@
+
+#include "shl/platform.hpp"
+#include "fs/impl/read.hpp"
+
+#if Windows
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/vfs.h> // fstatfs
+#include <linux/fs.h> // FS_IOC_GETFLAGS
+
+#ifndef FS_CASEFOLD_FL
+#define FS_CASEFOLD_FL 0x40000000
+#endif
+
+// filesystems whose names are matched ignoring case
+#define MAGIC_MSDOS  0x4d44
+#define MAGIC_EXFAT  0x2011bab0
+#define MAGIC_CIFS   0xff534d42
+#define MAGIC_SMB2   0xfe534d42
+#endif
+
+bool fs::_open_read(fs::const_fs_string pth, fs::_read_handle *out, error *err)
+{
+#if Windows
+    *out = CreateFile((const sys_native_char*)pth.c_str,
+                      GENERIC_READ,
+                      FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE,
+                      nullptr,
+                      OPEN_EXISTING,
+                      FILE_FLAG_SEQUENTIAL_SCAN,
+                      nullptr);
+
+    if (*out == INVALID_HANDLE_VALUE)
+    {
+        set_GetLastError_error(err);
+        return false;
+    }
+#else
+    *out = open(pth.c_str, O_RDONLY | O_CLOEXEC);
+
+    if (*out < 0)
+    {
+        set_error_by_code(err, errno);
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+void fs::_close_read(fs::_read_handle h)
+{
+    if (h == _invalid_read_handle)
+        return;
+
+#if Windows
+    CloseHandle(h);
+#else
+    close(h);
+#endif
+}
+
+// offset < 0 reads at the current position
+static bool _read_into(fs::_read_handle h, s64 offset, void *buf, s64 size, s64 *out, error *err)
+{
+    u8 *data = (u8*)buf;
+    s64 done = 0;
+
+    while (done < size)
+    {
+#if Windows
+        DWORD n = 0;
+        OVERLAPPED overlapped{};
+        OVERLAPPED *at = nullptr;
+
+        if (offset >= 0)
+        {
+            overlapped.Offset = (DWORD)((offset + done) & 0xffffffff);
+            overlapped.OffsetHigh = (DWORD)((offset + done) >> 32);
+            at = &overlapped;
+        }
+
+        if (!ReadFile(h, data + done, (DWORD)(size - done), &n, at))
+        {
+            if (GetLastError() == ERROR_HANDLE_EOF)
+                break;
+
+            set_GetLastError_error(err);
+            return false;
+        }
+#else
+        ssize_t n;
+
+        if (offset >= 0)
+            n = pread(h, data + done, (size_t)(size - done), (off_t)(offset + done));
+        else
+            n = read(h, data + done, (size_t)(size - done));
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            set_error_by_code(err, errno);
+            return false;
+        }
+#endif
+
+        if (n == 0)
+            break;
+
+        done += (s64)n;
+    }
+
+    *out = done;
+    return true;
+}
+
+bool fs::_read_full(fs::_read_handle h, void *buf, s64 size, s64 *out, error *err)
+{
+    return ::_read_into(h, -1, buf, size, out, err);
+}
+
+bool fs::_read_full_at(fs::_read_handle h, s64 offset, void *buf, s64 size, s64 *out, error *err)
+{
+    return ::_read_into(h, offset, buf, size, out, err);
+}
+
+#if Linux
+bool fs::_is_case_insensitive_directory(int fd)
+{
+    int flags = 0;
+
+    // ext4 and f2fs directories with the casefold attribute (chattr +F)
+    if (ioctl(fd, FS_IOC_GETFLAGS, &flags) == 0 && (flags & FS_CASEFOLD_FL) != 0)
+        return true;
+
+    struct statfs st;
+
+    if (fstatfs(fd, &st) != 0)
+        return false;
+
+    switch ((u32)st.f_type)
+    {
+    case MAGIC_MSDOS:
+    case MAGIC_EXFAT:
+    case MAGIC_CIFS:
+    case MAGIC_SMB2:
+        return true;
+    default:
+        return false;
+    }
+}
+#endif
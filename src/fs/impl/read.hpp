@@ -0,0 +1,58 @@
+/* read.hpp
+
+used internally, you don't need to include this to use fs.
+
+Reading the contents of files, used by the functions that compare or hash
+files (sync_directory, copy_directory with copy_directory_flag::Deduplicate),
+and how names are looked up in a directory (exists_many).
+
+_read_handle
+    An open file, a file descriptor on Linux and a HANDLE on Windows.
+    _invalid_read_handle is a handle that is not open.
+
+_open_read(PathStr, *Out[, err])
+    Opens the file at PathStr for reading, sequentially from the start.
+    Returns whether or not the function succeeded.
+
+_close_read(Handle)
+    Closes Handle, does nothing if Handle is _invalid_read_handle.
+
+_read_full(Handle, *Buffer, Size, *OutRead[, err])
+    Reads Size bytes from the current position of Handle to Buffer, or fewer
+    at the end of the file, and sets OutRead to the number of bytes read.
+    Returns whether or not the function succeeded.
+
+_read_full_at(Handle, Offset, *Buffer, Size, *OutRead[, err])
+    Same as _read_full, from Offset in the file.
+
+_is_case_insensitive_directory(Fd) (Linux only)
+    Returns whether names in the open directory Fd are looked up ignoring
+    case, so they can't be compared bytewise with the names of a listing:
+    casefolded directories (ext4, f2fs) and FAT, exFAT and SMB filesystems.
+*/
+
+#pragma once
+
+#include "shl/number_types.hpp"
+#include "shl/error.hpp"
+#include "fs/common.hpp"
+
+namespace fs
+{
+#if Windows
+typedef HANDLE _read_handle;
+#define _invalid_read_handle INVALID_HANDLE_VALUE
+#else
+typedef int _read_handle;
+#define _invalid_read_handle -1
+#endif
+
+bool _open_read(fs::const_fs_string pth, fs::_read_handle *out, error *err = nullptr);
+void _close_read(fs::_read_handle h);
+bool _read_full(fs::_read_handle h, void *buf, s64 size, s64 *out, error *err = nullptr);
+bool _read_full_at(fs::_read_handle h, s64 offset, void *buf, s64 size, s64 *out, error *err = nullptr);
+
+#if Linux
+bool _is_case_insensitive_directory(int fd);
+#endif
+}
@@ -0,0 +1,306 @@
+
+#include "shl/platform.hpp"
+#include "fs/impl/scan.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#  define FS_SCAN_X86_64 1
+#  include <immintrin.h>
+#  if defined(_MSC_VER) && !defined(__clang__)
+#    include <intrin.h>
+#  endif
+#else
+#  define FS_SCAN_X86_64 0
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#  define FS_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#  define FS_TARGET_AVX2
+#endif
+
+typedef fs::path_char_t pchar;
+
+// scalar
+static s64 _first_of_scalar(const pchar *str, s64 size, pchar c1, pchar c2)
+{
+    for (s64 i = 0; i < size; ++i)
+        if (str[i] == c1 || str[i] == c2)
+            return i;
+
+    return -1;
+}
+
+static s64 _last_of_scalar(const pchar *str, s64 size, pchar c1, pchar c2)
+{
+    for (s64 i = size - 1; i >= 0; --i)
+        if (str[i] == c1 || str[i] == c2)
+            return i;
+
+    return -1;
+}
+
+#if FS_SCAN_X86_64
+static inline u32 _lowest_bit(u32 mask)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long idx;
+    _BitScanForward(&idx, mask);
+    return (u32)idx;
+#else
+    return (u32)__builtin_ctz(mask);
+#endif
+}
+
+static inline u32 _highest_bit(u32 mask)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long idx;
+    _BitScanReverse(&idx, mask);
+    return (u32)idx;
+#else
+    return 31u - (u32)__builtin_clz(mask);
+#endif
+}
+
+// movemask yields one bit per byte, so for wide characters every character
+// sets sizeof(pchar) bits and bit indices have to be divided by the character size.
+#define _bit_to_index(Bit) ((s64)((Bit) / sizeof(pchar)))
+
+// SSE2
+static inline __m128i _splat_sse2(pchar c)
+{
+    if constexpr (sizeof(pchar) == 1)
+        return _mm_set1_epi8((char)c);
+    else
+        return _mm_set1_epi16((short)c);
+}
+
+static inline u32 _match_sse2(const pchar *str, __m128i n1, __m128i n2)
+{
+    __m128i chunk = _mm_loadu_si128((const __m128i*)str);
+
+    if constexpr (sizeof(pchar) == 1)
+        return (u32)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, n1), _mm_cmpeq_epi8(chunk, n2)));
+    else
+        return (u32)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi16(chunk, n1), _mm_cmpeq_epi16(chunk, n2)));
+}
+
+static s64 _first_of_sse2(const pchar *str, s64 size, pchar c1, pchar c2)
+{
+    constexpr s64 step = 16 / sizeof(pchar);
+    const __m128i n1 = _splat_sse2(c1);
+    const __m128i n2 = _splat_sse2(c2);
+    s64 i = 0;
+
+    for (; i + step <= size; i += step)
+    {
+        u32 mask = _match_sse2(str + i, n1, n2);
+
+        if (mask != 0)
+            return i + _bit_to_index(_lowest_bit(mask));
+    }
+
+    s64 found = _first_of_scalar(str + i, size - i, c1, c2);
+
+    return found < 0 ? -1 : i + found;
+}
+
+static s64 _last_of_sse2(const pchar *str, s64 size, pchar c1, pchar c2)
+{
+    constexpr s64 step = 16 / sizeof(pchar);
+    const __m128i n1 = _splat_sse2(c1);
+    const __m128i n2 = _splat_sse2(c2);
+    s64 i = size;
+
+    while (i >= step)
+    {
+        i -= step;
+        u32 mask = _match_sse2(str + i, n1, n2);
+
+        if (mask != 0)
+            return i + _bit_to_index(_highest_bit(mask));
+    }
+
+    return _last_of_scalar(str, i, c1, c2);
+}
+
+// AVX2
+FS_TARGET_AVX2
+static inline __m256i _splat_avx2(pchar c)
+{
+    if constexpr (sizeof(pchar) == 1)
+        return _mm256_set1_epi8((char)c);
+    else
+        return _mm256_set1_epi16((short)c);
+}
+
+FS_TARGET_AVX2
+static inline u32 _match_avx2(const pchar *str, __m256i n1, __m256i n2)
+{
+    __m256i chunk = _mm256_loadu_si256((const __m256i*)str);
+
+    if constexpr (sizeof(pchar) == 1)
+        return (u32)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, n1), _mm256_cmpeq_epi8(chunk, n2)));
+    else
+        return (u32)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi16(chunk, n1), _mm256_cmpeq_epi16(chunk, n2)));
+}
+
+FS_TARGET_AVX2
+static s64 _first_of_avx2(const pchar *str, s64 size, pchar c1, pchar c2)
+{
+    constexpr s64 step = 32 / sizeof(pchar);
+    const __m256i n1 = _splat_avx2(c1);
+    const __m256i n2 = _splat_avx2(c2);
+    s64 i = 0;
+
+    for (; i + step <= size; i += step)
+    {
+        u32 mask = _match_avx2(str + i, n1, n2);
+
+        if (mask != 0)
+            return i + _bit_to_index(_lowest_bit(mask));
+    }
+
+    // most paths are short, so the remainder still goes through SSE2
+    s64 found = _first_of_sse2(str + i, size - i, c1, c2);
+
+    return found < 0 ? -1 : i + found;
+}
+
+FS_TARGET_AVX2
+static s64 _last_of_avx2(const pchar *str, s64 size, pchar c1, pchar c2)
+{
+    constexpr s64 step = 32 / sizeof(pchar);
+    const __m256i n1 = _splat_avx2(c1);
+    const __m256i n2 = _splat_avx2(c2);
+    s64 i = size;
+
+    while (i >= step)
+    {
+        i -= step;
+        u32 mask = _match_avx2(str + i, n1, n2);
+
+        if (mask != 0)
+            return i + _bit_to_index(_highest_bit(mask));
+    }
+
+    return _last_of_sse2(str, i, c1, c2);
+}
+
+#undef _bit_to_index
+
+static bool _cpu_supports_avx2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int regs[4];
+    __cpuid(regs, 0);
+
+    if (regs[0] < 7)
+        return false;
+
+    __cpuid(regs, 1);
+
+    // OSXSAVE and AVX, and the OS must save the YMM registers
+    if ((regs[2] & (1 << 27)) == 0 || (regs[2] & (1 << 28)) == 0)
+        return false;
+
+    if ((_xgetbv(0) & 6) != 6)
+        return false;
+
+    __cpuidex(regs, 7, 0);
+    return (regs[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif // FS_SCAN_X86_64
+
+static bool _set_kernels(fs::_scan_kernels *kernels, fs::scan_implementation impl)
+{
+    switch (impl)
+    {
+    case fs::scan_implementation::Scalar:
+        kernels->first_of.store(_first_of_scalar, std::memory_order_relaxed);
+        kernels->last_of.store(_last_of_scalar, std::memory_order_relaxed);
+        return true;
+
+#if FS_SCAN_X86_64
+    case fs::scan_implementation::SSE2:
+        kernels->first_of.store(_first_of_sse2, std::memory_order_relaxed);
+        kernels->last_of.store(_last_of_sse2, std::memory_order_relaxed);
+        return true;
+
+    case fs::scan_implementation::AVX2:
+        if (!_cpu_supports_avx2())
+            return false;
+
+        kernels->first_of.store(_first_of_avx2, std::memory_order_relaxed);
+        kernels->last_of.store(_last_of_avx2, std::memory_order_relaxed);
+        return true;
+#endif
+
+    default:
+        return false;
+    }
+}
+
+static fs::scan_implementation _best_implementation()
+{
+#if FS_SCAN_X86_64
+    if (_cpu_supports_avx2())
+        return fs::scan_implementation::AVX2;
+
+    return fs::scan_implementation::SSE2;
+#else
+    return fs::scan_implementation::Scalar;
+#endif
+}
+
+// the best implementation is selected by the first call of any kernel (or of
+// get / set_scan_implementation), not by a dynamic initializer, so scanning
+// also works in static initializers of other translation units.
+static fs::scan_implementation _select_best_implementation()
+{
+    fs::scan_implementation impl = _best_implementation();
+    _set_kernels(&fs::_scan, impl);
+    return impl;
+}
+
+// atomic like the kernels, set_scan_implementation may run while other threads
+// call get_scan_implementation.
+static std::atomic<fs::scan_implementation> *_current_implementation()
+{
+    static std::atomic<fs::scan_implementation> impl{_select_best_implementation()};
+    return &impl;
+}
+
+static s64 _first_of_select(const pchar *str, s64 size, pchar c1, pchar c2)
+{
+    _current_implementation();
+    return fs::_scan.first_of.load(std::memory_order_relaxed)(str, size, c1, c2);
+}
+
+static s64 _last_of_select(const pchar *str, s64 size, pchar c1, pchar c2)
+{
+    _current_implementation();
+    return fs::_scan.last_of.load(std::memory_order_relaxed)(str, size, c1, c2);
+}
+
+constinit fs::_scan_kernels fs::_scan{{_first_of_select}, {_last_of_select}};
+
+fs::scan_implementation fs::get_scan_implementation()
+{
+    return _current_implementation()->load(std::memory_order_relaxed);
+}
+
+bool fs::set_scan_implementation(fs::scan_implementation impl)
+{
+    std::atomic<fs::scan_implementation> *current = _current_implementation();
+
+    if (!_set_kernels(&fs::_scan, impl))
+        return false;
+
+    current->store(impl, std::memory_order_relaxed);
+    return true;
+}
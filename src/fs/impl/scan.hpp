@@ -0,0 +1,99 @@
+
+/* scan.hpp
+
+used internally, you don't need to include this to use fs.
+
+Character scanning kernels used by the path functions (filename,
+parent_path_segment, path_segments, normalize, file_extension, ...) to find
+path separators and dots.
+
+On x86_64, SSE2 and AVX2 versions of the kernels exist, the implementation
+is picked on the first call depending on what the CPU supports. Other platforms
+use the scalar implementation.
+
+Functions:
+
+_scan_first(Str, Size, C)
+    Returns the index of the first C in Str, or -1 if Str does not contain C.
+
+_scan_last(Str, Size, C)
+    Returns the index of the last C in Str, or -1 if Str does not contain C.
+
+_scan_first_separator(Str, Size)
+_scan_last_separator(Str, Size)
+    Same as _scan_first / _scan_last, but look for path separators.
+    On Windows, both / and \ are path separators.
+
+get_scan_implementation()
+    Returns the scan implementation currently in use.
+
+set_scan_implementation(Impl)
+    Sets the scan implementation to use, e.g. to compare them in benchmarks.
+    Returns false if Impl is not supported on this CPU, in which case
+    the implementation is not changed.
+*/
+
+#pragma once
+
+#include <atomic>
+
+#include "shl/number_types.hpp"
+#include "fs/common.hpp"
+
+namespace fs
+{
+enum class scan_implementation : u8
+{
+    Scalar,
+    SSE2,
+    AVX2
+};
+
+typedef s64 (*_scan_function)(const fs::path_char_t *str, s64 size, fs::path_char_t c1, fs::path_char_t c2);
+
+// first_of / last_of find the first / last character that is either c1 or c2.
+// constant initialized with functions that select the implementation on the
+// first call and replace themselves.
+struct _scan_kernels
+{
+    std::atomic<fs::_scan_function> first_of;
+    std::atomic<fs::_scan_function> last_of;
+};
+
+extern fs::_scan_kernels _scan;
+
+fs::scan_implementation get_scan_implementation();
+bool set_scan_implementation(fs::scan_implementation impl);
+
+inline s64 _scan_first(const fs::path_char_t *str, s64 size, fs::path_char_t c)
+{
+    return fs::_scan.first_of.load(std::memory_order_relaxed)(str, size, c, c);
+}
+
+inline s64 _scan_last(const fs::path_char_t *str, s64 size, fs::path_char_t c)
+{
+    return fs::_scan.last_of.load(std::memory_order_relaxed)(str, size, c, c);
+}
+
+#if Windows
+inline s64 _scan_first_separator(const fs::path_char_t *str, s64 size)
+{
+    return fs::_scan.first_of.load(std::memory_order_relaxed)(str, size, SYS_CHAR('\\'), SYS_CHAR('/'));
+}
+
+inline s64 _scan_last_separator(const fs::path_char_t *str, s64 size)
+{
+    return fs::_scan.last_of.load(std::memory_order_relaxed)(str, size, SYS_CHAR('\\'), SYS_CHAR('/'));
+}
+#else
+inline s64 _scan_first_separator(const fs::path_char_t *str, s64 size)
+{
+    return fs::_scan.first_of.load(std::memory_order_relaxed)(str, size, fs::path_separator, fs::path_separator);
+}
+
+inline s64 _scan_last_separator(const fs::path_char_t *str, s64 size)
+{
+    return fs::_scan.last_of.load(std::memory_order_relaxed)(str, size, fs::path_separator, fs::path_separator);
+}
+#endif
+}
@@ -0,0 +1,30 @@
+
+#include "shl/platform.hpp"
+#include "fs/impl/time.hpp"
+
+#if Windows
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+s64 fs::_monotonic_time()
+{
+#if Windows
+    static LARGE_INTEGER frequency{};
+
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+
+    return (s64)((counter.QuadPart / frequency.QuadPart) * 1000000000ll
+               + ((counter.QuadPart % frequency.QuadPart) * 1000000000ll) / frequency.QuadPart);
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (s64)ts.tv_sec * 1000000000ll + (s64)ts.tv_nsec;
+#endif
+}
@@ -0,0 +1,18 @@
+/* time.hpp
+
+used internally, you don't need to include this to use fs.
+
+_monotonic_time()
+    Returns a monotonic time in nanoseconds, used for expiry times of caches
+    and the rates of operation_control. Neither clock_gettime (vDSO) nor
+    QueryPerformanceCounter enter the kernel.
+*/
+
+#pragma once
+
+#include "shl/number_types.hpp"
+
+namespace fs
+{
+s64 _monotonic_time();
+}
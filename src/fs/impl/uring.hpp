@@ -0,0 +1,162 @@
+
+/* uring.hpp
+
+used internally, you don't need to include this to use fs.
+
+Minimal io_uring wrapper (Linux only) used by the batch functions that issue
+many independent syscalls at once, e.g. query_filesystem_batch.
+Talks to the kernel directly through io_uring_setup / io_uring_enter, fs does
+not depend on liburing.
+
+A _uring is not thread safe, use one per thread.
+
+_uring_init(*Ring, Entries[, err])
+    Sets up a ring with room for at least Entries queued submissions and twice
+    as many completions. Fails if the kernel has no io_uring or it is disabled,
+    e.g. through kernel.io_uring_disabled or a seccomp filter.
+    Returns whether or not the function succeeded.
+
+_uring_free(*Ring)
+    Tears down Ring. The kernel cancels operations still in flight, but
+    cancelled operations may still be writing into their buffers after
+    _uring_free returned, wait for them with _uring_wait first.
+
+_uring_supports(*Ring, Op)
+    Returns whether the running kernel supports the operation Op.
+
+_uring_prep_statx(*Ring, Dirfd, Path, Flags, Mask, *Out, UserData)
+    Queues a statx(Dirfd, Path, Flags, Mask, Out). Path and Out must stay valid
+    until the completion for UserData was reaped.
+    Returns false if the submission queue is full.
+
+_uring_register_files(*Ring, Count[, err])
+    Registers a table of Count empty file slots with Ring, used by the
+    operations below which take a Slot instead of a file descriptor
+    ("direct descriptors", 5.15+). Files in the slots are never visible to
+    the process, which lets linked operations use a file that an earlier
+    operation of the same chain opens.
+    Returns whether or not the function succeeded.
+
+_uring_prep_openat(*Ring, Dirfd, Path, Flags, Mode, Slot, UserData)
+    Queues an openat(Dirfd, Path, Flags, Mode) which installs the file into
+    Slot, the result is 0 on success. Kernels before 5.15 ignore Slot and
+    return a regular file descriptor instead, which the caller must close.
+    Path must stay valid until the completion for UserData was reaped.
+    Returns false if the submission queue is full.
+
+_uring_prep_read(*Ring, Slot, *Buffer, Size, Offset, UserData)
+_uring_prep_write(*Ring, Slot, *Buffer, Size, Offset, UserData)
+    Queues a pread / pwrite of the file in Slot. Buffer must stay valid until
+    the completion for UserData was reaped. In a chain, reading or writing
+    less than Size fails the chain.
+    Returns false if the submission queue is full.
+
+_uring_prep_close(*Ring, Slot, UserData)
+    Queues closing the file in Slot.
+    Returns false if the submission queue is full.
+
+_uring_link_last(*Ring)
+    Links the last queued operation to the next queued operation: the next
+    one only starts after the last one succeeded, and fails with ECANCELED
+    otherwise. Chains must be submitted as a whole, see _uring_sq_space.
+
+_uring_sq_space(*Ring)
+    Returns the number of operations that can be queued before the
+    submission queue is full.
+
+_uring_submit(*Ring, WaitCount[, err])
+    Submits all queued operations and waits until at least WaitCount
+    completions are available. Interrupted and busy waits are not errors,
+    operations that could not be submitted are submitted by the next call.
+    Returns whether or not the function succeeded.
+
+_uring_reap(*Ring, *Out, MaxCount)
+    Moves up to MaxCount available completions to Out and returns how many
+    were moved, 0 if there are none.
+
+_uring_in_flight(*Ring)
+    Returns the number of submitted operations whose completions were not
+    reaped yet. Queued operations the kernel did not take are not counted.
+
+_uring_wait(*Ring[, err])
+    Waits until at least one completion is available without submitting
+    queued operations, e.g. to finish the operations in flight after
+    _uring_submit failed. Returns immediately if nothing is in flight.
+    Returns whether or not the function succeeded.
+*/
+
+#pragma once
+
+#include "shl/platform.hpp"
+
+#if Linux
+#include "shl/number_types.hpp"
+#include "shl/error.hpp"
+
+namespace fs
+{
+enum class _uring_op : u8
+{
+    Statx,
+    Openat,
+    Read,
+    Write,
+    Close
+};
+
+struct _uring
+{
+    int fd;
+
+    // submission queue
+    u32 *sq_head;
+    u32 *sq_tail;
+    u32 sq_mask;
+    u32 sq_entries;
+    u32 sq_local_tail; // queued, but not yet visible to the kernel
+    u32 in_flight;     // taken by the kernel, completion not reaped
+    void *sqes;
+
+    // completion queue
+    u32 *cq_head;
+    u32 *cq_tail;
+    u32 cq_mask;
+    u32 cq_entries;
+    void *cqes;
+
+    // mappings
+    void *sq_ring;
+    u64 sq_ring_size;
+    void *cq_ring;
+    u64 cq_ring_size;
+    u64 sqes_size;
+};
+
+struct _uring_completion
+{
+    u64 user_data;
+    s32 result; // -errno on failure
+    u32 flags;
+};
+
+bool _uring_init(fs::_uring *ring, u32 entries, error *err = nullptr);
+void _uring_free(fs::_uring *ring);
+
+bool _uring_supports(fs::_uring *ring, fs::_uring_op op);
+
+bool _uring_register_files(fs::_uring *ring, u32 count, error *err = nullptr);
+
+bool _uring_prep_statx(fs::_uring *ring, int dirfd, const char *pth, int flags, u32 mask, void *out, u64 user_data);
+bool _uring_prep_openat(fs::_uring *ring, int dirfd, const char *pth, int flags, u32 mode, u32 slot, u64 user_data);
+bool _uring_prep_read(fs::_uring *ring, u32 slot, void *buf, u32 size, u64 offset, u64 user_data);
+bool _uring_prep_write(fs::_uring *ring, u32 slot, const void *buf, u32 size, u64 offset, u64 user_data);
+bool _uring_prep_close(fs::_uring *ring, u32 slot, u64 user_data);
+void _uring_link_last(fs::_uring *ring);
+u32  _uring_sq_space(fs::_uring *ring);
+
+bool _uring_submit(fs::_uring *ring, u32 wait_count, error *err = nullptr);
+s32  _uring_reap(fs::_uring *ring, fs::_uring_completion *out, s32 max_count);
+u32  _uring_in_flight(fs::_uring *ring);
+bool _uring_wait(fs::_uring *ring, error *err = nullptr);
+}
+#endif
@@ -0,0 +1,411 @@
+
+#include "shl/platform.hpp"
+
+#if Linux
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h> // memset
+#include <stdlib.h>
+
+#include "shl/assert.hpp"
+#include "shl/memory.hpp"
+#include "fs/impl/uring.hpp"
+
+// the kernel reads and writes the ring indices concurrently
+static inline u32 _load_acquire(const u32 *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void _store_release(u32 *p, u32 val)
+{
+    __atomic_store_n(p, val, __ATOMIC_RELEASE);
+}
+
+#define _ring_ptr(Base, Offset) (void*)((u8*)(Base) + (Offset))
+
+bool fs::_uring_init(fs::_uring *ring, u32 entries, error *err)
+{
+    assert(ring != nullptr);
+
+    fill_memory(ring, 0);
+    ring->fd = -1;
+
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+
+    if (fd < 0)
+    {
+        set_error_by_code(err, errno);
+        return false;
+    }
+
+    ring->fd = fd;
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+
+    if (single_mmap)
+    {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(nullptr, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+
+    if (ring->sq_ring == MAP_FAILED)
+    {
+        set_error_by_code(err, errno);
+        ring->sq_ring = nullptr;
+        fs::_uring_free(ring);
+        return false;
+    }
+
+    if (single_mmap)
+        ring->cq_ring = ring->sq_ring;
+    else
+    {
+        ring->cq_ring = mmap(nullptr, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+
+        if (ring->cq_ring == MAP_FAILED)
+        {
+            set_error_by_code(err, errno);
+            ring->cq_ring = nullptr;
+            fs::_uring_free(ring);
+            return false;
+        }
+    }
+
+    ring->sqes = mmap(nullptr, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+    if (ring->sqes == MAP_FAILED)
+    {
+        set_error_by_code(err, errno);
+        ring->sqes = nullptr;
+        fs::_uring_free(ring);
+        return false;
+    }
+
+    ring->sq_head    = (u32*)_ring_ptr(ring->sq_ring, params.sq_off.head);
+    ring->sq_tail    = (u32*)_ring_ptr(ring->sq_ring, params.sq_off.tail);
+    ring->sq_mask    = *(u32*)_ring_ptr(ring->sq_ring, params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+
+    ring->cq_head    = (u32*)_ring_ptr(ring->cq_ring, params.cq_off.head);
+    ring->cq_tail    = (u32*)_ring_ptr(ring->cq_ring, params.cq_off.tail);
+    ring->cq_mask    = *(u32*)_ring_ptr(ring->cq_ring, params.cq_off.ring_mask);
+    ring->cq_entries = params.cq_entries;
+    ring->cqes       = _ring_ptr(ring->cq_ring, params.cq_off.cqes);
+
+    // submission entries are always used in ring order, so the indirection
+    // array maps every slot to itself once.
+    u32 *sq_array = (u32*)_ring_ptr(ring->sq_ring, params.sq_off.array);
+
+    for (u32 i = 0; i < ring->sq_entries; ++i)
+        sq_array[i] = i;
+
+    return true;
+}
+
+void fs::_uring_free(fs::_uring *ring)
+{
+    if (ring == nullptr)
+        return;
+
+    if (ring->sqes != nullptr)
+        munmap(ring->sqes, ring->sqes_size);
+
+    if (ring->cq_ring != nullptr && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+
+    if (ring->sq_ring != nullptr)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+
+    if (ring->fd >= 0)
+        close(ring->fd);
+
+    fill_memory(ring, 0);
+    ring->fd = -1;
+}
+
+static u8 _native_op(fs::_uring_op op)
+{
+    switch (op)
+    {
+    case fs::_uring_op::Statx:  return IORING_OP_STATX;
+    case fs::_uring_op::Openat: return IORING_OP_OPENAT;
+    case fs::_uring_op::Read:   return IORING_OP_READ;
+    case fs::_uring_op::Write:  return IORING_OP_WRITE;
+    case fs::_uring_op::Close:  return IORING_OP_CLOSE;
+    }
+
+    return IORING_OP_NOP;
+}
+
+#define URING_PROBE_OPS 256
+
+bool fs::_uring_supports(fs::_uring *ring, fs::_uring_op op)
+{
+    assert(ring != nullptr);
+
+    // io_uring_probe ends in a flexible array of URING_PROBE_OPS entries
+    alignas(io_uring_probe) u8 buf[sizeof(io_uring_probe) + URING_PROBE_OPS * sizeof(io_uring_probe_op)];
+    memset(buf, 0, sizeof(buf));
+
+    io_uring_probe *probe = (io_uring_probe*)buf;
+
+    // probing was added in 5.6, together with statx and most other operations
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, URING_PROBE_OPS) < 0)
+        return false;
+
+    u8 native = _native_op(op);
+
+    return native < probe->ops_len
+        && (probe->ops[native].flags & IO_URING_OP_SUPPORTED) != 0;
+}
+
+static io_uring_sqe *_get_sqe(fs::_uring *ring)
+{
+    u32 head = _load_acquire(ring->sq_head);
+
+    if (ring->sq_local_tail - head >= ring->sq_entries)
+        return nullptr;
+
+    io_uring_sqe *sqe = (io_uring_sqe*)ring->sqes + (ring->sq_local_tail & ring->sq_mask);
+    ring->sq_local_tail += 1;
+
+    memset(sqe, 0, sizeof(io_uring_sqe));
+    return sqe;
+}
+
+bool fs::_uring_register_files(fs::_uring *ring, u32 count, error *err)
+{
+    assert(ring != nullptr);
+
+    int *fds = (int*)::malloc(sizeof(int) * count);
+
+    if (fds == nullptr)
+    {
+        set_error_by_code(err, ENOMEM);
+        return false;
+    }
+
+    // -1 = empty slot
+    for (u32 i = 0; i < count; ++i)
+        fds[i] = -1;
+
+    long ret = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES, fds, count);
+
+    ::free(fds);
+
+    if (ret < 0)
+    {
+        set_error_by_code(err, errno);
+        return false;
+    }
+
+    return true;
+}
+
+u32 fs::_uring_sq_space(fs::_uring *ring)
+{
+    assert(ring != nullptr);
+
+    return ring->sq_entries - (ring->sq_local_tail - _load_acquire(ring->sq_head));
+}
+
+void fs::_uring_link_last(fs::_uring *ring)
+{
+    assert(ring != nullptr);
+    assert(ring->sq_local_tail != _load_acquire(ring->sq_head));
+
+    io_uring_sqe *sqe = (io_uring_sqe*)ring->sqes + ((ring->sq_local_tail - 1) & ring->sq_mask);
+    sqe->flags |= IOSQE_IO_LINK;
+}
+
+bool fs::_uring_prep_statx(fs::_uring *ring, int dirfd, const char *pth, int flags, u32 mask, void *out, u64 user_data)
+{
+    assert(ring != nullptr);
+
+    io_uring_sqe *sqe = _get_sqe(ring);
+
+    if (sqe == nullptr)
+        return false;
+
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = dirfd;
+    sqe->addr = (u64)pth;
+    sqe->len = mask;
+    sqe->addr2 = (u64)out;
+    sqe->statx_flags = (u32)flags;
+    sqe->user_data = user_data;
+
+    return true;
+}
+
+bool fs::_uring_prep_openat(fs::_uring *ring, int dirfd, const char *pth, int flags, u32 mode, u32 slot, u64 user_data)
+{
+    assert(ring != nullptr);
+
+    io_uring_sqe *sqe = _get_sqe(ring);
+
+    if (sqe == nullptr)
+        return false;
+
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = dirfd;
+    sqe->addr = (u64)pth;
+    sqe->len = mode;
+    sqe->open_flags = (u32)flags;
+    sqe->file_index = slot + 1; // 0 = no slot
+    sqe->user_data = user_data;
+
+    return true;
+}
+
+static bool _prep_rw(fs::_uring *ring, u8 opcode, u32 slot, const void *buf, u32 size, u64 offset, u64 user_data)
+{
+    assert(ring != nullptr);
+
+    io_uring_sqe *sqe = _get_sqe(ring);
+
+    if (sqe == nullptr)
+        return false;
+
+    sqe->opcode = opcode;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = (s32)slot;
+    sqe->addr = (u64)buf;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+
+    return true;
+}
+
+bool fs::_uring_prep_read(fs::_uring *ring, u32 slot, void *buf, u32 size, u64 offset, u64 user_data)
+{
+    return _prep_rw(ring, IORING_OP_READ, slot, buf, size, offset, user_data);
+}
+
+bool fs::_uring_prep_write(fs::_uring *ring, u32 slot, const void *buf, u32 size, u64 offset, u64 user_data)
+{
+    return _prep_rw(ring, IORING_OP_WRITE, slot, buf, size, offset, user_data);
+}
+
+bool fs::_uring_prep_close(fs::_uring *ring, u32 slot, u64 user_data)
+{
+    assert(ring != nullptr);
+
+    io_uring_sqe *sqe = _get_sqe(ring);
+
+    if (sqe == nullptr)
+        return false;
+
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = slot + 1;
+    sqe->user_data = user_data;
+
+    return true;
+}
+
+bool fs::_uring_submit(fs::_uring *ring, u32 wait_count, error *err)
+{
+    assert(ring != nullptr);
+
+    _store_release(ring->sq_tail, ring->sq_local_tail);
+
+    u32 flags = wait_count > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+    while (true)
+    {
+        u32 to_submit = ring->sq_local_tail - _load_acquire(ring->sq_head);
+        long submitted = syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_count, flags, nullptr, 0);
+
+        if (submitted >= 0)
+        {
+            ring->in_flight += (u32)submitted;
+            return true;
+        }
+
+        if (errno == EINTR)
+            continue;
+
+        // the completion queue is full or the kernel is out of memory for
+        // requests, the caller has to reap completions first.
+        if (errno == EAGAIN || errno == EBUSY)
+            return true;
+
+        set_error_by_code(err, errno);
+        return false;
+    }
+}
+
+s32 fs::_uring_reap(fs::_uring *ring, fs::_uring_completion *out, s32 max_count)
+{
+    assert(ring != nullptr);
+    assert(out != nullptr);
+
+    // only this side writes the head
+    u32 head = *ring->cq_head;
+    u32 tail = _load_acquire(ring->cq_tail);
+    s32 count = 0;
+
+    while (head != tail && count < max_count)
+    {
+        const io_uring_cqe *cqe = (const io_uring_cqe*)ring->cqes + (head & ring->cq_mask);
+
+        out[count].user_data = cqe->user_data;
+        out[count].result = cqe->res;
+        out[count].flags = cqe->flags;
+
+        head += 1;
+        count += 1;
+    }
+
+    _store_release(ring->cq_head, head);
+    ring->in_flight -= (u32)count;
+
+    return count;
+}
+
+u32 fs::_uring_in_flight(fs::_uring *ring)
+{
+    assert(ring != nullptr);
+
+    return ring->in_flight;
+}
+
+bool fs::_uring_wait(fs::_uring *ring, error *err)
+{
+    assert(ring != nullptr);
+
+    while (ring->in_flight > 0)
+    {
+        if (_load_acquire(ring->cq_tail) != *ring->cq_head)
+            return true;
+
+        // to_submit = 0, operations queued after a failed submit stay queued
+        if (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) >= 0)
+            return true;
+
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+            continue;
+
+        set_error_by_code(err, errno);
+        return false;
+    }
+
+    return true;
+}
+#endif // if Linux
@@ -0,0 +1,594 @@
+
+#include "shl/assert.hpp"
+#include "shl/memory.hpp"
+#include "shl/defer.hpp"
+#include "fs/negative_cache.hpp"
+#include "fs/impl/hash.hpp"
+#include "fs/impl/cache.hpp"
+
+#if Windows
+#include <windows.h>
+#else
+#include <errno.h>
+#include <time.h>
+#endif
+
+// bits per entry and probes per lookup, ~0.2% false positives at capacity
+#define NEGATIVE_CACHE_BLOOM_BITS_PER_ENTRY 16
+#define NEGATIVE_CACHE_BLOOM_PROBES         4
+
+// directories modified less than this many seconds ago may be modified again
+// without changing their modification time (timestamps are only updated every
+// few milliseconds, or seconds on some filesystems), so missing paths in them
+// are not cached with Revalidate.
+#define NEGATIVE_CACHE_RACY_SECONDS 2
+
+static void _bloom_add(array<u64> *bloom, u64 h)
+{
+    u64 mask = (u64)bloom->size * 64 - 1;
+    u64 h2 = (h >> 32) | 1;
+
+    for (u64 i = 0; i < NEGATIVE_CACHE_BLOOM_PROBES; ++i)
+    {
+        u64 bit = (h + i * h2) & mask;
+        bloom->data[bit >> 6] |= 1ull << (bit & 63);
+    }
+}
+
+static bool _bloom_test(const array<u64> *bloom, u64 h)
+{
+    u64 mask = (u64)bloom->size * 64 - 1;
+    u64 h2 = (h >> 32) | 1;
+
+    for (u64 i = 0; i < NEGATIVE_CACHE_BLOOM_PROBES; ++i)
+    {
+        u64 bit = (h + i * h2) & mask;
+
+        if ((bloom->data[bit >> 6] & (1ull << (bit & 63))) == 0)
+            return false;
+    }
+
+    return true;
+}
+
+static inline u64 _key_hash(fs::const_fs_string pth)
+{
+    return fs::_hash_bytes(pth.c_str, pth.size * (s64)sizeof(fs::path_char_t), 0);
+}
+
+static void _clear_generation(fs::_negative_cache_generation *gen)
+{
+    for_hash_table(k, v, &gen->entries)
+    {
+        (void)k;
+        fs::free(&v->path);
+    }
+
+    ::clear(&gen->entries);
+    gen->count = 0;
+
+    for_array(word, &gen->bloom)
+        *word = 0;
+}
+
+// cache must be locked. the bits of the entry stay in the bloom filter,
+// lookups of the key then search the table and don't find it.
+static void _remove_entry(fs::_negative_cache_generation *gen, const fs::path *key)
+{
+    fs::negative_cache_entry *entry = ::search(&gen->entries, key);
+
+    if (entry == nullptr)
+        return;
+
+    // the key in the table uses the memory of entry->path
+    fs::path pth = entry->path;
+
+    ::remove_element_by_key(&gen->entries, key);
+    fs::free(&pth);
+    gen->count -= 1;
+}
+
+// cache must be locked
+static void _invalidate(fs::negative_cache *cache, fs::const_fs_string pth)
+{
+    array<fs::path> to_remove{};
+    defer { ::free(&to_remove); };
+
+    for (s32 i = 0; i < 2; ++i)
+    {
+        fs::_negative_cache_generation *gen = cache->generations + i;
+        ::clear(&to_remove);
+
+        for_hash_table(k, v, &gen->entries)
+        {
+            (void)v;
+
+            if (fs::_is_under(to_const_string(k), pth))
+                ::add_at_end(&to_remove, *k);
+        }
+
+        // to_remove holds copies of the keys in the table, _remove_entry frees their memory
+        for_array(k, &to_remove)
+            _remove_entry(gen, k);
+    }
+}
+
+static void _watcher_callback(fs::watcher_event *event)
+{
+    fs::negative_cache *cache = (fs::negative_cache*)event->userdata;
+
+    if (cache == nullptr)
+        return;
+
+    // negative_cache_process_events holds the lock while events are processed.
+    // created or moved paths may be (or contain) cached paths. removed or
+    // moved directories are no longer watched, so entries inside them are
+    // dropped as well.
+    cache->_events += 1;
+    _invalidate(cache, event->path);
+}
+
+// cache must be locked. watches the closest existing directory containing pth.
+// returns whether pth is watched.
+static bool _watch_closest_directory(fs::negative_cache *cache, fs::const_fs_string pth, bool *added)
+{
+    fs::path dir{};
+    defer { fs::free(&dir); };
+
+    fs::const_fs_string current = pth;
+    *added = false;
+
+    while (true)
+    {
+        fs::const_fs_string parent = fs::parent_path_segment(current);
+
+        // events of relative paths would not match the key of the entry
+        if (parent.size == 0 || parent.size >= current.size)
+            return false;
+
+        current = parent;
+        fs::path_set(&dir, parent);
+
+        if (::search(&cache->watched_directories, &dir) != nullptr)
+            return true;
+
+        // does not exist (yet), watch the directory above it
+        if (!fs::filesystem_watcher_watch_directory(cache->watcher, &dir, fs::watcher_event_type::Created | fs::watcher_event_type::MovedTo | fs::watcher_event_type::Removed | fs::watcher_event_type::MovedFrom, cache))
+            continue;
+
+        bool *val = ::add_element_by_key(&cache->watched_directories, &dir);
+        *val = true;
+
+        // the table owns the memory now
+        dir = fs::path{};
+        *added = true;
+
+        return true;
+    }
+}
+
+// false if the stamp can't be used to revalidate
+static bool _get_stamp(fs::const_fs_string pth, fs::negative_cache_stamp *out)
+{
+    fill_memory(out, 0);
+
+    fs::const_fs_string parent = fs::parent_path_segment(pth);
+
+    if (parent.size == 0)
+        parent = fs::const_fs_string{SYS_CHAR("."), 1};
+
+    fs::filesystem_info info;
+    error err{};
+
+    if (!fs::_query_filesystem(parent, &info, true, fs::query_flag::FileTimes, &err))
+    {
+#if Windows
+        out->parent_exists = !(err.error_code == ERROR_FILE_NOT_FOUND || err.error_code == ERROR_PATH_NOT_FOUND);
+#else
+        out->parent_exists = err.error_code != ENOENT;
+#endif
+        // a missing parent is a valid stamp, other errors are not
+        return !out->parent_exists;
+    }
+
+    out->parent_exists = true;
+
+#if Windows
+    out->last_write_time = info.detail.file_times.last_write_time;
+
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+
+    u64 now_time = ((u64)now.dwHighDateTime << 32) | now.dwLowDateTime;
+
+    // FILETIME is in 100 nanosecond units
+    return now_time >= out->last_write_time + NEGATIVE_CACHE_RACY_SECONDS * 10000000ull;
+#else
+    out->mtime = info.stx_mtime;
+
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return (s64)now.tv_sec >= out->mtime.tv_sec + NEGATIVE_CACHE_RACY_SECONDS;
+#endif
+}
+
+static bool _same_stamp(const fs::negative_cache_stamp *a, const fs::negative_cache_stamp *b)
+{
+    if (a->parent_exists != b->parent_exists)
+        return false;
+
+    if (!a->parent_exists)
+        return true;
+
+#if Windows
+    return a->last_write_time == b->last_write_time;
+#else
+    return a->mtime.tv_sec == b->mtime.tv_sec
+        && a->mtime.tv_nsec == b->mtime.tv_nsec;
+#endif
+}
+
+static void _init_generation(fs::_negative_cache_generation *gen, s64 capacity)
+{
+    ::init(&gen->entries);
+    ::init(&gen->bloom);
+    gen->count = 0;
+
+    // power of two bits so probes can be masked
+    s64 bits = 64;
+
+    while (bits < capacity * NEGATIVE_CACHE_BLOOM_BITS_PER_ENTRY)
+        bits *= 2;
+
+    ::reserve(&gen->bloom, bits / 64);
+
+    for (s64 i = 0; i < bits / 64; ++i)
+        ::add_at_end(&gen->bloom, (u64)0);
+}
+
+void fs::init(fs::negative_cache *cache)
+{
+    [[maybe_unused]] bool ret = fs::init(cache, fs::negative_cache_validation::None);
+    assert(ret);
+}
+
+bool fs::init(fs::negative_cache *cache, fs::negative_cache_validation validation, s64 capacity, error *err)
+{
+    assert(cache != nullptr);
+    assert(capacity >= 2);
+
+    cache->generation_capacity = capacity / 2;
+    _init_generation(cache->generations + 0, cache->generation_capacity);
+    _init_generation(cache->generations + 1, cache->generation_capacity);
+    cache->current = 0;
+    cache->validation = validation;
+
+    ::init(&cache->watched_directories);
+    cache->watcher = nullptr;
+    cache->_events = 0;
+    fill_memory(&cache->counters, 0);
+    fs::_mutex_init(&cache->_lock);
+
+    if (validation == fs::negative_cache_validation::Watcher)
+    {
+        cache->watcher = fs::filesystem_watcher_create(_watcher_callback, err);
+
+        if (cache->watcher == nullptr)
+        {
+            fs::free(cache);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void fs::free(fs::negative_cache *cache)
+{
+    if (cache == nullptr)
+        return;
+
+    for (s32 i = 0; i < 2; ++i)
+    {
+        _clear_generation(cache->generations + i);
+        ::free(&cache->generations[i].entries);
+        ::free(&cache->generations[i].bloom);
+    }
+
+    for_hash_table(k, v, &cache->watched_directories)
+    {
+        (void)v;
+        fs::free(k);
+    }
+
+    ::free(&cache->watched_directories);
+
+    if (cache->watcher != nullptr)
+    {
+        fs::filesystem_watcher_destroy(cache->watcher);
+        cache->watcher = nullptr;
+    }
+
+    fs::_mutex_free(&cache->_lock);
+}
+
+void fs::negative_cache_clear(fs::negative_cache *cache)
+{
+    assert(cache != nullptr);
+
+    fs::_mutex_lock(&cache->_lock);
+    _clear_generation(cache->generations + 0);
+    _clear_generation(cache->generations + 1);
+    fs::_mutex_unlock(&cache->_lock);
+}
+
+void fs::_negative_cache_invalidate(fs::negative_cache *cache, fs::const_fs_string pth)
+{
+    assert(cache != nullptr);
+
+    fs::_mutex_lock(&cache->_lock);
+    _invalidate(cache, pth);
+    fs::_mutex_unlock(&cache->_lock);
+}
+
+bool fs::negative_cache_process_events(fs::negative_cache *cache, error *err)
+{
+    assert(cache != nullptr);
+
+    if (cache->watcher == nullptr)
+        return true;
+
+    fs::_mutex_lock(&cache->_lock);
+    defer { fs::_mutex_unlock(&cache->_lock); };
+
+    if (!fs::filesystem_watcher_has_events(cache->watcher, err))
+        return true;
+
+    return fs::filesystem_watcher_process_events(cache->watcher, err);
+}
+
+void fs::negative_cache_get_counters(fs::negative_cache *cache, fs::negative_cache_counters *out)
+{
+    assert(cache != nullptr);
+    assert(out != nullptr);
+
+    fs::_mutex_lock(&cache->_lock);
+    *out = cache->counters;
+    fs::_mutex_unlock(&cache->_lock);
+}
+
+// cache must be locked. adds pth to the current generation, dropping the
+// older generation if the current one is full.
+static void _add_entry(fs::negative_cache *cache, fs::path owned, u64 h, bool follow_symlinks, const fs::negative_cache_stamp *stamp)
+{
+    fs::_negative_cache_generation *gen = cache->generations + cache->current;
+
+    if (gen->count >= cache->generation_capacity)
+    {
+        cache->current = 1 - cache->current;
+        gen = cache->generations + cache->current;
+        _clear_generation(gen);
+    }
+
+    // the table key shares its memory with entry->path
+    fs::negative_cache_entry *entry = ::add_element_by_key(&gen->entries, &owned);
+    assert(entry != nullptr);
+
+    entry->path = owned;
+    entry->follow_symlinks = follow_symlinks;
+    entry->stamp = *stamp;
+
+    _bloom_add(&gen->bloom, h);
+    gen->count += 1;
+}
+
+// cache must be locked. if key is cached for lookups with follow_symlinks,
+// moves it to the current generation and returns it.
+static fs::negative_cache_entry *_lookup(fs::negative_cache *cache, const fs::path *key, u64 h, bool follow_symlinks)
+{
+    bool maybe_cached = false;
+
+    for (s32 i = 0; i < 2; ++i)
+    {
+        s32 index = i == 0 ? cache->current : 1 - cache->current;
+        fs::_negative_cache_generation *gen = cache->generations + index;
+
+        if (!_bloom_test(&gen->bloom, h))
+            continue;
+
+        maybe_cached = true;
+        fs::negative_cache_entry *entry = ::search(&gen->entries, key);
+
+        // a path may be missing when following symlinks, but exist as
+        // a broken symlink.
+        if (entry == nullptr || (entry->follow_symlinks && !follow_symlinks))
+            continue;
+
+        if (index == cache->current)
+            return entry;
+
+        fs::negative_cache_entry moved = *entry;
+        ::remove_element_by_key(&gen->entries, key);
+        gen->count -= 1;
+
+        _add_entry(cache, moved.path, h, moved.follow_symlinks, &moved.stamp);
+
+        return ::search(&cache->generations[cache->current].entries, key);
+    }
+
+    if (!maybe_cached)
+        cache->counters.bloom_rejects += 1;
+
+    return nullptr;
+}
+
+// returns whether pth is known to be missing
+static bool _is_cached(fs::negative_cache *cache, fs::const_fs_string pth, u64 h, bool follow_symlinks, s64 *events)
+{
+    // not owning, only used to look up the entry
+    fs::path key{};
+    key.data = const_cast<fs::path_char_t*>(pth.c_str);
+    key.size = pth.size;
+
+    fs::negative_cache_stamp stamp{};
+    bool revalidate = cache->validation == fs::negative_cache_validation::Revalidate;
+
+    fs::_mutex_lock(&cache->_lock);
+
+    fs::negative_cache_entry *entry = _lookup(cache, &key, h, follow_symlinks);
+    bool found = entry != nullptr;
+
+    if (found)
+        stamp = entry->stamp;
+
+    if (!found)
+        cache->counters.misses += 1;
+    else if (!revalidate)
+        cache->counters.hits += 1;
+
+    *events = cache->_events;
+    fs::_mutex_unlock(&cache->_lock);
+
+    if (!found || !revalidate)
+        return found;
+
+    fs::negative_cache_stamp current{};
+    found = _get_stamp(pth, &current) && _same_stamp(&current, &stamp);
+
+    fs::_mutex_lock(&cache->_lock);
+
+    if (found)
+        cache->counters.hits += 1;
+    else
+    {
+        cache->counters.misses += 1;
+        _remove_entry(cache->generations + 0, &key);
+        _remove_entry(cache->generations + 1, &key);
+    }
+
+    fs::_mutex_unlock(&cache->_lock);
+
+    return found;
+}
+
+// pth was found missing after _is_cached returned events
+static void _add_missing(fs::negative_cache *cache, fs::const_fs_string pth, u64 h, bool follow_symlinks, s64 events)
+{
+    fs::negative_cache_stamp stamp{};
+
+    if (cache->validation == fs::negative_cache_validation::Revalidate
+     && !_get_stamp(pth, &stamp))
+        return;
+
+    fs::_mutex_lock(&cache->_lock);
+    defer { fs::_mutex_unlock(&cache->_lock); };
+
+    // something changed since the path was checked, it may exist now
+    if (cache->_events != events)
+        return;
+
+    if (cache->validation == fs::negative_cache_validation::Watcher)
+    {
+        bool added = false;
+
+        if (!_watch_closest_directory(cache, pth, &added))
+            return;
+
+        // events before the directory was watched are lost
+        if (added && fs::_exists(pth, follow_symlinks, nullptr) != 0)
+            return;
+    }
+
+    // not owning, only used to look up the entry
+    fs::path key{};
+    key.data = const_cast<fs::path_char_t*>(pth.c_str);
+    key.size = pth.size;
+
+    // another thread may have added the same path in the meantime
+    for (s32 i = 0; i < 2; ++i)
+    {
+        fs::negative_cache_entry *entry = ::search(&cache->generations[i].entries, &key);
+
+        if (entry != nullptr)
+        {
+            entry->follow_symlinks = entry->follow_symlinks && follow_symlinks;
+            entry->stamp = stamp;
+            return;
+        }
+    }
+
+    fs::path owned{};
+    fs::path_set(&owned, pth);
+
+    _add_entry(cache, owned, h, follow_symlinks, &stamp);
+}
+
+static inline bool _is_missing_error(const error *err)
+{
+#if Windows
+    return err->error_code == ERROR_FILE_NOT_FOUND || err->error_code == ERROR_PATH_NOT_FOUND;
+#else
+    return err->error_code == ENOENT;
+#endif
+}
+
+static inline void _set_missing_error(error *err)
+{
+#if Windows
+    set_error_by_code(err, ERROR_FILE_NOT_FOUND);
+#else
+    set_error_by_code(err, ENOENT);
+#endif
+}
+
+int fs::_exists(fs::const_fs_string pth, fs::negative_cache *cache, bool follow_symlinks, error *err)
+{
+    assert(cache != nullptr);
+
+    u64 h = _key_hash(pth);
+    s64 events = 0;
+
+    if (_is_cached(cache, pth, h, follow_symlinks, &events))
+    {
+#if Windows
+        // same as exists without cache
+        _set_missing_error(err);
+#endif
+        return 0;
+    }
+
+    int ret = fs::_exists(pth, follow_symlinks, err);
+
+    if (ret == 0)
+        _add_missing(cache, pth, h, follow_symlinks, events);
+
+    return ret;
+}
+
+bool fs::_query_filesystem(fs::const_fs_string pth, fs::filesystem_info *out, fs::negative_cache *cache, bool follow_symlinks, fs::query_flag flags, error *err)
+{
+    assert(cache != nullptr);
+
+    u64 h = _key_hash(pth);
+    s64 events = 0;
+
+    if (_is_cached(cache, pth, h, follow_symlinks, &events))
+    {
+        _set_missing_error(err);
+        return false;
+    }
+
+    error _err{};
+
+    if (fs::_query_filesystem(pth, out, follow_symlinks, flags, &_err))
+        return true;
+
+    if (err != nullptr)
+        *err = _err;
+
+    if (_is_missing_error(&_err))
+        _add_missing(cache, pth, h, follow_symlinks, events);
+
+    return false;
+}
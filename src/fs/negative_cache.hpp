@@ -0,0 +1,204 @@
+
+/* negative_cache.hpp
+
+Remembers paths that recently did not exist, for programs that probe many
+candidate paths which mostly don't exist, e.g. looking up headers in a list
+of include directories or plugins in a list of search paths.
+
+Example usage:
+
+    fs::negative_cache cache{};
+    fs::init(&cache, fs::negative_cache_validation::Watcher);
+
+    for (...each include directory and header...)
+        // only the first probe of a missing candidate asks the filesystem
+        if (fs::exists(candidate, &cache) == 1)
+            ...
+
+    // e.g. once per frame / tick, drops entries of created files
+    fs::negative_cache_process_events(&cache);
+
+    fs::free(&cache);
+
+Each lookup first checks a bloom filter of the cached paths, so lookups of
+paths that are not in the cache (e.g. paths that exist) cost a few bit tests
+before the filesystem is asked. Paths in the cache are answered without any
+system call (unless the cache revalidates, see below).
+
+The cache is bounded: it holds two generations of at most Capacity / 2 paths
+each. When the current generation is full, the older one is dropped and the
+current one becomes the older one. Paths found in the older generation move
+to the current one, so paths that are probed repeatedly stay in the cache.
+
+Entries are keyed by the exact path string, so normalized paths get more cache
+hits. Only missing paths are cached (ENOENT / ERROR_FILE_NOT_FOUND), paths
+that fail for other reasons (e.g. permissions) are not.
+
+A negative_cache may be shared between threads, all functions lock the cache
+while accessing it.
+
+Types:
+
+enum class negative_cache_validation
+    How entries of a negative_cache are kept up to date:
+
+    None:       entries stay until they are dropped (see above) or invalidated
+                with negative_cache_invalidate.
+    Revalidate: the modification time of the parent directory is recorded with
+                each entry and compared on every hit, costing one query of the
+                parent directory instead of a lookup of the full path.
+    Watcher:    the cache owns a filesystem_watcher which watches the closest
+                existing directory of every entry, and negative_cache_process_events
+                drops entries when something is created or moved there.
+                Hits don't make any system call. Paths should be canonical,
+                since events are reported with canonical paths, and the
+                targets of symlinks in the paths are not watched.
+                Directories that are removed and created again while
+                they are watched are not watched again.
+
+struct negative_cache
+    Set of recently missing paths.
+
+struct negative_cache_counters
+    hits:          number of lookups answered from the cache.
+    misses:        number of lookups that queried the filesystem.
+    bloom_rejects: number of misses the bloom filter rejected without a
+                   lookup in the entries.
+
+Functions:
+
+init(*Cache)
+    Initializes an empty Cache without validation.
+
+init(*Cache, Validation, Capacity = 4096[, err])
+    Initializes an empty Cache which holds at most Capacity paths with the
+    given validation.
+    Returns whether or not the function succeeded.
+
+free(*Cache)
+    Frees all memory used by Cache.
+
+negative_cache_clear(*Cache)
+    Removes all entries from Cache.
+
+negative_cache_invalidate(*Cache, PathStr)
+    Removes the entries of PathStr and of anything inside PathStr, e.g. after
+    creating PathStr. Useful to forward events of your own filesystem_watcher to Cache.
+
+negative_cache_process_events(*Cache[, err])
+    If Cache uses negative_cache_validation::Watcher, processes pending
+    filesystem events and removes the affected entries. Does nothing otherwise.
+    Returns whether or not the function succeeded.
+
+negative_cache_get_counters(*Cache, *OutCounters)
+    Sets OutCounters to the counters of Cache.
+
+exists(PathStr, *Cache, FollowSymlinks = true[, err])
+    Same as exists without Cache. Returns 0 without asking the filesystem if
+    PathStr is in Cache, otherwise checks PathStr and adds it to Cache if it
+    does not exist.
+
+query_filesystem(PathStr, *Out, *Cache, FollowSymlinks = true, Flags = fs::query_flag_default[, err])
+    Same as query_filesystem without Cache. Fails with ENOENT
+    (ERROR_FILE_NOT_FOUND on Windows) without asking the filesystem if PathStr
+    is in Cache, otherwise queries PathStr and adds it to Cache if it does not exist.
+*/
+
+#pragma once
+
+#include "shl/hash_table.hpp"
+#include "fs/path.hpp"
+#include "fs/filesystem_watcher.hpp"
+#include "fs/impl/parallel.hpp"
+
+namespace fs
+{
+enum class negative_cache_validation : u8
+{
+    None,
+    Revalidate,
+    Watcher
+};
+
+// the parent directory of a missing path at the time it was cached
+struct negative_cache_stamp
+{
+    bool parent_exists;
+#if Windows
+    u64 last_write_time;
+#else
+    fs::filesystem_timestamp mtime;
+#endif
+};
+
+struct negative_cache_entry
+{
+    fs::path path; // owns the memory of the key of the entry
+    bool follow_symlinks;
+    fs::negative_cache_stamp stamp;
+};
+
+struct _negative_cache_generation
+{
+    hash_table<fs::path, fs::negative_cache_entry> entries;
+    array<u64> bloom; // bits of the bloom filter of entries
+    s64 count;
+};
+
+struct negative_cache_counters
+{
+    s64 hits;
+    s64 misses;
+    s64 bloom_rejects;
+};
+
+struct negative_cache
+{
+    fs::_negative_cache_generation generations[2];
+    s32 current; // index of the current generation
+    s64 generation_capacity;
+    fs::negative_cache_validation validation;
+
+    fs::filesystem_watcher *watcher;
+    hash_table<fs::path, bool> watched_directories;
+
+    fs::negative_cache_counters counters;
+    s64 _events; // number of processed watcher events
+    fs::_mutex _lock;
+};
+
+void init(fs::negative_cache *cache);
+bool init(fs::negative_cache *cache, fs::negative_cache_validation validation, s64 capacity = 4096, error *err = nullptr);
+void free(fs::negative_cache *cache);
+
+void negative_cache_clear(fs::negative_cache *cache);
+
+void _negative_cache_invalidate(fs::negative_cache *cache, fs::const_fs_string pth);
+
+template<typename T>
+auto negative_cache_invalidate(fs::negative_cache *cache, T pth)
+    -> decltype(fs::_negative_cache_invalidate(cache, ::to_const_string(fs::get_platform_string(pth))))
+{
+    auto pth_str = fs::get_platform_string(pth);
+    fs::_negative_cache_invalidate(cache, ::to_const_string(pth_str));
+
+    if constexpr (needs_conversion(T))
+        fs::_free_platform_string(&pth_str);
+}
+
+bool negative_cache_process_events(fs::negative_cache *cache, error *err = nullptr);
+
+void negative_cache_get_counters(fs::negative_cache *cache, fs::negative_cache_counters *out);
+
+int _exists(fs::const_fs_string pth, fs::negative_cache *cache, bool follow_symlinks, error *err);
+
+template<typename T>
+auto exists(T pth, fs::negative_cache *cache, bool follow_symlinks = true, error *err = nullptr)
+    define_fs_conversion_body(fs::_exists, pth, cache, follow_symlinks, err)
+
+bool _query_filesystem(fs::const_fs_string pth, fs::filesystem_info *out, fs::negative_cache *cache, bool follow_symlinks, fs::query_flag flags, error *err);
+
+template<typename T>
+auto query_filesystem(T pth, fs::filesystem_info *out, fs::negative_cache *cache, bool follow_symlinks = true, fs::query_flag flags = fs::query_flag_default, error *err = nullptr)
+    define_fs_conversion_body(fs::_query_filesystem, pth, out, cache, follow_symlinks, flags, err)
+}
@@ -0,0 +1,153 @@
+
+#include "shl/assert.hpp"
+#include "shl/memory.hpp"
+#include "fs/operation_control.hpp"
+#include "fs/impl/time.hpp"
+
+#if Windows
+#include <windows.h>
+#else
+#include <errno.h>
+#endif
+
+static void _set_cancelled_error(error *err)
+{
+#if Windows
+    set_error_by_code(err, ERROR_CANCELLED);
+#else
+    set_error_by_code(err, ECANCELED);
+#endif
+}
+
+// control must be locked
+static void _get_progress(fs::operation_control *control, fs::operation_progress *out, const fs::path *pth)
+{
+    out->bytes_done = control->bytes_done.load(std::memory_order_relaxed);
+    out->files_done = control->files_done.load(std::memory_order_relaxed);
+    out->elapsed = fs::_monotonic_time() - control->start_time;
+    out->bytes_per_second = 0.0;
+    out->files_per_second = 0.0;
+    out->path = to_const_string(pth);
+
+    if (out->elapsed > 0)
+    {
+        double seconds = (double)out->elapsed / 1000000000.0;
+        out->bytes_per_second = (double)out->bytes_done / seconds;
+        out->files_per_second = (double)out->files_done / seconds;
+    }
+}
+
+static bool _call_callback(fs::operation_control *control, error *err)
+{
+    if (control->callback != nullptr)
+    {
+        fs::operation_progress progress;
+
+        fs::_mutex_lock(&control->_lock);
+        _get_progress(control, &progress, &control->_current_path);
+        bool go_on = control->callback(&progress, control->userdata);
+        fs::_mutex_unlock(&control->_lock);
+
+        if (!go_on)
+            fs::operation_cancel(control);
+    }
+
+    return fs::_operation_check(control, err);
+}
+
+void fs::init(fs::operation_control *control, fs::operation_callback callback, void *userdata)
+{
+    assert(control != nullptr);
+
+    control->cancelled = false;
+    control->bytes_done = 0;
+    control->files_done = 0;
+    control->callback = callback;
+    control->userdata = userdata;
+    control->start_time = fs::_monotonic_time();
+    fill_memory(&control->_current_path, 0);
+    fill_memory(&control->_progress_path, 0);
+    fs::_mutex_init(&control->_lock);
+}
+
+void fs::free(fs::operation_control *control)
+{
+    if (control == nullptr)
+        return;
+
+    fs::free(&control->_current_path);
+    fs::free(&control->_progress_path);
+    fs::_mutex_free(&control->_lock);
+}
+
+void fs::operation_cancel(fs::operation_control *control)
+{
+    assert(control != nullptr);
+
+    control->cancelled.store(true, std::memory_order_relaxed);
+}
+
+bool fs::operation_cancelled(const fs::operation_control *control)
+{
+    assert(control != nullptr);
+
+    return control->cancelled.load(std::memory_order_relaxed);
+}
+
+void fs::operation_get_progress(fs::operation_control *control, fs::operation_progress *out)
+{
+    assert(control != nullptr);
+    assert(out != nullptr);
+
+    fs::_mutex_lock(&control->_lock);
+    fs::path_set(&control->_progress_path, &control->_current_path);
+    _get_progress(control, out, &control->_progress_path);
+    fs::_mutex_unlock(&control->_lock);
+}
+
+bool fs::_operation_check(fs::operation_control *control, error *err)
+{
+    if (control == nullptr)
+        return true;
+
+    if (!fs::operation_cancelled(control))
+        return true;
+
+    _set_cancelled_error(err);
+    return false;
+}
+
+bool fs::_operation_file_started(fs::operation_control *control, fs::const_fs_string pth, error *err)
+{
+    if (control == nullptr)
+        return true;
+
+    if (!fs::_operation_check(control, err))
+        return false;
+
+    fs::_mutex_lock(&control->_lock);
+    fs::path_set(&control->_current_path, pth);
+    fs::_mutex_unlock(&control->_lock);
+
+    return true;
+}
+
+bool fs::_operation_bytes_done(fs::operation_control *control, s64 bytes, error *err)
+{
+    if (control == nullptr)
+        return true;
+
+    control->bytes_done.fetch_add(bytes, std::memory_order_relaxed);
+
+    return _call_callback(control, err);
+}
+
+bool fs::_operation_file_done(fs::operation_control *control, error *err)
+{
+    if (control == nullptr)
+        return true;
+
+    control->files_done.fetch_add(1, std::memory_order_relaxed);
+
+    return _call_callback(control, err);
+}
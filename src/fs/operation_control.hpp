@@ -0,0 +1,141 @@
+
+/* operation_control.hpp
+
+Progress, throughput and cancellation of long running operations:
+copy_file, copy_directory, copy and remove_directory take an optional
+operation_control. Without one, the operations only compare a pointer to
+nullptr where they would report progress.
+
+Example usage:
+
+    static bool print_progress(const fs::operation_progress *progress, void *userdata)
+    {
+        printf("%lld files, %.1f MB/s, %s\n", progress->files_done,
+               progress->bytes_per_second / 1000000.0, progress->path.c_str);
+
+        return true; // false cancels the operation
+    }
+
+    fs::operation_control control{};
+    fs::init(&control, print_progress);
+
+    // e.g. on another thread, when the user cancels
+    fs::operation_cancel(&control);
+
+    if (!fs::copy_directory(from, to, -1, fs::copy_file_option::OverwriteExisting,
+                            {.thread_count = 4, .control = &control}, &err))
+        ...
+
+    fs::free(&control);
+
+The operations check for cancellation between files and between chunks of
+large files (and copy_file_range / CopyFileEx progress on Windows), and fail
+with ECANCELED (ERROR_CANCELLED on Windows) once cancelled. The destination
+file being copied when the operation is cancelled is left partially copied.
+Removing does not count bytes, only files.
+
+A control may be polled from other threads while an operation runs, and is
+updated from all threads of a copy_directory with multiple threads. The
+callback is called with the lock of the control held, so it is never called
+concurrently, but may be called from any of the threads.
+
+Types:
+
+struct operation_progress
+    bytes_done:       number of bytes copied so far.
+    files_done:       number of files copied or removed so far.
+    elapsed:          nanoseconds since the control was initialized.
+    bytes_per_second: average throughput since the control was initialized.
+    files_per_second: average number of files since the control was initialized.
+    path:             the file the operation most recently started. Only valid
+                      while the callback runs, or until the next call to
+                      operation_get_progress.
+
+typedef operation_callback
+    bool (*)(const fs::operation_progress *Progress, void *Userdata)
+    Called after each file and after each chunk of large files.
+    Returns false to cancel the operation.
+
+struct operation_control
+    Counters and cancellation flag of an operation. May be reused for several
+    operations, the counters add up.
+
+Functions:
+
+init(*Control, Callback = nullptr, Userdata = nullptr)
+    Initializes Control and starts the clock of its rates.
+
+free(*Control)
+    Frees all memory used by Control.
+
+operation_cancel(*Control)
+    Cancels the operations using Control. Safe to call from any thread and
+    from the callback.
+
+operation_cancelled(*Control)
+    Returns whether Control was cancelled.
+
+operation_get_progress(*Control, *OutProgress)
+    Sets OutProgress to the current progress of Control.
+    Must not be called from the callback, which gets the progress already.
+*/
+
+#pragma once
+
+#include <atomic>
+
+#include "shl/error.hpp"
+#include "fs/path.hpp"
+#include "fs/impl/parallel.hpp"
+
+namespace fs
+{
+struct operation_progress
+{
+    s64 bytes_done;
+    s64 files_done;
+    s64 elapsed; // ns
+    double bytes_per_second;
+    double files_per_second;
+    fs::const_fs_string path;
+};
+
+typedef bool (*operation_callback)(const fs::operation_progress *progress, void *userdata);
+
+struct operation_control
+{
+    std::atomic<bool> cancelled;
+    std::atomic<s64> bytes_done;
+    std::atomic<s64> files_done;
+
+    fs::operation_callback callback;
+    void *userdata;
+
+    s64 start_time; // monotonic, ns
+    fs::path _current_path;
+    fs::path _progress_path; // path of the last operation_get_progress
+    fs::_mutex _lock;
+};
+
+void init(fs::operation_control *control, fs::operation_callback callback = nullptr, void *userdata = nullptr);
+void free(fs::operation_control *control);
+
+void operation_cancel(fs::operation_control *control);
+bool operation_cancelled(const fs::operation_control *control);
+
+void operation_get_progress(fs::operation_control *control, fs::operation_progress *out);
+
+// used by the operations, all do nothing and return true if control is nullptr.
+
+// fails with ECANCELED if control was cancelled
+bool _operation_check(fs::operation_control *control, error *err);
+
+// checks for cancellation and sets the current path
+bool _operation_file_started(fs::operation_control *control, fs::const_fs_string pth, error *err);
+
+// adds bytes, calls the callback and checks for cancellation
+bool _operation_bytes_done(fs::operation_control *control, s64 bytes, error *err);
+
+// adds a file, calls the callback and checks for cancellation
+bool _operation_file_done(fs::operation_control *control, error *err);
+}
@@ -8,6 +8,7 @@
 #include <ioapiset.h>
 #include <winioctl.h>
 #include <direct.h>
+#include <malloc.h> // _aligned_malloc
 #else
 // ---------- LINUX ----------
 #include <string.h> // strerror
@@ -17,6 +18,7 @@
 #include "shl/impl/linux/fs.hpp"
 #include "shl/impl/linux/io.hpp"
 #include "shl/impl/linux/statx.hpp"
+#include "shl/macros.hpp" // offset_of
 #endif
 
 #include <stdlib.h>
@@ -24,8 +26,18 @@
 #include "shl/memory.hpp"
 #include "shl/defer.hpp"
 #include "shl/error.hpp"
+#include "shl/sort.hpp"
 
 #include "fs/path.hpp"
+#include "fs/resolve_cache.hpp"
+#include "fs/impl/scan.hpp"
+#include "fs/impl/parallel.hpp"
+#include "fs/impl/hash.hpp"
+#include "fs/impl/uring.hpp"
+#include "fs/impl/copy.hpp"
+#include "fs/impl/crc32c.hpp"
+#include "fs/impl/read.hpp"
+#include "fs/operation_control.hpp"
 
 #define empty_fs_string     fs::const_fs_string{SYS_CHAR(""), 0}
 
@@ -161,6 +173,14 @@ bool operator>=(statx_timestamp lhs, statx_timestamp rhs) { return !(lhs < rhs);
 #define as_array_ptr(x)     (::array<fs::path_char_t>*)(x)
 #define as_string_ptr(x)    (::string_base<fs::path_char_t>*)(x)
 
+// index of the next path separator in [i, end), or end if there is none
+inline s64 _next_separator(const fs::path_char_t *str, s64 i, s64 end)
+{
+    s64 found = fs::_scan_first_separator(str + i, end - i);
+
+    return found < 0 ? end : i + found;
+}
+
 inline bool _is_dot_filename(fs::const_fs_string str)
 {
     return str.size == 1
@@ -402,6 +422,233 @@ bool fs::_query_filesystem(fs::const_fs_string pth, fs::filesystem_info *out, bo
 #endif
 }
 
+#define QUERY_BATCH_DEFAULT_QUEUE_DEPTH  64
+#define QUERY_BATCH_MIN_PARALLEL_COUNT   16
+#define QUERY_BATCH_CHUNK_SIZE           16
+#define QUERY_BATCH_REAP_COUNT           64
+
+struct _query_batch_context
+{
+    // only one of paths and strings is set
+    const fs::path *paths;
+    const fs::const_fs_string *strings;
+    fs::filesystem_info *out;
+    error *errs;
+
+    bool follow_symlinks;
+    fs::query_flag flags;
+
+    fs::_mutex error_lock;
+    bool failed;
+    error *err;
+};
+
+static inline fs::const_fs_string _query_batch_path(const _query_batch_context *ctx, s64 i)
+{
+    return (ctx->paths != nullptr) ? to_const_string(ctx->paths + i) : ctx->strings[i];
+}
+
+// e is nullptr if querying path i succeeded
+static void _query_batch_set_result(_query_batch_context *ctx, s64 i, const error *e)
+{
+    if (e == nullptr)
+    {
+        if (ctx->errs != nullptr)
+            ctx->errs[i] = error{};
+
+        return;
+    }
+
+    if (ctx->errs != nullptr)
+        ctx->errs[i] = *e;
+
+    fs::_mutex_lock(&ctx->error_lock);
+
+    if (!ctx->failed && ctx->err != nullptr)
+        *ctx->err = *e;
+
+    ctx->failed = true;
+    fs::_mutex_unlock(&ctx->error_lock);
+}
+
+static void _query_batch_range(s64 begin, s64 end, void *userdata)
+{
+    _query_batch_context *ctx = (_query_batch_context*)userdata;
+
+    for (s64 i = begin; i < end; ++i)
+    {
+        error e{};
+
+        if (fs::_query_filesystem(_query_batch_path(ctx, i), ctx->out + i, ctx->follow_symlinks, ctx->flags, &e))
+            _query_batch_set_result(ctx, i, nullptr);
+        else
+            _query_batch_set_result(ctx, i, &e);
+    }
+}
+
+#if Linux
+// returns the number of reaped queries
+static s64 _query_batch_reap(_query_batch_context *ctx, fs::_uring *ring, array<bool> *completed)
+{
+    fs::_uring_completion completions[QUERY_BATCH_REAP_COUNT];
+    s64 done = 0;
+    s32 reaped = 0;
+
+    while ((reaped = fs::_uring_reap(ring, completions, QUERY_BATCH_REAP_COUNT)) > 0)
+    for (s32 c = 0; c < reaped; ++c)
+    {
+        s64 i = (s64)completions[c].user_data;
+        completed->data[i] = true;
+        done += 1;
+
+        if (completions[c].result >= 0)
+            _query_batch_set_result(ctx, i, nullptr);
+        else
+        {
+            error qe{};
+            set_error_by_code(&qe, -completions[c].result);
+            _query_batch_set_result(ctx, i, &qe);
+        }
+    }
+
+    return done;
+}
+
+// returns false if io_uring can't be used, in which case no path was queried.
+static bool _query_batch_uring(_query_batch_context *ctx, s64 count, s32 queue_depth)
+{
+    fs::_uring ring;
+
+    if (!fs::_uring_init(&ring, (u32)queue_depth))
+        return false;
+
+    defer { fs::_uring_free(&ring); };
+
+    if (!fs::_uring_supports(&ring, fs::_uring_op::Statx))
+        return false;
+
+    int statx_flags = ctx->follow_symlinks ? 0 : AT_SYMLINK_NOFOLLOW;
+
+    // completions arrive in any order
+    array<bool> completed{};
+    defer { ::free(&completed); };
+    ::reserve(&completed, count);
+
+    for (s64 i = 0; i < count; ++i)
+        ::add_at_end(&completed, false);
+
+    s64 next = 0;
+    s64 done = 0;
+
+    while (done < count)
+    {
+        // at most queue_depth queries are in flight, so the completion queue
+        // (twice the size of the submission queue) never overflows.
+        while (next < count && next - done < queue_depth
+            && fs::_uring_prep_statx(&ring, AT_FDCWD, _query_batch_path(ctx, next).c_str, statx_flags, value(ctx->flags), ctx->out + next, (u64)next))
+            next++;
+
+        error e{};
+
+        if (!fs::_uring_submit(&ring, 1, &e))
+        {
+            // the ring is unusable. queries in flight still write into out,
+            // let them finish before the ring goes away. queued queries the
+            // kernel did not take and queries without a result fail.
+            while (fs::_uring_in_flight(&ring) > 0 && fs::_uring_wait(&ring))
+                _query_batch_reap(ctx, &ring, &completed);
+
+            for (s64 i = 0; i < count; ++i)
+            if (!completed.data[i])
+                _query_batch_set_result(ctx, i, &e);
+
+            return true;
+        }
+
+        done += _query_batch_reap(ctx, &ring, &completed);
+    }
+
+    return true;
+}
+#endif
+
+static void _resize_query_batch_arrays(s64 count, array<fs::filesystem_info> *out, array<error> *errs)
+{
+    ::reserve(out, count);
+    out->size = count;
+
+    if (errs != nullptr)
+    {
+        ::reserve(errs, count);
+        errs->size = count;
+    }
+}
+
+static bool _query_filesystem_batch(_query_batch_context *ctx, s64 count, array<fs::filesystem_info> *out, array<error> *errs, bool follow_symlinks, fs::query_flag flags, s32 queue_depth, error *err)
+{
+    assert(out != nullptr);
+
+    _resize_query_batch_arrays(count, out, errs);
+
+    if (count == 0)
+        return true;
+
+    if (queue_depth <= 0)
+        queue_depth = QUERY_BATCH_DEFAULT_QUEUE_DEPTH;
+
+    ctx->out = out->data;
+    ctx->errs = (errs != nullptr) ? errs->data : nullptr;
+    ctx->follow_symlinks = follow_symlinks;
+    ctx->flags = flags;
+    ctx->failed = false;
+    ctx->err = err;
+    fs::_mutex_init(&ctx->error_lock);
+    defer { fs::_mutex_free(&ctx->error_lock); };
+
+    // setting up a ring or threads costs more than a few queries
+    if (count < QUERY_BATCH_MIN_PARALLEL_COUNT)
+    {
+        _query_batch_range(0, count, ctx);
+        return !ctx->failed;
+    }
+
+#if Linux
+    if (_query_batch_uring(ctx, count, queue_depth))
+        return !ctx->failed;
+#endif
+
+    // blocking queries, queue_depth of them at a time. threads mostly wait
+    // for the filesystem, so there may be more than the hardware threads.
+    s32 thread_count = queue_depth;
+
+    if (thread_count > 4 * fs::_hardware_thread_count())
+        thread_count = 4 * fs::_hardware_thread_count();
+
+    fs::_parallel_for(count, QUERY_BATCH_CHUNK_SIZE, thread_count, _query_batch_range, ctx);
+
+    return !ctx->failed;
+}
+
+bool fs::query_filesystem_batch(const array<fs::path> *paths, array<fs::filesystem_info> *out, array<error> *errs, bool follow_symlinks, fs::query_flag flags, s32 queue_depth, error *err)
+{
+    assert(paths != nullptr);
+
+    _query_batch_context ctx{};
+    ctx.paths = paths->data;
+
+    return _query_filesystem_batch(&ctx, paths->size, out, errs, follow_symlinks, flags, queue_depth, err);
+}
+
+bool fs::query_filesystem_batch(const array<fs::const_fs_string> *paths, array<fs::filesystem_info> *out, array<error> *errs, bool follow_symlinks, fs::query_flag flags, s32 queue_depth, error *err)
+{
+    assert(paths != nullptr);
+
+    _query_batch_context ctx{};
+    ctx.strings = paths->data;
+
+    return _query_filesystem_batch(&ctx, paths->size, out, errs, follow_symlinks, flags, queue_depth, err);
+}
+
 int fs::_exists(fs::const_fs_string pth, bool follow_symlinks, error *err)
 {
 #if Windows
@@ -446,6 +693,264 @@ int fs::_exists(fs::const_fs_string pth, bool follow_symlinks, error *err)
 #endif
 }
 
+// groups smaller than this are checked with one _exists per path
+#define EXISTS_MANY_MIN_GROUP_SIZE  8
+#define EXISTS_MANY_DIRENT_BUFFER   16384
+
+struct _exists_many_context
+{
+    // only one of paths and strings is set
+    const fs::path *paths;
+    const fs::const_fs_string *strings;
+    int *out;
+    bool follow_symlinks;
+
+    bool failed;
+    error *err;
+};
+
+static inline fs::const_fs_string _exists_many_path(const _exists_many_context *ctx, s64 i)
+{
+    return (ctx->paths != nullptr) ? to_const_string(ctx->paths + i) : ctx->strings[i];
+}
+
+static void _exists_many_single(_exists_many_context *ctx, s64 i)
+{
+    error e{};
+    ctx->out[i] = fs::_exists(_exists_many_path(ctx, i), ctx->follow_symlinks, &e);
+
+    if (ctx->out[i] < 0)
+    {
+        if (!ctx->failed && ctx->err != nullptr)
+            *ctx->err = e;
+
+        ctx->failed = true;
+    }
+}
+
+#if Linux
+// name of the entry of path i within its parent directory, or an empty
+// string if the path has to be checked on its own (e.g. "..", trailing separators).
+static fs::const_fs_string _exists_many_name(fs::const_fs_string pth)
+{
+    fs::const_fs_string name = fs::filename(pth);
+
+    if (name.size == 0 || fs::is_dot_or_dot_dot(name))
+        return fs::const_fs_string{pth.c_str, 0};
+
+    return name;
+}
+
+// found in the listing of the parent directory, with its dirent type
+#define EXISTS_MANY_NOT_FOUND 0xff
+
+// checks all paths in group, which share the same parent directory, with one
+// listing of the directory. returns false if the directory could not be
+// listed (or the listing would not give the same results as exists), in
+// which case the paths have to be checked one by one.
+static bool _exists_many_group(_exists_many_context *ctx, fs::const_fs_string parent, const array<s64> *group)
+{
+    fs::path dir{};
+    defer { fs::free(&dir); };
+
+    if (parent.size == 0)
+        fs::path_set(&dir, PC_LIT("."));
+    else
+        fs::path_set(&dir, parent);
+
+    // the names that are looked for, not owning
+    hash_table<fs::path, u8> names{};
+    ::init(&names);
+    defer { ::free(&names); };
+
+    for_array(i, group)
+    {
+        fs::const_fs_string name = _exists_many_name(_exists_many_path(ctx, *i));
+
+        fs::path key{};
+        key.data = const_cast<fs::path_char_t*>(name.c_str);
+        key.size = name.size;
+
+        if (::search(&names, &key) == nullptr)
+            *::add_element_by_key(&names, &key) = EXISTS_MANY_NOT_FOUND;
+    }
+
+    int fd = (int)::open(dir.data, O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+
+    if (fd < 0)
+    {
+        // nothing inside a missing directory exists either
+        if (-fd != ENOENT)
+            return false;
+
+        for_array(i, group)
+            ctx->out[*i] = 0;
+
+        return true;
+    }
+
+    defer { ::close(fd); };
+
+    // exists() needs search permission on the directory, listing only read
+    // permission. and names in casefolded directories match other names
+    // than the bytes in the listing.
+    if (faccessat2(AT_FDCWD, dir.data, X_OK, 0) != 0
+     || fs::_is_case_insensitive_directory(fd))
+        return false;
+
+    alignas(8) u8 buffer[EXISTS_MANY_DIRENT_BUFFER];
+    s64 remaining = names.size;
+
+    while (remaining > 0)
+    {
+        sys_int size = ::getdents64(fd, buffer, EXISTS_MANY_DIRENT_BUFFER);
+
+        if (size < 0)
+            return false;
+
+        if (size == 0)
+            break;
+
+        for (sys_int offset = 0; offset < size;)
+        {
+            const dirent64 *d = (const dirent64*)(buffer + offset);
+            offset += d->record_size;
+
+            // the name of the entry is directly after the type
+            const char *d_name = ((const char*)d) + offset_of(dirent64, type) + 1;
+
+            fs::path key{};
+            key.data = const_cast<char*>(d_name);
+            key.size = string_length(d_name);
+
+            u8 *found = ::search(&names, &key);
+
+            if (found != nullptr && *found == EXISTS_MANY_NOT_FOUND)
+            {
+                *found = d->type;
+                remaining -= 1;
+            }
+        }
+    }
+
+    for_array(i, group)
+    {
+        fs::const_fs_string name = _exists_many_name(_exists_many_path(ctx, *i));
+
+        fs::path key{};
+        key.data = const_cast<fs::path_char_t*>(name.c_str);
+        key.size = name.size;
+
+        u8 type = *::search(&names, &key);
+
+        if (type == EXISTS_MANY_NOT_FOUND)
+            ctx->out[*i] = 0;
+        // the target of a symlink (or an entry of unknown type, which may be
+        // a symlink) has to be checked on its own.
+        else if (ctx->follow_symlinks
+              && (type == 0 || (fs::filesystem_type)(type << 12) == fs::filesystem_type::Symlink))
+            _exists_many_single(ctx, *i);
+        else
+            ctx->out[*i] = 1;
+    }
+
+    return true;
+}
+#endif
+
+static bool _exists_many(_exists_many_context *ctx, s64 count, array<int> *out, bool follow_symlinks, error *err)
+{
+    assert(out != nullptr);
+
+    ::reserve(out, count);
+    out->size = count;
+
+    ctx->out = out->data;
+    ctx->follow_symlinks = follow_symlinks;
+    ctx->failed = false;
+    ctx->err = err;
+
+#if Windows
+    for (s64 i = 0; i < count; ++i)
+        _exists_many_single(ctx, i);
+#else
+    // parent directory -> indices of the paths inside it.
+    // keys are not owning and point into the input paths.
+    hash_table<fs::path, array<s64>> groups{};
+    ::init(&groups);
+
+    defer {
+        for_hash_table(k, v, &groups)
+        {
+            (void)k;
+            ::free(v);
+        }
+
+        ::free(&groups);
+    };
+
+    for (s64 i = 0; i < count; ++i)
+    {
+        fs::const_fs_string pth = _exists_many_path(ctx, i);
+        fs::const_fs_string name = _exists_many_name(pth);
+
+        if (name.size == 0)
+        {
+            _exists_many_single(ctx, i);
+            continue;
+        }
+
+        fs::path key{};
+        key.data = const_cast<fs::path_char_t*>(pth.c_str);
+        key.size = name.c_str - pth.c_str;
+
+        array<s64> *group = ::search(&groups, &key);
+
+        if (group == nullptr)
+        {
+            group = ::add_element_by_key(&groups, &key);
+            *group = array<s64>{};
+        }
+
+        ::add_at_end(group, i);
+    }
+
+    for_hash_table(k, group, &groups)
+    {
+        fs::const_fs_string parent = to_const_string(k);
+
+        if (group->size >= EXISTS_MANY_MIN_GROUP_SIZE
+         && _exists_many_group(ctx, parent, group))
+            continue;
+
+        for_array(i, group)
+            _exists_many_single(ctx, *i);
+    }
+#endif
+
+    return !ctx->failed;
+}
+
+bool fs::exists_many(const array<fs::path> *paths, array<int> *out, bool follow_symlinks, error *err)
+{
+    assert(paths != nullptr);
+
+    _exists_many_context ctx{};
+    ctx.paths = paths->data;
+
+    return _exists_many(&ctx, paths->size, out, follow_symlinks, err);
+}
+
+bool fs::exists_many(const array<fs::const_fs_string> *paths, array<int> *out, bool follow_symlinks, error *err)
+{
+    assert(paths != nullptr);
+
+    _exists_many_context ctx{};
+    ctx.strings = paths->data;
+
+    return _exists_many(&ctx, paths->size, out, follow_symlinks, err);
+}
+
 fs::filesystem_type fs::get_filesystem_type(const fs::filesystem_info *info)
 {
     assert(info != nullptr);
@@ -932,11 +1437,11 @@ fs::const_fs_string fs::filename(fs::const_fs_string pth)
     }
 #endif
 
-    s64 found = ::string_last_index_of(pth, fs::path_separator);
+    s64 found = fs::_scan_last(pth.c_str, pth.size, fs::path_separator);
 
 #if Windows
     if (found == -1)
-        found = ::string_last_index_of(pth, SYS_CHAR('/'));
+        found = fs::_scan_last(pth.c_str, pth.size, SYS_CHAR('/'));
 #endif
 
     if (found == -1)
@@ -986,7 +1491,7 @@ fs::const_fs_string fs::file_extension(fs::const_fs_string pth)
     if (_is_dot_filename(fname) || _is_dot_dot_filename(fname))
         return empty_fs_string;
 
-    s64 found = ::string_last_index_of(fname, PC_LIT('.'));
+    s64 found = fs::_scan_last(fname.c_str, fname.size, PC_DOT);
 
     if (found == -1)
         return empty_fs_string;
@@ -1008,10 +1513,10 @@ fs::const_fs_string fs::parent_path_segment(fs::const_fs_string pth)
 #if Windows
     auto rt = fs::root(pth);
 
-    s64 last_sep = ::string_last_index_of(pth, fs::path_separator);
+    s64 last_sep = fs::_scan_last(pth.c_str, pth.size, fs::path_separator);
 
     if (last_sep == -1)
-        last_sep = ::string_last_index_of(pth, SYS_CHAR('/'));
+        last_sep = fs::_scan_last(pth.c_str, pth.size, SYS_CHAR('/'));
 
     if (last_sep == -1)
     {
@@ -1024,12 +1529,12 @@ fs::const_fs_string fs::parent_path_segment(fs::const_fs_string pth)
     else if ((s64)last_sep < rt.size)
         return rt;
 #else
-    s64 last_sep = ::string_last_index_of(pth, fs::path_separator);
+    s64 last_sep = fs::_scan_last(pth.c_str, pth.size, fs::path_separator);
     
     if (last_sep == -1)
         return empty_fs_string;
 
-    s64 first_sep = ::string_index_of(pth, fs::path_separator);
+    s64 first_sep = fs::_scan_first(pth.c_str, pth.size, fs::path_separator);
 
     if (first_sep == last_sep
      && first_sep == 0)
@@ -1206,69 +1711,134 @@ void fs::_replace_filename(fs::path *out, fs::const_fs_string newname)
     out->data[cutoff] = PC_NUL;
 }
 
-void fs::path_segments(fs::const_fs_string pth, array<fs::const_fs_string> *out)
+fs::const_fs_string *fs::_path_segment_first(fs::path_segment_iterator *it, fs::const_fs_string pth)
 {
-    assert(out != nullptr);
+    assert(it != nullptr);
 
-    ::clear(out);
+    it->path = pth;
+    it->segment = fs::root(pth);
+    it->root_size = it->segment.size;
 
-    auto seg = fs::root(pth);
+    if (it->root_size > 0)
+        return &it->segment;
 
-    if (seg.size > 0)
-        ::add_at_end(out, seg);
+    it->segment.c_str = pth.c_str;
+    it->segment.size = 0;
 
-    s64 start = seg.size;
-    s64 i = start;
+    return fs::_path_segment_next(it);
+}
 
-    while (i < pth.size)
-    {
-        if (!_is_path_separator(pth.c_str[i]))
-        {
-            i += 1;
-            continue;
-        }
+fs::const_fs_string *fs::_path_segment_first(fs::path_segment_iterator *it, const fs::path *pth)
+{
+    assert(pth != nullptr);
 
-        // no empty segments
-        if (start == i)
-        {
-            i += 1;
-            continue;
-        }
+    return fs::_path_segment_first(it, to_const_string(pth));
+}
 
-        seg.c_str = pth.c_str + start;
-        seg.size = i - start;
+fs::const_fs_string *fs::_path_segment_next(fs::path_segment_iterator *it)
+{
+    assert(it != nullptr);
 
-        ::add_at_end(out, seg);
+    const fs::path_char_t *str = it->path.c_str;
+    s64 size = it->path.size;
+    s64 start = (it->segment.c_str - str) + it->segment.size;
 
-        i += 1;
-        start = i;
-    }
+    // no empty segments
+    while (start < size && _is_path_separator(str[start]))
+        start += 1;
 
-    if (start == i)
-        return;
+    if (start >= size)
+        return nullptr;
 
-    seg.c_str = pth.c_str + start;
-    seg.size = i - start;
+    it->segment.c_str = str + start;
+    it->segment.size = _next_separator(str, start, size) - start;
 
-    ::add_at_end(out, seg);
+    return &it->segment;
 }
 
-void fs::path_segments(const fs::path *pth, array<fs::const_fs_string> *out)
+fs::const_fs_string *fs::_path_segment_last(fs::path_segment_iterator *it, fs::const_fs_string pth)
 {
-    assert(pth != nullptr);
-    assert(out != nullptr);
+    assert(it != nullptr);
 
-    fs::path_segments(to_const_string(pth), out);
+    it->path = pth;
+    it->root_size = fs::root(pth).size;
+
+    // previous starts searching at the start of the current segment
+    it->segment.c_str = pth.c_str + pth.size;
+    it->segment.size = 0;
+
+    if (pth.size == 0)
+        return nullptr;
+
+    return fs::_path_segment_previous(it);
 }
 
-fs::path fs::_parent_path(fs::const_fs_string pth)
+fs::const_fs_string *fs::_path_segment_last(fs::path_segment_iterator *it, const fs::path *pth)
 {
-    fs::path ret{};
-    fs::_parent_path(pth, &ret);
-    return ret;
+    assert(pth != nullptr);
+
+    return fs::_path_segment_last(it, to_const_string(pth));
 }
 
-void fs::_parent_path(fs::const_fs_string pth, fs::path *out)
+fs::const_fs_string *fs::_path_segment_previous(fs::path_segment_iterator *it)
+{
+    assert(it != nullptr);
+
+    const fs::path_char_t *str = it->path.c_str;
+    s64 end = it->segment.c_str - str;
+
+    // the root (or the first segment of a relative path) was the last one
+    if (end <= 0)
+        return nullptr;
+
+    while (end > it->root_size && _is_path_separator(str[end - 1]))
+        end -= 1;
+
+    if (end <= it->root_size)
+    {
+        if (it->root_size == 0)
+            return nullptr;
+
+        it->segment.c_str = str;
+        it->segment.size = it->root_size;
+        return &it->segment;
+    }
+
+    s64 start = fs::_scan_last_separator(str + it->root_size, end - it->root_size);
+    start = (start < 0) ? it->root_size : it->root_size + start + 1;
+
+    it->segment.c_str = str + start;
+    it->segment.size = end - start;
+
+    return &it->segment;
+}
+
+void fs::path_segments(fs::const_fs_string pth, array<fs::const_fs_string> *out)
+{
+    assert(out != nullptr);
+
+    ::clear(out);
+
+    for_path_segment(seg, pth)
+        ::add_at_end(out, *seg);
+}
+
+void fs::path_segments(const fs::path *pth, array<fs::const_fs_string> *out)
+{
+    assert(pth != nullptr);
+    assert(out != nullptr);
+
+    fs::path_segments(to_const_string(pth), out);
+}
+
+fs::path fs::_parent_path(fs::const_fs_string pth)
+{
+    fs::path ret{};
+    fs::_parent_path(pth, &ret);
+    return ret;
+}
+
+void fs::_parent_path(fs::const_fs_string pth, fs::path *out)
 {
     assert(out != nullptr);
 
@@ -1284,29 +1854,70 @@ fs::path fs::_longest_existing_path(fs::const_fs_string pth)
     return existing_slice;
 }
 
-void fs::_longest_existing_path(fs::const_fs_string pth, fs::path *out)
+/* Returns the end of a path segment (the index of the separator or end of
+string after it) in Str that's strictly between Lo and Hi and close to their
+middle, or -1 if there is none.
+*/
+static s64 _segment_end_between(const fs::path_char_t *str, s64 lo, s64 hi)
 {
-    assert(out != nullptr);
+    s64 mid = lo + (hi - lo) / 2;
 
-    fs::path_set(out, pth);
+    for (s64 i = (mid > lo ? mid : lo + 1); i < hi; ++i)
+        if (_is_path_separator(str[i]) && !_is_path_separator(str[i - 1]))
+            return i;
 
-    s64 i = 0;
+    for (s64 i = mid - 1; i > lo; --i)
+        if (_is_path_separator(str[i]) && !_is_path_separator(str[i - 1]))
+            return i;
 
-    fs::const_fs_string rt = fs::root(out);
+    return -1;
+}
 
-    while (out->size > rt.size)
+/* Returns the length of the longest existing prefix of Pth that ends at a
+segment boundary, given that the prefix of length Existing exists and the
+prefix of length Missing does not.
+Since a path can only exist if all its parents exist, this binary searches
+the segment boundaries, which takes O(log N) exists() calls instead of N.
+Pth is temporarily modified, but unchanged when the function returns.
+*/
+static s64 _longest_existing_prefix(fs::path *pth, s64 existing, s64 missing)
+{
+    while (true)
     {
-        if (fs::exists(out) == 1)
-            break;
+        s64 end = _segment_end_between(pth->data, existing, missing);
 
-        i = out->size - 1;
+        if (end < 0)
+            break;
 
-        while (i > rt.size && !_is_path_separator(out->data[i]))
-            i--;
+        fs::path_char_t c = pth->data[end];
+        pth->data[end] = PC_NUL;
+        bool ex = fs::_exists(fs::const_fs_string{pth->data, end}, true, nullptr) == 1;
+        pth->data[end] = c;
 
-        out->size = i;
-        out->data[i] = PC_NUL;
+        if (ex)
+            existing = end;
+        else
+            missing = end;
     }
+
+    return existing;
+}
+
+void fs::_longest_existing_path(fs::const_fs_string pth, fs::path *out)
+{
+    assert(out != nullptr);
+
+    fs::path_set(out, pth);
+
+    // common case: all of it exists
+    if (out->size == 0 || fs::exists(out) == 1)
+        return;
+
+    fs::const_fs_string rt = fs::root(out);
+
+    s64 len = _longest_existing_prefix(out, rt.size, out->size);
+    out->size = len;
+    out->data[len] = PC_NUL;
 }
 
 // The algorithm for normalizing is here
@@ -1341,7 +1952,7 @@ void fs::normalize(fs::path *pth)
     {
         if (!_is_path_separator(pth->data[i]))
         {
-            i += 1;
+            i = _next_separator(pth->data, i, pth->size - 1);
             continue;
         }
 
@@ -1380,7 +1991,15 @@ void fs::normalize(fs::path *pth)
                 i += 1;
         }
         else
-            i += 1;
+        {
+            // skip to the next dot
+            s64 found = fs::_scan_first(pth->data + i + 1, pth->size - i - 1, PC_DOT);
+
+            if (found < 0)
+                break;
+
+            i += found + 1;
+        }
     }
 
     pth->data[pth->size] = PC_NUL;
@@ -1404,9 +2023,8 @@ void fs::normalize(fs::path *pth)
             i += 1;
             filename_start = i;
 
-            while ((i < pth->size - 3)
-                && !_is_path_separator(pth->data[i]))
-                i += 1;
+            if (i < pth->size - 3)
+                i = _next_separator(pth->data, i, pth->size - 3);
 
             if (i >= pth->size - 3)
                 break;
@@ -1432,7 +2050,7 @@ void fs::normalize(fs::path *pth)
             }
         }
         else
-            i += 1;
+            i = _next_separator(pth->data, i, pth->size - 3);
     }
 
     pth->data[pth->size] = PC_NUL;
@@ -1545,6 +2163,194 @@ bool fs::_absolute_path(fs::const_fs_string pth, fs::path *out, error *err)
     return true;
 }
 
+#if Linux
+#ifndef O_PATH
+#define O_PATH 010000000
+#endif
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 02000000
+#endif
+
+// same limit as the kernel
+#define MAX_SYMLINK_FOLLOWS 40
+
+static void _trace_add(array<fs::path> *trace, fs::const_fs_string dir, fs::const_fs_string name)
+{
+    fs::path *p = ::add_at_end(trace);
+    *p = fs::path{};
+    fs::path_set(p, dir);
+
+    if (name.size > 0)
+        fs::path_append(p, name);
+}
+
+#define _open_directory_at(Fd, Name) (int)::openat((Fd), (Name), O_PATH | O_DIRECTORY | O_CLOEXEC, 0)
+
+/* Appends the canonical path of Rest to Out, where Out is the canonical path
+of an existing directory and Rest is relative to Out.
+Walks Rest segment by segment relative to a directory file descriptor,
+expanding symlinks in place, so no intermediate path is ever resolved twice
+and there is no length limit other than PATH_ALLOC_MAX_SIZE per symlink target.
+If Trace is not nullptr, adds the canonical location of every symlink followed,
+every directory left via .. and the final path to Trace, i.e. everything the
+result depends on (see resolve_cache.cpp).
+*/
+static bool _canonical_resolve(fs::path *out, fs::const_fs_string rest_str, array<fs::path> *trace, error *err)
+{
+    int dirfd = _open_directory_at(AT_FDCWD, out->data);
+
+    if (dirfd < 0)
+    {
+        set_error_by_code(err, -dirfd);
+        return false;
+    }
+
+    defer { ::close(dirfd); };
+
+    fs::path rest{};
+    fs::path_set(&rest, rest_str);
+    defer { fs::free(&rest); };
+
+    // readlinkat and openat need null terminated segment names
+    fs::path name{};
+    defer { fs::free(&name); };
+
+    scratch_buffer<1024> link{};
+    ::init(&link);
+    defer { ::free(&link); };
+
+    s32 follows = 0;
+    s64 pos = 0;
+
+    while (true)
+    {
+        while (pos < rest.size && _is_path_separator(rest.data[pos]))
+            pos += 1;
+
+        if (pos >= rest.size)
+            break;
+
+        s64 end = _next_separator(rest.data, pos, rest.size);
+        fs::const_fs_string seg{rest.data + pos, end - pos};
+        // trailing separators still require a directory
+        bool last = (end >= rest.size);
+
+        pos = end;
+
+        if (_is_dot_filename(seg))
+            continue;
+
+        if (_is_dot_dot_filename(seg))
+        {
+            if (trace != nullptr)
+                _trace_add(trace, to_const_string(out), empty_fs_string);
+
+            // out contains no symlinks, so its parent segment is its actual parent
+            s64 i = fs::_scan_last_separator(out->data, out->size);
+            out->size = (i > 0) ? i : 1;
+            out->data[out->size] = PC_NUL;
+
+            int fd = _open_directory_at(dirfd, "..");
+
+            if (fd < 0)
+            {
+                set_error_by_code(err, -fd);
+                return false;
+            }
+
+            ::close(dirfd);
+            dirfd = fd;
+            continue;
+        }
+
+        fs::path_set(&name, seg);
+
+        s64 link_size = 0;
+
+        while (true)
+        {
+            link_size = ::readlinkat(dirfd, name.data, link.data, link.size);
+
+            if (link_size != link.size)
+                break;
+
+            if (link.size >= PATH_ALLOC_MAX_SIZE)
+            {
+                set_error_by_code(err, ENAMETOOLONG);
+                return false;
+            }
+
+            ::grow(&link);
+        }
+
+        if (link_size >= 0)
+        {
+            if (trace != nullptr)
+                _trace_add(trace, to_const_string(out), to_const_string(name));
+
+            follows += 1;
+
+            if (follows > MAX_SYMLINK_FOLLOWS)
+            {
+                set_error_by_code(err, ELOOP);
+                return false;
+            }
+
+            // replace the symlink segment (and everything before it) with its target
+            ::remove_elements(as_array_ptr(&rest), 0, pos);
+            ::insert_range(as_array_ptr(&rest), 0, link.data, link_size);
+            pos = 0;
+
+            if (link_size > 0 && _is_path_separator(link.data[0]))
+            {
+                int fd = _open_directory_at(AT_FDCWD, "/");
+
+                if (fd < 0)
+                {
+                    set_error_by_code(err, -fd);
+                    return false;
+                }
+
+                ::close(dirfd);
+                dirfd = fd;
+                fs::path_set(out, PC_LIT("/"));
+            }
+
+            continue;
+        }
+
+        // EINVAL: exists, but is not a symlink
+        if (link_size != -EINVAL)
+        {
+            set_error_by_code(err, (int)-link_size);
+            return false;
+        }
+
+        if (!last)
+        {
+            int fd = _open_directory_at(dirfd, name.data);
+
+            if (fd < 0)
+            {
+                set_error_by_code(err, -fd);
+                return false;
+            }
+
+            ::close(dirfd);
+            dirfd = fd;
+        }
+
+        fs::path_append(out, to_const_string(name));
+    }
+
+    if (trace != nullptr)
+        _trace_add(trace, to_const_string(out), empty_fs_string);
+
+    return true;
+}
+#endif
+
 fs::path fs::_canonical_path(fs::const_fs_string pth, error *err)
 {
     fs::path ret{};
@@ -1595,24 +2401,71 @@ bool fs::_canonical_path(fs::const_fs_string pth, fs::path *out, error *err)
 
     return true;
 #else
+    return fs::_canonical_path_trace(pth, out, nullptr, err);
+#endif
+}
+
+bool fs::_canonical_path_trace(fs::const_fs_string pth, fs::path *out, array<fs::path> *trace, error *err)
+{
+    assert(out != nullptr);
+    assert(pth.c_str != out->data);
+
+#if Windows
+    if (!fs::_canonical_path(pth, out, err))
+        return false;
 
-    // TODO: replace with a real realpath, not a fake one.
-    // Problems with ::realpath: allocates its own buffer,
-    // and the buffer can only be up to PATH_MAX bytes long.
-    char *npath = ::realpath(pth.c_str, nullptr);
+    if (trace != nullptr)
+    {
+        fs::path *p = ::add_at_end(trace);
+        *p = fs::path{};
+        fs::path_set(p, out);
+    }
 
-    if (npath == nullptr)
+    return true;
+#else
+    if (pth.size == 0)
     {
-        set_errno_error(err);
+        set_error_by_code(err, ENOENT);
         return false;
     }
 
-    fs::free(out);
-    out->data = npath;
-    out->size = ::string_length(npath);
-    out->reserved_size = out->size;
+    // getcwd returns a path without symlinks, so it is a valid starting point.
+    if (_is_path_separator(pth.c_str[0]))
+        fs::path_set(out, PC_LIT("/"));
+    else if (!fs::get_current_path(out, err))
+        return false;
+
+    return _canonical_resolve(out, pth, trace, err);
+#endif
+}
 
-    return true;
+bool fs::_canonical_path(fs::const_fs_string pth, fs::path *out, fs::resolve_cache *cache, error *err)
+{
+#if Linux
+    if (cache == nullptr || !fs::is_absolute(pth))
+        return fs::_canonical_path(pth, out, err);
+
+    assert(out != nullptr);
+    assert(pth.c_str != out->data);
+
+    s64 sep = fs::_scan_last_separator(pth.c_str, pth.size);
+    fs::const_fs_string parent{pth.c_str, sep > 0 ? sep : 1};
+    fs::const_fs_string rest{pth.c_str + sep + 1, pth.size - sep - 1};
+
+    // only the last segment is resolved outside the cache, e.g. "/a/b/" or "/a/b/.."
+    // are not worth special casing.
+    if (rest.size == 0 || _is_dot_filename(rest) || _is_dot_dot_filename(rest))
+        return fs::_canonical_path(pth, out, err);
+
+    if (!fs::_resolve_cache_canonical_path(cache, parent, out, err))
+        return false;
+
+    return _canonical_resolve(out, rest, nullptr, err);
+#else
+    // GetFinalPathNameByHandle resolves the entire path in one call,
+    // there is no prefix to skip.
+    (void)cache;
+    return fs::_canonical_path(pth, out, err);
 #endif
 }
 
@@ -1681,65 +2534,273 @@ bool fs::_weakly_canonical_path(fs::const_fs_string pth, fs::path *out, error *e
     return true;
 }
 
-bool fs::_get_symlink_target(fs::const_fs_string pth, fs::path *out, error *err)
+// pth must be absolute and normalized, parent is used as scratch memory.
+static bool _cached_weakly_canonical_path(fs::path *pth, fs::resolve_cache *cache, fs::path *parent, error *err)
 {
-    assert(out != nullptr);
+    auto rt = fs::root(pth);
 
-#if Windows
-    HANDLE h = CreateFile((const sys_native_char*)pth.c_str,
-                          0,
-                          0,
-                          nullptr, 
-                          OPEN_EXISTING,
-                          FILE_FLAG_OPEN_REPARSE_POINT,
-                          nullptr);
+    if (rt.size == 0 || rt.size == pth->size)
+        return true;
 
-    if (h == INVALID_HANDLE_VALUE)
+    fs::const_fs_string parent_seg = fs::parent_path_segment(pth);
+    fs::const_fs_string fname = fs::filename(pth);
+    fs::filesystem_type type = fs::filesystem_type::Unknown;
+
+    // canonical(parent)/filename is only the canonical path if the filename
+    // itself is not a symlink and the parent exists, everything else goes
+    // through the uncached path.
+    bool use_cache = fname.size > 0
+                  && parent_seg.size > 0
+                  && !(fs::_get_filesystem_type(to_const_string(pth), &type, false, nullptr)
+                       && type == fs::filesystem_type::Symlink)
+                  && fs::_resolve_cache_canonical_path(cache, parent_seg, parent, nullptr);
+
+    if (use_cache)
     {
-        set_GetLastError_error(err);
-        return false;
+        fs::path_append(parent, fname);
+        fs::path_set(pth, parent);
+        return true;
     }
 
-    defer { CloseHandle(h); };
+    fs::path_set(parent, pth);
+    return fs::_weakly_canonical_path(to_const_string(parent), pth, err);
+}
 
-    // this is pretty huge
-    char buffer[MAXIMUM_REPARSE_DATA_BUFFER_SIZE];
-    DWORD bufsize = 0;
+bool fs::_weakly_canonical_path(fs::const_fs_string pth, fs::path *out, fs::resolve_cache *cache, error *err)
+{
+    if (cache == nullptr)
+        return fs::_weakly_canonical_path(pth, out, err);
 
-    if (!DeviceIoControl(h,
-                         FSCTL_GET_REPARSE_POINT,
-                         nullptr,
-                         0,
-                         buffer,
-                         sizeof(buffer),
-                         &bufsize, 0))
+    assert(out != nullptr);
+    assert(pth.c_str != out->data);
+
+    if (pth.size == 0)
     {
-        set_GetLastError_error(err);
-        return false;
+        fs::path_set(out, pth);
+        return true;
     }
 
-    typedef struct _REPARSE_DATA_BUFFER {
-        ULONG  ReparseTag;
-        USHORT ReparseDataLength;
-        USHORT Reserved;
-        union {
-            struct {
-                USHORT SubstituteNameOffset;
-                USHORT SubstituteNameLength;
-                USHORT PrintNameOffset;
-                USHORT PrintNameLength;
-                ULONG  Flags;
-                WCHAR  PathBuffer[1];
-            } SymbolicLinkReparseBuffer;
-            struct {
-                USHORT SubstituteNameOffset;
-                USHORT SubstituteNameLength;
-                USHORT PrintNameOffset;
-                USHORT PrintNameLength;
-                WCHAR  PathBuffer[1];
-            } MountPointReparseBuffer;
-            struct {
-                UCHAR DataBuffer[1];
+    out->size = 0;
+
+    if (!fs::absolute_path(pth, out, err))
+        return false;
+
+    fs::normalize(out);
+
+    fs::path parent{};
+    defer { fs::free(&parent); };
+
+    return _cached_weakly_canonical_path(out, cache, &parent, err);
+}
+
+#define NORMALIZE_ALL_CHUNK_SIZE        256
+#define WEAKLY_CANONICAL_ALL_CHUNK_SIZE  32
+
+static void _normalize_range(s64 begin, s64 end, void *userdata)
+{
+    fs::path *paths = (fs::path*)userdata;
+
+    for (s64 i = begin; i < end; ++i)
+        fs::normalize(paths + i);
+}
+
+void fs::normalize_all(array<fs::path> *paths, s32 thread_count)
+{
+    assert(paths != nullptr);
+
+    fs::_parallel_for(paths->size, NORMALIZE_ALL_CHUNK_SIZE, thread_count, _normalize_range, paths->data);
+}
+
+struct _weakly_canonical_all_context
+{
+    // only one of paths and strings is set
+    const fs::path *paths;
+    const fs::const_fs_string *strings;
+    fs::path *out;
+
+    fs::const_fs_string current_dir;
+    fs::resolve_cache *cache;
+
+    fs::_mutex error_lock;
+    bool failed;
+    error *err;
+};
+
+static void _weakly_canonical_range(s64 begin, s64 end, void *userdata)
+{
+    _weakly_canonical_all_context *ctx = (_weakly_canonical_all_context*)userdata;
+
+    fs::path parent{};
+    defer { fs::free(&parent); };
+
+    for (s64 i = begin; i < end; ++i)
+    {
+        fs::const_fs_string pth = (ctx->paths != nullptr) ? to_const_string(ctx->paths + i) : ctx->strings[i];
+        fs::path *out = ctx->out + i;
+
+        if (pth.size == 0)
+        {
+            fs::path_set(out, pth);
+            continue;
+        }
+
+        // same as absolute_path, without querying the current directory every time
+        if (fs::is_absolute(pth))
+            fs::path_set(out, pth);
+        else
+        {
+            fs::path_set(out, ctx->current_dir);
+            fs::path_append(out, pth);
+        }
+
+        fs::normalize(out);
+
+        error e{};
+
+        if (_cached_weakly_canonical_path(out, ctx->cache, &parent, &e))
+            continue;
+
+        fs::path_set(out, PC_LIT(""));
+
+        fs::_mutex_lock(&ctx->error_lock);
+
+        if (!ctx->failed && ctx->err != nullptr)
+            *ctx->err = e;
+
+        ctx->failed = true;
+        fs::_mutex_unlock(&ctx->error_lock);
+    }
+}
+
+static void _resize_path_array(array<fs::path> *arr, s64 size)
+{
+    while (arr->size > size)
+    {
+        fs::free(arr->data + arr->size - 1);
+        arr->size -= 1;
+    }
+
+    ::reserve(arr, size);
+
+    while (arr->size < size)
+        ::add_at_end(arr, fs::path{});
+}
+
+static bool _weakly_canonical_all(_weakly_canonical_all_context *ctx, s64 count, array<fs::path> *out, fs::resolve_cache *cache, s32 thread_count, error *err)
+{
+    assert(out != nullptr);
+
+    _resize_path_array(out, count);
+
+    fs::path current_dir{};
+    defer { fs::free(&current_dir); };
+
+    if (!fs::get_current_path(&current_dir, err))
+        return false;
+
+    fs::resolve_cache tmp_cache{};
+
+    if (cache == nullptr)
+    {
+        fs::init(&tmp_cache);
+        cache = &tmp_cache;
+    }
+
+    defer { if (cache == &tmp_cache) fs::free(&tmp_cache); };
+
+    ctx->out = out->data;
+    ctx->current_dir = to_const_string(&current_dir);
+    ctx->cache = cache;
+    ctx->failed = false;
+    ctx->err = err;
+    fs::_mutex_init(&ctx->error_lock);
+
+    fs::_parallel_for(count, WEAKLY_CANONICAL_ALL_CHUNK_SIZE, thread_count, _weakly_canonical_range, ctx);
+
+    fs::_mutex_free(&ctx->error_lock);
+
+    return !ctx->failed;
+}
+
+bool fs::weakly_canonical_all(const array<fs::path> *paths, array<fs::path> *out, fs::resolve_cache *cache, s32 thread_count, error *err)
+{
+    assert(paths != nullptr);
+
+    _weakly_canonical_all_context ctx{};
+    ctx.paths = paths->data;
+
+    return _weakly_canonical_all(&ctx, paths->size, out, cache, thread_count, err);
+}
+
+bool fs::weakly_canonical_all(const array<fs::const_fs_string> *paths, array<fs::path> *out, fs::resolve_cache *cache, s32 thread_count, error *err)
+{
+    assert(paths != nullptr);
+
+    _weakly_canonical_all_context ctx{};
+    ctx.strings = paths->data;
+
+    return _weakly_canonical_all(&ctx, paths->size, out, cache, thread_count, err);
+}
+
+bool fs::_get_symlink_target(fs::const_fs_string pth, fs::path *out, error *err)
+{
+    assert(out != nullptr);
+
+#if Windows
+    HANDLE h = CreateFile((const sys_native_char*)pth.c_str,
+                          0,
+                          0,
+                          nullptr, 
+                          OPEN_EXISTING,
+                          FILE_FLAG_OPEN_REPARSE_POINT,
+                          nullptr);
+
+    if (h == INVALID_HANDLE_VALUE)
+    {
+        set_GetLastError_error(err);
+        return false;
+    }
+
+    defer { CloseHandle(h); };
+
+    // this is pretty huge
+    char buffer[MAXIMUM_REPARSE_DATA_BUFFER_SIZE];
+    DWORD bufsize = 0;
+
+    if (!DeviceIoControl(h,
+                         FSCTL_GET_REPARSE_POINT,
+                         nullptr,
+                         0,
+                         buffer,
+                         sizeof(buffer),
+                         &bufsize, 0))
+    {
+        set_GetLastError_error(err);
+        return false;
+    }
+
+    typedef struct _REPARSE_DATA_BUFFER {
+        ULONG  ReparseTag;
+        USHORT ReparseDataLength;
+        USHORT Reserved;
+        union {
+            struct {
+                USHORT SubstituteNameOffset;
+                USHORT SubstituteNameLength;
+                USHORT PrintNameOffset;
+                USHORT PrintNameLength;
+                ULONG  Flags;
+                WCHAR  PathBuffer[1];
+            } SymbolicLinkReparseBuffer;
+            struct {
+                USHORT SubstituteNameOffset;
+                USHORT SubstituteNameLength;
+                USHORT PrintNameOffset;
+                USHORT PrintNameLength;
+                WCHAR  PathBuffer[1];
+            } MountPointReparseBuffer;
+            struct {
+                UCHAR DataBuffer[1];
             } GenericReparseBuffer;
         } DUMMYUNIONNAME;
     } REPARSE_DATA_BUFFER, *PREPARSE_DATA_BUFFER;
@@ -1900,7 +2961,7 @@ void _string_append(fs::path *out, const_string_base<C> seg)
     fs::path_append(out, &to_append);
 
     if constexpr (needs_conversion(C))
-        free(&conv);
+        fs::_free_platform_string(&conv);
 }
 
 void fs::path_append(fs::path *out, const_string    seg) { _string_append(out, seg); }
@@ -1974,7 +3035,7 @@ void _path_concat(fs::path *out, const_string_base<C> seg)
     ::string_append(as_string_ptr(out), conv);
 
     if constexpr (needs_conversion(C))
-        free(&conv);
+        fs::_free_platform_string(&conv);
 }
 
 void fs::path_concat(fs::path *out, const_string    seg) { _path_concat(out, seg); }
@@ -2001,48 +3062,43 @@ void fs::_relative_path(fs::const_fs_string from, fs::const_fs_string to, fs::pa
     if (rt_from != rt_to)
         return;
 
-    array<fs::const_fs_string> from_segs{};
-    array<fs::const_fs_string> to_segs{};
-
-    defer { ::free(&from_segs); };
-    defer { ::free(&to_segs); };
+    fs::path_segment_iterator from_it;
+    fs::path_segment_iterator to_it;
 
-    fs::path_segments(from, &from_segs);
-    fs::path_segments(to,   &to_segs);
+    fs::const_fs_string *from_seg = fs::_path_segment_first(&from_it, from);
+    fs::const_fs_string *to_seg   = fs::_path_segment_first(&to_it, to);
 
-    s64 i = 0;
-
-    while (i < from_segs.size && i < to_segs.size)
+    while (from_seg != nullptr && to_seg != nullptr)
     {
-        if (from_segs[i] != to_segs[i])
+        if (*from_seg != *to_seg)
             break;
 
-        i += 1;
+        from_seg = fs::_path_segment_next(&from_it);
+        to_seg   = fs::_path_segment_next(&to_it);
     }
 
-    if (i == from_segs.size && i == to_segs.size)
+    if (from_seg == nullptr && to_seg == nullptr)
     {
         fs::path_set(out, PC_LIT("."));
         return;
     }
 
     s64 n = 0;
-    s64 j = i;
     
-    while (j < from_segs.size)
+    while (from_seg != nullptr)
     {
-        if (_is_dot_dot_filename(from_segs[j]))
+        if (_is_dot_dot_filename(*from_seg))
             n -= 1;
-        else if (!_is_dot_filename(from_segs[j]))
+        else if (!_is_dot_filename(*from_seg))
             n += 1;
 
-        j += 1;
+        from_seg = fs::_path_segment_next(&from_it);
     }
 
     if (n < 0)
         return;
 
-    if (n == 0 && i >= to_segs.size)
+    if (n == 0 && to_seg == nullptr)
     {
         fs::path_set(out, PC_LIT("."));
         return;
@@ -2054,9 +3110,9 @@ void fs::_relative_path(fs::const_fs_string from, fs::const_fs_string to, fs::pa
         n -= 1;
     }
 
-    if (i < to_segs.size)
+    if (to_seg != nullptr)
     {
-        fs::const_fs_string to_append = to_segs[i];
+        fs::const_fs_string to_append = *to_seg;
         to_append.size = (to.c_str - to_append.c_str) + to.size;
 
         assert(to_append.c_str != nullptr);
@@ -2122,115 +3178,31 @@ bool fs::_touch(fs::const_fs_string pth, fs::permission perms, error *err)
 #endif
 }
 
-bool fs::_copy_file(fs::const_fs_string from, fs::const_fs_string to, fs::copy_file_option opt, error *err)
+#if Linux
+bool fs::_copy_file_at(int from_dirfd, const char *from, int to_dirfd, const char *to, fs::copy_file_option opt, fs::copy_file_info *info, fs::copy_file_flag flags, fs::operation_control *control, error *err)
 {
-#if Windows
-    io_handle from_handle;
-    io_handle to_handle;
-    bool to_exists = false;
-
-    from_handle = CreateFile((const sys_native_char*)from.c_str,
-                             0,
-                             FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE,
-                             nullptr,
-                             OPEN_EXISTING,
-                             FILE_ATTRIBUTE_NORMAL,
-                             nullptr);
-
-    if (from_handle == INVALID_HANDLE_VALUE)
-    {
-        set_GetLastError_error(err);
-        return false;
-    }
-
-    defer { CloseHandle(from_handle); };
-
-    to_handle = CreateFile((const sys_native_char*)to.c_str,
-                           0,
-                           FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE,
-                           nullptr,
-                           OPEN_EXISTING,
-                           FILE_ATTRIBUTE_NORMAL,
-                           nullptr);
-
-    if (to_handle == INVALID_HANDLE_VALUE)
-    {
-        int ec = GetLastError();
-
-        if (ec == ERROR_FILE_NOT_FOUND || ec == ERROR_PATH_NOT_FOUND)
-            to_exists = false;
-        else
-        {
-            // some error other than file not found probably means its inaccessible
-            set_error(err, ec, windows_error_message(ec));
-            return false;
-        }
-    }
-    else
-        to_exists = true;
-
-    defer { if (to_handle != INVALID_HANDLE_VALUE) CloseHandle(to_handle); };
-
-    if (to_exists)
-    {
-        switch (opt)
-        {
-        case fs::copy_file_option::None:
-        {
-            set_error(err, ERROR_ALREADY_EXISTS, windows_error_message(ERROR_ALREADY_EXISTS));
-            return false;
-        }
-        case fs::copy_file_option::OverwriteExisting:
-            break;
-
-        case fs::copy_file_option::SkipExisting:
-            return true;
-
-        case fs::copy_file_option::UpdateExisting:
-        {
-            fs::filesystem_info from_info;
-            fs::filesystem_info to_info;
-
-            if (!fs::query_filesystem(from_handle, &from_info, fs::query_flag::FileTimes, err))
-                return false;
-
-            if (!fs::query_filesystem(to_handle, &to_info, fs::query_flag::FileTimes, err))
-                return false;
-
-            if (to_info.detail.file_times.last_write_time >= from_info.detail.file_times.last_write_time)
-                return true;
-
-            break;
-        }
-        }
-    }
-
-    if (!::CopyFile((const sys_native_char*)from.c_str, (const sys_native_char*)to.c_str, false))
-    {
-        set_GetLastError_error(err);
-        return false;
-    }
-
-    // is this desired?
-    if (!fs::touch(to, fs::permission::All, err))
-        return false;
-
-    return true;
-#else
     int from_fd = 0;
     int to_fd = 0;
     fs::filesystem_info from_info{};
-    unsigned int statx_mask = STATX_SIZE | STATX_MODE;
+    unsigned int statx_mask = STATX_MODE;
     unsigned int open_from_flags = O_RDONLY;
     unsigned int open_to_flags = O_CREAT | O_WRONLY | O_TRUNC;
 
+    // skipped files copy nothing
+    if (info != nullptr)
+        fill_memory(info, 0);
+
     if (opt != fs::copy_file_option::OverwriteExisting)
         open_to_flags |= O_EXCL; // O_EXCL to ensure creating, or error when already exists
 
     if (opt == fs::copy_file_option::UpdateExisting)
         statx_mask |= STATX_MTIME;
 
-    from_fd = (int)::open(from.c_str, open_from_flags, 0);
+    // the destination is read again after copying
+    if (is_flag_set(flags, fs::copy_file_flag::VerifyDestination))
+        open_to_flags = (open_to_flags & ~O_WRONLY) | O_RDWR;
+
+    from_fd = (int)::openat(from_dirfd, from, open_from_flags, 0);
 
     if (from_fd < 0)
     {
@@ -2243,7 +3215,7 @@ bool fs::_copy_file(fs::const_fs_string from, fs::const_fs_string to, fs::copy_f
     if (!fs::query_filesystem(from_fd, &from_info, (fs::query_flag)statx_mask, err))
         return false;
 
-    to_fd = (int)::open(to.c_str, open_to_flags, from_info.stx_mode);
+    to_fd = (int)::openat(to_dirfd, to, open_to_flags, from_info.stx_mode);
 
     if (to_fd < 0)
     {
@@ -2258,7 +3230,7 @@ bool fs::_copy_file(fs::const_fs_string from, fs::const_fs_string to, fs::copy_f
             return true;
 
         // check change time
-        int tmp_fd = (int)::open(to.c_str, O_RDONLY, 0);
+        int tmp_fd = (int)::openat(to_dirfd, to, O_RDONLY, 0);
         fs::filesystem_info tmp_info{};
 
         if (tmp_fd < 0)
@@ -2276,7 +3248,7 @@ bool fs::_copy_file(fs::const_fs_string from, fs::const_fs_string to, fs::copy_f
             return true;
 
         open_to_flags &= (~O_EXCL);
-        to_fd = (int)::open(to.c_str, open_to_flags, from_info.stx_mode);
+        to_fd = (int)::openat(to_dirfd, to, open_to_flags, from_info.stx_mode);
 
         if (to_fd < 0)
         {
@@ -2287,27 +3259,383 @@ bool fs::_copy_file(fs::const_fs_string from, fs::const_fs_string to, fs::copy_f
     
     defer { ::close(to_fd); };
 
-    if (sys_int code = ::sendfile(to_fd, from_fd, nullptr, from_info.stx_size); code < 0)
-    {
-        set_error_by_code(err, -code);
-        return false;
-    }
-
-    return true;
-#endif
+    return fs::_copy_file_contents(from_fd, to_fd, info, flags, control, err);
 }
+#endif
 
-// only the directory, not children
-bool _copy_single_directory(fs::const_fs_string from, fs::const_fs_string to, fs::copy_file_option opt, error *err)
-{
 #if Windows
-    fs::filesystem_type from_type;
+struct _copy_progress_state
+{
+    fs::operation_control *control;
+    s64 reported; // bytes
+};
+
+static DWORD CALLBACK _copy_progress_routine(LARGE_INTEGER total_size, LARGE_INTEGER transferred,
+                                             LARGE_INTEGER stream_size, LARGE_INTEGER stream_transferred,
+                                             DWORD stream_number, DWORD reason,
+                                             HANDLE from_handle, HANDLE to_handle, LPVOID data)
+{
+    (void)total_size; (void)stream_size; (void)stream_transferred;
+    (void)stream_number; (void)reason; (void)from_handle; (void)to_handle;
 
-    if (!fs::get_filesystem_type(from, &from_type, true, err))
-        return false;
+    _copy_progress_state *state = (_copy_progress_state*)data;
+    s64 bytes = (s64)transferred.QuadPart - state->reported;
+    state->reported = (s64)transferred.QuadPart;
 
-    if (from_type != fs::filesystem_type::Directory)
-    {
+    if (bytes > 0 && !fs::_operation_bytes_done(state->control, bytes, nullptr))
+        return PROGRESS_CANCEL;
+
+    return fs::operation_cancelled(state->control) ? PROGRESS_CANCEL : PROGRESS_CONTINUE;
+}
+
+// a multiple of the sector size, for unbuffered reads
+#define CHECKSUM_BUFFER_SIZE (1ll << 20)
+#define CHECKSUM_BUFFER_ALIGNMENT 4096
+
+// reads h until the end, writes what was read to `to` (unless it's
+// INVALID_HANDLE_VALUE) and continues crc and size with it. with
+// FILE_FLAG_NO_BUFFERING, reads have to start at multiples of the sector
+// size, so a short read ends the loop instead of reading again at the end.
+static bool _checksum_handle(HANDLE h, HANDLE to, u8 *buf, u32 *crc, s64 *size, fs::operation_control *control, error *err)
+{
+    while (true)
+    {
+        DWORD n = 0;
+
+        if (!ReadFile(h, buf, (DWORD)CHECKSUM_BUFFER_SIZE, &n, nullptr))
+        {
+            set_GetLastError_error(err);
+            return false;
+        }
+
+        if (n == 0)
+            return true;
+
+        // WriteFile may write less than asked, e.g. on a full disk
+        for (DWORD written = 0; to != INVALID_HANDLE_VALUE && written < n;)
+        {
+            DWORD w = 0;
+
+            if (!WriteFile(to, buf + written, n - written, &w, nullptr))
+            {
+                set_GetLastError_error(err);
+                return false;
+            }
+
+            if (w == 0)
+            {
+                set_error(err, ERROR_WRITE_FAULT, windows_error_message(ERROR_WRITE_FAULT));
+                return false;
+            }
+
+            written += w;
+        }
+
+        *crc = fs::_crc32c(*crc, buf, n);
+        *size += n;
+
+        if (!fs::_operation_bytes_done(control, n, err))
+            return false;
+
+        if (n < (DWORD)CHECKSUM_BUFFER_SIZE)
+            return true;
+    }
+}
+
+// copy_file_flag::Verify and VerifyDestination: CopyFile doesn't pass the data
+// through a buffer, so the contents are copied with ReadFile / WriteFile and
+// checksummed on the way. with VerifyDestination, the destination is written
+// to the device and read again without buffering.
+static bool _copy_file_checksummed(fs::const_fs_string from, fs::const_fs_string to, fs::copy_file_info *info, fs::copy_file_flag flags, fs::operation_control *control, error *err)
+{
+    bool bulk = is_flag_set(flags, fs::copy_file_flag::Bulk) || is_flag_set(flags, fs::copy_file_flag::DirectIO);
+    DWORD from_flags = FILE_FLAG_SEQUENTIAL_SCAN;
+    DWORD to_flags = FILE_ATTRIBUTE_NORMAL;
+
+    // Bulk and DirectIO: unbuffered reads and written through, the closest
+    // to COPY_FILE_NO_BUFFERING without aligning the writes.
+    if (bulk)
+    {
+        from_flags |= FILE_FLAG_NO_BUFFERING;
+        to_flags |= FILE_FLAG_WRITE_THROUGH;
+    }
+
+    u8 *buf = (u8*)_aligned_malloc(CHECKSUM_BUFFER_SIZE, CHECKSUM_BUFFER_ALIGNMENT);
+
+    if (buf == nullptr)
+    {
+        set_error_by_code(err, ERROR_NOT_ENOUGH_MEMORY);
+        return false;
+    }
+
+    defer { _aligned_free(buf); };
+
+    HANDLE from_handle = CreateFile((const sys_native_char*)from.c_str,
+                                    GENERIC_READ,
+                                    FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                    nullptr,
+                                    OPEN_EXISTING,
+                                    from_flags,
+                                    nullptr);
+
+    if (from_handle == INVALID_HANDLE_VALUE)
+    {
+        set_GetLastError_error(err);
+        return false;
+    }
+
+    defer { CloseHandle(from_handle); };
+
+    HANDLE to_handle = CreateFile((const sys_native_char*)to.c_str,
+                                  GENERIC_WRITE,
+                                  FILE_SHARE_DELETE | FILE_SHARE_READ,
+                                  nullptr,
+                                  CREATE_ALWAYS,
+                                  to_flags,
+                                  nullptr);
+
+    if (to_handle == INVALID_HANDLE_VALUE)
+    {
+        set_GetLastError_error(err);
+        return false;
+    }
+
+    defer { if (to_handle != INVALID_HANDLE_VALUE) CloseHandle(to_handle); };
+
+    u32 crc = 0;
+    s64 copied = 0;
+
+    if (!::_checksum_handle(from_handle, to_handle, buf, &crc, &copied, control, err))
+        return false;
+
+    if (info != nullptr)
+    {
+        info->strategy = fs::copy_strategy::ReadWrite;
+        info->bytes_copied = copied;
+        info->checksum = crc;
+    }
+
+    if (!is_flag_set(flags, fs::copy_file_flag::VerifyDestination))
+        return true;
+
+    if (!FlushFileBuffers(to_handle))
+    {
+        set_GetLastError_error(err);
+        return false;
+    }
+
+    CloseHandle(to_handle);
+    to_handle = INVALID_HANDLE_VALUE;
+
+    // not from the cache, unless the volume doesn't support unbuffered reads
+    HANDLE verify_handle = CreateFile((const sys_native_char*)to.c_str,
+                                      GENERIC_READ,
+                                      FILE_SHARE_DELETE | FILE_SHARE_READ,
+                                      nullptr,
+                                      OPEN_EXISTING,
+                                      FILE_FLAG_SEQUENTIAL_SCAN | FILE_FLAG_NO_BUFFERING,
+                                      nullptr);
+
+    if (verify_handle == INVALID_HANDLE_VALUE && GetLastError() == ERROR_INVALID_PARAMETER)
+        verify_handle = CreateFile((const sys_native_char*)to.c_str,
+                                   GENERIC_READ,
+                                   FILE_SHARE_DELETE | FILE_SHARE_READ,
+                                   nullptr,
+                                   OPEN_EXISTING,
+                                   FILE_FLAG_SEQUENTIAL_SCAN,
+                                   nullptr);
+
+    if (verify_handle == INVALID_HANDLE_VALUE)
+    {
+        set_GetLastError_error(err);
+        return false;
+    }
+
+    defer { CloseHandle(verify_handle); };
+
+    u32 read_crc = 0;
+    s64 read_size = 0;
+
+    // the progress was already reported while copying
+    if (!::_checksum_handle(verify_handle, INVALID_HANDLE_VALUE, buf, &read_crc, &read_size, nullptr, err))
+        return false;
+
+    if (read_crc != crc || read_size != copied)
+    {
+        set_error(err, ERROR_CRC, windows_error_message(ERROR_CRC));
+        return false;
+    }
+
+    return true;
+}
+#endif
+
+static bool _copy_file_single(fs::const_fs_string from, fs::const_fs_string to, fs::copy_file_option opt, fs::copy_file_info *info, fs::copy_file_flag flags, fs::operation_control *control, error *err)
+{
+#if Windows
+    io_handle from_handle;
+    io_handle to_handle;
+    bool to_exists = false;
+
+    // skipped files copy nothing
+    if (info != nullptr)
+        fill_memory(info, 0);
+
+    from_handle = CreateFile((const sys_native_char*)from.c_str,
+                             0,
+                             FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE,
+                             nullptr,
+                             OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL,
+                             nullptr);
+
+    if (from_handle == INVALID_HANDLE_VALUE)
+    {
+        set_GetLastError_error(err);
+        return false;
+    }
+
+    defer { CloseHandle(from_handle); };
+
+    to_handle = CreateFile((const sys_native_char*)to.c_str,
+                           0,
+                           FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE,
+                           nullptr,
+                           OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL,
+                           nullptr);
+
+    if (to_handle == INVALID_HANDLE_VALUE)
+    {
+        int ec = GetLastError();
+
+        if (ec == ERROR_FILE_NOT_FOUND || ec == ERROR_PATH_NOT_FOUND)
+            to_exists = false;
+        else
+        {
+            // some error other than file not found probably means its inaccessible
+            set_error(err, ec, windows_error_message(ec));
+            return false;
+        }
+    }
+    else
+        to_exists = true;
+
+    defer { if (to_handle != INVALID_HANDLE_VALUE) CloseHandle(to_handle); };
+
+    if (to_exists)
+    {
+        switch (opt)
+        {
+        case fs::copy_file_option::None:
+        {
+            set_error(err, ERROR_ALREADY_EXISTS, windows_error_message(ERROR_ALREADY_EXISTS));
+            return false;
+        }
+        case fs::copy_file_option::OverwriteExisting:
+            break;
+
+        case fs::copy_file_option::SkipExisting:
+            return true;
+
+        case fs::copy_file_option::UpdateExisting:
+        {
+            fs::filesystem_info from_info;
+            fs::filesystem_info to_info;
+
+            if (!fs::query_filesystem(from_handle, &from_info, fs::query_flag::FileTimes, err))
+                return false;
+
+            if (!fs::query_filesystem(to_handle, &to_info, fs::query_flag::FileTimes, err))
+                return false;
+
+            if (to_info.detail.file_times.last_write_time >= from_info.detail.file_times.last_write_time)
+                return true;
+
+            break;
+        }
+        }
+    }
+
+    // Bulk and DirectIO: unbuffered, the closest Windows has
+    DWORD copy_flags = 0;
+
+    if (is_flag_set(flags, fs::copy_file_flag::Bulk) || is_flag_set(flags, fs::copy_file_flag::DirectIO))
+        copy_flags = COPY_FILE_NO_BUFFERING;
+
+    bool verify = is_flag_set(flags, fs::copy_file_flag::Verify) || is_flag_set(flags, fs::copy_file_flag::VerifyDestination);
+
+    if (verify)
+    {
+        if (!::_copy_file_checksummed(from, to, info, flags, control, err))
+            return false;
+    }
+    else if (control == nullptr && copy_flags == 0)
+    {
+        if (!::CopyFile((const sys_native_char*)from.c_str, (const sys_native_char*)to.c_str, false))
+        {
+            set_GetLastError_error(err);
+            return false;
+        }
+    }
+    else
+    {
+        _copy_progress_state state{control, 0};
+        LPPROGRESS_ROUTINE routine = (control != nullptr) ? _copy_progress_routine : nullptr;
+
+        if (!::CopyFileEx((const sys_native_char*)from.c_str, (const sys_native_char*)to.c_str, routine, &state, nullptr, copy_flags))
+        {
+            int ec = GetLastError();
+
+            // ERROR_REQUEST_ABORTED, reported as cancelled
+            if (!fs::_operation_check(control, err))
+                return false;
+
+            set_error(err, ec, windows_error_message(ec));
+            return false;
+        }
+    }
+
+    if (info != nullptr && !verify)
+    {
+        info->strategy = fs::copy_strategy::CopyFile;
+
+        if (!fs::_get_file_size(to, &info->bytes_copied, true, err))
+            return false;
+    }
+
+    // is this desired?
+    if (!fs::touch(to, fs::permission::All, err))
+        return false;
+
+    return true;
+#else
+    return fs::_copy_file_at(AT_FDCWD, from.c_str, AT_FDCWD, to.c_str, opt, info, flags, control, err);
+#endif
+}
+
+bool fs::_copy_file(fs::const_fs_string from, fs::const_fs_string to, fs::copy_file_option opt, fs::copy_file_info *info, fs::copy_file_flag flags, fs::operation_control *control, error *err)
+{
+    if (!fs::_operation_file_started(control, from, err))
+        return false;
+
+    if (!::_copy_file_single(from, to, opt, info, flags, control, err))
+        return false;
+
+    return fs::_operation_file_done(control, err);
+}
+
+// only the directory, not children
+bool _copy_single_directory(fs::const_fs_string from, fs::const_fs_string to, fs::copy_file_option opt, error *err)
+{
+#if Windows
+    fs::filesystem_type from_type;
+
+    if (!fs::get_filesystem_type(from, &from_type, true, err))
+        return false;
+
+    if (from_type != fs::filesystem_type::Directory)
+    {
         set_error(err, ERROR_ALREADY_EXISTS, ::windows_error_message(ERROR_ALREADY_EXISTS));
         return false;
     }
@@ -2315,55 +3643,1463 @@ bool _copy_single_directory(fs::const_fs_string from, fs::const_fs_string to, fs
     error _err{};
     bool ok = fs::create_directory(to, fs::permission::All, &_err);
 
-    if (err != nullptr)
-        *err = _err;
+    if (err != nullptr)
+        *err = _err;
+
+    if (!ok)
+        return false;
+
+    if (_err.error_code == ERROR_ALREADY_EXISTS && opt == fs::copy_file_option::None)
+        return false;
+
+    return true;
+#else
+    fs::query_flag flags = fs::query_flag::Permissions | fs::query_flag::Type;
+
+    fs::filesystem_info from_info{};
+
+    // TODO: symlinks?
+    if (!fs::query_filesystem(from, &from_info, true, flags, err))
+        return false;
+
+    fs::filesystem_type from_type = fs::get_filesystem_type(&from_info);
+
+    if (from_type != fs::filesystem_type::Directory)
+    {
+        set_error(err, EEXIST, ::strerror(EEXIST));
+        return false;
+    }
+
+    error _err{};
+    bool ok = fs::create_directory(to, fs::get_permissions(&from_info), &_err);
+
+    if (err != nullptr)
+        *err = _err;
+
+    if (!ok)
+        return false;
+
+    // create_directory returns true even if target exists as directory,
+    // so we check again.
+    if (_err.error_code == EEXIST && opt == fs::copy_file_option::None)
+        return false;
+
+    return true;
+#endif
+}
+
+// the copy_file_flag of the files of copy_directory
+static inline fs::copy_file_flag _copy_file_flags(fs::copy_directory_flag flags)
+{
+    fs::copy_file_flag ret = fs::copy_file_flag::None;
+
+    if (is_flag_set(flags, fs::copy_directory_flag::Bulk))
+        ret = ret | fs::copy_file_flag::Bulk;
+
+    if (is_flag_set(flags, fs::copy_directory_flag::DirectIO))
+        ret = ret | fs::copy_file_flag::DirectIO;
+
+    return ret;
+}
+
+template<bool CheckDepth>
+bool _copy_directory(fs::const_fs_string from, fs::const_fs_string to, int max_depth, fs::copy_file_option opt, fs::copy_file_flag file_flags, fs::operation_control *control, error *err)
+{
+    if (!::_copy_single_directory(from, to, opt, err))
+        return false;
+
+    fs::path from_abs = fs::_canonical_path(from, nullptr);
+    fs::path path_it{};
+    fs::const_fs_string attachment;
+    fs::_relative_path(fs::parent_path_segment(&from_abs), to, &path_it);
+
+    fs::free(&from_abs);
+
+    s64 base_length = path_it.size;
+    s64 attachment_length = from.size + 1;
+
+    defer { fs::free(&path_it); };
+
+    // TODO: iterate options in parameters?
+    for_recursive_path(item, from, fs::iterate_option::StopOnError, err)
+    {
+        path_it.size = base_length;
+        path_it.data[path_it.size] = PC_NUL;
+        attachment = item->path;
+        assert(attachment.size >= attachment_length);
+        attachment.size -= attachment_length;
+        attachment.c_str += attachment_length;
+        fs::path_append(&path_it, attachment);
+
+        if constexpr (CheckDepth)
+        {
+            if (item->depth == max_depth)
+                item->recurse = false;
+        }
+
+        if (!fs::_operation_check(control, err))
+            return false;
+
+        if (item->type == fs::filesystem_type::Directory)
+        {
+            if (!::_copy_single_directory(item->path, ::to_const_string(path_it), opt, err))
+                return false;
+        }
+        else
+        {
+            if (!fs::_copy_file(item->path, ::to_const_string(path_it), opt, nullptr, file_flags, control, err))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+// parallel copy_directory: the walker creates the directories and queues the
+// files, the workers copy them.
+
+// at least this many queued files, more with more threads
+#define COPY_DIRECTORY_MIN_QUEUE_SIZE 64
+
+struct _copy_job
+{
+    fs::path from;
+    fs::path to;
+    s64 index; // position in walk order
+};
+
+struct _copy_directory_context
+{
+    fs::const_fs_string from;
+    fs::const_fs_string to;
+    int max_depth;
+    fs::copy_file_option opt;
+    fs::copy_file_flag file_flags;
+    fs::operation_control *control;
+
+    // ring buffer of queued files, the walker copies files itself when it is full
+    array<_copy_job> queue;
+    s64 queue_head;
+    s64 queue_count;
+
+    bool walk_done;
+    error walk_err; // error of the iterator, not of copying
+
+    // once anything failed, no more files are queued, and queued files
+    // after the first failed entry in walk order are not copied. files
+    // before it still are, one of them may fail too and become the first.
+    bool failed;
+    s64 error_index;
+    error err;
+
+    fs::_mutex lock;
+    fs::_condition job_available;
+};
+
+static inline void _swap_paths(fs::path *a, fs::path *b)
+{
+    fs::path tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+// ctx must be locked
+static void _add_copy_error(_copy_directory_context *ctx, s64 index, const error *e)
+{
+    if (ctx->failed && ctx->error_index < index)
+        return;
+
+    ctx->failed = true;
+    ctx->error_index = index;
+    ctx->err = *e;
+}
+
+// ctx must be locked, is unlocked while copying. takes the next queued job
+// into the buffers of from and to, and copies it.
+static void _copy_next_job(_copy_directory_context *ctx, fs::path *from, fs::path *to)
+{
+    _copy_job *job = ctx->queue.data + ctx->queue_head;
+    s64 index = job->index;
+
+    // the slot gets the old buffers, so neither side allocates again
+    _swap_paths(&job->from, from);
+    _swap_paths(&job->to, to);
+
+    ctx->queue_head = (ctx->queue_head + 1) % ctx->queue.size;
+    ctx->queue_count -= 1;
+
+    if (ctx->failed && index > ctx->error_index)
+        return;
+
+    fs::_mutex_unlock(&ctx->lock);
+
+    error e{};
+    bool ok = fs::_copy_file(to_const_string(from), to_const_string(to), ctx->opt, nullptr, ctx->file_flags, ctx->control, &e);
+
+    fs::_mutex_lock(&ctx->lock);
+
+    if (!ok)
+        _add_copy_error(ctx, index, &e);
+}
+
+// copies queued files until the walker is done and the queue is empty
+static void _copy_worker(_copy_directory_context *ctx)
+{
+    fs::path from{};
+    fs::path to{};
+
+    fs::_mutex_lock(&ctx->lock);
+
+    while (true)
+    {
+        while (ctx->queue_count == 0 && !ctx->walk_done)
+            fs::_condition_wait(&ctx->job_available, &ctx->lock);
+
+        if (ctx->queue_count == 0)
+            break;
+
+        _copy_next_job(ctx, &from, &to);
+    }
+
+    fs::_mutex_unlock(&ctx->lock);
+
+    fs::free(&from);
+    fs::free(&to);
+}
+
+template<bool CheckDepth>
+static void _copy_walker(_copy_directory_context *ctx)
+{
+    fs::path from_abs = fs::_canonical_path(ctx->from, nullptr);
+    fs::path path_it{};
+    fs::const_fs_string attachment;
+    fs::_relative_path(fs::parent_path_segment(&from_abs), ctx->to, &path_it);
+
+    fs::free(&from_abs);
+
+    s64 base_length = path_it.size;
+    s64 attachment_length = ctx->from.size + 1;
+    s64 index = 0;
+
+    // used when the walker copies a file itself
+    fs::path job_from{};
+    fs::path job_to{};
+
+    defer
+    {
+        fs::free(&path_it);
+        fs::free(&job_from);
+        fs::free(&job_to);
+    };
+
+    for_recursive_path(item, ctx->from, fs::iterate_option::StopOnError, &ctx->walk_err)
+    {
+        index += 1;
+
+        path_it.size = base_length;
+        path_it.data[path_it.size] = PC_NUL;
+        attachment = item->path;
+        assert(attachment.size >= attachment_length);
+        attachment.size -= attachment_length;
+        attachment.c_str += attachment_length;
+        fs::path_append(&path_it, attachment);
+
+        if constexpr (CheckDepth)
+        {
+            if (item->depth == ctx->max_depth)
+                item->recurse = false;
+        }
+
+        error e{};
+
+        // directories are created in walk order, so parents exist before
+        // any file inside them is queued.
+        if (!fs::_operation_check(ctx->control, &e)
+         || (item->type == fs::filesystem_type::Directory
+          && !::_copy_single_directory(item->path, ::to_const_string(path_it), ctx->opt, &e)))
+        {
+            fs::_mutex_lock(&ctx->lock);
+            _add_copy_error(ctx, index, &e);
+            fs::_mutex_unlock(&ctx->lock);
+            break;
+        }
+
+        if (item->type == fs::filesystem_type::Directory)
+            continue;
+
+        fs::_mutex_lock(&ctx->lock);
+
+        if (ctx->failed)
+        {
+            fs::_mutex_unlock(&ctx->lock);
+            break;
+        }
+
+        // full, the walker helps instead of waiting
+        while (ctx->queue_count == ctx->queue.size)
+            _copy_next_job(ctx, &job_from, &job_to);
+
+        _copy_job *job = ctx->queue.data + (ctx->queue_head + ctx->queue_count) % ctx->queue.size;
+        fs::path_set(&job->from, item->path);
+        fs::path_set(&job->to, &path_it);
+        job->index = index;
+        ctx->queue_count += 1;
+
+        fs::_condition_signal(&ctx->job_available);
+        fs::_mutex_unlock(&ctx->lock);
+    }
+
+    fs::_mutex_lock(&ctx->lock);
+    ctx->walk_done = true;
+    fs::_condition_broadcast(&ctx->job_available);
+    fs::_mutex_unlock(&ctx->lock);
+}
+
+template<bool CheckDepth>
+static void _copy_directory_thread(s64 begin, s64 end, void *userdata)
+{
+    _copy_directory_context *ctx = (_copy_directory_context*)userdata;
+
+    for (s64 i = begin; i < end; ++i)
+    {
+        // one walker, everyone (including the walker when it's done) copies
+        if (i == 0)
+            _copy_walker<CheckDepth>(ctx);
+
+        _copy_worker(ctx);
+    }
+}
+
+static bool _copy_directory_parallel(fs::const_fs_string from, fs::const_fs_string to, int max_depth, fs::copy_file_option opt, fs::copy_file_flag file_flags, s32 thread_count, fs::operation_control *control, error *err)
+{
+    if (!::_copy_single_directory(from, to, opt, err))
+        return false;
+
+    _copy_directory_context ctx{};
+    ctx.from = from;
+    ctx.to = to;
+    ctx.max_depth = max_depth;
+    ctx.opt = opt;
+    ctx.file_flags = file_flags;
+    ctx.control = control;
+
+    s64 queue_size = (s64)thread_count * 4;
+
+    if (queue_size < COPY_DIRECTORY_MIN_QUEUE_SIZE)
+        queue_size = COPY_DIRECTORY_MIN_QUEUE_SIZE;
+
+    ::reserve(&ctx.queue, queue_size);
+
+    for (s64 i = 0; i < queue_size; ++i)
+    {
+        _copy_job job{};
+        ::add_at_end(&ctx.queue, job);
+    }
+
+    fs::_mutex_init(&ctx.lock);
+    fs::_condition_init(&ctx.job_available);
+
+    defer
+    {
+        for_array(job, &ctx.queue)
+        {
+            fs::free(&job->from);
+            fs::free(&job->to);
+        }
+
+        ::free(&ctx.queue);
+        fs::_condition_free(&ctx.job_available);
+        fs::_mutex_free(&ctx.lock);
+    };
+
+    // if threads can't be started, _parallel_for runs the walker first,
+    // which then copies everything itself.
+    if (max_depth < 0)
+        fs::_parallel_for(thread_count, 1, thread_count, _copy_directory_thread<false>, &ctx);
+    else
+        fs::_parallel_for(thread_count, 1, thread_count, _copy_directory_thread<true>, &ctx);
+
+    // same error regardless of timing: the first failed entry in walk order
+    if (ctx.failed)
+    {
+        if (err != nullptr)
+            *err = ctx.err;
+
+        return false;
+    }
+
+    // same as sequential copying, iteration errors are reported but don't fail
+    if (err != nullptr && ctx.walk_err.error_code != 0)
+        *err = ctx.walk_err;
+
+    return true;
+}
+
+#if Linux
+// io_uring copy_directory: the walker creates the directories and starts
+// small files on one ring, each file goes through up to three rounds of
+// operations which are submitted together with the rounds of other files:
+//
+// 1. statx (size and mode of the source)
+// 2. openat source -> openat destination -> read, linked
+// 3. write -> close source -> close destination, linked
+//
+// The files are opened into fixed slots of the ring so the linked
+// operations can use them. Files that are not regular, don't fit into the
+// buffer of a job or fail anywhere in the chains are copied with _copy_file.
+
+#define URING_COPY_JOB_COUNT     256
+#define URING_COPY_BUFFER_SIZE   (16 * 1024) // files of this size or larger are copied with _copy_file
+#define URING_COPY_RING_ENTRIES  1024        // at most 3 operations of each job are in flight
+#define URING_COPY_REAP_COUNT    64
+
+enum class _uring_copy_step : u8
+{
+    Statx,
+    OpenFrom,
+    OpenTo,
+    Read,
+    Write,
+    CloseFrom,
+    CloseTo,
+    Cleanup // closing the slots of a failed chain
+};
+
+#define URING_COPY_STEP_COUNT 8
+
+struct _uring_copy_job
+{
+    fs::path from;
+    fs::path to;
+    s64 index; // position in walk order
+    fs::filesystem_info info;
+    s32 results[URING_COPY_STEP_COUNT];
+    s32 pending; // operations in flight
+    bool used;
+    bool copying; // in round 3
+};
+
+struct _uring_copy_context
+{
+    fs::_uring ring;
+    bool ring_failed;
+    bool direct; // false if the kernel ignores the slots of openat (before 5.15)
+    fs::copy_file_option opt;
+    fs::operation_control *control;
+
+    array<_uring_copy_job> jobs;
+    array<s32> free_jobs;
+    u8 *buffers; // URING_COPY_BUFFER_SIZE per job
+
+    // the error of the first failed entry in walk order
+    bool failed;
+    s64 error_index;
+    error err;
+};
+
+static inline u64 _uring_copy_user_data(s32 job, _uring_copy_step step)
+{
+    return ((u64)job * URING_COPY_STEP_COUNT) + (u64)step;
+}
+
+static inline u32 _uring_copy_slot(s32 job, bool to)
+{
+    return (u32)job * 2 + (to ? 1 : 0);
+}
+
+static void _uring_copy_fail(_uring_copy_context *ctx, s64 index, const error *e)
+{
+    if (ctx->failed && ctx->error_index < index)
+        return;
+
+    ctx->failed = true;
+    ctx->error_index = index;
+    ctx->err = *e;
+}
+
+static void _uring_copy_release(_uring_copy_context *ctx, s32 j)
+{
+    ctx->jobs.data[j].used = false;
+    ::add_at_end(&ctx->free_jobs, j);
+}
+
+// copies the file of job j without the ring
+static void _uring_copy_sync(_uring_copy_context *ctx, s32 j, fs::copy_file_option opt)
+{
+    _uring_copy_job *job = ctx->jobs.data + j;
+    error e{};
+
+    if (!fs::_copy_file(to_const_string(job->from), to_const_string(job->to), opt, nullptr, fs::copy_file_flag::None, ctx->control, &e))
+        _uring_copy_fail(ctx, job->index, &e);
+}
+
+// whether count operations fit into the submission queue, submits the
+// queued ones first if necessary.
+static bool _uring_copy_reserve(_uring_copy_context *ctx, u32 count)
+{
+    if (fs::_uring_sq_space(&ctx->ring) >= count)
+        return true;
+
+    if (!fs::_uring_submit(&ctx->ring, 0))
+        return false;
+
+    return fs::_uring_sq_space(&ctx->ring) >= count;
+}
+
+// closes the slots of a failed chain and copies the file without the ring
+static void _uring_copy_retry(_uring_copy_context *ctx, s32 j)
+{
+    _uring_copy_job *job = ctx->jobs.data + j;
+    s32 *res = job->results;
+    bool from_open = res[(int)_uring_copy_step::OpenFrom] == 0 && res[(int)_uring_copy_step::CloseFrom] != 0;
+    bool to_open   = res[(int)_uring_copy_step::OpenTo]   == 0 && res[(int)_uring_copy_step::CloseTo]   != 0;
+
+    if (from_open && _uring_copy_reserve(ctx, 1)
+     && fs::_uring_prep_close(&ctx->ring, _uring_copy_slot(j, false), _uring_copy_user_data(j, _uring_copy_step::Cleanup)))
+        job->pending += 1;
+
+    if (to_open && _uring_copy_reserve(ctx, 1)
+     && fs::_uring_prep_close(&ctx->ring, _uring_copy_slot(j, true), _uring_copy_user_data(j, _uring_copy_step::Cleanup)))
+        job->pending += 1;
+
+    // the chain created the destination, so it's overwritten regardless
+    // of the option.
+    fs::copy_file_option opt = ctx->opt;
+
+    if (res[(int)_uring_copy_step::OpenTo] >= 0)
+        opt = fs::copy_file_option::OverwriteExisting;
+
+    _uring_copy_sync(ctx, j, opt);
+
+    if (job->pending == 0)
+        _uring_copy_release(ctx, j);
+}
+
+static void _uring_copy_queue_open(_uring_copy_context *ctx, s32 j)
+{
+    _uring_copy_job *job = ctx->jobs.data + j;
+
+    int open_to_flags = O_CREAT | O_WRONLY | O_TRUNC;
+
+    // same as _copy_file, existing destinations of the other options are
+    // handled by copying the file again without the ring.
+    if (ctx->opt != fs::copy_file_option::OverwriteExisting)
+        open_to_flags |= O_EXCL;
+
+    if (!ctx->direct || !_uring_copy_reserve(ctx, 3))
+    {
+        _uring_copy_sync(ctx, j, ctx->opt);
+        _uring_copy_release(ctx, j);
+        return;
+    }
+
+    fs::_uring_prep_openat(&ctx->ring, AT_FDCWD, job->from.data, O_RDONLY, 0, _uring_copy_slot(j, false), _uring_copy_user_data(j, _uring_copy_step::OpenFrom));
+    fs::_uring_link_last(&ctx->ring);
+    fs::_uring_prep_openat(&ctx->ring, AT_FDCWD, job->to.data, open_to_flags, job->info.stx_mode & ~S_IFMT, _uring_copy_slot(j, true), _uring_copy_user_data(j, _uring_copy_step::OpenTo));
+    fs::_uring_link_last(&ctx->ring);
+    fs::_uring_prep_read(&ctx->ring, _uring_copy_slot(j, false), ctx->buffers + (s64)j * URING_COPY_BUFFER_SIZE, URING_COPY_BUFFER_SIZE, 0, _uring_copy_user_data(j, _uring_copy_step::Read));
+
+    job->pending = 3;
+}
+
+static void _uring_copy_queue_write(_uring_copy_context *ctx, s32 j)
+{
+    _uring_copy_job *job = ctx->jobs.data + j;
+    s32 size = job->results[(int)_uring_copy_step::Read];
+
+    if (!_uring_copy_reserve(ctx, 3))
+    {
+        _uring_copy_retry(ctx, j);
+        return;
+    }
+
+    job->copying = true;
+    job->pending = 2;
+
+    if (size > 0)
+    {
+        fs::_uring_prep_write(&ctx->ring, _uring_copy_slot(j, true), ctx->buffers + (s64)j * URING_COPY_BUFFER_SIZE, (u32)size, 0, _uring_copy_user_data(j, _uring_copy_step::Write));
+        fs::_uring_link_last(&ctx->ring);
+        job->pending += 1;
+    }
+    else
+        job->results[(int)_uring_copy_step::Write] = 0;
+
+    fs::_uring_prep_close(&ctx->ring, _uring_copy_slot(j, false), _uring_copy_user_data(j, _uring_copy_step::CloseFrom));
+    fs::_uring_link_last(&ctx->ring);
+    fs::_uring_prep_close(&ctx->ring, _uring_copy_slot(j, true), _uring_copy_user_data(j, _uring_copy_step::CloseTo));
+}
+
+static void _uring_copy_complete(_uring_copy_context *ctx, const fs::_uring_completion *c)
+{
+    s32 j = (s32)(c->user_data / URING_COPY_STEP_COUNT);
+    _uring_copy_step step = (_uring_copy_step)(c->user_data % URING_COPY_STEP_COUNT);
+    _uring_copy_job *job = ctx->jobs.data + j;
+    s32 *res = job->results;
+
+    job->pending -= 1;
+
+    if (step == _uring_copy_step::Cleanup)
+    {
+        if (job->pending == 0)
+            _uring_copy_release(ctx, j);
+
+        return;
+    }
+
+    res[(int)step] = c->result;
+
+    // the kernel ignored the slot and opened a regular file descriptor,
+    // the linked read failed on the empty slot. the file was opened (and
+    // maybe created) though.
+    if ((step == _uring_copy_step::OpenFrom || step == _uring_copy_step::OpenTo) && c->result > 0)
+    {
+        ::close(c->result);
+        res[(int)step] = 0;
+        ctx->direct = false;
+    }
+
+    if (job->pending > 0)
+        return;
+
+    if (step == _uring_copy_step::Statx)
+    {
+        // errors and everything that's not a small regular file are left
+        // to _copy_file.
+        if (c->result < 0
+         || (job->info.stx_mode & S_IFMT) != S_IFREG
+         || job->info.stx_size >= URING_COPY_BUFFER_SIZE)
+        {
+            _uring_copy_sync(ctx, j, ctx->opt);
+            _uring_copy_release(ctx, j);
+            return;
+        }
+
+        _uring_copy_queue_open(ctx, j);
+        return;
+    }
+
+    if (!job->copying)
+    {
+        // the file grew past the buffer since statx
+        if (res[(int)_uring_copy_step::OpenFrom] < 0
+         || res[(int)_uring_copy_step::OpenTo] < 0
+         || res[(int)_uring_copy_step::Read] < 0
+         || res[(int)_uring_copy_step::Read] >= URING_COPY_BUFFER_SIZE)
+        {
+            _uring_copy_retry(ctx, j);
+            return;
+        }
+
+        _uring_copy_queue_write(ctx, j);
+        return;
+    }
+
+    if (res[(int)_uring_copy_step::Write] != res[(int)_uring_copy_step::Read]
+     || res[(int)_uring_copy_step::CloseFrom] != 0
+     || res[(int)_uring_copy_step::CloseTo] != 0)
+    {
+        _uring_copy_retry(ctx, j);
+        return;
+    }
+
+    error e{};
+
+    if (!fs::_operation_bytes_done(ctx->control, res[(int)_uring_copy_step::Read], &e)
+     || !fs::_operation_file_done(ctx->control, &e))
+        _uring_copy_fail(ctx, job->index, &e);
+
+    _uring_copy_release(ctx, j);
+}
+
+// the ring is unusable: waits for the operations in flight, which still use
+// the buffers and slots of their jobs, and records their results without
+// starting anything new.
+static void _uring_copy_drain(_uring_copy_context *ctx)
+{
+    fs::_uring_completion completions[URING_COPY_REAP_COUNT];
+    s32 reaped = 0;
+
+    while (fs::_uring_in_flight(&ctx->ring) > 0 && fs::_uring_wait(&ctx->ring))
+    while ((reaped = fs::_uring_reap(&ctx->ring, completions, URING_COPY_REAP_COUNT)) > 0)
+    for (s32 c = 0; c < reaped; ++c)
+    {
+        s32 j = (s32)(completions[c].user_data / URING_COPY_STEP_COUNT);
+        _uring_copy_step step = (_uring_copy_step)(completions[c].user_data % URING_COPY_STEP_COUNT);
+        s32 *res = ctx->jobs.data[j].results;
+
+        if (step == _uring_copy_step::Cleanup)
+            continue;
+
+        res[(int)step] = completions[c].result;
+
+        // same as _uring_copy_complete
+        if ((step == _uring_copy_step::OpenFrom || step == _uring_copy_step::OpenTo) && completions[c].result > 0)
+        {
+            ::close(completions[c].result);
+            res[(int)step] = 0;
+        }
+    }
+}
+
+// submits queued operations and waits for at least one completion
+static void _uring_copy_wait(_uring_copy_context *ctx)
+{
+    error e{};
+
+    if (!fs::_uring_submit(&ctx->ring, 1, &e))
+    {
+        // no file is failed because of the ring: once nothing is in flight
+        // anymore, the ring is freed, and the files it did not finish are
+        // copied again without it, like the files that weren't started yet.
+        ::_uring_copy_drain(ctx);
+        fs::_uring_free(&ctx->ring);
+        ctx->ring_failed = true;
+
+        for (s32 j = 0; j < (s32)ctx->jobs.size; ++j)
+        {
+            _uring_copy_job *job = ctx->jobs.data + j;
+
+            if (!job->used)
+                continue;
+
+            // same as _uring_copy_retry
+            fs::copy_file_option opt = ctx->opt;
+
+            if (job->results[(int)_uring_copy_step::OpenTo] >= 0)
+                opt = fs::copy_file_option::OverwriteExisting;
+
+            _uring_copy_sync(ctx, j, opt);
+            _uring_copy_release(ctx, j);
+        }
+
+        return;
+    }
+
+    fs::_uring_completion completions[URING_COPY_REAP_COUNT];
+    s32 reaped = 0;
+
+    while ((reaped = fs::_uring_reap(&ctx->ring, completions, URING_COPY_REAP_COUNT)) > 0)
+    for (s32 c = 0; c < reaped; ++c)
+        _uring_copy_complete(ctx, completions + c);
+}
+
+static void _uring_copy_start(_uring_copy_context *ctx, fs::const_fs_string from, const fs::path *to, s64 index)
+{
+    while (ctx->free_jobs.size == 0)
+        _uring_copy_wait(ctx);
+
+    ctx->free_jobs.size -= 1;
+    s32 j = ctx->free_jobs.data[ctx->free_jobs.size];
+    _uring_copy_job *job = ctx->jobs.data + j;
+
+    fs::path_set(&job->from, from);
+    fs::path_set(&job->to, to);
+    job->index = index;
+    job->pending = 0;
+    job->used = true;
+    job->copying = false;
+
+    for (s32 i = 0; i < URING_COPY_STEP_COUNT; ++i)
+        job->results[i] = -ECANCELED;
+
+    error e{};
+
+    if (!fs::_operation_file_started(ctx->control, from, &e))
+    {
+        _uring_copy_fail(ctx, index, &e);
+        _uring_copy_release(ctx, j);
+        return;
+    }
+
+    if (ctx->ring_failed || !ctx->direct || !_uring_copy_reserve(ctx, 1))
+    {
+        _uring_copy_sync(ctx, j, ctx->opt);
+        _uring_copy_release(ctx, j);
+        return;
+    }
+
+    fs::_uring_prep_statx(&ctx->ring, AT_FDCWD, job->from.data, 0, STATX_TYPE | STATX_MODE | STATX_SIZE, &job->info, _uring_copy_user_data(j, _uring_copy_step::Statx));
+    job->pending = 1;
+}
+
+// returns false if io_uring can't be used, in which case nothing was copied.
+template<bool CheckDepth>
+static bool _copy_directory_uring(fs::const_fs_string from, fs::const_fs_string to, int max_depth, fs::copy_file_option opt, fs::operation_control *control, bool *result, error *err)
+{
+    _uring_copy_context ctx{};
+    ctx.opt = opt;
+    ctx.control = control;
+    ctx.direct = true;
+
+    if (!fs::_uring_init(&ctx.ring, URING_COPY_RING_ENTRIES))
+        return false;
+
+    defer { if (!ctx.ring_failed) fs::_uring_free(&ctx.ring); };
+
+    if (!fs::_uring_supports(&ctx.ring, fs::_uring_op::Statx)
+     || !fs::_uring_supports(&ctx.ring, fs::_uring_op::Openat)
+     || !fs::_uring_supports(&ctx.ring, fs::_uring_op::Read)
+     || !fs::_uring_supports(&ctx.ring, fs::_uring_op::Write)
+     || !fs::_uring_supports(&ctx.ring, fs::_uring_op::Close)
+     || !fs::_uring_register_files(&ctx.ring, URING_COPY_JOB_COUNT * 2))
+        return false;
+
+    ctx.buffers = (u8*)::malloc((s64)URING_COPY_JOB_COUNT * URING_COPY_BUFFER_SIZE);
+
+    if (ctx.buffers == nullptr)
+        return false;
+
+    ::reserve(&ctx.jobs, URING_COPY_JOB_COUNT);
+    ::reserve(&ctx.free_jobs, URING_COPY_JOB_COUNT);
+
+    for (s32 j = 0; j < URING_COPY_JOB_COUNT; ++j)
+    {
+        _uring_copy_job job{};
+        ::add_at_end(&ctx.jobs, job);
+        ::add_at_end(&ctx.free_jobs, URING_COPY_JOB_COUNT - 1 - j);
+    }
+
+    defer
+    {
+        for_array(job, &ctx.jobs)
+        {
+            fs::free(&job->from);
+            fs::free(&job->to);
+        }
+
+        ::free(&ctx.jobs);
+        ::free(&ctx.free_jobs);
+        ::free(ctx.buffers);
+    };
+
+    *result = false;
+
+    if (!::_copy_single_directory(from, to, opt, err))
+        return true;
+
+    fs::path from_abs = fs::_canonical_path(from, nullptr);
+    fs::path path_it{};
+    fs::const_fs_string attachment;
+    fs::_relative_path(fs::parent_path_segment(&from_abs), to, &path_it);
+
+    fs::free(&from_abs);
+
+    s64 base_length = path_it.size;
+    s64 attachment_length = from.size + 1;
+    s64 index = 0;
+    error walk_err{};
+
+    defer { fs::free(&path_it); };
+
+    for_recursive_path(item, from, fs::iterate_option::StopOnError, &walk_err)
+    {
+        index += 1;
+
+        path_it.size = base_length;
+        path_it.data[path_it.size] = PC_NUL;
+        attachment = item->path;
+        assert(attachment.size >= attachment_length);
+        attachment.size -= attachment_length;
+        attachment.c_str += attachment_length;
+        fs::path_append(&path_it, attachment);
+
+        if constexpr (CheckDepth)
+        {
+            if (item->depth == max_depth)
+                item->recurse = false;
+        }
+
+        if (ctx.failed)
+            break;
+
+        error e{};
+
+        // directories are created before any file inside them is started
+        if (!fs::_operation_check(control, &e)
+         || (item->type == fs::filesystem_type::Directory
+          && !::_copy_single_directory(item->path, ::to_const_string(path_it), opt, &e)))
+        {
+            _uring_copy_fail(&ctx, index, &e);
+            break;
+        }
+
+        if (item->type == fs::filesystem_type::Directory)
+            continue;
+
+        _uring_copy_start(&ctx, item->path, &path_it, index);
+    }
+
+    while (!ctx.ring_failed && ctx.free_jobs.size < ctx.jobs.size)
+        _uring_copy_wait(&ctx);
+
+    if (ctx.failed)
+    {
+        if (err != nullptr)
+            *err = ctx.err;
+
+        return true;
+    }
+
+    // same as sequential copying, iteration errors are reported but don't fail
+    if (err != nullptr && walk_err.error_code != 0)
+        *err = walk_err;
+
+    *result = true;
+    return true;
+}
+#endif
+
+// copy_directory with copy_directory_flag::Deduplicate or PreserveHardLinks:
+// the walk creates the directories and collects the files. Hard links of the
+// same file are found by their file IDs, identical files in phases which each
+// read less than the next one (size, first and last bytes, everything) and
+// are then compared byte by byte.
+// The first file of every set of identical files is copied and the others
+// are cloned from or hard linked to its copy.
+
+// bytes at the start and at the end of a file that are hashed before
+// hashing the whole file.
+#define DEDUPE_EDGE_SIZE            4096
+#define DEDUPE_HASH_BUFFER_SIZE     (1ll << 20)
+#define DEDUPE_HASH_SEED_0          0x9e3779b97f4a7c15ull
+#define DEDUPE_HASH_SEED_1          0xc2b2ae3d27d4eb4full
+
+// files per chunk of _parallel_for
+#define DEDUPE_CHUNK_SIZE           16
+
+// how a file is created, also the order in which they are created
+enum class _dedupe_kind : u8
+{
+    Copy,       // copied
+    Duplicate,  // cloned from or hard linked to the copy of first
+    HardLink    // hard linked to the copy of first (which may be a Duplicate)
+};
+
+struct _dedupe_file
+{
+    fs::path from;
+    fs::path to;
+    s64 index; // position in walk order and in _dedupe_context.files
+    s64 size;  // -1 if not a regular file, which is never deduplicated
+    u32 mode;  // permissions of clones
+
+    // with PreserveHardLinks, the file ID of files with more than one link
+    bool has_links;
+    u64 link_id[2];
+
+    u64 edge_hash;
+    u64 hash[2];
+
+    _dedupe_kind kind;
+    s64 first;   // index of the file this is created from, -1 if Copy
+    bool copied; // false if creating it was skipped because of the copy_file_option
+};
+
+struct _dedupe_context
+{
+    fs::copy_file_option opt;
+    fs::copy_directory_flag flags;
+    fs::copy_file_flag file_flags;
+    fs::operation_control *control;
+
+    array<_dedupe_file> files;
+    array<_dedupe_file*> work; // files of the current phase
+
+    // once anything failed, no more files are read or copied
+    std::atomic<bool> failed;
+    s64 error_index;
+    error err;
+    fs::_mutex lock;
+};
+
+static void _dedupe_fail(_dedupe_context *ctx, s64 index, const error *e)
+{
+    fs::_mutex_lock(&ctx->lock);
+
+    if (!ctx->failed || index < ctx->error_index)
+    {
+        ctx->error_index = index;
+        ctx->err = *e;
+    }
+
+    ctx->failed = true;
+    fs::_mutex_unlock(&ctx->lock);
+}
+
+static int _compare_dedupe_sizes(_dedupe_file *const *a, _dedupe_file *const *b)
+{
+    if ((*a)->size != (*b)->size)
+        return (*a)->size < (*b)->size ? -1 : 1;
+
+    return 0;
+}
+
+static int _compare_dedupe_edges(_dedupe_file *const *a, _dedupe_file *const *b)
+{
+    if (int cmp = _compare_dedupe_sizes(a, b); cmp != 0)
+        return cmp;
+
+    if ((*a)->edge_hash != (*b)->edge_hash)
+        return (*a)->edge_hash < (*b)->edge_hash ? -1 : 1;
+
+    return 0;
+}
+
+static int _compare_dedupe_hashes(_dedupe_file *const *a, _dedupe_file *const *b)
+{
+    if (int cmp = _compare_dedupe_edges(a, b); cmp != 0)
+        return cmp;
+
+    for (int i = 0; i < 2; ++i)
+        if ((*a)->hash[i] != (*b)->hash[i])
+            return (*a)->hash[i] < (*b)->hash[i] ? -1 : 1;
+
+    return 0;
+}
+
+static int _compare_dedupe_link_ids(_dedupe_file *const *a, _dedupe_file *const *b)
+{
+    for (int i = 0; i < 2; ++i)
+        if ((*a)->link_id[i] != (*b)->link_id[i])
+            return (*a)->link_id[i] < (*b)->link_id[i] ? -1 : 1;
+
+    return 0;
+}
+
+typedef int (*_dedupe_comparer)(_dedupe_file *const *a, _dedupe_file *const *b);
+
+// sorts work by compare, then by walk order
+template<_dedupe_comparer Compare>
+static int _compare_dedupe_ordered(_dedupe_file *const *a, _dedupe_file *const *b)
+{
+    if (int cmp = Compare(a, b); cmp != 0)
+        return cmp;
+
+    return (*a)->index < (*b)->index ? -1 : ((*a)->index > (*b)->index);
+}
+
+// sorts the files of the current phase and keeps the ones which are the
+// same as at least one other file by Compare.
+template<_dedupe_comparer Compare>
+static void _dedupe_keep_equal(_dedupe_context *ctx)
+{
+    array<_dedupe_file*> *work = &ctx->work;
+    ::sort(work->data, work->size, _compare_dedupe_ordered<Compare>);
+
+    s64 kept = 0;
+    s64 run_start = 0;
+
+    for (s64 i = 1; i <= work->size; ++i)
+    {
+        if (i < work->size && Compare(work->data + run_start, work->data + i) == 0)
+            continue;
+
+        if (i - run_start > 1)
+            for (s64 j = run_start; j < i; ++j)
+                work->data[kept++] = work->data[j];
+
+        run_start = i;
+    }
+
+    work->size = kept;
+}
+
+// after _dedupe_keep_equal, files are created from the first of their run
+template<_dedupe_comparer Compare>
+static void _dedupe_assign_first(_dedupe_context *ctx, _dedupe_kind kind)
+{
+    _dedupe_file **w = ctx->work.data;
+
+    for (s64 i = 1; i < ctx->work.size; ++i)
+    {
+        if (Compare(w + i - 1, w + i) != 0)
+            continue;
+
+        w[i]->kind = kind;
+        w[i]->first = (w[i - 1]->first >= 0) ? w[i - 1]->first : w[i - 1]->index;
+    }
+}
+
+static void _dedupe_hash_edges(s64 begin, s64 end, void *userdata)
+{
+    _dedupe_context *ctx = (_dedupe_context*)userdata;
+    u8 buf[DEDUPE_EDGE_SIZE];
+
+    for (s64 i = begin; i < end && !ctx->failed; ++i)
+    {
+        _dedupe_file *f = ctx->work.data[i];
+        fs::_read_handle h = _invalid_read_handle;
+        error e{};
+
+        defer { fs::_close_read(h); };
+
+        s64 head_size = f->size < DEDUPE_EDGE_SIZE ? f->size : DEDUPE_EDGE_SIZE;
+        s64 tail_offset = f->size - DEDUPE_EDGE_SIZE;
+
+        if (tail_offset < head_size)
+            tail_offset = head_size;
+
+        s64 head = 0;
+        s64 tail = 0;
+
+        if (!fs::_open_read(to_const_string(&f->from), &h, &e)
+         || !fs::_read_full_at(h, 0, buf, head_size, &head, &e))
+        {
+            _dedupe_fail(ctx, f->index, &e);
+            break;
+        }
+
+        f->edge_hash = fs::_hash_bytes(buf, head, DEDUPE_HASH_SEED_0);
+
+        if (!fs::_read_full_at(h, tail_offset, buf, f->size - tail_offset, &tail, &e))
+        {
+            _dedupe_fail(ctx, f->index, &e);
+            break;
+        }
+
+        f->edge_hash = fs::_hash_combine(f->edge_hash, fs::_hash_bytes(buf, tail, DEDUPE_HASH_SEED_0));
+    }
+}
+
+static void _dedupe_hash_contents(s64 begin, s64 end, void *userdata)
+{
+    _dedupe_context *ctx = (_dedupe_context*)userdata;
+    u8 *buf = (u8*)::malloc(DEDUPE_HASH_BUFFER_SIZE);
+
+    if (buf == nullptr)
+    {
+        error e{};
+#if Windows
+        set_error_by_code(&e, ERROR_NOT_ENOUGH_MEMORY);
+#else
+        set_error_by_code(&e, ENOMEM);
+#endif
+        _dedupe_fail(ctx, ctx->work.data[begin]->index, &e);
+        return;
+    }
+
+    defer { ::free(buf); };
+
+    for (s64 i = begin; i < end && !ctx->failed; ++i)
+    {
+        _dedupe_file *f = ctx->work.data[i];
+        fs::_read_handle h = _invalid_read_handle;
+        error e{};
+
+        defer { fs::_close_read(h); };
+
+        if (!fs::_operation_check(ctx->control, &e)
+         || !fs::_open_read(to_const_string(&f->from), &h, &e))
+        {
+            _dedupe_fail(ctx, f->index, &e);
+            break;
+        }
+
+        // two independent 64 bit hashes, so different files are practically
+        // never taken as identical.
+        f->hash[0] = (u64)f->size;
+        f->hash[1] = (u64)f->size;
+
+        while (true)
+        {
+            s64 n = 0;
+
+            if (!fs::_read_full(h, buf, DEDUPE_HASH_BUFFER_SIZE, &n, &e))
+            {
+                _dedupe_fail(ctx, f->index, &e);
+                return;
+            }
+
+            if (n == 0)
+                break;
+
+            f->hash[0] = fs::_hash_combine(f->hash[0], fs::_hash_bytes(buf, n, DEDUPE_HASH_SEED_0));
+            f->hash[1] = fs::_hash_combine(f->hash[1], fs::_hash_bytes(buf, n, DEDUPE_HASH_SEED_1));
+
+            if (n < DEDUPE_HASH_BUFFER_SIZE)
+                break;
+        }
+    }
+}
+
+// files with the same hashes are compared byte by byte to the file they
+// would be created from, files which differ after all are copied.
+static void _dedupe_compare_contents(s64 begin, s64 end, void *userdata)
+{
+    _dedupe_context *ctx = (_dedupe_context*)userdata;
+    u8 *buf = (u8*)::malloc(2 * DEDUPE_HASH_BUFFER_SIZE);
+
+    if (buf == nullptr)
+    {
+        error e{};
+#if Windows
+        set_error_by_code(&e, ERROR_NOT_ENOUGH_MEMORY);
+#else
+        set_error_by_code(&e, ENOMEM);
+#endif
+        _dedupe_fail(ctx, ctx->work.data[begin]->index, &e);
+        return;
+    }
+
+    defer { ::free(buf); };
+
+    u8 *first_buf = buf;
+    u8 *f_buf = buf + DEDUPE_HASH_BUFFER_SIZE;
+
+    for (s64 i = begin; i < end && !ctx->failed; ++i)
+    {
+        _dedupe_file *f = ctx->work.data[i];
+        _dedupe_file *first = ctx->files.data + f->first;
+        fs::_read_handle first_h = _invalid_read_handle;
+        fs::_read_handle f_h = _invalid_read_handle;
+        error e{};
+
+        defer { fs::_close_read(first_h); fs::_close_read(f_h); };
+
+        if (!fs::_operation_check(ctx->control, &e)
+         || !fs::_open_read(to_const_string(&first->from), &first_h, &e)
+         || !fs::_open_read(to_const_string(&f->from), &f_h, &e))
+        {
+            _dedupe_fail(ctx, f->index, &e);
+            break;
+        }
+
+        bool same = true;
+
+        while (same)
+        {
+            s64 first_n = 0;
+            s64 f_n = 0;
+
+            if (!fs::_read_full(first_h, first_buf, DEDUPE_HASH_BUFFER_SIZE, &first_n, &e)
+             || !fs::_read_full(f_h, f_buf, DEDUPE_HASH_BUFFER_SIZE, &f_n, &e))
+            {
+                _dedupe_fail(ctx, f->index, &e);
+                return;
+            }
+
+            same = first_n == f_n && memcmp(first_buf, f_buf, (size_t)f_n) == 0;
+
+            if (f_n < DEDUPE_HASH_BUFFER_SIZE)
+                break;
+        }
+
+        if (!same)
+        {
+            f->kind = _dedupe_kind::Copy;
+            f->first = -1;
+        }
+    }
+}
+
+static inline bool _is_exists_error(const error *e)
+{
+#if Windows
+    return e->error_code == ERROR_ALREADY_EXISTS;
+#else
+    return e->error_code == EEXIST;
+#endif
+}
+
+// whether the modification time of a is older than the one of b
+static bool _dedupe_older(fs::const_fs_string a, fs::const_fs_string b, bool *out, error *err)
+{
+    fs::filesystem_info a_info;
+    fs::filesystem_info b_info;
+
+    if (!fs::_query_filesystem(a, &a_info, false, fs::query_flag::FileTimes, err)
+     || !fs::_query_filesystem(b, &b_info, false, fs::query_flag::FileTimes, err))
+        return false;
+
+#if Windows
+    *out = a_info.detail.file_times.last_write_time < b_info.detail.file_times.last_write_time;
+#else
+    *out = a_info.stx_mtime < b_info.stx_mtime;
+#endif
+
+    return true;
+}
+
+static bool _dedupe_copy_file(_dedupe_context *ctx, _dedupe_file *f, error *err)
+{
+    fs::copy_file_info info{};
+
+    // an existing destination may be a hard link to other destinations, made
+    // by an earlier copy. copying over it would write through to all of them
+    // (and race with the threads writing those), so it's removed first.
+    if (ctx->opt == fs::copy_file_option::OverwriteExisting
+     || ctx->opt == fs::copy_file_option::UpdateExisting)
+    {
+        fs::filesystem_type type;
+        bool replace = false;
+
+        if (fs::_get_filesystem_type(to_const_string(&f->to), &type, false, nullptr))
+        {
+            replace = true;
+
+            if (ctx->opt == fs::copy_file_option::UpdateExisting
+             && !::_dedupe_older(to_const_string(&f->to), to_const_string(&f->from), &replace, err))
+                return false;
+        }
+
+        if (replace && !fs::_remove_file(to_const_string(&f->to), err))
+            return false;
+    }
+
+    if (!fs::_copy_file(to_const_string(&f->from), to_const_string(&f->to), ctx->opt, &info, ctx->file_flags, ctx->control, err))
+        return false;
+
+    f->copied = info.strategy != fs::copy_strategy::None;
+    return true;
+}
+
+// f is created from first, whose copy exists
+static bool _dedupe_link(_dedupe_context *ctx, _dedupe_file *f, const _dedupe_file *first, error *err)
+{
+    if (!first->copied || ctx->opt == fs::copy_file_option::UpdateExisting)
+        return _dedupe_copy_file(ctx, f, err);
+
+    if (!fs::_operation_file_started(ctx->control, to_const_string(&f->from), err))
+        return false;
+
+    if (ctx->opt != fs::copy_file_option::None)
+    {
+        fs::filesystem_type type;
+
+        if (fs::_get_filesystem_type(to_const_string(&f->to), &type, false, nullptr))
+        {
+            if (ctx->opt == fs::copy_file_option::SkipExisting)
+                return fs::_operation_file_done(ctx->control, err);
+
+            if (!fs::_remove_file(to_const_string(&f->to), err))
+                return false;
+        }
+    }
+
+    bool linked = false;
+
+#if Linux
+    if (f->kind == _dedupe_kind::Duplicate
+     && !fs::_clone_file(first->to.data, f->to.data, f->mode, &linked, err))
+        return false;
+#endif
+
+    if (!linked)
+    {
+        error _err{};
+
+        if (fs::_create_hard_link(to_const_string(&first->to), to_const_string(&f->to), &_err))
+            linked = true;
+        else if (_is_exists_error(&_err))
+        {
+            if (err != nullptr)
+                *err = _err;
+
+            return false;
+        }
+    }
+
+    // e.g. too many links to the first copy, or a filesystem without hard links
+    if (!linked && !::_copy_file_single(to_const_string(&f->from), to_const_string(&f->to), ctx->opt, nullptr, ctx->file_flags, ctx->control, err))
+        return false;
+
+    f->copied = true;
+    return fs::_operation_file_done(ctx->control, err);
+}
+
+static void _dedupe_copy(s64 begin, s64 end, void *userdata)
+{
+    _dedupe_context *ctx = (_dedupe_context*)userdata;
+
+    for (s64 i = begin; i < end && !ctx->failed; ++i)
+    {
+        _dedupe_file *f = ctx->work.data[i];
+        error e{};
+        bool ok;
+
+        if (f->kind == _dedupe_kind::Copy)
+            ok = _dedupe_copy_file(ctx, f, &e);
+        else
+            ok = _dedupe_link(ctx, f, ctx->files.data + f->first, &e);
 
-    if (!ok)
-        return false;
+        if (!ok)
+        {
+            _dedupe_fail(ctx, f->index, &e);
+            break;
+        }
+    }
+}
 
-    if (_err.error_code == ERROR_ALREADY_EXISTS && opt == fs::copy_file_option::None)
-        return false;
+// runs Func on the files of the current phase, returns false if anything failed
+static bool _dedupe_run(_dedupe_context *ctx, s32 thread_count, fs::_parallel_function func)
+{
+    fs::_parallel_for(ctx->work.size, DEDUPE_CHUNK_SIZE, thread_count, func, ctx);
+    return !ctx->failed;
+}
 
-    return true;
-#else
-    fs::query_flag flags = fs::query_flag::Permissions | fs::query_flag::Type;
+// size, permissions and, with PreserveHardLinks, the file ID of a regular file
+static bool _dedupe_query(_dedupe_context *ctx, fs::const_fs_string pth, _dedupe_file *f, error *err)
+{
+    bool links = is_flag_set(ctx->flags, fs::copy_directory_flag::PreserveHardLinks);
 
-    fs::filesystem_info from_info{};
+#if Windows
+    if (!links)
+        return fs::_get_file_size(pth, &f->size, false, err);
 
-    // TODO: symlinks?
-    if (!fs::query_filesystem(from, &from_info, true, flags, err))
+    HANDLE h = CreateFile((const sys_native_char*)pth.c_str,
+                          0,
+                          FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE,
+                          nullptr,
+                          OPEN_EXISTING,
+                          FILE_ATTRIBUTE_NORMAL,
+                          nullptr);
+
+    if (h == INVALID_HANDLE_VALUE)
+    {
+        set_GetLastError_error(err);
         return false;
+    }
 
-    fs::filesystem_type from_type = fs::get_filesystem_type(&from_info);
+    defer { CloseHandle(h); };
 
-    if (from_type != fs::filesystem_type::Directory)
+    BY_HANDLE_FILE_INFORMATION info;
+
+    if (!GetFileInformationByHandle(h, &info))
     {
-        set_error(err, EEXIST, ::strerror(EEXIST));
+        set_GetLastError_error(err);
         return false;
     }
 
-    error _err{};
-    bool ok = fs::create_directory(to, fs::get_permissions(&from_info), &_err);
+    f->size = (s64)(((u64)info.nFileSizeHigh << 32) | info.nFileSizeLow);
+    f->has_links = info.nNumberOfLinks > 1;
+    f->link_id[0] = info.dwVolumeSerialNumber;
+    f->link_id[1] = ((u64)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+#else
+    fs::filesystem_info info;
+    fs::query_flag flags = fs::query_flag::Size | fs::query_flag::Permissions;
 
-    if (err != nullptr)
-        *err = _err;
+    // STATX_BASIC_STATS includes the number of links
+    if (links)
+        flags = fs::query_flag_default;
 
-    if (!ok)
+    if (!fs::_query_filesystem(pth, &info, false, flags, err))
         return false;
 
-    // create_directory returns true even if target exists as directory,
-    // so we check again.
-    if (_err.error_code == EEXIST && opt == fs::copy_file_option::None)
-        return false;
+    f->size = (s64)info.stx_size;
+    f->mode = info.stx_mode & 07777;
+    f->has_links = links && info.stx_nlink > 1;
+    f->link_id[0] = ((u64)info.stx_dev_major << 32) | info.stx_dev_minor;
+    f->link_id[1] = info.stx_ino;
+#endif
 
     return true;
-#endif
 }
 
 template<bool CheckDepth>
-bool _copy_directory(fs::const_fs_string from, fs::const_fs_string to, int max_depth, fs::copy_file_option opt, error *err)
+static bool _dedupe_walk(_dedupe_context *ctx, fs::const_fs_string from, fs::const_fs_string to, int max_depth, error *err)
 {
-    if (!::_copy_single_directory(from, to, opt, err))
+    if (!::_copy_single_directory(from, to, ctx->opt, err))
         return false;
 
     fs::path from_abs = fs::_canonical_path(from, nullptr);
@@ -2378,7 +5114,6 @@ bool _copy_directory(fs::const_fs_string from, fs::const_fs_string to, int max_d
 
     defer { fs::free(&path_it); };
 
-    // TODO: iterate options in parameters?
     for_recursive_path(item, from, fs::iterate_option::StopOnError, err)
     {
         path_it.size = base_length;
@@ -2395,30 +5130,200 @@ bool _copy_directory(fs::const_fs_string from, fs::const_fs_string to, int max_d
                 item->recurse = false;
         }
 
+        if (!fs::_operation_check(ctx->control, err))
+            return false;
+
         if (item->type == fs::filesystem_type::Directory)
         {
-            if (!::_copy_single_directory(item->path, ::to_const_string(path_it), opt, err))
+            if (!::_copy_single_directory(item->path, ::to_const_string(path_it), ctx->opt, err))
                 return false;
+
+            continue;
         }
-        else
+
+        _dedupe_file f{};
+        fs::init(&f.from);
+        fs::init(&f.to);
+        fs::path_set(&f.from, item->path);
+        fs::path_set(&f.to, &path_it);
+        f.index = ctx->files.size;
+        f.size = -1;
+        f.kind = _dedupe_kind::Copy;
+        f.first = -1;
+        ::add_at_end(&ctx->files, f);
+
+        if (item->type != fs::filesystem_type::File)
+            continue;
+
+        if (!::_dedupe_query(ctx, item->path, ctx->files.data + f.index, err))
+            return false;
+    }
+
+    return true;
+}
+
+template<bool CheckDepth>
+static bool _copy_directory_deduplicated(fs::const_fs_string from, fs::const_fs_string to, int max_depth, fs::copy_file_option opt, fs::copy_directory_flag flags, s32 thread_count, fs::operation_control *control, error *err)
+{
+    _dedupe_context ctx{};
+    ctx.opt = opt;
+    ctx.flags = flags;
+    ctx.file_flags = ::_copy_file_flags(flags);
+    ctx.control = control;
+    ctx.failed = false;
+    fs::_mutex_init(&ctx.lock);
+
+    defer
+    {
+        for_array(f, &ctx.files)
         {
-            if (!fs::_copy_file(item->path, ::to_const_string(path_it), opt, err))
-                return false;
+            fs::free(&f->from);
+            fs::free(&f->to);
+        }
+
+        ::free(&ctx.files);
+        ::free(&ctx.work);
+        fs::_mutex_free(&ctx.lock);
+    };
+
+    if (!::_dedupe_walk<CheckDepth>(&ctx, from, to, max_depth, err))
+        return false;
+
+    // same as sequential copying, iteration errors are reported but don't fail
+    error walk_err{};
+
+    if (err != nullptr)
+        walk_err = *err;
+
+    // hard links of the same file within the copied directory
+    for_array(f, &ctx.files)
+        if (f->has_links)
+            ::add_at_end(&ctx.work, f);
+
+    ::_dedupe_keep_equal<_compare_dedupe_link_ids>(&ctx);
+    ::_dedupe_assign_first<_compare_dedupe_link_ids>(&ctx, _dedupe_kind::HardLink);
+
+    bool ok = true;
+
+    if (is_flag_set(flags, fs::copy_directory_flag::Deduplicate))
+    {
+        // candidates: files which have the same size as another file, one
+        // per set of hard links.
+        ctx.work.size = 0;
+
+        for_array(f, &ctx.files)
+            if (f->size > 0 && f->first < 0)
+                ::add_at_end(&ctx.work, f);
+
+        ::_dedupe_keep_equal<_compare_dedupe_sizes>(&ctx);
+        ok = ::_dedupe_run(&ctx, thread_count, _dedupe_hash_edges);
+
+        if (ok)
+        {
+            ::_dedupe_keep_equal<_compare_dedupe_edges>(&ctx);
+            ok = ::_dedupe_run(&ctx, thread_count, _dedupe_hash_contents);
+        }
+
+        if (ok)
+        {
+            ::_dedupe_keep_equal<_compare_dedupe_hashes>(&ctx);
+            ::_dedupe_assign_first<_compare_dedupe_hashes>(&ctx, _dedupe_kind::Duplicate);
+
+            // a hash collision must not give a copy the contents of another file
+            ctx.work.size = 0;
+
+            for_array(f, &ctx.files)
+                if (f->kind == _dedupe_kind::Duplicate)
+                    ::add_at_end(&ctx.work, f);
+
+            ok = ::_dedupe_run(&ctx, thread_count, _dedupe_compare_contents);
         }
     }
 
-    return true;
+    // copies first, then duplicates of the copies, then the hard links to
+    // both of them.
+    for (u8 kind = 0; ok && kind <= (u8)_dedupe_kind::HardLink; ++kind)
+    {
+        ctx.work.size = 0;
+
+        for_array(f, &ctx.files)
+            if (f->kind == (_dedupe_kind)kind)
+                ::add_at_end(&ctx.work, f);
+
+        ok = ::_dedupe_run(&ctx, thread_count, _dedupe_copy);
+    }
+
+    if (err != nullptr)
+        *err = ok ? walk_err : ctx.err;
+
+    return ok;
 }
 
-bool fs::_copy_directory(fs::const_fs_string from, fs::const_fs_string to, int max_depth, fs::copy_file_option opt, error *err)
+bool fs::_copy_directory(fs::const_fs_string from, fs::const_fs_string to, int max_depth, fs::copy_file_option opt, const fs::copy_options *options, error *err)
 {
+    fs::copy_options defaults{};
+
+    if (options == nullptr)
+        options = &defaults;
+
+    fs::copy_directory_flag flags = options->flags;
+    s32 thread_count = options->thread_count;
+    fs::operation_control *control = options->control;
+
+    // the ring reads and writes small files itself, through the page cache
+    // and while walking, so it can't do what any of the flags ask for
+    if (options->method == fs::copy_directory_method::Uring && flags != fs::copy_directory_flag::None)
+    {
+#if Windows
+        set_error(err, ERROR_INVALID_PARAMETER, "");
+#else
+        set_error_by_code(err, EINVAL);
+#endif
+        return false;
+    }
+
+    if (is_flag_set(flags, fs::copy_directory_flag::Deduplicate)
+     || is_flag_set(flags, fs::copy_directory_flag::PreserveHardLinks))
+    {
+        if (max_depth < 0)
+            return ::_copy_directory_deduplicated<false>(from, to, max_depth, opt, flags, thread_count, control, err);
+        else
+            return ::_copy_directory_deduplicated<true>(from, to, max_depth, opt, flags, thread_count, control, err);
+    }
+
+    fs::copy_file_flag file_flags = ::_copy_file_flags(flags);
+
+#if Linux
+    if (options->method == fs::copy_directory_method::Uring)
+    {
+        bool result = false;
+
+        if (max_depth < 0)
+        {
+            if (::_copy_directory_uring<false>(from, to, max_depth, opt, control, &result, err))
+                return result;
+        }
+        else
+        {
+            if (::_copy_directory_uring<true>(from, to, max_depth, opt, control, &result, err))
+                return result;
+        }
+    }
+#endif
+
+    if (thread_count <= 0)
+        thread_count = fs::_hardware_thread_count();
+
+    if (thread_count > 1)
+        return ::_copy_directory_parallel(from, to, max_depth, opt, file_flags, thread_count, control, err);
+
     if (max_depth < 0)
-        return ::_copy_directory<false>(from, to, max_depth, opt, err);
+        return ::_copy_directory<false>(from, to, max_depth, opt, file_flags, control, err);
     else
-        return ::_copy_directory<true>(from, to, max_depth, opt, err);
+        return ::_copy_directory<true>(from, to, max_depth, opt, file_flags, control, err);
 }
 
-bool fs::_copy(fs::const_fs_string from, fs::const_fs_string to, int max_depth, fs::copy_file_option opt, error *err)
+bool fs::_copy(fs::const_fs_string from, fs::const_fs_string to, int max_depth, fs::copy_file_option opt, const fs::copy_options *options, error *err)
 {
     fs::filesystem_type from_type;
 
@@ -2426,9 +5331,12 @@ bool fs::_copy(fs::const_fs_string from, fs::const_fs_string to, int max_depth,
         return false;
 
     if (from_type == fs::filesystem_type::Directory)
-        return fs::_copy_directory(from, to, max_depth, opt, err);
-    else
-        return fs::_copy_file(from, to, opt, err);
+        return fs::_copy_directory(from, to, max_depth, opt, options, err);
+
+    if (options == nullptr)
+        return fs::_copy_file(from, to, opt, nullptr, fs::copy_file_flag::None, nullptr, err);
+
+    return fs::_copy_file(from, to, opt, nullptr, ::_copy_file_flags(options->flags), options->control, err);
 }
 
 bool fs::_create_directory(fs::const_fs_string pth, fs::permission perms, error *err)
@@ -2474,43 +5382,134 @@ bool fs::_create_directory(fs::const_fs_string pth, fs::permission perms, error
     return t == fs::filesystem_type::Directory;
 }
 
+// pth exists, sets the same error as _create_directory if it's not a directory
+static bool _existing_is_directory(fs::const_fs_string pth, error *err)
+{
+#if Windows
+    set_error(err, ERROR_ALREADY_EXISTS, ::windows_error_message(ERROR_ALREADY_EXISTS));
+#else
+    set_error_by_code(err, EEXIST);
+#endif
+
+    fs::filesystem_type t;
+
+    if (!fs::_get_filesystem_type(pth, &t, false, err))
+        return false;
+
+    return t == fs::filesystem_type::Directory;
+}
+
 bool fs::_create_directories(fs::const_fs_string pth, fs::permission perms, error *err)
 {
-    fs::path longest_part{};
-    fs::longest_existing_path(pth, &longest_part);
-    defer { fs::free(&longest_part); };
+    if (pth.size == 0)
+        return fs::_create_directory(pth, perms, err);
 
-    array<fs::const_fs_string> segs{};
-    fs::path_segments(pth, &segs);
-    defer { ::free(&segs); };
+    // optimistic: usually the directory either exists already or only the
+    // last segment is missing, which takes a single mkdir.
+#if Windows
+    if (::CreateDirectory((const sys_native_char*)pth.c_str, nullptr))
+        return true;
 
-    s64 i = 0;
+    int _errcode = (int)GetLastError();
+
+    if (_errcode == ERROR_ALREADY_EXISTS)
+        return _existing_is_directory(pth, err);
 
-    // find the first segment after longest_part that doesn't exist
-    if (longest_part.size > 0)
-    while (i < segs.size)
+    if (_errcode != ERROR_PATH_NOT_FOUND)
     {
-        s64 offset = (segs[i].c_str - pth.c_str);
+        set_error(err, _errcode, ::windows_error_message(_errcode));
+        return false;
+    }
+#else
+    sys_int code = ::mkdir(pth.c_str, (int)perms);
 
-        if (offset > longest_part.size)
-            break;
+    if (code == 0)
+        return true;
 
-        i += 1;
-    }
+    if (-code == EEXIST)
+        return _existing_is_directory(pth, err);
 
-    // we do this to make sure longest_part is a directory
-    if (longest_part.size > 0
-     && !fs::create_directory(&longest_part, perms, err))
+    if (-code != ENOENT)
+    {
+        set_error_by_code(err, -code);
         return false;
+    }
+#endif
+
+    // some parents are missing too, find the longest existing parent
+    // and create everything after it.
+    fs::path buf{};
+    fs::path_set(&buf, pth);
+    defer { fs::free(&buf); };
 
-    while (i < segs.size)
+    fs::const_fs_string rt = fs::root(&buf);
+    s64 existing = _longest_existing_prefix(&buf, rt.size, buf.size);
+
+#if Linux
+    // create the missing directories relative to the existing parent,
+    // so the kernel doesn't walk the full path for every mkdir.
+    int dirfd = AT_FDCWD;
+
+    if (existing > 0)
     {
-        fs::path_append(&longest_part, segs[i]);
+        fs::path_char_t c = buf.data[existing];
+        buf.data[existing] = PC_NUL;
+        dirfd = _open_directory_at(AT_FDCWD, buf.data);
+        buf.data[existing] = c;
 
-        if (!fs::create_directory(&longest_part, perms, err))
+        if (dirfd < 0)
+        {
+            set_error_by_code(err, -dirfd);
             return false;
+        }
+    }
 
-        i += 1;
+    defer { if (dirfd >= 0) ::close(dirfd); };
+
+    s64 rel_start = existing;
+
+    while (rel_start < buf.size && _is_path_separator(buf.data[rel_start]))
+        rel_start++;
+#endif
+
+    fs::path_segment_iterator it;
+
+    for (fs::const_fs_string *seg = fs::_path_segment_first(&it, pth);
+         seg != nullptr;
+         seg = fs::_path_segment_next(&it))
+    {
+        s64 end = (seg->c_str - pth.c_str) + seg->size;
+
+        if (end <= existing)
+            continue;
+
+        fs::path_char_t c = buf.data[end];
+        buf.data[end] = PC_NUL;
+        defer { buf.data[end] = c; };
+
+        fs::const_fs_string prefix{buf.data, end};
+
+#if Linux
+        code = ::mkdirat(dirfd, buf.data + rel_start, (int)perms);
+
+        if (code == 0)
+            continue;
+
+        // created concurrently, fine if it's a directory
+        if (-code == EEXIST)
+        {
+            if (!_existing_is_directory(prefix, err))
+                return false;
+
+            continue;
+        }
+
+        set_error_by_code(err, -code);
+        return false;
+#else
+        if (!fs::_create_directory(prefix, perms, err))
+            return false;
+#endif
     }
 
     return true;
@@ -2701,7 +5700,7 @@ bool fs::_remove_empty_directory(fs::const_fs_string pth, error *err)
 #endif
 }
 
-bool fs::_remove_directory(fs::const_fs_string pth, error *err)
+bool fs::_remove_directory(fs::const_fs_string pth, fs::operation_control *control, error *err)
 {
     fs::iterate_option opts = fs::iterate_option::Fullpaths
                             | fs::iterate_option::StopOnError
@@ -2710,6 +5709,9 @@ bool fs::_remove_directory(fs::const_fs_string pth, error *err)
 
     for_recursive_path(item, pth, opts, err)
     {
+        if (!fs::_operation_file_started(control, item->path, err))
+            return false;
+
         switch (item->type)
         {
         case fs::filesystem_type::File:
@@ -2720,6 +5722,9 @@ bool fs::_remove_directory(fs::const_fs_string pth, error *err)
             if (!fs::remove_file(item->path, err))
                 return false;
 
+            if (!fs::_operation_file_done(control, err))
+                return false;
+
             break;
         }
         case fs::filesystem_type::Symlink:
@@ -2727,6 +5732,9 @@ bool fs::_remove_directory(fs::const_fs_string pth, error *err)
             if (!fs::remove_symlink(item->path, err))
                 return false;
 
+            if (!fs::_operation_file_done(control, err))
+                return false;
+
             break;
         }
         case fs::filesystem_type::Directory:
@@ -3090,8 +6098,94 @@ bool fs::get_temporary_path(fs::path *out, error *err)
 #endif
 }
 
+// hash of the empty path
+#define PATH_HASH_SEED 0x2d358dccaa6c78a5ull
+
+static inline hash_t _hash_segment(hash_t h, fs::const_fs_string seg)
+{
+    return (hash_t)fs::_hash_combine((u64)h, fs::_hash_bytes(seg.c_str, seg.size * sizeof(fs::path_char_t), 0));
+}
+
+// combines the hashes of the segments of pth, including the root, with h
+static hash_t _hash_segments(hash_t h, fs::const_fs_string pth)
+{
+    for_path_segment(seg, pth)
+        h = _hash_segment(h, *seg);
+
+    return h;
+}
+
+hash_t fs::_path_hash(fs::const_fs_string pth)
+{
+    return _hash_segments((hash_t)PATH_HASH_SEED, pth);
+}
+
+hash_t fs::_path_hash_append(hash_t parent_hash, fs::const_fs_string seg)
+{
+    // same as path_append, an absolute segment replaces the parent
+    if (fs::is_absolute(seg))
+        return fs::_path_hash(seg);
+
+    return _hash_segments(parent_hash, seg);
+}
+
+void fs::_hashed_path_set(fs::hashed_path *out, fs::const_fs_string pth)
+{
+    assert(out != nullptr);
+
+    fs::path_set(&out->path, pth);
+    out->hash = fs::_path_hash(pth);
+}
+
+void fs::_hashed_path_append(fs::hashed_path *out, fs::const_fs_string seg)
+{
+    assert(out != nullptr);
+
+    if (seg.size == 0)
+        return;
+
+    if (out->path.size == 0)
+    {
+        fs::_hashed_path_set(out, seg);
+        return;
+    }
+
+    s64 old_size = out->path.size;
+    fs::path_append(&out->path, seg);
+
+    // appending to e.g. "C:" changes the root, rehash everything
+    if (fs::root(&out->path).size >= old_size)
+        out->hash = fs::_path_hash(::to_const_string(&out->path));
+    else
+        out->hash = fs::_path_hash_append(out->hash, seg);
+}
+
+void fs::free(fs::hashed_path *pth)
+{
+    if (pth == nullptr)
+        return;
+
+    fs::free(&pth->path);
+    pth->hash = 0;
+}
+
+bool fs::operator==(const fs::hashed_path &lhs, const fs::hashed_path &rhs)
+{
+    return lhs.hash == rhs.hash && lhs.path == rhs.path;
+}
+
+bool fs::operator!=(const fs::hashed_path &lhs, const fs::hashed_path &rhs)
+{
+    return !(lhs == rhs);
+}
+
 hash_t hash(const fs::path *pth)
 {
-    return hash_data(pth->data, pth->size * sizeof(fs::path_char_t));
+    return fs::_path_hash(::to_const_string(pth));
+}
+
+hash_t hash(const fs::hashed_path *pth)
+{
+    return pth->hash;
 }
 
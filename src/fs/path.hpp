@@ -126,12 +126,44 @@ path_new(PathStr, ResolveVariables = true, VariableAliases = true)
     If VariableAliases is true, also replaces some variables that are not
     environment variables with the contents of certain other environment
     variables. See shl/environment.hpp for details.
+    To expand the same variables many times, see path_new(PathStr, *Cache) in
+    fs/path_template.hpp, which caches the values of variables.
 
 free(*Path) frees the memory of Path.
 
 hash(*Path) returns a hash of the Path string. Note that two equivalent paths may produce
             different hashes. Use fs::are_equivalent(Path1, Path2) to check if two paths
             are equivalent.
+            Same as fs::path_hash(Path).
+
+path_hash(PathStr)
+    Returns a hash of PathStr. The hash is computed per segment (the root counts
+    as a segment) and the segment hashes are combined in order, which allows
+    extending the hash of a parent path with path_hash_append.
+    Separators are not hashed, e.g. "a/b" and "a//b" have the same hash (but
+    they are not equal strings, so hash tables still tell them apart).
+
+path_hash_append(ParentHash, StrSegment)
+    Returns the hash of a path whose hash is ParentHash after appending
+    StrSegment using path_append, without rehashing the parent, i.e.
+    path_hash_append(path_hash(P), S) == path_hash(P after path_append(P, S)).
+    The parent path must not be empty or a drive without separator (e.g. "C:").
+
+struct hashed_path
+    An fs::path together with its hash, for paths that are hashed often, e.g.
+    as keys of hash tables. hash(*HashedPath) returns the stored hash and
+    comparisons compare hashes first.
+    Use hashed_path_set / hashed_path_append to modify hashed paths, modifying
+    .path directly invalidates the hash.
+
+hashed_path_set(*HashedPath, PathStr)
+    Sets HashedPath to a copy of PathStr and hashes it.
+
+hashed_path_append(*HashedPath, StrSegment)
+    Same as path_append(&HashedPath->path, StrSegment), updates the hash using
+    path_hash_append.
+
+free(*HashedPath) frees the memory of HashedPath.
 
 query_filesystem(PathStr, *Out, FollowSymlinks = true, Flags = fs::query_flag_default[, *err])
     Queries filesystem information from PathStr. To get information about symlinks,
@@ -141,6 +173,18 @@ query_filesystem(PathStr, *Out, FollowSymlinks = true, Flags = fs::query_flag_de
     flags may be used.
     Returns whether or not the function succeeded.
 
+query_filesystem_batch(*PathArray, *OutArray, *ErrorArray = nullptr, FollowSymlinks = true, Flags = fs::query_flag_default, QueueDepth = 0[, *err])
+    Queries filesystem information of every path in PathArray (array<fs::path> or
+    array<const_fs_string>) and sets OutArray (array<fs::filesystem_info>) to the
+    results, in the same order.
+    Up to QueueDepth queries are in flight at once (64 if QueueDepth is 0). On Linux,
+    the queries are submitted through io_uring if the kernel supports it, otherwise
+    (and on Windows) they are split across threads.
+    If ErrorArray (array<error>) is not nullptr, it is set to the error of every
+    path (error_code 0 if the query succeeded). The entries in OutArray of paths
+    that failed are unspecified. All other paths are still queried, the first error
+    is written to err and the function returns false.
+
 query_filesystem(Handle, *Out, Flags[, *err])
     Queries filesystem information about an open I/O Handle. 
     The flags determine what information is queried and what information is written
@@ -184,6 +228,18 @@ set_permissions(Handle, Perms[, *err])
 exists(PathStr, FollowSymlinks = true[, *err])
     Returns 1 if PathStr exists, 0 if PathStr does not exist and -1 if an error occurred.
 
+exists_many(*PathArray, *OutArray, FollowSymlinks = true[, *err])
+    Sets OutArray (array<int>) to the result of exists(Path, FollowSymlinks) of every
+    path in PathArray (array<fs::path> or array<const_fs_string>), in the same order.
+    On Linux, paths are grouped by their parent directory and each parent directory
+    with enough paths in it is listed once, instead of checking every path on its own.
+    Paths that are symlinks (when FollowSymlinks is true), paths ending in ".", ".."
+    or a separator and paths in directories that cannot be listed, are not searchable
+    or look up names ignoring case (casefolded directories, FAT, exFAT, SMB) are still
+    checked one by one, so every result is the same as that of exists.
+    If checking a path fails, its entry is -1, the first error is written to err and
+    the function returns false.
+
 is_X(PathStr, FollowSymlinks = true[, *err]) (replace X with file, pipe, directory, symlink, ...)
     Returns whether or not the type of the PathStr is X.
 
@@ -261,6 +317,23 @@ path_segments(*Path, *OutArray)
     path separators.
     See tests/path_tests.cpp for a comprehensive list of examples.
 
+for_path_segment(Seg, PathStr)
+for_path_segment(Seg, *Path)
+for_path_segment_reverse(Seg, PathStr)
+for_path_segment_reverse(Seg, *Path)
+    Iterates the segments of a path without allocating memory, yielding the
+    same segments as path_segments, in order or in reverse order.
+    Seg is a pointer to a const_fs_string slice into Path, e.g.:
+
+        for_path_segment(seg, "/foo/bar"_cs)
+            tprint("%\n", *seg);
+
+    Prints "/", "foo" and "bar". The reverse version prints "bar", "foo" and "/".
+    Path must not be modified while iterating.
+    The functions used by the macros are _path_segment_first, _path_segment_next,
+    _path_segment_last and _path_segment_previous, which return nullptr when there
+    are no more segments.
+
 * The following functions ending in "_path" create a new fs::path object (or
 write to an existing one).
 
@@ -277,6 +350,8 @@ longest_existing_path(PathStr)
 longest_existing_path(PathStr, *OutPath)
     Sets the fs::path OutPath to the longest path that exists (and is accessible)
     of PathStr.
+    Checks PathStr first, then binary searches its segments, so this takes
+    O(log N) filesystem queries for a path with N segments.
 
 normalize(*Path)
     Normalizes the path. Normalization follows rules loosely following
@@ -314,6 +389,16 @@ canonical_path(PathStr, *OutPath[, *err])
     no symlinks. PathStr must be an accessible and existing path, canonical_path
     does not work on paths that do not exist.
     Returns whether or not the function succeeded.
+    On Linux, symlinks are resolved segment by segment with openat and
+    readlinkat, there is no PATH_MAX limit on the resulting path. Resolving
+    more than 40 symlinks fails with ELOOP.
+
+canonical_path_cached(PathStr, *OutPath, *Cache[, *err])
+    Same as canonical_path(PathStr, *OutPath[, *err]), but if PathStr is
+    absolute, resolves the parent directory of PathStr through Cache (see
+    fs/resolve_cache.hpp) and only resolves the last segment itself.
+    If Cache is nullptr, does not use a cache.
+    On Windows, Cache is not used.
 
 weakly_canonical_path(PathStr[, *err])
     Returns a new fs::path that is the canonical path of PathStr.
@@ -326,6 +411,27 @@ weakly_canonical_path(PathStr, *OutPath[, *err])
     no symlinks. Unlike canonical_path, PathStr does not need to exist.
     Returns whether or not the function succeeded.
 
+weakly_canonical_path_cached(PathStr, *OutPath, *Cache[, *err])
+    Same as weakly_canonical_path(PathStr, *OutPath[, *err]), but resolves the
+    parent directory of PathStr through Cache (see fs/resolve_cache.hpp), so
+    paths sharing a parent directory only resolve it once.
+    If Cache is nullptr, does not use a cache.
+
+normalize_all(*PathArray[, ThreadCount])
+    Normalizes every fs::path in PathArray (array<fs::path>), splitting the
+    work across up to ThreadCount threads. If ThreadCount is 0, uses as many
+    threads as the hardware supports.
+
+weakly_canonical_all(*PathArray, *OutArray, *Cache = nullptr, ThreadCount = 0[, *err])
+    Sets OutArray (array<fs::path>) to the weakly canonical paths of every path in
+    PathArray (array<fs::path> or array<const_fs_string>), in the same order,
+    splitting the work across up to ThreadCount threads.
+    Parent directories are resolved through Cache. If Cache is nullptr, a temporary
+    cache is used for the duration of the call.
+    If a path cannot be resolved, its entry in OutArray is empty. All other
+    paths are still resolved, the first error is written to err and the
+    function returns false.
+
 get_symlink_target(PathStr, *OutPath[, *err])
     Sets the fs::path OutPath to the target of the symlink that PathStr points
     to.
@@ -370,10 +476,44 @@ copy_file(FromPathStr, ToPathStr, Options = fs::copy_file_option::OverwriteExist
     fs::copy_file_option::SkipExisting does not overwrite existing files silently (no error).
     fs::copy_file_option::UpdateExisting overwrites existing files only if FromPathStr has a
                                          newer _modification_ time than ToPathStr.
+
+    On Linux, the contents are cloned if the filesystem supports it (e.g. btrfs,
+    XFS), otherwise copied with copy_file_range, otherwise read and written
+    through a buffer, see fs/impl/copy.hpp.
                                          
     Returns whether or not the function succeeded.
     See tests/path_tests.cpp for a comprehensive list of examples.
 
+copy_file(FromPathStr, ToPathStr, Options, *OutInfo, Flags, *Control[, *err])
+    Same as copy_file above, with fs::copy_file_flag Flags, and sets OutInfo
+    to the fs::copy_strategy that was used and the number of bytes copied.
+    OutInfo and Control may be nullptr. If Control is given, reports
+    progress to Control and stops when Control is cancelled, see
+    fs/operation_control.hpp.
+    With copy_file_flag::Bulk (or DirectIO), the copy does not fill the page
+    cache, e.g. for backups next to a service whose working set should stay
+    cached: the data is written back and dropped from the cache while copying,
+    so copying is slower than without Bulk when the destination is slow.
+    With copy_file_flag::DirectIO, large files are read and written with
+    O_DIRECT instead, and OutInfo->strategy is copy_strategy::Direct. Clones
+    are still used when possible, they don't copy any data.
+    With copy_file_flag::Verify, the CRC32C of the contents is computed while
+    they are copied, without reading anything twice, and set in
+    OutInfo->checksum, e.g. for a manifest. The data then has to pass through
+    a buffer, so files are not cloned and not copied with copy_file_range.
+    copy_file_flag::VerifyDestination also writes the destination to the
+    device, reads it again with O_DIRECT (not from the page cache) and fails
+    with EIO if its CRC32C is different. If the filesystem rejects O_DIRECT,
+    the destination is dropped from the page cache and read through it.
+    On Windows, CopyFile does not pass the data through a buffer, so with
+    either flag the contents are copied with ReadFile / WriteFile instead
+    (without the alternate data streams and attributes CopyFile copies),
+    OutInfo->strategy is copy_strategy::ReadWrite, and VerifyDestination
+    flushes the destination, reads it again with FILE_FLAG_NO_BUFFERING and
+    fails with ERROR_CRC if its CRC32C is different. Bulk and DirectIO then
+    read the source without buffering and write the destination through.
+    The flags can be combined, e.g. Bulk | Verify.
+
 copy_directory(FromPathStr, ToPathStr, MaxDepth, Options = fs::copy_file_option::OverwriteExisting[, *err])
     (Recursively) copies a directory from FromPathStr to ToPathStr.
     MaxDepth determines the deepest subdirectories to be copied:
@@ -386,11 +526,79 @@ copy_directory(FromPathStr, ToPathStr, MaxDepth, Options = fs::copy_file_option:
     Returns whether or not the function succeeded.
     See tests/path_tests.cpp for a comprehensive list of examples.
 
-copy(FromPathStr, ToPathStr, MaxDepth, Options = fs::copy_file_option::OverwriteExisting[, *err])
+copy_directory(FromPathStr, ToPathStr, MaxDepth, Options, CopyOptions[, *err])
+    Same as copy_directory above, with the fs::copy_options CopyOptions, e.g.
+
+        fs::copy_directory(from, to, -1, fs::copy_file_option::None,
+                           {.thread_count = 4, .control = &control}, &err);
+
+    Fields which are not set keep their defaults, i.e. the same as
+    copy_directory above.
+
+    CopyOptions.thread_count: copies files on this many threads (0 = one per
+    hardware thread, 1 = only the calling thread).
+    The calling thread walks FromPathStr and creates the directories in order,
+    the files are queued and copied by the other threads, which helps when
+    copying many small files or to filesystems with high latency (e.g. network
+    filesystems). When the queue is full, the walking thread copies files too.
+    After the first failure no more files are copied and the error of the
+    first failed entry in walk order is reported, regardless of which thread
+    failed first.
+
+    CopyOptions.method: with copy_directory_method::Uring, the calling
+    thread keeps hundreds of small files in flight on one io_uring: each
+    file is a chain of statx, openat, read, write and close operations, and
+    the chains of many files are submitted with a single system call.
+    Larger files and files which fail in the ring are copied with copy_file.
+    thread_count is used if io_uring is not available (e.g. not Linux,
+    kernels before 5.15, or io_uring is disabled) and the method falls back
+    to copy_directory_method::Threads.
+    Uring can not be combined with any flag, the function fails with EINVAL
+    (ERROR_INVALID_PARAMETER on Windows) and copies nothing if it is.
+
+    CopyOptions.control: reports progress to the fs::operation_control and
+    stops when it is cancelled, see fs/operation_control.hpp.
+
+    CopyOptions.flags: fs::copy_directory_flag flags.
+    With copy_directory_flag::Deduplicate, the calling thread walks
+    FromPathStr first and creates the directories, then files of the same
+    size are compared by a hash of their first and last 4 KiB, files
+    which are still the same by a 128 bit hash of their contents, and
+    files with the same hash byte by byte, on thread_count threads. The
+    first file (in walk order) of every set of identical files is copied,
+    then the others are cloned from its copy (Linux, if the filesystem
+    supports it, e.g. btrfs or XFS) or hard linked to it, so the contents
+    are only written once. Hard linked duplicates share permissions and
+    times. Empty files and files which are not regular files
+    (e.g. symlinks) are always copied. Duplicates of files which were not
+    copied because of Options are copied as well, and existing destinations
+    of duplicates are replaced with OverwriteExisting, skipped with
+    SkipExisting and updated by copying with UpdateExisting. Existing
+    destinations which are copied over are removed first, so hard links
+    created by an earlier copy are replaced and not written through.
+    With copy_directory_flag::PreserveHardLinks, the walk also records the
+    file ID (device and inode on Linux, volume and file index on Windows) of
+    every regular file with more than one link. Files with the same ID are
+    copied once and the other names are hard linked to the copy, so the
+    destination has the same hard links as FromPathStr (among the copied
+    files) and the data is written once. If linking fails, e.g. because of
+    the link limit of the filesystem, the file is copied instead. Existing
+    destinations are removed before they are copied over or linked, so
+    links from an earlier copy which were broken in FromPathStr since then
+    are not written through.
+    Both flags can be combined, sets of hard links are then deduplicated as
+    a single file.
+    With copy_directory_flag::Bulk or DirectIO, every file is copied with
+    the copy_file_flag of the same name (see copy_file).
+
+copy(FromPathStr, ToPathStr, MaxDepth, Options = fs::copy_file_option::OverwriteExisting[, CopyOptions][, *err])
     Copies files and directories from FromPathStr to ToPathStr.
-    Same options as copy_file and copy_directory.
+    Same options as copy_file and copy_directory, a file is copied with the
+    Bulk / DirectIO flags and the control of CopyOptions.
     Returns whether or not the function succeeded.
     See tests/path_tests.cpp for a comprehensive list of examples.
+    To copy only what changed since the last copy, and remove what was
+    removed, see sync_directory in fs/sync.hpp.
 
 create_directory(PathStr, Permissions = User[, *err])
     Creates a directory at PathStr with permissions Permissions.
@@ -403,6 +611,9 @@ create_directories(PathStr, Permissions = User[, *err])
     Creates a directory at PathStr and all its parents with permissions Permissions.
     Returns whether or not the function succeeded, also returns true if a directory
     already exists at PathStr.
+    Tries to create PathStr directly first, so if PathStr or its parent exist,
+    this is a single system call. Otherwise finds the longest existing parent
+    (see longest_existing_path) and creates the missing directories after it.
 
 create_hard_link(TargetPathStr, LinkPathStr[, *err])
     Creates a link at LinkPathStr which is a hard link to TargetPathStr.
@@ -429,8 +640,10 @@ remove_empty_directory(PathStr[, *err])
     Removes an empty directory at PathStr. Fails if the directory is not empty.
     Returns whether or not the function succeeded.
 
-remove_directory(PathStr[, *err])
+remove_directory(PathStr[, *Control][, *err])
     Removes a directory and all its descendants. Stops on the first error.
+    If Control is given, reports the removed files to Control and stops
+    when Control is cancelled, see fs/operation_control.hpp.
     Returns whether or not the function succeeded.
 
 remove(PathStr[, *err])
@@ -520,6 +733,8 @@ get_temporary_path(*OutPath[, *err])
 
 namespace fs
 {
+struct operation_control; // fs/operation_control.hpp
+
 struct path
 {
     typedef fs::path_char_t value_type;
@@ -546,15 +761,22 @@ namespace fs
 {
 // this function returns a string that's always using the character
 // type for paths on the current system.
-// This will allocate memory if needs_conversion(C) is true, in which case
-// it needs to be freed by calling fs::free(&return value of this function).
+// If needs_conversion(C) is true, the string is converted into thread-local
+// scratch memory (see fs/convert.hpp), in which case it needs to be freed by
+// calling fs::_free_platform_string(&return value of this function).
 template<typename C>
 sys_string _get_platform_string(::const_string_base<C> str)
 {
     sys_string ret{};
 
     if constexpr (needs_conversion(C))
-        ::string_set(&ret, str);
+    {
+        s64 capacity = fs::_transcoded_capacity<C>(str.size);
+        ret.data = (sys_char*)fs::_platform_string_alloc(capacity * sizeof(sys_char));
+        ret.size = fs::_transcode_to_platform(str.c_str, str.size, ret.data);
+        ret.data[ret.size] = (sys_char)0;
+        ret.reserved_size = capacity;
+    }
     else
     {
         ret.data = const_cast<C*>(str.c_str);
@@ -565,6 +787,14 @@ sys_string _get_platform_string(::const_string_base<C> str)
     return ret;
 }
 
+inline void _free_platform_string(sys_string *str)
+{
+    fs::_platform_string_free(str->data, str->reserved_size * sizeof(sys_char));
+    str->data = nullptr;
+    str->size = 0;
+    str->reserved_size = 0;
+}
+
 /* FYI: we do this auto -> decltype to get better compiler errors when passing
         something to this function that has no to_const_string overload.
 */
@@ -584,13 +814,13 @@ auto get_platform_string(T str)
     {                                                                                                   \
         Func(::to_const_string(pth_str) __VA_OPT__(,) __VA_ARGS__);                                     \
                                                                                                         \
-        if constexpr (needs_conversion(T)) free(&pth_str);                                              \
+        if constexpr (needs_conversion(T)) fs::_free_platform_string(&pth_str);                         \
     }                                                                                                   \
     else                                                                                                \
     {                                                                                                   \
         auto ret = Func(::to_const_string(pth_str) __VA_OPT__(,) __VA_ARGS__);                          \
                                                                                                         \
-        if constexpr (needs_conversion(T)) free(&pth_str);                                              \
+        if constexpr (needs_conversion(T)) fs::_free_platform_string(&pth_str);                         \
                                                                                                         \
         return ret;                                                                                     \
     }                                                                                                   \
@@ -606,15 +836,15 @@ auto get_platform_string(T str)
     {                                                                                                                                           \
         Func(::to_const_string(pth_str1), ::to_const_string(pth_str2) __VA_OPT__(,) __VA_ARGS__);                                               \
                                                                                                                                                 \
-        if constexpr (needs_conversion(T1)) free(&pth_str1);                                                                                    \
-        if constexpr (needs_conversion(T2)) free(&pth_str2);                                                                                    \
+        if constexpr (needs_conversion(T2)) fs::_free_platform_string(&pth_str2);                                                               \
+        if constexpr (needs_conversion(T1)) fs::_free_platform_string(&pth_str1);                                                               \
     }                                                                                                                                           \
     else                                                                                                                                        \
     {                                                                                                                                           \
         auto ret = Func(::to_const_string(pth_str1), ::to_const_string(pth_str2) __VA_OPT__(,) __VA_ARGS__);                                    \
                                                                                                                                                 \
-        if constexpr (needs_conversion(T1)) free(&pth_str1);                                                                                    \
-        if constexpr (needs_conversion(T2)) free(&pth_str2);                                                                                    \
+        if constexpr (needs_conversion(T2)) fs::_free_platform_string(&pth_str2);                                                               \
+        if constexpr (needs_conversion(T1)) fs::_free_platform_string(&pth_str1);                                                               \
                                                                                                                                                 \
         return ret;                                                                                                                             \
     }                                                                                                                                           \
@@ -662,6 +892,9 @@ template<typename T>
 auto query_filesystem(T pth, fs::filesystem_info *out, bool follow_symlinks = true, fs::query_flag flags = fs::query_flag_default, error *err = nullptr)
     define_fs_conversion_body(fs::_query_filesystem, pth, out, follow_symlinks, flags, err)
 
+bool query_filesystem_batch(const array<fs::path> *paths, array<fs::filesystem_info> *out, array<error> *errs = nullptr, bool follow_symlinks = true, fs::query_flag flags = fs::query_flag_default, s32 queue_depth = 0, error *err = nullptr);
+bool query_filesystem_batch(const array<fs::const_fs_string> *paths, array<fs::filesystem_info> *out, array<error> *errs = nullptr, bool follow_symlinks = true, fs::query_flag flags = fs::query_flag_default, s32 queue_depth = 0, error *err = nullptr);
+
 fs::filesystem_type get_filesystem_type(const fs::filesystem_info *info);
 
 bool get_filesystem_type(io_handle h, fs::filesystem_type *out, error *err = nullptr);
@@ -700,6 +933,9 @@ template<typename T>
 auto exists(T pth, bool follow_symlinks = true, error *err = nullptr)
     define_fs_conversion_body(fs::_exists, pth, follow_symlinks, err)
 
+bool exists_many(const array<fs::path> *paths, array<int> *out, bool follow_symlinks = true, error *err = nullptr);
+bool exists_many(const array<fs::const_fs_string> *paths, array<int> *out, bool follow_symlinks = true, error *err = nullptr);
+
 bool is_file_info(const fs::filesystem_info *info);
 bool is_pipe_info(const fs::filesystem_info *info);
 bool is_block_device_info(const fs::filesystem_info *info);
@@ -795,12 +1031,26 @@ void replace_filename(fs::path *out, T newname)
     _replace_filename(out, ::to_const_string(pth_str));
 
     if constexpr (needs_conversion(T))
-        free(&pth_str);
+        fs::_free_platform_string(&pth_str);
 }
 
 void path_segments(fs::const_fs_string pth, array<fs::const_fs_string> *out);
 void path_segments(const fs::path *pth, array<fs::const_fs_string> *out);
 
+struct path_segment_iterator
+{
+    fs::const_fs_string path;
+    fs::const_fs_string segment;
+    s64 root_size;
+};
+
+fs::const_fs_string *_path_segment_first(fs::path_segment_iterator *it, fs::const_fs_string pth);
+fs::const_fs_string *_path_segment_first(fs::path_segment_iterator *it, const fs::path *pth);
+fs::const_fs_string *_path_segment_next(fs::path_segment_iterator *it);
+fs::const_fs_string *_path_segment_last(fs::path_segment_iterator *it, fs::const_fs_string pth);
+fs::const_fs_string *_path_segment_last(fs::path_segment_iterator *it, const fs::path *pth);
+fs::const_fs_string *_path_segment_previous(fs::path_segment_iterator *it);
+
 fs::path _parent_path(fs::const_fs_string pth);
 void     _parent_path(fs::const_fs_string pth, fs::path *out);
 template<typename T> auto parent_path(T pth) define_fs_conversion_body(fs::_parent_path, pth)
@@ -823,11 +1073,26 @@ bool     _canonical_path(fs::const_fs_string pth, fs::path *out, error *err);
 template<typename T> auto canonical_path(T pth, error *err = nullptr) define_fs_conversion_body(fs::_canonical_path, pth, err);
 template<typename T> auto canonical_path(T pth, fs::path *out, error *err = nullptr) define_fs_conversion_body(fs::_canonical_path, pth, out, err);
 
+struct resolve_cache;
+
+bool     _canonical_path(fs::const_fs_string pth, fs::path *out, fs::resolve_cache *cache, error *err);
+// used by resolve_cache, adds the canonical locations the result depends on to trace
+bool     _canonical_path_trace(fs::const_fs_string pth, fs::path *out, array<fs::path> *trace, error *err);
+// not an overload of canonical_path, canonical_path(Path, Out, nullptr) would be ambiguous
+template<typename T> auto canonical_path_cached(T pth, fs::path *out, fs::resolve_cache *cache, error *err = nullptr) define_fs_conversion_body(fs::_canonical_path, pth, out, cache, err);
+
 fs::path _weakly_canonical_path(fs::const_fs_string pth, error *err);
 bool     _weakly_canonical_path(fs::const_fs_string pth, fs::path *out, error *err);
 template<typename T> auto weakly_canonical_path(T pth, error *err = nullptr) define_fs_conversion_body(fs::_weakly_canonical_path, pth, err);
 template<typename T> auto weakly_canonical_path(T pth, fs::path *out, error *err = nullptr) define_fs_conversion_body(fs::_weakly_canonical_path, pth, out, err);
 
+bool     _weakly_canonical_path(fs::const_fs_string pth, fs::path *out, fs::resolve_cache *cache, error *err);
+template<typename T> auto weakly_canonical_path_cached(T pth, fs::path *out, fs::resolve_cache *cache, error *err = nullptr) define_fs_conversion_body(fs::_weakly_canonical_path, pth, out, cache, err);
+
+void normalize_all(array<fs::path> *paths, s32 thread_count = 0);
+bool weakly_canonical_all(const array<fs::path> *paths, array<fs::path> *out, fs::resolve_cache *cache = nullptr, s32 thread_count = 0, error *err = nullptr);
+bool weakly_canonical_all(const array<fs::const_fs_string> *paths, array<fs::path> *out, fs::resolve_cache *cache = nullptr, s32 thread_count = 0, error *err = nullptr);
+
 bool _get_symlink_target(fs::const_fs_string pth, fs::path *out, error *err);
 template<typename T> auto get_symlink_target(T pth, fs::path *out, error *err = nullptr) define_fs_conversion_body(fs::_get_symlink_target, pth, out, err);
 
@@ -866,13 +1131,21 @@ auto relative_path(T1 from_path, T2 to_path, fs::path *out)
 bool _touch(fs::const_fs_string pth, fs::permission perms, error *err);
 template<typename T> auto touch(T pth, fs::permission perms = fs::permission::User, error *err = nullptr) define_fs_conversion_body(fs::_touch, pth, perms, err)
 
-bool _copy_file(fs::const_fs_string from, fs::const_fs_string to, fs::copy_file_option opt, error *err);
+bool _copy_file(fs::const_fs_string from, fs::const_fs_string to, fs::copy_file_option opt, fs::copy_file_info *info, fs::copy_file_flag flags, fs::operation_control *control, error *err);
+#if Linux
+// used by dir_handle, from and to are relative to from_dirfd and to_dirfd
+bool _copy_file_at(int from_dirfd, const char *from, int to_dirfd, const char *to, fs::copy_file_option opt, fs::copy_file_info *info, fs::copy_file_flag flags, fs::operation_control *control, error *err);
+#endif
 
 template<typename T1, typename T2>
 auto copy_file(T1 from, T2 to, fs::copy_file_option opt = fs::copy_file_option::OverwriteExisting, error *err = nullptr)
-    define_fs_conversion_body2(fs::_copy_file, from, to, opt, err)
+    define_fs_conversion_body2(fs::_copy_file, from, to, opt, nullptr, fs::copy_file_flag::None, nullptr, err)
+
+template<typename T1, typename T2>
+auto copy_file(T1 from, T2 to, fs::copy_file_option opt, fs::copy_file_info *info, fs::copy_file_flag flags, fs::operation_control *control, error *err = nullptr)
+    define_fs_conversion_body2(fs::_copy_file, from, to, opt, info, flags, control, err)
 
-bool _copy_directory(fs::const_fs_string from, fs::const_fs_string to, int max_depth, fs::copy_file_option opt, error *err);
+bool _copy_directory(fs::const_fs_string from, fs::const_fs_string to, int max_depth, fs::copy_file_option opt, const fs::copy_options *options, error *err);
 
 // -1 max depth = everything
 // 0 = only current directory
@@ -880,14 +1153,23 @@ bool _copy_directory(fs::const_fs_string from, fs::const_fs_string to, int max_d
 // 2 = ...
 template<typename T1, typename T2>
 auto copy_directory(T1 from, T2 to, int max_depth = -1, fs::copy_file_option opt = fs::copy_file_option::OverwriteExisting, error *err = nullptr)
-    define_fs_conversion_body2(fs::_copy_directory, from, to, max_depth, opt, err)
+    define_fs_conversion_body2(fs::_copy_directory, from, to, max_depth, opt, nullptr, err)
+
+// options by value, so copy_directory(From, To, MaxDepth, Opt, nullptr) is the error overload
+template<typename T1, typename T2>
+auto copy_directory(T1 from, T2 to, int max_depth, fs::copy_file_option opt, fs::copy_options options, error *err = nullptr)
+    define_fs_conversion_body2(fs::_copy_directory, from, to, max_depth, opt, &options, err)
 
 // copies files and directories, doesn't matter what you give it
-bool _copy(fs::const_fs_string from, fs::const_fs_string to, int max_depth, fs::copy_file_option opt, error *err);
+bool _copy(fs::const_fs_string from, fs::const_fs_string to, int max_depth, fs::copy_file_option opt, const fs::copy_options *options, error *err);
 
 template<typename T1, typename T2>
 auto copy(T1 from, T2 to, int max_depth = -1, fs::copy_file_option opt = fs::copy_file_option::OverwriteExisting, error *err = nullptr)
-    define_fs_conversion_body2(fs::_copy, from, to, max_depth, opt, err)
+    define_fs_conversion_body2(fs::_copy, from, to, max_depth, opt, nullptr, err)
+
+template<typename T1, typename T2>
+auto copy(T1 from, T2 to, int max_depth, fs::copy_file_option opt, fs::copy_options options, error *err = nullptr)
+    define_fs_conversion_body2(fs::_copy, from, to, max_depth, opt, &options, err)
 
 // does not create parents
 bool _create_directory(fs::const_fs_string pth, fs::permission perms, error *err);
@@ -923,8 +1205,9 @@ bool _remove_empty_directory(fs::const_fs_string pth, error *err);
 template<typename T> auto remove_empty_directory(T pth, error *err = nullptr) define_fs_conversion_body(fs::_remove_empty_directory, pth, err)
 
 // removes all children as well
-bool _remove_directory(fs::const_fs_string pth, error *err);
-template<typename T> auto remove_directory(T pth, error *err = nullptr) define_fs_conversion_body(fs::_remove_directory, pth, err)
+bool _remove_directory(fs::const_fs_string pth, fs::operation_control *control, error *err);
+template<typename T> auto remove_directory(T pth, error *err = nullptr) define_fs_conversion_body(fs::_remove_directory, pth, nullptr, err)
+template<typename T> auto remove_directory(T pth, fs::operation_control *control, error *err = nullptr) define_fs_conversion_body(fs::_remove_directory, pth, control, err)
 
 // removes anything. does not return false when removing non-existent things.
 bool _remove(fs::const_fs_string pth, error *err);
@@ -988,7 +1271,7 @@ auto get_preference_path(fs::path *out, T app, error *err = nullptr)
     auto ret = fs::_get_preference_path(out, ::to_const_string(pth_str1), const_fs_string{SYS_CHAR(""), 0}, err);
 
     if constexpr (needs_conversion(T))
-        free(&pth_str1);
+        fs::_free_platform_string(&pth_str1);
 
     return ret;
 }
@@ -1004,16 +1287,84 @@ auto get_preference_path(fs::path *out, T1 app, T2 org, error *err = nullptr)
 
     auto ret = fs::_get_preference_path(out, ::to_const_string(pth_str1), ::to_const_string(pth_str2), err);
 
-    if constexpr (needs_conversion(T1)) free(&pth_str1);
-    if constexpr (needs_conversion(T2)) free(&pth_str2);
+    if constexpr (needs_conversion(T2)) fs::_free_platform_string(&pth_str2);
+    if constexpr (needs_conversion(T1)) fs::_free_platform_string(&pth_str1);
 
     return ret;
 }
 
 // /tmp
 bool get_temporary_path(fs::path *out, error *err);
+
+// hashing
+hash_t _path_hash(fs::const_fs_string pth);
+template<typename T> auto path_hash(T pth) define_fs_conversion_body(fs::_path_hash, pth)
+
+hash_t _path_hash_append(hash_t parent_hash, fs::const_fs_string seg);
+
+template<typename T>
+auto path_hash_append(hash_t parent_hash, T seg)
+    -> decltype(fs::_path_hash_append(parent_hash, ::to_const_string(fs::get_platform_string(seg))))
+{
+    auto seg_str = fs::get_platform_string(seg);
+    auto ret = fs::_path_hash_append(parent_hash, ::to_const_string(seg_str));
+
+    if constexpr (needs_conversion(T))
+        fs::_free_platform_string(&seg_str);
+
+    return ret;
+}
+
+struct hashed_path
+{
+    fs::path path;
+    hash_t hash;
+};
+
+void _hashed_path_set(fs::hashed_path *out, fs::const_fs_string pth);
+void _hashed_path_append(fs::hashed_path *out, fs::const_fs_string seg);
+
+template<typename T>
+auto hashed_path_set(fs::hashed_path *out, T pth)
+    -> decltype(fs::_hashed_path_set(out, ::to_const_string(fs::get_platform_string(pth))))
+{
+    auto pth_str = fs::get_platform_string(pth);
+    fs::_hashed_path_set(out, ::to_const_string(pth_str));
+
+    if constexpr (needs_conversion(T))
+        fs::_free_platform_string(&pth_str);
+}
+
+template<typename T>
+auto hashed_path_append(fs::hashed_path *out, T seg)
+    -> decltype(fs::_hashed_path_append(out, ::to_const_string(fs::get_platform_string(seg))))
+{
+    auto seg_str = fs::get_platform_string(seg);
+    fs::_hashed_path_append(out, ::to_const_string(seg_str));
+
+    if constexpr (needs_conversion(T))
+        fs::_free_platform_string(&seg_str);
+}
+
+void free(fs::hashed_path *pth);
+
+bool operator==(const fs::hashed_path &lhs, const fs::hashed_path &rhs);
+bool operator!=(const fs::hashed_path &lhs, const fs::hashed_path &rhs);
 }
 
 hash_t hash(const fs::path *pth);
+hash_t hash(const fs::hashed_path *pth);
+
+#define for_path_segment(Seg_Var, Pth)\
+    if (fs::path_segment_iterator Seg_Var##_it; true)\
+    for (fs::const_fs_string *Seg_Var = fs::_path_segment_first(&Seg_Var##_it, (Pth));\
+         Seg_Var != nullptr;\
+         Seg_Var = fs::_path_segment_next(&Seg_Var##_it))
+
+#define for_path_segment_reverse(Seg_Var, Pth)\
+    if (fs::path_segment_iterator Seg_Var##_it; true)\
+    for (fs::const_fs_string *Seg_Var = fs::_path_segment_last(&Seg_Var##_it, (Pth));\
+         Seg_Var != nullptr;\
+         Seg_Var = fs::_path_segment_previous(&Seg_Var##_it))
 
 #include "fs/impl/iterator.hpp"
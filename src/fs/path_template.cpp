@@ -0,0 +1,303 @@
+
+#include "shl/assert.hpp"
+#include "shl/string.hpp"
+#include "shl/environment.hpp"
+#include "shl/memory.hpp"
+#include "shl/defer.hpp"
+#include "fs/path_template.hpp"
+
+#define as_string_ptr(x)    (::string_base<fs::path_char_t>*)(x)
+#define empty_fs_string     fs::const_fs_string{SYS_CHAR(""), 0}
+
+static inline bool _is_variable_char(fs::path_char_t c)
+{
+    return (c >= 'a' && c <= 'z')
+        || (c >= 'A' && c <= 'Z')
+        || (c >= '0' && c <= '9')
+        || c == '_';
+}
+
+// finds the next "$Var" in str starting at from.
+// returns the offset of "$" or -1, name_size is the size of Var.
+static s64 _next_variable(fs::const_fs_string str, s64 from, s64 *name_size)
+{
+    for (s64 i = from; i < str.size; ++i)
+    {
+        if (str.c_str[i] != '$')
+            continue;
+
+        s64 end = i + 1;
+
+        while (end < str.size && _is_variable_char(str.c_str[end]))
+            end++;
+
+        if (end > i + 1)
+        {
+            *name_size = end - i - 1;
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// not owning, only used to look up entries
+static fs::path _lookup_key(fs::const_fs_string name)
+{
+    fs::path key{};
+    key.data = const_cast<fs::path_char_t*>(name.c_str);
+    key.size = name.size;
+    return key;
+}
+
+static void _free_entry(fs::variable_cache_entry *entry)
+{
+    fs::free(&entry->value);
+    fs::free(&entry->name);
+}
+
+// cache must be locked
+static void _remove_entry(fs::variable_cache *cache, fs::const_fs_string name)
+{
+    fs::path key = _lookup_key(name);
+    fs::variable_cache_entry *entry = ::search(&cache->entries, &key);
+
+    if (entry == nullptr)
+        return;
+
+    // the key in the table uses the memory of entry->name
+    fs::variable_cache_entry removed = *entry;
+
+    ::remove_element_by_key(&cache->entries, &key);
+    _free_entry(&removed);
+}
+
+// cache must be locked
+static fs::variable_cache_entry *_add_entry(fs::variable_cache *cache, fs::const_fs_string name)
+{
+    fs::path owned_name{};
+    fs::path_set(&owned_name, name);
+
+    // the table key shares its memory with entry->name
+    fs::variable_cache_entry *entry = ::add_element_by_key(&cache->entries, &owned_name);
+    assert(entry != nullptr);
+
+    fill_memory(entry, 0);
+    entry->name = owned_name;
+
+    return entry;
+}
+
+// cache must be locked. the returned entry is valid until the next entry is
+// added or removed.
+static const fs::variable_cache_entry *_get_entry(fs::variable_cache *cache, fs::const_fs_string name)
+{
+    fs::path key = _lookup_key(name);
+    fs::variable_cache_entry *entry = ::search(&cache->entries, &key);
+
+    if (entry != nullptr)
+        return entry;
+
+    entry = _add_entry(cache, name);
+
+    // resolving "$Var" on its own yields exactly what path_new would
+    // substitute for it, aliases included.
+    const fs::path_char_t dollar[] = {'$', '\0'};
+    fs::path_set(&entry->value, dollar, 1);
+    ::string_append(as_string_ptr(&entry->value), name);
+    ::resolve_environment_variables(as_string_ptr(&entry->value), cache->variable_aliases);
+
+    return entry;
+}
+
+// cache must be locked
+static void _append_variable(fs::variable_cache *cache, fs::const_fs_string name, fs::path *out)
+{
+    const fs::variable_cache_entry *entry = _get_entry(cache, name);
+    ::string_append(as_string_ptr(out), to_const_string(&entry->value));
+}
+
+static void _add_segment(fs::path_template *tmpl, fs::path_template_segment_type type, s64 offset, s64 size)
+{
+    fs::path_template_segment seg{};
+    seg.type = type;
+    seg.offset = offset;
+    seg.size = size;
+    ::add_at_end(&tmpl->segments, seg);
+}
+
+void fs::init(fs::variable_cache *cache, bool variable_aliases)
+{
+    assert(cache != nullptr);
+
+    ::init(&cache->entries);
+    cache->variable_aliases = variable_aliases;
+    fs::_mutex_init(&cache->_lock);
+}
+
+void fs::free(fs::variable_cache *cache)
+{
+    if (cache == nullptr)
+        return;
+
+    for_hash_table(k, v, &cache->entries)
+    {
+        (void)k;
+        _free_entry(v);
+    }
+
+    ::free(&cache->entries);
+    fs::_mutex_free(&cache->_lock);
+}
+
+void fs::_variable_cache_set(fs::variable_cache *cache, fs::const_fs_string name, fs::const_fs_string value)
+{
+    assert(cache != nullptr);
+
+    fs::_mutex_lock(&cache->_lock);
+    defer { fs::_mutex_unlock(&cache->_lock); };
+
+    fs::path key = _lookup_key(name);
+    fs::variable_cache_entry *entry = ::search(&cache->entries, &key);
+
+    if (entry == nullptr)
+        entry = _add_entry(cache, name);
+
+    fs::path_set(&entry->value, value);
+    entry->custom = true;
+}
+
+void fs::_variable_cache_unset(fs::variable_cache *cache, fs::const_fs_string name)
+{
+    assert(cache != nullptr);
+
+    fs::_mutex_lock(&cache->_lock);
+    _remove_entry(cache, name);
+    fs::_mutex_unlock(&cache->_lock);
+}
+
+void fs::variable_cache_invalidate(fs::variable_cache *cache)
+{
+    assert(cache != nullptr);
+
+    fs::_mutex_lock(&cache->_lock);
+    defer { fs::_mutex_unlock(&cache->_lock); };
+
+    array<fs::const_fs_string> to_remove{};
+    defer { ::free(&to_remove); };
+
+    for_hash_table(k, v, &cache->entries)
+    if (!v->custom)
+        ::add_at_end(&to_remove, to_const_string(k));
+
+    // the names point to memory owned by the entries, which removing other
+    // entries does not move or free.
+    for_array(name, &to_remove)
+        _remove_entry(cache, *name);
+}
+
+void fs::_variable_cache_invalidate(fs::variable_cache *cache, fs::const_fs_string name)
+{
+    assert(cache != nullptr);
+
+    fs::_mutex_lock(&cache->_lock);
+    defer { fs::_mutex_unlock(&cache->_lock); };
+
+    fs::path key = _lookup_key(name);
+    fs::variable_cache_entry *entry = ::search(&cache->entries, &key);
+
+    if (entry != nullptr && !entry->custom)
+        _remove_entry(cache, name);
+}
+
+void fs::init(fs::path_template *tmpl)
+{
+    assert(tmpl != nullptr);
+
+    fs::init(&tmpl->source);
+    ::init(&tmpl->segments);
+}
+
+void fs::free(fs::path_template *tmpl)
+{
+    if (tmpl == nullptr)
+        return;
+
+    fs::free(&tmpl->source);
+    ::free(&tmpl->segments);
+}
+
+void fs::_path_template_compile(fs::const_fs_string pth, fs::path_template *out)
+{
+    assert(out != nullptr);
+    assert(pth.c_str != out->source.data);
+
+    fs::path_set(&out->source, pth);
+    ::clear(&out->segments);
+
+    s64 pos = 0;
+    s64 name_size = 0;
+    s64 var = 0;
+
+    while ((var = _next_variable(pth, pos, &name_size)) >= 0)
+    {
+        if (var > pos)
+            _add_segment(out, fs::path_template_segment_type::Literal, pos, var - pos);
+
+        _add_segment(out, fs::path_template_segment_type::Variable, var + 1, name_size);
+        pos = var + 1 + name_size;
+    }
+
+    if (pos < pth.size)
+        _add_segment(out, fs::path_template_segment_type::Literal, pos, pth.size - pos);
+}
+
+void fs::path_template_expand(const fs::path_template *tmpl, fs::variable_cache *cache, fs::path *out)
+{
+    assert(tmpl != nullptr);
+    assert(cache != nullptr);
+    assert(out != nullptr);
+    assert(out != &tmpl->source);
+
+    fs::path_set(out, empty_fs_string);
+
+    fs::_mutex_lock(&cache->_lock);
+    defer { fs::_mutex_unlock(&cache->_lock); };
+
+    for_array(seg, &tmpl->segments)
+    {
+        fs::const_fs_string str{tmpl->source.data + seg->offset, seg->size};
+
+        if (seg->type == fs::path_template_segment_type::Variable)
+            _append_variable(cache, str, out);
+        else
+            ::string_append(as_string_ptr(out), str);
+    }
+}
+
+fs::path fs::_path_new(fs::const_fs_string pth, fs::variable_cache *cache)
+{
+    assert(cache != nullptr);
+
+    fs::path ret{};
+    fs::path_set(&ret, empty_fs_string);
+
+    // same as compiling and expanding, without storing the segments
+    s64 pos = 0;
+    s64 name_size = 0;
+    s64 var = 0;
+
+    fs::_mutex_lock(&cache->_lock);
+    defer { fs::_mutex_unlock(&cache->_lock); };
+
+    while ((var = _next_variable(pth, pos, &name_size)) >= 0)
+    {
+        ::string_append(as_string_ptr(&ret), fs::const_fs_string{pth.c_str + pos, var - pos});
+        _append_variable(cache, fs::const_fs_string{pth.c_str + var + 1, name_size}, &ret);
+        pos = var + 1 + name_size;
+    }
+
+    ::string_append(as_string_ptr(&ret), fs::const_fs_string{pth.c_str + pos, pth.size - pos});
+
+    return ret;
+}
@@ -0,0 +1,218 @@
+
+/* path_template.hpp
+
+Expands environment variables in paths without looking up the environment on
+every expansion.
+fs::path_new(PathStr) resolves every variable through the environment each time
+it is called. For paths that are built over and over (e.g. config files that
+use "$HOME" or "$XDG_CONFIG_HOME" everywhere), a variable_cache keeps the values
+of the variables, and a path_template keeps the template parsed into literal and
+variable segments.
+
+Example usage:
+
+    fs::variable_cache vars{};
+    fs::init(&vars);
+
+    // looks up HOME once, every following expansion uses the cached value
+    fs::path p1 = fs::path_new("$HOME/.config/app/a.conf", &vars);
+    fs::path p2 = fs::path_new("$HOME/.config/app/b.conf", &vars);
+
+    // templates are parsed once
+    fs::path_template tmpl{};
+    fs::path_template_compile("$HOME/.cache/$APP_NAME", &tmpl);
+    fs::variable_cache_set(&vars, "APP_NAME", "myapp");
+
+    fs::path out{};
+    fs::path_template_expand(&tmpl, &vars, &out); // e.g. /home/user/.cache/myapp
+
+    // e.g. after changing the environment
+    fs::variable_cache_invalidate(&vars, "HOME");
+
+    fs::free(&p1);
+    fs::free(&p2);
+    fs::free(&out);
+    fs::free(&tmpl);
+    fs::free(&vars);
+
+Variables are denoted as "$Var", where Var consists of ASCII letters, digits
+and underscores, e.g. "$HOST.txt" refers to the variable HOST.
+A "$" which is not followed by a variable name is kept as is.
+
+The value of a variable is a snapshot taken the first time the variable is
+expanded through a cache. Values are resolved the same way path_new resolves
+"$Var", including variable aliases (see shl/environment.hpp), so a cached
+expansion yields the same path as path_new(PathStr) at the time of the snapshot.
+
+A variable_cache may be shared between threads, all functions lock the cache
+while accessing it.
+
+Types:
+
+struct variable_cache
+    Maps variable names to their values.
+
+struct path_template
+    A parsed path template. Does not depend on a variable_cache and may be
+    expanded with any number of caches.
+
+Functions:
+
+init(*Cache[, VariableAliases = true])
+    Initializes an empty Cache.
+    If VariableAliases is true, variables that are not environment variables
+    may be resolved through aliases, same as path_new.
+
+free(*Cache)
+    Frees all memory used by Cache.
+
+variable_cache_set(*Cache, Name, Value)
+    Sets the custom variable Name to Value. Custom variables take precedence
+    over environment variables and are not removed by variable_cache_invalidate.
+
+variable_cache_unset(*Cache, Name)
+    Removes the variable Name from Cache, custom or not.
+
+variable_cache_invalidate(*Cache)
+    Removes the values of all environment variables from Cache. Custom variables
+    are kept.
+
+variable_cache_invalidate(*Cache, Name)
+    Removes the value of the environment variable Name from Cache, if it's not
+    a custom variable.
+
+init(*Template)
+    Initializes an empty Template.
+
+free(*Template)
+    Frees all memory used by Template.
+
+path_template_compile(PathStr, *Template)
+    Parses PathStr into Template, replacing the previous contents of Template.
+
+path_template_expand(*Template, *Cache, *OutPath)
+    Sets OutPath to Template with all variables replaced by their values
+    in Cache. Variables that are not in Cache yet are looked up and added
+    to Cache.
+
+path_new(PathStr, *Cache)
+    Returns a new fs::path which contains a copy of PathStr with all variables
+    replaced by their values in Cache, see path_template_expand.
+    Same as path_new(PathStr) but using Cache.
+*/
+
+#pragma once
+
+#include "shl/hash_table.hpp"
+#include "fs/path.hpp"
+#include "fs/impl/parallel.hpp"
+
+namespace fs
+{
+struct variable_cache_entry
+{
+    fs::path name; // owns the memory of the key of the entry
+    fs::path value;
+    bool custom;
+};
+
+struct variable_cache
+{
+    hash_table<fs::path, fs::variable_cache_entry> entries;
+    bool variable_aliases;
+
+    fs::_mutex _lock;
+};
+
+enum class path_template_segment_type : u8
+{
+    Literal,
+    Variable
+};
+
+struct path_template_segment
+{
+    fs::path_template_segment_type type;
+
+    // range within path_template::source. for variables, the name without "$"
+    s64 offset;
+    s64 size;
+};
+
+struct path_template
+{
+    fs::path source;
+    array<fs::path_template_segment> segments;
+};
+
+void init(fs::variable_cache *cache, bool variable_aliases = true);
+void free(fs::variable_cache *cache);
+
+void _variable_cache_set(fs::variable_cache *cache, fs::const_fs_string name, fs::const_fs_string value);
+
+template<typename T1, typename T2>
+auto variable_cache_set(fs::variable_cache *cache, T1 name, T2 value)
+    -> decltype(fs::_variable_cache_set(cache, ::to_const_string(fs::get_platform_string(name)), ::to_const_string(fs::get_platform_string(value))))
+{
+    auto name_str = fs::get_platform_string(name);
+    auto value_str = fs::get_platform_string(value);
+    fs::_variable_cache_set(cache, ::to_const_string(name_str), ::to_const_string(value_str));
+
+    if constexpr (needs_conversion(T2))
+        fs::_free_platform_string(&value_str);
+
+    if constexpr (needs_conversion(T1))
+        fs::_free_platform_string(&name_str);
+}
+
+void _variable_cache_unset(fs::variable_cache *cache, fs::const_fs_string name);
+
+template<typename T>
+auto variable_cache_unset(fs::variable_cache *cache, T name)
+    -> decltype(fs::_variable_cache_unset(cache, ::to_const_string(fs::get_platform_string(name))))
+{
+    auto name_str = fs::get_platform_string(name);
+    fs::_variable_cache_unset(cache, ::to_const_string(name_str));
+
+    if constexpr (needs_conversion(T))
+        fs::_free_platform_string(&name_str);
+}
+
+void variable_cache_invalidate(fs::variable_cache *cache);
+void _variable_cache_invalidate(fs::variable_cache *cache, fs::const_fs_string name);
+
+template<typename T>
+auto variable_cache_invalidate(fs::variable_cache *cache, T name)
+    -> decltype(fs::_variable_cache_invalidate(cache, ::to_const_string(fs::get_platform_string(name))))
+{
+    auto name_str = fs::get_platform_string(name);
+    fs::_variable_cache_invalidate(cache, ::to_const_string(name_str));
+
+    if constexpr (needs_conversion(T))
+        fs::_free_platform_string(&name_str);
+}
+
+void init(fs::path_template *tmpl);
+void free(fs::path_template *tmpl);
+
+void _path_template_compile(fs::const_fs_string pth, fs::path_template *out);
+
+template<typename T>
+auto path_template_compile(T pth, fs::path_template *out)
+    -> decltype(fs::_path_template_compile(::to_const_string(fs::get_platform_string(pth)), out))
+{
+    auto pth_str = fs::get_platform_string(pth);
+    fs::_path_template_compile(::to_const_string(pth_str), out);
+
+    if constexpr (needs_conversion(T))
+        fs::_free_platform_string(&pth_str);
+}
+
+void path_template_expand(const fs::path_template *tmpl, fs::variable_cache *cache, fs::path *out);
+
+fs::path _path_new(fs::const_fs_string pth, fs::variable_cache *cache);
+
+template<typename T>
+auto path_new(T pth, fs::variable_cache *cache)
+    define_fs_conversion_body(fs::_path_new, pth, cache)
+}
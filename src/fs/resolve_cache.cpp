@@ -0,0 +1,437 @@
+
+#include "shl/assert.hpp"
+#include "shl/memory.hpp"
+#include "shl/defer.hpp"
+#include "fs/resolve_cache.hpp"
+#include "fs/impl/cache.hpp"
+
+#if Windows
+#include <string.h> // memcmp
+#endif
+
+static void _free_paths(array<fs::path> *paths)
+{
+    for_array(p, paths)
+        fs::free(p);
+
+    ::free(paths);
+}
+
+static void _free_entries(fs::resolve_cache *cache)
+{
+    for_hash_table(k, v, &cache->entries)
+    {
+        (void)k;
+        fs::free(&v->input);
+        fs::free(&v->canonical);
+        _free_paths(&v->dependencies);
+    }
+}
+
+static bool _entry_depends_on(const fs::path *key, const fs::resolve_cache_entry *entry, fs::const_fs_string pth)
+{
+    if (fs::_is_under(to_const_string(key), pth)
+     || fs::_is_under(to_const_string(&entry->canonical), pth))
+        return true;
+
+    for_array(dep, &entry->dependencies)
+        if (fs::_is_under(to_const_string(dep), pth))
+            return true;
+
+    return false;
+}
+
+// the directories watched for deps: the parent directories of every
+// dependency, not owning and not null-terminated. a directory is in out
+// as many times as it is a parent, the same for adding and removing.
+static void _dependency_directories(const array<fs::path> *deps, array<fs::path> *out)
+{
+    for_array(dep, deps)
+    {
+        fs::const_fs_string current = to_const_string(dep);
+
+        while (true)
+        {
+            fs::const_fs_string parent = fs::parent_path_segment(current);
+
+            if (parent.size == 0 || parent.size >= current.size)
+                break;
+
+            current = parent;
+
+            fs::path *key = ::add_at_end(out);
+            *key = fs::path{};
+            key->data = const_cast<fs::path_char_t*>(parent.c_str);
+            key->size = parent.size;
+        }
+    }
+}
+
+// cache must be locked. the entry with deps no longer depends on their directories.
+static void _release_dependencies(fs::resolve_cache *cache, const array<fs::path> *deps)
+{
+    if (cache->watcher == nullptr)
+        return;
+
+    array<fs::path> dirs{};
+    defer { ::free(&dirs); };
+
+    _dependency_directories(deps, &dirs);
+
+    for_array(key, &dirs)
+    {
+        s64 *count = ::search(&cache->watched_directories, key);
+
+        if (count != nullptr && *count > 0)
+            *count -= 1;
+    }
+}
+
+static void _remove_entry(fs::resolve_cache *cache, const fs::path *key)
+{
+    fs::resolve_cache_entry *entry = ::search(&cache->entries, key);
+
+    if (entry == nullptr)
+        return;
+
+    // the key in the table uses the memory of entry->input
+    fs::path input = entry->input;
+
+    fs::free(&entry->canonical);
+    _release_dependencies(cache, &entry->dependencies);
+    _free_paths(&entry->dependencies);
+
+    ::remove_element_by_key(&cache->entries, key);
+    fs::free(&input);
+}
+
+// cache must be locked
+static void _invalidate(fs::resolve_cache *cache, fs::const_fs_string pth)
+{
+    array<fs::path> to_remove{};
+    defer { ::free(&to_remove); };
+
+    for_hash_table(k, v, &cache->entries)
+    if (_entry_depends_on(k, v, pth))
+        ::add_at_end(&to_remove, *k);
+
+    // to_remove holds copies of the keys in the table, _remove_entry frees their memory
+    for_array(k, &to_remove)
+        _remove_entry(cache, k);
+}
+
+static void _watcher_callback(fs::watcher_event *event)
+{
+    fs::resolve_cache *cache = (fs::resolve_cache*)event->userdata;
+
+    if (cache == nullptr)
+        return;
+
+    // resolve_cache_process_events holds the lock while events are processed
+    _invalidate(cache, event->path);
+}
+
+// creating or modifying entries cannot change how an existing (resolved) path
+// resolves, only removing or replacing them can.
+#define RESOLVE_CACHE_WATCH_EVENTS \
+    (fs::watcher_event_type::Removed | fs::watcher_event_type::MovedFrom | fs::watcher_event_type::MovedTo)
+
+// cache must be locked. watches the parent directories of all dependencies
+// and counts the entry as depending on them.
+static bool _watch_dependencies(fs::resolve_cache *cache, const array<fs::path> *deps)
+{
+    array<fs::path> dirs{};
+    defer { ::free(&dirs); };
+
+    _dependency_directories(deps, &dirs);
+
+    for_array(key, &dirs)
+    {
+        if (::search(&cache->watched_directories, key) != nullptr)
+            continue;
+
+        fs::path dir{};
+        fs::path_set(&dir, to_const_string(key));
+
+        if (!fs::filesystem_watcher_watch_directory(cache->watcher, &dir, RESOLVE_CACHE_WATCH_EVENTS, cache))
+        {
+            fs::free(&dir);
+            return false;
+        }
+
+        // the table owns the memory of dir now. not counted until all
+        // directories are watched, _unwatch_unused removes it otherwise.
+        *::add_element_by_key(&cache->watched_directories, &dir) = 0;
+    }
+
+    for_array(key, &dirs)
+        *::search(&cache->watched_directories, key) += 1;
+
+    return true;
+}
+
+// cache must be locked. stops watching directories no entry depends on.
+// not called from the watcher callback, the watcher may not be modified
+// while it processes events.
+static void _unwatch_unused(fs::resolve_cache *cache)
+{
+    if (cache->watcher == nullptr)
+        return;
+
+    array<fs::path> unused{};
+    defer { ::free(&unused); };
+
+    for_hash_table(k, v, &cache->watched_directories)
+    if (*v <= 0)
+        ::add_at_end(&unused, *k);
+
+    // unused holds copies of the keys in the table, which own their memory
+    for_array(dir, &unused)
+    {
+        // fails if the directory was removed, which removes the watch as well
+        fs::filesystem_watcher_unwatch_directory(cache->watcher, dir);
+
+        ::remove_element_by_key(&cache->watched_directories, dir);
+        fs::free(dir);
+    }
+}
+
+static bool _get_stamp(fs::const_fs_string pth, fs::resolve_cache_stamp *out)
+{
+    fs::filesystem_info info;
+    fill_memory(out, 0);
+
+#if Windows
+    if (!fs::_query_filesystem(pth, &info, true, fs::query_flag::Id, nullptr))
+        return false;
+
+    out->id = info.detail.id_info;
+
+    if (!fs::_query_filesystem(pth, &info, true, fs::query_flag::FileTimes, nullptr))
+        return false;
+
+    out->change_time = info.detail.file_times.change_time;
+#else
+    if (!fs::_query_filesystem(pth, &info, true, fs::query_flag::Id | fs::query_flag::FileTimes, nullptr))
+        return false;
+
+    out->ino = info.stx_ino;
+    out->dev_major = info.stx_dev_major;
+    out->dev_minor = info.stx_dev_minor;
+    out->ctime = info.stx_ctime;
+#endif
+
+    return true;
+}
+
+static bool _same_stamp(const fs::resolve_cache_stamp *a, const fs::resolve_cache_stamp *b)
+{
+#if Windows
+    return memcmp(&a->id, &b->id, sizeof(FILE_ID_INFO)) == 0
+        && a->change_time == b->change_time;
+#else
+    return a->ino == b->ino
+        && a->dev_major == b->dev_major
+        && a->dev_minor == b->dev_minor
+        && a->ctime.tv_sec == b->ctime.tv_sec
+        && a->ctime.tv_nsec == b->ctime.tv_nsec;
+#endif
+}
+
+void fs::init(fs::resolve_cache *cache)
+{
+    [[maybe_unused]] bool ret = fs::init(cache, fs::resolve_cache_validation::None);
+    assert(ret);
+}
+
+bool fs::init(fs::resolve_cache *cache, fs::resolve_cache_validation validation, error *err)
+{
+    assert(cache != nullptr);
+
+    ::init(&cache->entries);
+    ::init(&cache->watched_directories);
+    cache->validation = validation;
+    cache->watcher = nullptr;
+    fs::_mutex_init(&cache->_lock);
+
+    if (validation == fs::resolve_cache_validation::Watcher)
+    {
+        cache->watcher = fs::filesystem_watcher_create(_watcher_callback, err);
+
+        if (cache->watcher == nullptr)
+        {
+            fs::free(cache);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void fs::free(fs::resolve_cache *cache)
+{
+    if (cache == nullptr)
+        return;
+
+    _free_entries(cache);
+    ::free(&cache->entries);
+
+    for_hash_table(k, v, &cache->watched_directories)
+    {
+        (void)v;
+        fs::free(k);
+    }
+
+    ::free(&cache->watched_directories);
+
+    if (cache->watcher != nullptr)
+    {
+        fs::filesystem_watcher_destroy(cache->watcher);
+        cache->watcher = nullptr;
+    }
+
+    fs::_mutex_free(&cache->_lock);
+}
+
+void fs::resolve_cache_clear(fs::resolve_cache *cache)
+{
+    assert(cache != nullptr);
+
+    fs::_mutex_lock(&cache->_lock);
+    _free_entries(cache);
+    ::clear(&cache->entries);
+
+    // no entry depends on any directory anymore
+    for_hash_table(k, v, &cache->watched_directories)
+    {
+        (void)k;
+        *v = 0;
+    }
+
+    _unwatch_unused(cache);
+    fs::_mutex_unlock(&cache->_lock);
+}
+
+void fs::_resolve_cache_invalidate(fs::resolve_cache *cache, fs::const_fs_string pth)
+{
+    assert(cache != nullptr);
+
+    fs::_mutex_lock(&cache->_lock);
+    _invalidate(cache, pth);
+    _unwatch_unused(cache);
+    fs::_mutex_unlock(&cache->_lock);
+}
+
+bool fs::resolve_cache_process_events(fs::resolve_cache *cache, error *err)
+{
+    assert(cache != nullptr);
+
+    if (cache->watcher == nullptr)
+        return true;
+
+    fs::_mutex_lock(&cache->_lock);
+    defer { fs::_mutex_unlock(&cache->_lock); };
+
+    if (!fs::filesystem_watcher_has_events(cache->watcher, err))
+        return true;
+
+    bool ok = fs::filesystem_watcher_process_events(cache->watcher, err);
+
+    // the callback removed the affected entries
+    _unwatch_unused(cache);
+
+    return ok;
+}
+
+bool fs::_resolve_cache_canonical_path(fs::resolve_cache *cache, fs::const_fs_string pth, fs::path *out, error *err)
+{
+    assert(cache != nullptr);
+    assert(out != nullptr);
+    assert(pth.c_str != out->data);
+
+    // not owning, only used to look up the entry
+    fs::path key{};
+    key.data = const_cast<fs::path_char_t*>(pth.c_str);
+    key.size = pth.size;
+
+    fs::resolve_cache_stamp stamp{};
+    bool found = false;
+
+    fs::_mutex_lock(&cache->_lock);
+    fs::resolve_cache_entry *cached = ::search(&cache->entries, &key);
+
+    if (cached != nullptr)
+    {
+        fs::path_set(out, &cached->canonical);
+        stamp = cached->stamp;
+        found = true;
+    }
+
+    fs::_mutex_unlock(&cache->_lock);
+
+    if (found)
+    {
+        if (cache->validation != fs::resolve_cache_validation::Revalidate)
+            return true;
+
+        fs::resolve_cache_stamp current{};
+
+        if (_get_stamp(pth, &current) && _same_stamp(&current, &stamp))
+            return true;
+
+        fs::_mutex_lock(&cache->_lock);
+        _remove_entry(cache, &key);
+        fs::_mutex_unlock(&cache->_lock);
+    }
+
+    // resolve without holding the lock, other threads may resolve
+    // different directories in the meantime.
+    array<fs::path> deps{};
+    defer { _free_paths(&deps); };
+
+    if (cache->validation == fs::resolve_cache_validation::Watcher)
+    {
+        if (!fs::_canonical_path_trace(pth, out, &deps, err))
+            return false;
+    }
+    else if (!fs::canonical_path(pth, out, err))
+        return false;
+
+    // can't be validated later, so it's not cached
+    if (cache->validation == fs::resolve_cache_validation::Revalidate
+     && !_get_stamp(to_const_string(out), &stamp))
+        return true;
+
+    fs::_mutex_lock(&cache->_lock);
+    defer { fs::_mutex_unlock(&cache->_lock); };
+
+    // another thread may have added the same directory already
+    if (::search(&cache->entries, &key) != nullptr)
+        return true;
+
+    // if the dependencies can't be watched, the entry could become stale
+    if (cache->validation == fs::resolve_cache_validation::Watcher
+     && !_watch_dependencies(cache, &deps))
+    {
+        _unwatch_unused(cache);
+        return true;
+    }
+
+    fs::path input{};
+    fs::path_set(&input, pth);
+
+    // the table key shares its memory with entry->input
+    fs::resolve_cache_entry *entry = ::add_element_by_key(&cache->entries, &input);
+    assert(entry != nullptr);
+
+    fill_memory(entry, 0);
+    entry->input = input;
+    fs::path_set(&entry->canonical, out);
+    entry->stamp = stamp;
+
+    // the entry takes the dependencies
+    entry->dependencies = deps;
+    deps = array<fs::path>{};
+
+    return true;
+}
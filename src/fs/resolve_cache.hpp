@@ -0,0 +1,179 @@
+
+/* resolve_cache.hpp
+
+Caches canonical paths of directories, so resolving many paths that share
+parent directories does not resolve the same directories over and over.
+
+Example usage:
+
+    fs::resolve_cache cache{};
+    fs::init(&cache, fs::resolve_cache_validation::Watcher);
+
+    fs::path out{};
+
+    // both calls resolve /home/user/projects only once
+    fs::weakly_canonical_path_cached("/home/user/projects/a.txt", &out, &cache);
+    fs::weakly_canonical_path_cached("/home/user/projects/b.txt", &out, &cache);
+
+    // e.g. once per frame / tick, drops entries affected by filesystem changes
+    fs::resolve_cache_process_events(&cache);
+
+    fs::free(&out);
+    fs::free(&cache);
+
+A resolve_cache may be shared between threads, all functions lock the cache
+while accessing it.
+
+Types:
+
+struct resolve_cache
+    Maps absolute directory paths (the input, not normalized) to their
+    canonical paths.
+
+enum class resolve_cache_validation
+    How cached entries are kept up to date:
+
+    None:       Entries are never invalidated automatically. If directories
+                or symlinks change while the cache is in use, call
+                resolve_cache_invalidate or resolve_cache_clear.
+    Revalidate: Every cache hit queries the file ID and change time of the
+                cached path (one stat) and drops the entry if either changed,
+                e.g. because a symlink on the path now points elsewhere or the
+                directory was replaced.
+    Watcher:    The cache owns a filesystem_watcher which watches the
+                directories every entry depends on, including the locations
+                of all symlinks followed while resolving the entry (on Linux).
+                Calling resolve_cache_process_events drops the affected entries,
+                cache hits are a hash lookup.
+                Watching uses one inotify watch (Linux) or directory handle
+                (Windows) per distinct directory. Directories no entry
+                depends on anymore are unwatched by resolve_cache_invalidate,
+                resolve_cache_process_events and resolve_cache_clear.
+
+Functions:
+
+init(*Cache)
+    Initializes an empty Cache without validation.
+
+init(*Cache, Validation[, err])
+    Initializes an empty Cache using the given resolve_cache_validation.
+    Returns whether or not the function succeeded.
+
+free(*Cache)
+    Frees all memory used by Cache.
+
+resolve_cache_clear(*Cache)
+    Removes all entries from Cache.
+
+resolve_cache_invalidate(*Cache, PathStr)
+    Removes all entries whose input path, canonical path or any location they
+    depend on is PathStr or inside PathStr.
+    Useful to forward events of your own filesystem_watcher to Cache.
+
+resolve_cache_process_events(*Cache[, err])
+    If Cache uses resolve_cache_validation::Watcher, processes pending
+    filesystem events and removes the affected entries. Does nothing otherwise.
+    Returns whether or not the function succeeded.
+
+resolve_cache_canonical_path(*Cache, PathStr, *OutPath[, err])
+    Sets OutPath to the canonical path of the directory PathStr.
+    PathStr must be absolute. Entries are keyed by the exact string, so
+    normalized paths get more cache hits.
+    If PathStr is in Cache (and still valid), copies the cached canonical path
+    into OutPath, otherwise resolves PathStr and adds it to Cache.
+    Returns whether or not the function succeeded.
+
+canonical_path_cached(PathStr, *OutPath, *Cache[, err])
+weakly_canonical_path_cached(PathStr, *OutPath, *Cache[, err])
+    See path.hpp. Same as canonical_path / weakly_canonical_path without Cache,
+    but resolve the parent directory of PathStr through Cache.
+*/
+
+#pragma once
+
+#include "shl/hash_table.hpp"
+#include "fs/path.hpp"
+#include "fs/filesystem_watcher.hpp"
+#include "fs/impl/parallel.hpp"
+
+namespace fs
+{
+enum class resolve_cache_validation : u8
+{
+    None,
+    Revalidate,
+    Watcher
+};
+
+// identity of a resolved directory at the time it was cached
+struct resolve_cache_stamp
+{
+#if Windows
+    FILE_ID_INFO id;
+    u64 change_time;
+#else
+    u64 ino;
+    u32 dev_major;
+    u32 dev_minor;
+    fs::filesystem_timestamp ctime;
+#endif
+};
+
+struct resolve_cache_entry
+{
+    fs::path input; // owns the memory of the key of the entry
+    fs::path canonical;
+    fs::resolve_cache_stamp stamp;
+
+    // canonical locations the entry depends on, only with Watcher validation
+    array<fs::path> dependencies;
+};
+
+struct resolve_cache
+{
+    hash_table<fs::path, fs::resolve_cache_entry> entries;
+    fs::resolve_cache_validation validation;
+
+    fs::filesystem_watcher *watcher;
+    // number of entries which depend on each watched directory
+    hash_table<fs::path, s64> watched_directories;
+
+    fs::_mutex _lock;
+};
+
+void init(fs::resolve_cache *cache);
+bool init(fs::resolve_cache *cache, fs::resolve_cache_validation validation, error *err = nullptr);
+void free(fs::resolve_cache *cache);
+
+void resolve_cache_clear(fs::resolve_cache *cache);
+
+void _resolve_cache_invalidate(fs::resolve_cache *cache, fs::const_fs_string pth);
+
+template<typename T>
+auto resolve_cache_invalidate(fs::resolve_cache *cache, T pth)
+    -> decltype(fs::_resolve_cache_invalidate(cache, ::to_const_string(fs::get_platform_string(pth))))
+{
+    auto pth_str = fs::get_platform_string(pth);
+    fs::_resolve_cache_invalidate(cache, ::to_const_string(pth_str));
+
+    if constexpr (needs_conversion(T))
+        fs::_free_platform_string(&pth_str);
+}
+
+bool resolve_cache_process_events(fs::resolve_cache *cache, error *err = nullptr);
+
+bool _resolve_cache_canonical_path(fs::resolve_cache *cache, fs::const_fs_string pth, fs::path *out, error *err);
+
+template<typename T>
+auto resolve_cache_canonical_path(fs::resolve_cache *cache, T pth, fs::path *out, error *err = nullptr)
+    -> decltype(fs::_resolve_cache_canonical_path(cache, ::to_const_string(fs::get_platform_string(pth)), out, err))
+{
+    auto pth_str = fs::get_platform_string(pth);
+    auto ret = fs::_resolve_cache_canonical_path(cache, ::to_const_string(pth_str), out, err);
+
+    if constexpr (needs_conversion(T))
+        fs::_free_platform_string(&pth_str);
+
+    return ret;
+}
+}
@@ -0,0 +1,436 @@
+
+#include "shl/assert.hpp"
+#include "shl/memory.hpp"
+#include "shl/defer.hpp"
+#include "fs/stat_cache.hpp"
+#include "fs/impl/time.hpp"
+#include "fs/impl/cache.hpp"
+
+// returns the number of freed entries
+static s64 _free_entries(hash_table<fs::path, fs::stat_cache_entry> *entries)
+{
+    s64 count = 0;
+
+    for_hash_table(k, v, entries)
+    {
+        (void)k;
+        fs::free(&v->path);
+        count += 1;
+    }
+
+    return count;
+}
+
+// whether an entry queried with cached_flags has everything flags queries
+static bool _has_flags(fs::query_flag cached_flags, fs::query_flag flags)
+{
+#if Windows
+    // on Windows, flags are information classes, not bits
+    return cached_flags == flags;
+#else
+    return (value(cached_flags) & value(flags)) == value(flags);
+#endif
+}
+
+// cache must be locked
+static void _remove_entry(fs::stat_cache *cache, hash_table<fs::path, fs::stat_cache_entry> *entries, const fs::path *key)
+{
+    fs::stat_cache_entry *entry = ::search(entries, key);
+
+    if (entry == nullptr)
+        return;
+
+    // the key in the table uses the memory of entry->path
+    fs::path pth = entry->path;
+
+    ::remove_element_by_key(entries, key);
+    fs::free(&pth);
+
+    cache->counters.invalidations += 1;
+}
+
+// cache must be locked
+static void _remove_exact(fs::stat_cache *cache, fs::const_fs_string pth)
+{
+    // not owning, only used to look up the entry
+    fs::path key{};
+    key.data = const_cast<fs::path_char_t*>(pth.c_str);
+    key.size = pth.size;
+
+    _remove_entry(cache, &cache->entries[0], &key);
+    _remove_entry(cache, &cache->entries[1], &key);
+}
+
+// cache must be locked
+static void _remove_under(fs::stat_cache *cache, fs::const_fs_string pth)
+{
+    array<fs::path> to_remove{};
+    defer { ::free(&to_remove); };
+
+    for (s32 i = 0; i < 2; ++i)
+    {
+        ::clear(&to_remove);
+
+        for_hash_table(k, v, &cache->entries[i])
+        {
+            (void)v;
+
+            if (fs::_is_under(to_const_string(k), pth))
+                ::add_at_end(&to_remove, *k);
+        }
+
+        // to_remove holds copies of the keys in the table, _remove_entry frees their memory
+        for_array(k, &to_remove)
+            _remove_entry(cache, &cache->entries[i], k);
+    }
+}
+
+// cache must be locked.
+// removes pth, and the directory containing pth since its times changed.
+// if pth was removed or moved, everything inside it is gone as well.
+static void _invalidate(fs::stat_cache *cache, fs::const_fs_string pth, bool recursive)
+{
+    if (recursive)
+        _remove_under(cache, pth);
+    else
+        _remove_exact(cache, pth);
+
+    fs::const_fs_string parent = fs::parent_path_segment(pth);
+
+    if (parent.size > 0 && parent.size < pth.size)
+        _remove_exact(cache, parent);
+}
+
+static void _watcher_callback(fs::watcher_event *event)
+{
+    fs::stat_cache *cache = (fs::stat_cache*)event->userdata;
+
+    if (cache == nullptr)
+        return;
+
+    constexpr fs::watcher_event_type recursive_events =
+        fs::watcher_event_type::Removed | fs::watcher_event_type::MovedFrom | fs::watcher_event_type::MovedTo;
+
+    // stat_cache_process_events holds the lock while events are processed
+    _invalidate(cache, event->path, (event->event & recursive_events) != fs::watcher_event_type::None);
+}
+
+// cache must be locked
+static bool _watch_directory(fs::stat_cache *cache, fs::const_fs_string pth)
+{
+    fs::path dir{};
+    defer { fs::free(&dir); };
+
+    fs::path_set(&dir, pth);
+
+    if (::search(&cache->watched_directories, &dir) != nullptr)
+        return true;
+
+    if (!fs::filesystem_watcher_watch_directory(cache->watcher, &dir, fs::watcher_event_type::All, cache))
+        return false;
+
+    bool *val = ::add_element_by_key(&cache->watched_directories, &dir);
+    *val = true;
+
+    // the table owns the memory now
+    dir = fs::path{};
+
+    return true;
+}
+
+// cache must be locked. watches the directory containing pth, and pth
+// itself if it is a directory, so that changes of its entries (and with
+// them its times) are noticed.
+static bool _watch_entry(fs::stat_cache *cache, fs::const_fs_string pth, const fs::filesystem_info *info, fs::query_flag flags)
+{
+    fs::const_fs_string parent = fs::parent_path_segment(pth);
+
+    // events of relative paths would not match the key of the entry
+    if (parent.size == 0 || parent.size >= pth.size)
+        return false;
+
+    if (!_watch_directory(cache, parent))
+        return false;
+
+#if Windows
+    bool has_type = flags == fs::query_flag::Type;
+#else
+    bool has_type = (value(flags) & value(fs::query_flag::Type)) != 0;
+#endif
+
+    if (has_type && fs::get_filesystem_type(info) == fs::filesystem_type::Directory)
+        return _watch_directory(cache, pth);
+
+    return true;
+}
+
+void fs::init(fs::stat_cache *cache)
+{
+    [[maybe_unused]] bool ret = fs::init(cache, 0, false);
+    assert(ret);
+}
+
+bool fs::init(fs::stat_cache *cache, s64 time_to_live_ms, bool watch, error *err)
+{
+    assert(cache != nullptr);
+    assert(time_to_live_ms >= 0);
+
+    ::init(&cache->entries[0]);
+    ::init(&cache->entries[1]);
+    ::init(&cache->watched_directories);
+    cache->time_to_live = time_to_live_ms * 1000000ll;
+    cache->watcher = nullptr;
+    fill_memory(&cache->counters, 0);
+    fs::_mutex_init(&cache->_lock);
+
+    if (watch)
+    {
+        cache->watcher = fs::filesystem_watcher_create(_watcher_callback, err);
+
+        if (cache->watcher == nullptr)
+        {
+            fs::free(cache);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void fs::free(fs::stat_cache *cache)
+{
+    if (cache == nullptr)
+        return;
+
+    for (s32 i = 0; i < 2; ++i)
+    {
+        _free_entries(&cache->entries[i]);
+        ::free(&cache->entries[i]);
+    }
+
+    for_hash_table(k, v, &cache->watched_directories)
+    {
+        (void)v;
+        fs::free(k);
+    }
+
+    ::free(&cache->watched_directories);
+
+    if (cache->watcher != nullptr)
+    {
+        fs::filesystem_watcher_destroy(cache->watcher);
+        cache->watcher = nullptr;
+    }
+
+    fs::_mutex_free(&cache->_lock);
+}
+
+void fs::stat_cache_clear(fs::stat_cache *cache)
+{
+    assert(cache != nullptr);
+
+    fs::_mutex_lock(&cache->_lock);
+
+    for (s32 i = 0; i < 2; ++i)
+    {
+        cache->counters.invalidations += _free_entries(&cache->entries[i]);
+        ::clear(&cache->entries[i]);
+    }
+
+    fs::_mutex_unlock(&cache->_lock);
+}
+
+void fs::_stat_cache_invalidate(fs::stat_cache *cache, fs::const_fs_string pth)
+{
+    assert(cache != nullptr);
+
+    fs::_mutex_lock(&cache->_lock);
+    _invalidate(cache, pth, true);
+    fs::_mutex_unlock(&cache->_lock);
+}
+
+bool fs::stat_cache_process_events(fs::stat_cache *cache, error *err)
+{
+    assert(cache != nullptr);
+
+    if (cache->watcher == nullptr)
+        return true;
+
+    fs::_mutex_lock(&cache->_lock);
+    defer { fs::_mutex_unlock(&cache->_lock); };
+
+    if (!fs::filesystem_watcher_has_events(cache->watcher, err))
+        return true;
+
+    return fs::filesystem_watcher_process_events(cache->watcher, err);
+}
+
+void fs::stat_cache_get_counters(fs::stat_cache *cache, fs::stat_cache_counters *out)
+{
+    assert(cache != nullptr);
+    assert(out != nullptr);
+
+    fs::_mutex_lock(&cache->_lock);
+    *out = cache->counters;
+    fs::_mutex_unlock(&cache->_lock);
+}
+
+// cache must be locked. copies the cached information of key to out if it is
+// still valid and has flags. expired entries are removed.
+static bool _lookup(fs::stat_cache *cache, const fs::path *key, bool follow_symlinks, fs::query_flag flags, fs::filesystem_info *out, fs::query_flag *cached_flags)
+{
+    hash_table<fs::path, fs::stat_cache_entry> *entries = &cache->entries[follow_symlinks ? 1 : 0];
+    fs::stat_cache_entry *entry = ::search(entries, key);
+
+    if (entry == nullptr)
+        return false;
+
+    if (entry->expires != 0 && fs::_monotonic_time() >= entry->expires)
+    {
+        _remove_entry(cache, entries, key);
+        return false;
+    }
+
+    if (!_has_flags(entry->flags, flags))
+    {
+        *cached_flags = entry->flags;
+        return false;
+    }
+
+    *out = entry->info;
+    return true;
+}
+
+// cache must be locked
+static void _insert(fs::stat_cache *cache, fs::const_fs_string pth, bool follow_symlinks, fs::query_flag flags, const fs::filesystem_info *info)
+{
+    // without a watched directory, changes of the entry would go unnoticed
+    if (cache->watcher != nullptr && !_watch_entry(cache, pth, info, flags))
+        return;
+
+    hash_table<fs::path, fs::stat_cache_entry> *entries = &cache->entries[follow_symlinks ? 1 : 0];
+
+    // not owning, only used to look up the entry
+    fs::path key{};
+    key.data = const_cast<fs::path_char_t*>(pth.c_str);
+    key.size = pth.size;
+
+    // another thread may have queried the same path in the meantime,
+    // or the entry was queried with fewer flags before.
+    fs::stat_cache_entry *entry = ::search(entries, &key);
+
+    if (entry == nullptr)
+    {
+        fs::path owned{};
+        fs::path_set(&owned, pth);
+
+        // the table key shares its memory with entry->path
+        entry = ::add_element_by_key(entries, &owned);
+        assert(entry != nullptr);
+
+        fill_memory(entry, 0);
+        entry->path = owned;
+    }
+
+    entry->info = *info;
+    entry->flags = flags;
+    entry->expires = cache->time_to_live > 0 ? fs::_monotonic_time() + cache->time_to_live : 0;
+}
+
+// key is the path of the entry, dir and name are only used to query it
+static bool _cached_query(fs::stat_cache *cache, fs::const_fs_string key_str, const fs::dir_handle *dir, fs::const_fs_string name, fs::filesystem_info *out, bool follow_symlinks, fs::query_flag flags, error *err)
+{
+    assert(cache != nullptr);
+    assert(out != nullptr);
+
+    // not owning, only used to look up the entry
+    fs::path key{};
+    key.data = const_cast<fs::path_char_t*>(key_str.c_str);
+    key.size = key_str.size;
+
+    fs::query_flag cached_flags = (fs::query_flag)0;
+
+    fs::_mutex_lock(&cache->_lock);
+    bool found = _lookup(cache, &key, follow_symlinks, flags, out, &cached_flags);
+
+    if (found)
+        cache->counters.hits += 1;
+    else
+        cache->counters.misses += 1;
+
+    fs::_mutex_unlock(&cache->_lock);
+
+    if (found)
+        return true;
+
+#if !Windows
+    // query what was cached before as well, so the entry keeps serving
+    // the lookups it served so far.
+    flags = (fs::query_flag)(value(flags) | value(cached_flags));
+#endif
+
+    // query without holding the lock, other threads may use the cache
+    // in the meantime.
+    bool ok = dir != nullptr
+            ? fs::_query_filesystem(dir, name, out, follow_symlinks, flags, err)
+            : fs::_query_filesystem(key_str, out, follow_symlinks, flags, err);
+
+    if (!ok)
+        return false;
+
+    fs::_mutex_lock(&cache->_lock);
+    _insert(cache, key_str, follow_symlinks, flags, out);
+    fs::_mutex_unlock(&cache->_lock);
+
+    return true;
+}
+
+bool fs::_query_filesystem(fs::const_fs_string pth, fs::filesystem_info *out, fs::stat_cache *cache, bool follow_symlinks, fs::query_flag flags, error *err)
+{
+    return _cached_query(cache, pth, nullptr, pth, out, follow_symlinks, flags, err);
+}
+
+bool fs::_query_filesystem(const fs::dir_handle *dir, fs::const_fs_string name, fs::filesystem_info *out, fs::stat_cache *cache, bool follow_symlinks, fs::query_flag flags, error *err)
+{
+    assert(dir != nullptr);
+
+    // entries of a dir_handle are keyed by their full path, so they are
+    // shared with lookups by path and invalidated by the same events.
+    fs::path key{};
+    defer { fs::free(&key); };
+
+    fs::path_set(&key, &dir->path);
+
+    if (name.size > 0)
+        fs::path_append(&key, name);
+
+    return _cached_query(cache, to_const_string(&key), dir, name, out, follow_symlinks, flags, err);
+}
+
+bool fs::_get_filesystem_type(fs::const_fs_string pth, fs::filesystem_type *out, fs::stat_cache *cache, bool follow_symlinks, error *err)
+{
+    assert(out != nullptr);
+
+    fs::filesystem_info info;
+
+    if (!fs::_query_filesystem(pth, &info, cache, follow_symlinks, fs::query_flag::Type, err))
+        return false;
+
+    *out = fs::get_filesystem_type(&info);
+
+    return true;
+}
+
+bool fs::_get_file_size(fs::const_fs_string pth, s64 *out, fs::stat_cache *cache, bool follow_symlinks, error *err)
+{
+    assert(out != nullptr);
+
+    fs::filesystem_info info;
+
+    if (!fs::_query_filesystem(pth, &info, cache, follow_symlinks, fs::query_flag::Size, err))
+        return false;
+
+    *out = fs::get_file_size(&info);
+
+    return true;
+}
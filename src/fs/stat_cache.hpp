@@ -0,0 +1,180 @@
+
+/* stat_cache.hpp
+
+Caches filesystem information (see query_filesystem) of paths, for programs
+that ask about the same paths over and over, e.g. build systems checking the
+sizes and types of their inputs.
+
+Example usage:
+
+    fs::stat_cache cache{};
+    fs::init(&cache, 1000 /* ms */, true /* watch */);
+
+    fs::filesystem_info info{};
+    s64 size = 0;
+
+    // only the first call queries the filesystem
+    fs::query_filesystem("/home/user/project/main.cpp", &info, &cache);
+    fs::get_file_size("/home/user/project/main.cpp", &size, &cache);
+
+    // e.g. once per frame / tick, drops entries of changed files
+    fs::stat_cache_process_events(&cache);
+
+    fs::free(&cache);
+
+Entries are invalidated when they are older than the time to live of the cache
+(if any), when the cache watches the directories of its entries and an event
+for the entry is processed, or explicitly with stat_cache_invalidate.
+Cache hits do not make any system call: the time to live is checked against a
+monotonic clock which is read in user space, and watcher events are only read
+by stat_cache_process_events.
+
+Entries are keyed by the exact path string (and whether symlinks are followed),
+so e.g. "a/b" and "a//b" are separate entries. When watching, use absolute
+paths, since filesystem events are reported relative to the watched directory.
+
+A stat_cache may be shared between threads, all functions lock the cache
+while accessing it.
+
+Types:
+
+struct stat_cache
+    Maps paths to their fs::filesystem_info.
+
+struct stat_cache_counters
+    hits:          number of lookups answered from the cache.
+    misses:        number of lookups that queried the filesystem.
+    invalidations: number of entries removed because they expired, changed
+                   or were invalidated explicitly.
+
+Functions:
+
+init(*Cache)
+    Initializes an empty Cache whose entries never expire.
+
+init(*Cache, TimeToLiveMs, Watch = false[, err])
+    Initializes an empty Cache. Entries expire TimeToLiveMs milliseconds after
+    they were queried, never if TimeToLiveMs is 0.
+    If Watch is true, the cache owns a filesystem_watcher which watches the
+    directories of all entries (and directories that are entries themselves),
+    and stat_cache_process_events drops the entries of changed files.
+    Changes of attributes only (e.g. permissions) are not reported by the watcher,
+    use a time to live if those matter.
+    Returns whether or not the function succeeded.
+
+free(*Cache)
+    Frees all memory used by Cache.
+
+stat_cache_clear(*Cache)
+    Removes all entries from Cache.
+
+stat_cache_invalidate(*Cache, PathStr)
+    Removes the entries of PathStr, of anything inside PathStr and of the
+    parent directory of PathStr.
+
+stat_cache_process_events(*Cache[, err])
+    If Cache watches directories, processes pending filesystem events and
+    removes the affected entries. Does nothing otherwise.
+    Returns whether or not the function succeeded.
+
+stat_cache_get_counters(*Cache, *OutCounters)
+    Sets OutCounters to the counters of Cache.
+
+query_filesystem(PathStr, *Out, *Cache, FollowSymlinks = true, Flags = fs::query_flag_default[, err])
+query_filesystem(*Dir, Name, *Out, *Cache, FollowSymlinks = true, Flags = fs::query_flag_default[, err])
+    Same as query_filesystem without Cache, but returns the cached information
+    if PathStr (or Name inside the dir_handle Dir) is in Cache, still valid and
+    was queried with at least Flags. Otherwise queries the filesystem and
+    adds the result to Cache. Failed queries are not cached.
+
+get_filesystem_type(PathStr, *Out, *Cache, FollowSymlinks = true[, err])
+get_file_size(PathStr, *Out, *Cache, FollowSymlinks = true[, err])
+    Same as get_filesystem_type / get_file_size without Cache, using query_filesystem
+    with Cache.
+*/
+
+#pragma once
+
+#include "shl/hash_table.hpp"
+#include "fs/path.hpp"
+#include "fs/dir_handle.hpp"
+#include "fs/filesystem_watcher.hpp"
+#include "fs/impl/parallel.hpp"
+
+namespace fs
+{
+struct stat_cache_entry
+{
+    fs::path path; // owns the memory of the key of the entry
+    fs::filesystem_info info;
+    fs::query_flag flags;
+    s64 expires; // monotonic time in nanoseconds, 0 if it never expires
+};
+
+struct stat_cache_counters
+{
+    s64 hits;
+    s64 misses;
+    s64 invalidations;
+};
+
+struct stat_cache
+{
+    // [0] entries queried without following symlinks, [1] following symlinks
+    hash_table<fs::path, fs::stat_cache_entry> entries[2];
+    s64 time_to_live; // nanoseconds, 0 = entries never expire
+
+    fs::filesystem_watcher *watcher;
+    hash_table<fs::path, bool> watched_directories;
+
+    fs::stat_cache_counters counters;
+    fs::_mutex _lock;
+};
+
+void init(fs::stat_cache *cache);
+bool init(fs::stat_cache *cache, s64 time_to_live_ms, bool watch = false, error *err = nullptr);
+void free(fs::stat_cache *cache);
+
+void stat_cache_clear(fs::stat_cache *cache);
+
+void _stat_cache_invalidate(fs::stat_cache *cache, fs::const_fs_string pth);
+
+template<typename T>
+auto stat_cache_invalidate(fs::stat_cache *cache, T pth)
+    -> decltype(fs::_stat_cache_invalidate(cache, ::to_const_string(fs::get_platform_string(pth))))
+{
+    auto pth_str = fs::get_platform_string(pth);
+    fs::_stat_cache_invalidate(cache, ::to_const_string(pth_str));
+
+    if constexpr (needs_conversion(T))
+        fs::_free_platform_string(&pth_str);
+}
+
+bool stat_cache_process_events(fs::stat_cache *cache, error *err = nullptr);
+
+void stat_cache_get_counters(fs::stat_cache *cache, fs::stat_cache_counters *out);
+
+bool _query_filesystem(fs::const_fs_string pth, fs::filesystem_info *out, fs::stat_cache *cache, bool follow_symlinks, fs::query_flag flags, error *err);
+
+template<typename T>
+auto query_filesystem(T pth, fs::filesystem_info *out, fs::stat_cache *cache, bool follow_symlinks = true, fs::query_flag flags = fs::query_flag_default, error *err = nullptr)
+    define_fs_conversion_body(fs::_query_filesystem, pth, out, cache, follow_symlinks, flags, err)
+
+bool _query_filesystem(const fs::dir_handle *dir, fs::const_fs_string name, fs::filesystem_info *out, fs::stat_cache *cache, bool follow_symlinks, fs::query_flag flags, error *err);
+
+template<typename T>
+auto query_filesystem(const fs::dir_handle *dir, T name, fs::filesystem_info *out, fs::stat_cache *cache, bool follow_symlinks = true, fs::query_flag flags = fs::query_flag_default, error *err = nullptr)
+    define_dir_handle_conversion_body(fs::_query_filesystem, dir, name, out, cache, follow_symlinks, flags, err)
+
+bool _get_filesystem_type(fs::const_fs_string pth, fs::filesystem_type *out, fs::stat_cache *cache, bool follow_symlinks, error *err);
+
+template<typename T>
+auto get_filesystem_type(T pth, fs::filesystem_type *out, fs::stat_cache *cache, bool follow_symlinks = true, error *err = nullptr)
+    define_fs_conversion_body(fs::_get_filesystem_type, pth, out, cache, follow_symlinks, err)
+
+bool _get_file_size(fs::const_fs_string pth, s64 *out, fs::stat_cache *cache, bool follow_symlinks, error *err);
+
+template<typename T>
+auto get_file_size(T pth, s64 *out, fs::stat_cache *cache, bool follow_symlinks = true, error *err = nullptr)
+    define_fs_conversion_body(fs::_get_file_size, pth, out, cache, follow_symlinks, err)
+}
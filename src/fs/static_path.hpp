@@ -0,0 +1,530 @@
+
+/* static_path.hpp
+
+Paths known at compile time.
+Everything in here is constexpr, so paths built from string literals don't
+cost anything at runtime: no allocation, no normalization, no appending.
+
+Example usage:
+
+    using assets  = fs::static_path<"assets">;
+    using shaders = decltype(assets{} / fs::static_path<"shaders">{});
+
+    static_assert(fs::static_string_equal(shaders::filename, SYS_CHAR("shaders")));
+
+    // converts to fs::const_fs_string, no copy or conversion
+    fs::exists(shaders{});
+
+    // compile-time normalization
+    constexpr auto cfg = fs::static_normalize(fs::static_path<"config/../config/./app.toml">{});
+    static_assert(fs::static_string_equal(cfg.filename, SYS_CHAR("app.toml")));
+
+String literals may be narrow (UTF-8) literals or literals of the character type
+of paths (i.e. SYS_CHAR literals). On Windows, narrow literals are converted to
+UTF-16 at compile time.
+
+The functions behave exactly like their runtime counterparts in path.hpp
+(root, filename, file_extension, parent_path_segment, normalize, path_append
+and path_concat), see there and tests/path_tests.cpp for details.
+
+Types:
+
+static_path_string<N>
+    A fixed capacity string of N path characters (including the terminating
+    null character) that may be used in constant expressions and as template
+    argument.
+
+static_path<Str>
+    A path literal type, e.g. fs::static_path<"assets/shaders">.
+    Has the following static constexpr members, all views into the path:
+
+    value                 the path as fs::const_fs_string
+    root                  same as fs::root(value)
+    filename              same as fs::filename(value)
+    file_extension        same as fs::file_extension(value)
+    parent_path_segment   same as fs::parent_path_segment(value)
+
+    Converts to fs::const_fs_string and may be passed to all fs functions
+    that take a PathStr.
+
+Functions:
+
+static_root(ConstString)
+static_filename(ConstString)
+static_file_extension(ConstString)
+static_parent_path_segment(ConstString)
+    Constexpr versions of root, filename, file_extension and parent_path_segment.
+
+static_normalize(StaticPath)
+    Returns the normalized StaticPath as new static_path type.
+
+static_path_append(StaticPath1, StaticPath2)
+StaticPath1 / StaticPath2
+    Returns StaticPath2 appended to StaticPath1 as new static_path type,
+    see path_append.
+
+static_path_concat(StaticPath1, StaticPath2)
+    Returns StaticPath2 concatenated to StaticPath1 as new static_path type,
+    see path_concat.
+
+static_string_equal(ConstString1, ConstString2)
+    Constexpr string comparison, e.g. for static_assert.
+*/
+
+#pragma once
+
+#include "shl/string.hpp"
+#include "fs/common.hpp"
+#include "fs/convert.hpp"
+
+namespace fs
+{
+constexpr bool _static_is_separator(fs::path_char_t c)
+{
+#if Windows
+    return c == SYS_CHAR('\\') || c == SYS_CHAR('/');
+#else
+    return c == fs::path_separator;
+#endif
+}
+
+constexpr fs::const_fs_string _static_view(const fs::path_char_t *str, s64 size)
+{
+    return fs::const_fs_string{str, size};
+}
+
+template<s64 N>
+struct static_path_string
+{
+    static_assert(N > 0);
+
+    fs::path_char_t data[N];
+    s64 size;
+
+    constexpr static_path_string()
+        : data{}, size(0)
+    {}
+
+    template<typename C>
+    constexpr static_path_string(const C (&str)[N])
+        : data{}, size(0)
+    {
+        static_assert(sizeof(C) == sizeof(fs::path_char_t) || sizeof(C) == 1,
+                      "static_path literals must be UTF-8 or use the path character type");
+
+        if constexpr (sizeof(C) == sizeof(fs::path_char_t))
+        {
+            for (s64 i = 0; i < N - 1 && str[i] != 0; ++i)
+                data[size++] = (fs::path_char_t)str[i];
+        }
+        else
+        {
+            // UTF-8 to UTF-16, never produces more characters than bytes
+            for (s64 i = 0; i < N - 1 && str[i] != 0;)
+            {
+                u8 c = (u8)str[i];
+                u32 cp = c;
+                s64 len = 1;
+
+                if (c >= 0xf0)      { cp = c & 0x07; len = 4; }
+                else if (c >= 0xe0) { cp = c & 0x0f; len = 3; }
+                else if (c >= 0xc0) { cp = c & 0x1f; len = 2; }
+
+                for (s64 j = 1; j < len && i + j < N - 1; ++j)
+                    cp = (cp << 6) | ((u8)str[i + j] & 0x3f);
+
+                i += len;
+
+                if (cp >= 0x10000)
+                {
+                    cp -= 0x10000;
+                    data[size++] = (fs::path_char_t)(0xd800 + (cp >> 10));
+                    data[size++] = (fs::path_char_t)(0xdc00 + (cp & 0x3ff));
+                }
+                else
+                    data[size++] = (fs::path_char_t)cp;
+            }
+        }
+    }
+
+    constexpr operator fs::const_fs_string() const
+    {
+        return fs::_static_view(data, size);
+    }
+};
+
+template<typename C, s64 N>
+static_path_string(const C (&)[N]) -> static_path_string<N>;
+
+constexpr bool static_string_equal(fs::const_fs_string a, fs::const_fs_string b)
+{
+    if (a.size != b.size)
+        return false;
+
+    for (s64 i = 0; i < a.size; ++i)
+        if (a.c_str[i] != b.c_str[i])
+            return false;
+
+    return true;
+}
+
+template<s64 N>
+constexpr bool static_string_equal(fs::const_fs_string a, const fs::path_char_t (&b)[N])
+{
+    return fs::static_string_equal(a, fs::_static_view(b, N - 1));
+}
+
+#if Windows
+constexpr bool _static_is_alpha(fs::path_char_t c)
+{
+    return (c >= SYS_CHAR('a') && c <= SYS_CHAR('z'))
+        || (c >= SYS_CHAR('A') && c <= SYS_CHAR('Z'));
+}
+
+// see _parse_unc_segment in path.cpp
+constexpr bool _static_unc_segment(fs::const_fs_string pth, s64 start, s64 *seg_end)
+{
+    s64 i = start;
+
+    while (i < pth.size && !fs::_static_is_separator(pth.c_str[i]))
+        i++;
+
+    if (i == start)
+        return false;
+
+    *seg_end = i;
+    return true;
+}
+#endif
+
+constexpr fs::const_fs_string static_root(fs::const_fs_string pth)
+{
+#if Windows
+    // see fs::root in path.cpp, this is the same algorithm.
+    fs::const_fs_string empty = fs::_static_view(pth.c_str, 0);
+
+    if (pth.size == 0)
+        return empty;
+
+    if (pth.size == 1)
+        return fs::_static_is_separator(pth.c_str[0]) ? pth : empty;
+
+    if (fs::_static_is_separator(pth.c_str[0]) && !fs::_static_is_separator(pth.c_str[1]))
+        return fs::_static_view(pth.c_str, 1);
+
+    if (fs::_static_is_alpha(pth.c_str[0]) && pth.c_str[1] == SYS_CHAR(':'))
+    {
+        s64 i = 2;
+
+        if (i < pth.size && fs::_static_is_separator(pth.c_str[i]))
+            i += 1;
+
+        return fs::_static_view(pth.c_str, i);
+    }
+
+    if (!(fs::_static_is_separator(pth.c_str[0]) && fs::_static_is_separator(pth.c_str[1])))
+        return empty;
+
+    auto with_sep = [pth](s64 end) {
+        if (end < pth.size && fs::_static_is_separator(pth.c_str[end]))
+            end += 1;
+
+        return fs::_static_view(pth.c_str, end);
+    };
+
+    s64 end1 = 0;
+    s64 end2 = 0;
+    s64 offset = 2;
+
+    if (!fs::_static_unc_segment(pth, offset, &end1))
+        return fs::_static_view(pth.c_str, 1);
+
+    s64 seg1_start = offset;
+    offset = end1 + 1;
+
+    if (!fs::_static_unc_segment(pth, offset, &end2))
+        return with_sep(end1);
+
+    s64 seg2_start = offset;
+    s64 seg1_size = end1 - seg1_start;
+    bool special = seg1_size == 1
+                && (pth.c_str[seg1_start] == SYS_CHAR('.') || pth.c_str[seg1_start] == SYS_CHAR('?'));
+
+    if (!special)
+        return with_sep(end2);
+
+    if (!fs::static_string_equal(fs::_static_view(pth.c_str + seg2_start, end2 - seg2_start), SYS_CHAR("UNC")))
+        return with_sep(end2);
+
+    offset = end2 + 1;
+
+    if (!fs::_static_unc_segment(pth, offset, &end1))
+        return with_sep(end2);
+
+    offset = end1 + 1;
+
+    if (!fs::_static_unc_segment(pth, offset, &end2))
+        return with_sep(end1);
+
+    return with_sep(end2);
+#else
+    if (pth.size == 0 || pth.c_str[0] != fs::path_separator)
+        return fs::_static_view(pth.c_str, 0);
+
+    return fs::_static_view(pth.c_str, 1);
+#endif
+}
+
+constexpr fs::const_fs_string static_filename(fs::const_fs_string pth)
+{
+#if Windows
+    fs::const_fs_string rt = fs::static_root(pth);
+    pth = fs::_static_view(pth.c_str + rt.size, pth.size - rt.size);
+#endif
+
+    s64 found = pth.size - 1;
+
+    while (found >= 0 && pth.c_str[found] != fs::path_separator)
+        found--;
+
+#if Windows
+    if (found == -1)
+    {
+        found = pth.size - 1;
+
+        while (found >= 0 && pth.c_str[found] != SYS_CHAR('/'))
+            found--;
+    }
+#endif
+
+    found++;
+
+    return fs::_static_view(pth.c_str + found, pth.size - found);
+}
+
+constexpr fs::const_fs_string static_file_extension(fs::const_fs_string pth)
+{
+    fs::const_fs_string fname = fs::static_filename(pth);
+    fs::const_fs_string empty = fs::_static_view(fname.c_str + fname.size, 0);
+
+    if (fname.size == 0
+     || fs::static_string_equal(fname, SYS_CHAR("."))
+     || fs::static_string_equal(fname, SYS_CHAR("..")))
+        return empty;
+
+    for (s64 i = fname.size - 1; i >= 0; --i)
+        if (fname.c_str[i] == SYS_CHAR('.'))
+            return fs::_static_view(fname.c_str + i, fname.size - i);
+
+    return empty;
+}
+
+constexpr fs::const_fs_string static_parent_path_segment(fs::const_fs_string pth)
+{
+    s64 last_sep = pth.size - 1;
+
+    while (last_sep >= 0 && pth.c_str[last_sep] != fs::path_separator)
+        last_sep--;
+
+#if Windows
+    fs::const_fs_string rt = fs::static_root(pth);
+
+    if (last_sep == -1)
+    {
+        last_sep = pth.size - 1;
+
+        while (last_sep >= 0 && pth.c_str[last_sep] != SYS_CHAR('/'))
+            last_sep--;
+    }
+
+    // e.g. C: without separator
+    if (last_sep == -1)
+        return rt;
+    else if (last_sep < rt.size)
+        return rt;
+#else
+    if (last_sep == -1)
+        return fs::_static_view(pth.c_str, 0);
+
+    s64 first_sep = 0;
+
+    while (first_sep < pth.size && pth.c_str[first_sep] != fs::path_separator)
+        first_sep++;
+
+    if (first_sep == last_sep && first_sep == 0)
+        return fs::_static_view(pth.c_str, 1);
+#endif
+
+    return fs::_static_view(pth.c_str, last_sep);
+}
+
+template<s64 N>
+constexpr void _static_append_chars(fs::static_path_string<N> *out, fs::const_fs_string str)
+{
+    for (s64 i = 0; i < str.size; ++i)
+        out->data[out->size++] = str.c_str[i];
+}
+
+// see fs::normalize in path.cpp
+template<s64 N>
+constexpr fs::static_path_string<N> _static_normalize(const fs::static_path_string<N> &in)
+{
+    fs::static_path_string<N> out{};
+
+    if (in.size == 0)
+        return out;
+
+    fs::static_path_string<N> buf = in;
+
+#if Windows
+    for (s64 i = 0; i < buf.size; ++i)
+        if (buf.data[i] == SYS_CHAR('/'))
+            buf.data[i] = fs::path_separator;
+#endif
+
+    fs::const_fs_string src = buf;
+    fs::const_fs_string rt = fs::static_root(src);
+    fs::_static_append_chars(&out, rt);
+
+    const s64 base = out.size;
+    s64 segments = 0; // segments after root that may be removed by ..
+    s64 i = rt.size;
+
+    while (i < src.size)
+    {
+        while (i < src.size && fs::_static_is_separator(src.c_str[i]))
+            i++;
+
+        if (i >= src.size)
+            break;
+
+        s64 start = i;
+
+        while (i < src.size && !fs::_static_is_separator(src.c_str[i]))
+            i++;
+
+        fs::const_fs_string seg = fs::_static_view(src.c_str + start, i - start);
+
+        if (fs::static_string_equal(seg, SYS_CHAR(".")))
+            continue;
+
+        if (fs::static_string_equal(seg, SYS_CHAR("..")))
+        {
+            if (segments > 0)
+            {
+                s64 last = out.size - 1;
+
+                while (last >= base && !fs::_static_is_separator(out.data[last]))
+                    last--;
+
+                out.size = last >= base ? last : base;
+                segments -= 1;
+                continue;
+            }
+
+            // .. of the root is the root
+            if (rt.size > 0)
+                continue;
+        }
+        else
+            segments += 1;
+
+        if (out.size > base)
+            out.data[out.size++] = fs::path_separator;
+
+        fs::_static_append_chars(&out, seg);
+    }
+
+    if (out.size == 0)
+        out.data[out.size++] = SYS_CHAR('.');
+
+    for (s64 j = out.size; j < N; ++j)
+        out.data[j] = 0;
+
+    return out;
+}
+
+// see fs::path_append in path.cpp
+template<s64 N, s64 M>
+constexpr fs::static_path_string<N + M> _static_append(const fs::static_path_string<N> &a, const fs::static_path_string<M> &b)
+{
+    fs::static_path_string<N + M> out{};
+    fs::const_fs_string bv = b;
+
+    if (a.size == 0 || fs::static_root(bv).size > 0)
+    {
+        fs::_static_append_chars(&out, bv);
+        return out;
+    }
+
+    fs::_static_append_chars(&out, a);
+
+    if (b.size == 0)
+        return out;
+
+    bool a_sep = fs::_static_is_separator(a.data[a.size - 1]);
+    bool b_sep = fs::_static_is_separator(b.data[0]);
+
+    if (a_sep && b_sep)
+        bv = fs::_static_view(bv.c_str + 1, bv.size - 1);
+    else if (!a_sep && !b_sep)
+        out.data[out.size++] = fs::path_separator;
+
+    fs::_static_append_chars(&out, bv);
+    return out;
+}
+
+template<s64 N, s64 M>
+constexpr fs::static_path_string<N + M - 1> _static_concat(const fs::static_path_string<N> &a, const fs::static_path_string<M> &b)
+{
+    fs::static_path_string<N + M - 1> out{};
+    fs::_static_append_chars(&out, a);
+    fs::_static_append_chars(&out, b);
+    return out;
+}
+
+template<fs::static_path_string Str>
+struct static_path
+{
+    static constexpr auto string = Str;
+
+    static constexpr fs::const_fs_string value               = string;
+    static constexpr fs::const_fs_string root                = fs::static_root(value);
+    static constexpr fs::const_fs_string filename            = fs::static_filename(value);
+    static constexpr fs::const_fs_string file_extension      = fs::static_file_extension(value);
+    static constexpr fs::const_fs_string parent_path_segment = fs::static_parent_path_segment(value);
+
+    constexpr operator fs::const_fs_string() const
+    {
+        return value;
+    }
+};
+
+template<fs::static_path_string Str>
+constexpr auto static_normalize(fs::static_path<Str>)
+{
+    return fs::static_path<fs::_static_normalize(Str)>{};
+}
+
+template<fs::static_path_string Str1, fs::static_path_string Str2>
+constexpr auto static_path_append(fs::static_path<Str1>, fs::static_path<Str2>)
+{
+    return fs::static_path<fs::_static_append(Str1, Str2)>{};
+}
+
+template<fs::static_path_string Str1, fs::static_path_string Str2>
+constexpr auto operator/(fs::static_path<Str1> lhs, fs::static_path<Str2> rhs)
+{
+    return fs::static_path_append(lhs, rhs);
+}
+
+template<fs::static_path_string Str1, fs::static_path_string Str2>
+constexpr auto static_path_concat(fs::static_path<Str1>, fs::static_path<Str2>)
+{
+    return fs::static_path<fs::_static_concat(Str1, Str2)>{};
+}
+
+// static_path converts to fs::const_fs_string, which is already a platform string
+template<fs::static_path_string Str>
+struct _needs_conversion<fs::static_path<Str>> { static constexpr bool value = false; };
+}
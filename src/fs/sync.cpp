@@ -0,0 +1,564 @@
+#include "shl/assert.hpp"
+#include "shl/memory.hpp"
+#include "shl/defer.hpp"
+#include "shl/sort.hpp"
+#include "fs/sync.hpp"
+#include "fs/operation_control.hpp"
+#include "fs/impl/read.hpp"
+
+#include <stdlib.h>
+#include <string.h> // memcmp
+
+#if Windows
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+// with sync_option::CompareContents, files are compared in chunks of this size
+#define SYNC_COMPARE_BUFFER_SIZE (256ll << 10)
+
+struct _sync_entry
+{
+    fs::path name;
+    fs::filesystem_type type;
+};
+
+// what decides whether a file changed, without CompareContents
+struct _sync_stamp
+{
+    s64 size;
+#if Windows
+    u64 last_write_time;
+#else
+    fs::filesystem_timestamp mtime;
+#endif
+};
+
+struct _sync_context
+{
+    fs::sync_option opts;
+    fs::sync_stats *stats;
+    fs::operation_control *control;
+
+    // the entries being synced, names of children are appended and removed
+    // again while walking.
+    fs::path from;
+    fs::path to;
+
+    u8 *buffer; // 2 * SYNC_COMPARE_BUFFER_SIZE, allocated on first compare
+};
+
+static inline u32 _name_char(fs::path_char_t c)
+{
+    u32 ret;
+
+    if constexpr (sizeof(fs::path_char_t) == 1)
+        ret = (u8)c;
+    else
+        ret = (u32)c;
+
+#if Windows
+    // names differing only in case are the same entry
+    if (ret >= 'A' && ret <= 'Z')
+        ret += 'a' - 'A';
+#endif
+
+    return ret;
+}
+
+static int _compare_names(fs::const_fs_string a, fs::const_fs_string b)
+{
+    s64 size = a.size < b.size ? a.size : b.size;
+
+    for (s64 i = 0; i < size; ++i)
+    {
+        u32 ca = _name_char(a.c_str[i]);
+        u32 cb = _name_char(b.c_str[i]);
+
+        if (ca != cb)
+            return ca < cb ? -1 : 1;
+    }
+
+    if (a.size == b.size)
+        return 0;
+
+    return a.size < b.size ? -1 : 1;
+}
+
+static int _compare_entries(const _sync_entry *a, const _sync_entry *b)
+{
+    return _compare_names(to_const_string(&a->name), to_const_string(&b->name));
+}
+
+static inline void _truncate(fs::path *pth, s64 size)
+{
+    pth->size = size;
+    pth->data[size] = PC_NUL;
+}
+
+static void _free_entries(array<_sync_entry> *entries)
+{
+    for_array(e, entries)
+        fs::free(&e->name);
+
+    ::free(entries);
+}
+
+// the children of dir, sorted by name
+static bool _list_entries(fs::path *dir, array<_sync_entry> *out, error *err)
+{
+    error _err{};
+
+    for_path(item, to_const_string(dir), fs::iterate_option::StopOnError | fs::iterate_option::QueryType, &_err)
+    {
+        _sync_entry *e = ::add_at_end(out);
+        fs::init(&e->name);
+        fs::path_set(&e->name, item->path);
+        e->type = item->type;
+    }
+
+    if (_err.error_code != 0)
+    {
+        if (err != nullptr)
+            *err = _err;
+
+        return false;
+    }
+
+    // some filesystems don't have the types in directory entries
+    s64 dir_size = dir->size;
+
+    for_array(e, out)
+    {
+        if (e->type != fs::filesystem_type::Unknown)
+            continue;
+
+        fs::path_append(dir, &e->name);
+        bool ok = fs::_get_filesystem_type(to_const_string(dir), &e->type, false, err);
+        _truncate(dir, dir_size);
+
+        if (!ok)
+            return false;
+    }
+
+    ::sort(out->data, out->size, _compare_entries);
+    return true;
+}
+
+static bool _get_stamp(const fs::path *pth, _sync_stamp *out, error *err)
+{
+    fs::filesystem_info info;
+
+#if Windows
+    if (!fs::_get_file_size(to_const_string(pth), &out->size, false, err))
+        return false;
+
+    if (!fs::_query_filesystem(to_const_string(pth), &info, false, fs::query_flag::FileTimes, err))
+        return false;
+
+    out->last_write_time = info.detail.file_times.last_write_time;
+#else
+    if (!fs::_query_filesystem(to_const_string(pth), &info, false, fs::query_flag::Size | fs::query_flag::FileTimes, err))
+        return false;
+
+    out->size = (s64)info.stx_size;
+    out->mtime = info.stx_mtime;
+#endif
+
+    return true;
+}
+
+static bool _same_time(const _sync_stamp *a, const _sync_stamp *b)
+{
+#if Windows
+    return a->last_write_time == b->last_write_time;
+#else
+    return a->mtime.tv_sec == b->mtime.tv_sec
+        && a->mtime.tv_nsec == b->mtime.tv_nsec;
+#endif
+}
+
+static bool _set_modification_time(const fs::path *pth, const _sync_stamp *stamp, error *err)
+{
+#if Windows
+    HANDLE h = CreateFile((const sys_native_char*)pth->data,
+                          FILE_WRITE_ATTRIBUTES,
+                          FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE,
+                          nullptr,
+                          OPEN_EXISTING,
+                          FILE_ATTRIBUTE_NORMAL,
+                          nullptr);
+
+    if (h == INVALID_HANDLE_VALUE)
+    {
+        set_GetLastError_error(err);
+        return false;
+    }
+
+    defer { CloseHandle(h); };
+
+    FILETIME mtime;
+    mtime.dwLowDateTime = (DWORD)(stamp->last_write_time & 0xffffffff);
+    mtime.dwHighDateTime = (DWORD)(stamp->last_write_time >> 32);
+
+    if (!SetFileTime(h, nullptr, nullptr, &mtime))
+    {
+        set_GetLastError_error(err);
+        return false;
+    }
+#else
+    timespec times[2];
+    times[0].tv_sec = 0;
+    times[0].tv_nsec = UTIME_OMIT; // access time
+    times[1].tv_sec = (time_t)stamp->mtime.tv_sec;
+    times[1].tv_nsec = (long)stamp->mtime.tv_nsec;
+
+    if (utimensat(AT_FDCWD, pth->data, times, AT_SYMLINK_NOFOLLOW) != 0)
+    {
+        set_error_by_code(err, errno);
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+static bool _same_contents(_sync_context *ctx, bool *out, error *err)
+{
+    if (ctx->buffer == nullptr)
+    {
+        ctx->buffer = (u8*)::malloc(2 * SYNC_COMPARE_BUFFER_SIZE);
+
+        if (ctx->buffer == nullptr)
+        {
+#if Windows
+            set_error_by_code(err, ERROR_NOT_ENOUGH_MEMORY);
+#else
+            set_error_by_code(err, ENOMEM);
+#endif
+            return false;
+        }
+    }
+
+    fs::_read_handle from_file = _invalid_read_handle;
+    fs::_read_handle to_file = _invalid_read_handle;
+
+    defer { fs::_close_read(from_file); fs::_close_read(to_file); };
+
+    if (!fs::_open_read(to_const_string(&ctx->from), &from_file, err)
+     || !fs::_open_read(to_const_string(&ctx->to), &to_file, err))
+        return false;
+
+    u8 *from_buf = ctx->buffer;
+    u8 *to_buf = ctx->buffer + SYNC_COMPARE_BUFFER_SIZE;
+
+    while (true)
+    {
+        s64 from_read = 0;
+        s64 to_read = 0;
+
+        if (!fs::_read_full(from_file, from_buf, SYNC_COMPARE_BUFFER_SIZE, &from_read, err)
+         || !fs::_read_full(to_file, to_buf, SYNC_COMPARE_BUFFER_SIZE, &to_read, err))
+            return false;
+
+        if (from_read != to_read || memcmp(from_buf, to_buf, (size_t)from_read) != 0)
+        {
+            *out = false;
+            return true;
+        }
+
+        if (from_read < SYNC_COMPARE_BUFFER_SIZE)
+        {
+            *out = true;
+            return true;
+        }
+
+        if (!fs::_operation_check(ctx->control, err))
+            return false;
+    }
+}
+
+// removes ctx->to
+static bool _sync_remove(_sync_context *ctx, fs::filesystem_type type, error *err)
+{
+    bool ok;
+
+    if (type == fs::filesystem_type::Directory)
+        ok = fs::_remove_directory(to_const_string(&ctx->to), ctx->control, err);
+    else
+        ok = fs::_remove(to_const_string(&ctx->to), err);
+
+    if (!ok)
+        return false;
+
+    ctx->stats->entries_removed += 1;
+    return true;
+}
+
+static bool _sync_file(_sync_context *ctx, bool to_exists, error *err)
+{
+    // the stamp is taken before copying, if the source is modified while
+    // copying, the next sync copies it again.
+    _sync_stamp from_stamp;
+
+    if (!_get_stamp(&ctx->from, &from_stamp, err))
+        return false;
+
+    if (to_exists)
+    {
+        _sync_stamp to_stamp;
+
+        if (!_get_stamp(&ctx->to, &to_stamp, err))
+            return false;
+
+        if (from_stamp.size == to_stamp.size)
+        {
+            if (!is_flag_set(ctx->opts, fs::sync_option::CompareContents))
+            {
+                if (_same_time(&from_stamp, &to_stamp))
+                {
+                    ctx->stats->files_skipped += 1;
+                    return true;
+                }
+            }
+            else
+            {
+                bool same = false;
+
+                if (!_same_contents(ctx, &same, err))
+                    return false;
+
+                if (same)
+                {
+                    ctx->stats->files_skipped += 1;
+
+                    if (_same_time(&from_stamp, &to_stamp))
+                        return true;
+
+                    return _set_modification_time(&ctx->to, &from_stamp, err);
+                }
+            }
+        }
+    }
+
+    fs::copy_file_info info;
+
+    if (!fs::_copy_file(to_const_string(&ctx->from), to_const_string(&ctx->to), fs::copy_file_option::OverwriteExisting, &info, fs::copy_file_flag::None, ctx->control, err))
+        return false;
+
+    ctx->stats->files_copied += 1;
+    ctx->stats->bytes_copied += info.bytes_copied;
+
+    return _set_modification_time(&ctx->to, &from_stamp, err);
+}
+
+static bool _sync_symlink(_sync_context *ctx, bool to_exists, error *err)
+{
+    fs::path target{};
+    defer { fs::free(&target); };
+
+    if (!fs::_get_symlink_target(to_const_string(&ctx->from), &target, err))
+        return false;
+
+    if (to_exists)
+    {
+        fs::path to_target{};
+        defer { fs::free(&to_target); };
+
+        if (!fs::_get_symlink_target(to_const_string(&ctx->to), &to_target, err))
+            return false;
+
+        if (target == to_target)
+        {
+            ctx->stats->files_skipped += 1;
+            return true;
+        }
+
+        if (!fs::_remove_symlink(to_const_string(&ctx->to), err))
+            return false;
+    }
+
+    if (!fs::_create_symlink(to_const_string(&target), to_const_string(&ctx->to), err))
+        return false;
+
+    ctx->stats->files_copied += 1;
+    return true;
+}
+
+static bool _sync_directories(_sync_context *ctx, bool to_created, error *err);
+
+// from and to are the entries of ctx->from and ctx->to, either may be nullptr
+static bool _sync_entries(_sync_context *ctx, const _sync_entry *from, const _sync_entry *to, error *err)
+{
+    if (from == nullptr)
+    {
+        if (!is_flag_set(ctx->opts, fs::sync_option::Prune))
+            return true;
+
+        return _sync_remove(ctx, to->type, err);
+    }
+
+    if (from->type != fs::filesystem_type::File
+     && from->type != fs::filesystem_type::Directory
+     && from->type != fs::filesystem_type::Symlink)
+        return true;
+
+    if (to != nullptr && to->type != from->type)
+    {
+        if (!_sync_remove(ctx, to->type, err))
+            return false;
+
+        to = nullptr;
+    }
+
+    if (from->type == fs::filesystem_type::File)
+        return _sync_file(ctx, to != nullptr, err);
+
+    if (from->type == fs::filesystem_type::Symlink)
+        return _sync_symlink(ctx, to != nullptr, err);
+
+    if (to != nullptr)
+        return _sync_directories(ctx, false, err);
+
+    fs::permission perms = fs::permission::All;
+
+#if Linux
+    if (!fs::_get_permissions(to_const_string(&ctx->from), &perms, false, err))
+        return false;
+#endif
+
+    if (!fs::_create_directory(to_const_string(&ctx->to), perms, err))
+        return false;
+
+    ctx->stats->directories_created += 1;
+    return _sync_directories(ctx, true, err);
+}
+
+// merges the sorted listings of the directories ctx->from and ctx->to
+static bool _sync_directories(_sync_context *ctx, bool to_created, error *err)
+{
+    array<_sync_entry> from_entries{};
+    array<_sync_entry> to_entries{};
+
+    defer { _free_entries(&from_entries); _free_entries(&to_entries); };
+
+    if (!_list_entries(&ctx->from, &from_entries, err))
+        return false;
+
+    // a directory that was just created is empty
+    if (!to_created && !_list_entries(&ctx->to, &to_entries, err))
+        return false;
+
+    s64 from_size = ctx->from.size;
+    s64 to_size = ctx->to.size;
+    s64 i = 0;
+    s64 j = 0;
+
+    while (i < from_entries.size || j < to_entries.size)
+    {
+        if (!fs::_operation_check(ctx->control, err))
+            return false;
+
+        int cmp = 0;
+
+        if (i >= from_entries.size)
+            cmp = 1;
+        else if (j >= to_entries.size)
+            cmp = -1;
+        else
+            cmp = _compare_entries(from_entries.data + i, to_entries.data + j);
+
+        const _sync_entry *from = (cmp <= 0) ? from_entries.data + i++ : nullptr;
+        const _sync_entry *to   = (cmp >= 0) ? to_entries.data + j++ : nullptr;
+        const fs::path *name = (from != nullptr) ? &from->name : &to->name;
+
+        fs::path_append(&ctx->from, name);
+        fs::path_append(&ctx->to, name);
+
+        bool ok = _sync_entries(ctx, from, to, err);
+
+        _truncate(&ctx->from, from_size);
+        _truncate(&ctx->to, to_size);
+
+        if (!ok)
+            return false;
+    }
+
+    return true;
+}
+
+bool fs::_sync_directory(fs::const_fs_string from, fs::const_fs_string to, fs::sync_option opts, fs::sync_stats *stats, fs::operation_control *control, error *err)
+{
+    fs::sync_stats _stats;
+
+    if (stats == nullptr)
+        stats = &_stats;
+
+    fill_memory(stats, 0);
+
+    fs::filesystem_type from_type;
+
+    if (!fs::_get_filesystem_type(from, &from_type, true, err))
+        return false;
+
+    if (from_type != fs::filesystem_type::Directory)
+    {
+#if Windows
+        set_error_by_code(err, ERROR_DIRECTORY);
+#else
+        set_error_by_code(err, ENOTDIR);
+#endif
+        return false;
+    }
+
+    fs::permission perms = fs::permission::All;
+
+#if Linux
+    if (!fs::_get_permissions(from, &perms, true, err))
+        return false;
+#endif
+
+    // fails if to exists and is not a directory
+    error _err{};
+
+    if (!fs::_create_directory(to, perms, &_err))
+    {
+        if (err != nullptr)
+            *err = _err;
+
+        return false;
+    }
+
+#if Windows
+    bool to_created = _err.error_code != ERROR_ALREADY_EXISTS;
+#else
+    bool to_created = _err.error_code != EEXIST;
+#endif
+
+    if (to_created)
+        stats->directories_created += 1;
+
+    _sync_context ctx;
+    ctx.opts = opts;
+    ctx.stats = stats;
+    ctx.control = control;
+    ctx.buffer = nullptr;
+    fs::init(&ctx.from);
+    fs::init(&ctx.to);
+    fs::path_set(&ctx.from, from);
+    fs::path_set(&ctx.to, to);
+
+    defer
+    {
+        fs::free(&ctx.from);
+        fs::free(&ctx.to);
+
+        if (ctx.buffer != nullptr)
+            ::free(ctx.buffer);
+    };
+
+    return _sync_directories(&ctx, to_created, err);
+}
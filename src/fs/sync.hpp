@@ -0,0 +1,113 @@
+
+/* sync.hpp
+
+Incremental mirroring of directories: makes a destination directory the same
+as a source directory, copying only what changed since the last sync.
+
+Example usage:
+
+    fs::sync_stats stats{};
+
+    if (!fs::sync_directory(from, to, fs::sync_option::Prune, &stats, &err))
+        ...
+
+    printf("%lld copied, %lld unchanged, %lld removed\n",
+           stats.files_copied, stats.files_skipped, stats.entries_removed);
+
+Each directory of the source and the corresponding directory of the
+destination are listed once, the listings are sorted by name and merged in
+a single pass:
+
+    - entries only in the source are copied (directories are created and
+      synced recursively).
+    - entries only in the destination are removed with sync_option::Prune,
+      and left alone otherwise.
+    - entries with the same name but different types (e.g. a file in the
+      source, a directory in the destination) are replaced by the source.
+    - files in both are unchanged if they have the same size and modification
+      time, or, with sync_option::CompareContents, the same size and contents.
+      Unchanged files are not opened (without CompareContents) or written.
+
+Copied files get the modification time of their source, so they are unchanged
+in the next sync. Symlinks are recreated as symlinks with the same target,
+not followed. Other entries (pipes, sockets, devices) of the source are
+ignored.
+Names are compared bytewise, on Windows ignoring the case of ASCII letters.
+
+Files are copied with copy_file, see fs/impl/copy.hpp, and sync_directory stops
+at the first error, leaving the destination partially synced. Syncing again
+continues where it stopped.
+
+Types:
+
+enum class sync_option
+    Bitmask flags of sync_directory:
+
+    None:            Copies new and changed entries, compares files by size
+                     and modification time.
+    Prune:           Removes entries of the destination which are not in the
+                     source.
+    CompareContents: Compares files of the same size by their contents instead
+                     of their modification times, e.g. when the modification
+                     times of the destination were not kept. Unchanged files
+                     with different modification times get the modification
+                     time of the source.
+
+struct sync_stats
+    files_copied:        number of files (and symlinks) copied.
+    files_skipped:       number of unchanged files.
+    bytes_copied:        number of bytes copied.
+    directories_created: number of directories created in the destination.
+    entries_removed:     number of entries removed from the destination,
+                         a removed directory counts once.
+
+Functions:
+
+sync_directory(FromPathStr, ToPathStr, Options = fs::sync_option::None[, *OutStats][, *Control][, *err])
+    Syncs the directory ToPathStr with the directory FromPathStr, creating
+    ToPathStr (not its parents) if it does not exist.
+    OutStats, if given, is set to what was done, also when the function fails.
+    If Control is given, reports the copied files to Control and stops when
+    Control is cancelled, see fs/operation_control.hpp.
+    Returns whether or not the function succeeded.
+*/
+
+#pragma once
+
+#include "shl/enum_flag.hpp"
+#include "fs/path.hpp"
+
+namespace fs
+{
+enum class sync_option : u8
+{
+    None            = 0x00,
+    Prune           = 0x01, // removes entries of the destination not in the source.
+    CompareContents = 0x02, // compares contents instead of modification times.
+};
+
+enum_flag(sync_option);
+
+struct sync_stats
+{
+    s64 files_copied;
+    s64 files_skipped;
+    s64 bytes_copied;
+    s64 directories_created;
+    s64 entries_removed;
+};
+
+bool _sync_directory(fs::const_fs_string from, fs::const_fs_string to, fs::sync_option opts, fs::sync_stats *stats, fs::operation_control *control, error *err);
+
+template<typename T1, typename T2>
+auto sync_directory(T1 from, T2 to, fs::sync_option opts = fs::sync_option::None, error *err = nullptr)
+    define_fs_conversion_body2(fs::_sync_directory, from, to, opts, nullptr, nullptr, err)
+
+template<typename T1, typename T2>
+auto sync_directory(T1 from, T2 to, fs::sync_option opts, fs::sync_stats *stats, error *err = nullptr)
+    define_fs_conversion_body2(fs::_sync_directory, from, to, opts, stats, nullptr, err)
+
+template<typename T1, typename T2>
+auto sync_directory(T1 from, T2 to, fs::sync_option opts, fs::sync_stats *stats, fs::operation_control *control, error *err = nullptr)
+    define_fs_conversion_body2(fs::_sync_directory, from, to, opts, stats, control, err)
+}
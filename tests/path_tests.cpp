@@ -6,6 +6,10 @@
 #if Linux
 #include <sys/stat.h> // umask
 #include <errno.h>
+#include <stdio.h> // fopen, for file contents
+#include <fcntl.h> // open, O_DIRECT
+#include <unistd.h>
+#include <stdlib.h> // posix_memalign
 
 #define _ignore_return_value2(Name) [[maybe_unused]] auto _##Name = 
 #define _ignore_return_value(Name) _ignore_return_value2(Name)
@@ -19,6 +23,16 @@
 #include "shl/print.hpp"
 #include "shl/sort.hpp"
 #include "fs/path.hpp"
+#include "fs/resolve_cache.hpp"
+#include "fs/stat_cache.hpp"
+#include "fs/negative_cache.hpp"
+#include "fs/path_template.hpp"
+#include "fs/dir_handle.hpp"
+#include "fs/operation_control.hpp"
+#include "fs/sync.hpp"
+#include "fs/static_path.hpp"
+#include "fs/impl/scan.hpp"
+#include "fs/impl/crc32c.hpp"
 
 int path_comparer(const fs::path *a, const fs::path *b)
 {
@@ -88,6 +102,56 @@ define_test(path_new_creates_path_new_resolves_environment_variables)
     fs::free(&pth);
 }
 
+define_test(path_new_with_variable_cache_uses_cached_values)
+{
+    fs::variable_cache vars{};
+    fs::init(&vars);
+
+    fs::path pth{};
+    fs::path_template tmpl{};
+    fs::init(&tmpl);
+
+    defer { fs::free(&pth); fs::free(&tmpl); fs::free(&vars); };
+
+    ::set_environment_variable(SYS_CHAR("MYCACHEDVAR"), SYS_CHAR("first"));
+    pth = fs::path_new("$MYCACHEDVAR/abc/$", &vars);
+    assert_equal_str(pth, SYS_CHAR("first/abc/$"));
+    fs::free(&pth);
+
+    // the value is a snapshot until invalidated
+    ::set_environment_variable(SYS_CHAR("MYCACHEDVAR"), SYS_CHAR("second"));
+    pth = fs::path_new("$MYCACHEDVAR/abc/$", &vars);
+    assert_equal_str(pth, SYS_CHAR("first/abc/$"));
+    fs::free(&pth);
+
+    fs::variable_cache_invalidate(&vars, "MYCACHEDVAR");
+    pth = fs::path_new("$MYCACHEDVAR/abc/$", &vars);
+    assert_equal_str(pth, SYS_CHAR("second/abc/$"));
+
+    // same as path_new without cache
+    fs::path uncached = fs::path_new("$MYCACHEDVAR/abc/$");
+    assert_equal(pth == uncached, true);
+    fs::free(&uncached);
+
+    // custom variables take precedence and survive invalidation
+    fs::path_template_compile("x/$MYCACHEDVAR.$MYCUSTOMVAR_2", &tmpl);
+    assert_equal(tmpl.segments.size, 4);
+
+    fs::variable_cache_set(&vars, "MYCUSTOMVAR_2", "txt");
+    fs::variable_cache_invalidate(&vars);
+    fs::path_template_expand(&tmpl, &vars, &pth);
+    assert_equal_str(pth, SYS_CHAR("x/second.txt"));
+
+    fs::variable_cache_set(&vars, "MYCACHEDVAR", "custom");
+    fs::variable_cache_invalidate(&vars, "MYCACHEDVAR");
+    fs::path_template_expand(&tmpl, &vars, &pth);
+    assert_equal_str(pth, SYS_CHAR("x/custom.txt"));
+
+    fs::variable_cache_unset(&vars, "MYCACHEDVAR");
+    fs::path_template_expand(&tmpl, &vars, &pth);
+    assert_equal_str(pth, SYS_CHAR("x/second.txt"));
+}
+
 define_test(is_fs_type_tests)
 {
     fs::path p{};
@@ -367,6 +431,85 @@ define_test(exists_returns_false_when_not_exists)
     fs::free(&p);
 }
 
+define_test(exists_many_checks_all_paths)
+{
+    const sys_char *inputs[] = {
+        SANDBOX_TEST_DIR,
+        SANDBOX_TEST_FILE,
+        SANDBOX_TEST_SYMLINK,
+        SANDBOX_TEST_SYMLINK_NO_TARGET,
+        SANDBOX_DIR SYS_CHAR("/does_not_exist"),
+        SANDBOX_DIR SYS_CHAR("/does_not_exist/abc"),
+        SANDBOX_TEST_DIR2 SYS_CHAR("/.."),
+        SANDBOX_TEST_FILE2
+    };
+    const s64 input_count = sizeof(inputs) / sizeof(inputs[0]);
+
+    // enough paths per directory to list the directories
+    array<fs::path> paths{};
+    array<int> out{};
+
+    for (s64 i = 0; i < 100; ++i)
+    {
+        fs::path *p = ::add_at_end(&paths);
+        *p = fs::path{};
+        fs::path_set(p, inputs[i % input_count]);
+    }
+
+    for (int follow = 0; follow < 2; ++follow)
+    {
+        assert_equal(fs::exists_many(&paths, &out, follow == 1), true);
+        assert_equal(out.size, paths.size);
+
+        for (s64 i = 0; i < paths.size; ++i)
+            assert_equal(out[i], fs::exists(paths.data + i, follow == 1));
+    }
+
+    assert_equal(out[0], 1);
+    assert_equal(out[3], 0);
+    assert_equal(out[4], 0);
+    assert_equal(out[5], 0);
+
+    for_array(p, &paths) fs::free(p);
+    ::free(&paths);
+    ::free(&out);
+}
+
+#if Linux
+define_test(exists_many_checks_paths_in_unsearchable_directories_like_exists)
+{
+    // readable, so it can be listed, but not searchable
+    fs::create_directory(SANDBOX_DIR "/exists_many_r");
+
+    array<fs::path> paths{};
+    array<int> out{};
+
+    for (s64 i = 0; i < 20; ++i)
+    {
+        fs::path *p = ::add_at_end(&paths);
+        *p = fs::path{};
+        fs::path_set(p, (i % 2 == 0) ? SANDBOX_DIR "/exists_many_r/file1" : SANDBOX_DIR "/exists_many_r/file2");
+        fs::touch(p);
+    }
+
+    assert_equal(fs::set_permissions(SANDBOX_DIR "/exists_many_r", fs::permission::UserRead), true);
+
+    fs::exists_many(&paths, &out);
+    assert_equal(out.size, paths.size);
+
+    // -1 with EACCES, unless running as root
+    for (s64 i = 0; i < paths.size; ++i)
+        assert_equal(out[i], fs::exists(paths.data + i));
+
+    fs::set_permissions(SANDBOX_DIR "/exists_many_r", fs::permission::User);
+    fs::remove(SANDBOX_DIR "/exists_many_r");
+
+    for_array(p, &paths) fs::free(p);
+    ::free(&paths);
+    ::free(&out);
+}
+#endif
+
 define_test(exists_yields_error_when_unauthorized)
 {
     fs::path p{};
@@ -534,6 +677,96 @@ define_test(are_equivalent_returns_false_if_only_one_path_doesnt_exist)
     fs::free(&p2);
 }
 
+define_test(scan_implementations_find_the_same_characters)
+{
+    const fs::scan_implementation original = fs::get_scan_implementation();
+    const fs::scan_implementation impls[] = {fs::scan_implementation::Scalar,
+                                             fs::scan_implementation::SSE2,
+                                             fs::scan_implementation::AVX2};
+
+    // long enough to cover the vector loops and the scalar tails
+    fs::path_char_t str[100];
+
+    for (s64 size = 0; size < 100; ++size)
+    for (s64 pos = -1; pos < size; ++pos)
+    {
+        for (s64 i = 0; i < size; ++i)
+            str[i] = SYS_CHAR('a');
+
+        if (pos >= 0)
+            str[pos] = SYS_CHAR('/');
+
+        for (auto impl : impls)
+        {
+            if (!fs::set_scan_implementation(impl))
+                continue;
+
+            assert_equal(fs::_scan_first(str, size, SYS_CHAR('/')), pos);
+            assert_equal(fs::_scan_last(str, size, SYS_CHAR('/')), pos);
+
+            if (pos >= 0 && pos + 1 < size)
+            {
+                str[size - 1] = SYS_CHAR('/');
+                assert_equal(fs::_scan_first(str, size, SYS_CHAR('/')), pos);
+                assert_equal(fs::_scan_last(str, size, SYS_CHAR('/')), size - 1);
+                str[size - 1] = SYS_CHAR('a');
+            }
+        }
+    }
+
+    fs::set_scan_implementation(original);
+}
+
+define_test(crc32c_implementations_compute_the_same_checksum)
+{
+    const fs::crc32c_implementation original = fs::get_crc32c_implementation();
+    const fs::crc32c_implementation impls[] = {fs::crc32c_implementation::Scalar,
+                                               fs::crc32c_implementation::SSE42,
+                                               fs::crc32c_implementation::ARMv8};
+
+    u8 data[100];
+
+    for (s64 i = 0; i < 100; ++i)
+        data[i] = (u8)(i * 31 + 7);
+
+    fs::set_crc32c_implementation(fs::crc32c_implementation::Scalar);
+    u32 expected = fs::_crc32c(0, data, 100);
+
+    for (auto impl : impls)
+    {
+        if (!fs::set_crc32c_implementation(impl))
+            continue;
+
+        assert_equal(fs::_crc32c(0, "123456789", 9), 0xe3069283u);
+        assert_equal(fs::_crc32c(0, data, 0), 0u);
+
+        // in pieces, including unaligned pieces shorter than 8 bytes
+        for (s64 split = 0; split <= 100; ++split)
+            assert_equal(fs::_crc32c(fs::_crc32c(0, data, split), data + split, 100 - split), expected);
+    }
+
+    fs::set_crc32c_implementation(original);
+}
+
+define_test(crc32c_zeros_is_the_checksum_of_zero_bytes)
+{
+    u8 zeros[10000] = {};
+    const u32 crcs[] = {0u, 0xe3069283u, 0x12345678u};
+    const s64 sizes[] = {0, 1, 7, 8, 9, 4095, 4096, 4097, 10000};
+
+    for (u32 crc : crcs)
+    for (s64 size : sizes)
+        assert_equal(fs::_crc32c_zeros(crc, size), fs::_crc32c(crc, zeros, size));
+
+    // more than fits in the buffer
+    u32 expected = 0x12345678u;
+
+    for (int i = 0; i < 1000; ++i)
+        expected = fs::_crc32c(expected, zeros, 10000);
+
+    assert_equal(fs::_crc32c_zeros(0x12345678u, 10000000), expected);
+}
+
 define_test(filename_returns_the_filename)
 {
 #if Windows
@@ -807,6 +1040,53 @@ define_test(path_segments_gets_the_segments_of_a_path)
     ::free(&segs);
 }
 
+define_test(for_path_segment_iterates_the_segments_of_a_path)
+{
+    fs::path p{};
+    const sys_char *expected[] = {SYS_CHAR("/"), SYS_CHAR("foo"), SYS_CHAR("bar"), SYS_CHAR("file.txt")};
+    s64 i = 0;
+
+    // repeated and trailing separators do not yield empty segments
+    fs::path_set(&p, "/foo//bar/file.txt/");
+
+    for_path_segment(seg, &p)
+    {
+        assert_equal_str(*seg, expected[i]);
+        i += 1;
+    }
+
+    assert_equal(i, 4);
+
+    for_path_segment_reverse(seg, &p)
+    {
+        i -= 1;
+        assert_equal_str(*seg, expected[i]);
+    }
+
+    assert_equal(i, 0);
+
+    // relative path, no root
+    fs::path_set(&p, "a/b");
+
+    for_path_segment_reverse(seg, &p)
+    {
+        assert_equal_str(*seg, i == 0 ? SYS_CHAR("b") : SYS_CHAR("a"));
+        i += 1;
+    }
+
+    assert_equal(i, 2);
+
+    fs::path_set(&p, "");
+
+    for_path_segment(seg, &p)
+        assert_equal(true, false);
+
+    for_path_segment_reverse(seg, &p)
+        assert_equal(true, false);
+
+    fs::free(&p);
+}
+
 define_test(root_returns_the_path_root)
 {
     fs::path p{};
@@ -1141,6 +1421,40 @@ define_test(normalize_normalizes_path)
     fs::free(&p);
 }
 
+define_test(static_path_matches_runtime_path_functions)
+{
+    using usr      = fs::static_path<"/usr/./lib/../lib/">;
+    using libc     = decltype(fs::static_normalize(usr{}) / fs::static_path<"libc.so.6">{});
+    using relative = decltype(fs::static_normalize(fs::static_path<"a/b/../../..">{}));
+
+    static_assert(fs::static_string_equal(libc::filename, SYS_CHAR("libc.so.6")));
+    static_assert(fs::static_string_equal(libc::file_extension, SYS_CHAR(".6")));
+    static_assert(fs::static_string_equal(relative::value, SYS_CHAR("..")));
+
+    fs::path p{};
+
+    // same results as the runtime functions
+    fs::path_set(&p, usr{});
+    fs::normalize(&p);
+    fs::path_append(&p, "libc.so.6");
+    assert_equal_str(p, libc::value);
+
+    assert_equal_str(fs::root(&p), libc::root);
+    assert_equal_str(fs::filename(&p), libc::filename);
+    assert_equal_str(fs::file_extension(&p), libc::file_extension);
+    assert_equal_str(fs::parent_path_segment(&p), libc::parent_path_segment);
+
+    fs::path_set(&p, "a/b/../../..");
+    fs::normalize(&p);
+    assert_equal_str(p, relative::value);
+
+    // static paths can be passed to fs functions without conversion
+    assert_equal(fs::is_absolute(libc{}), true);
+    assert_equal(fs::exists(fs::static_path<SANDBOX_TEST_FILE>{}), 1);
+
+    fs::free(&p);
+}
+
 define_test(longest_existing_path_returns_longest_existing_path)
 {
     fs::path p{};
@@ -1274,6 +1588,245 @@ define_test(canonical_path_gets_canonical_path)
     fs::free(&p);
 }
 
+#if Linux
+define_test(canonical_path_resolves_symlinks)
+{
+    fs::path p{};
+    fs::path canonp{};
+    error err{};
+
+    fs::create_directories(SANDBOX_DIR "/canon/a/b");
+    fs::create_symlink(SANDBOX_DIR "/canon/a/b", SANDBOX_DIR "/canon/link");
+    fs::create_symlink(SANDBOX_DIR "/canon/loop1", SANDBOX_DIR "/canon/loop2");
+    fs::create_symlink(SANDBOX_DIR "/canon/loop2", SANDBOX_DIR "/canon/loop1");
+
+    fs::path_set(&p, SANDBOX_DIR "/canon/link");
+    assert_equal(fs::canonical_path(&p, &canonp), true);
+    assert_equal_str(canonp, SANDBOX_DIR "/canon/a/b");
+
+    // .. applies to the symlink target, not the symlink
+    fs::path_set(&p, SANDBOX_DIR "/canon/link/..");
+    assert_equal(fs::canonical_path(&p, &canonp), true);
+    assert_equal_str(canonp, SANDBOX_DIR "/canon/a");
+
+    fs::path_set(&p, SANDBOX_DIR "/canon/loop1");
+    assert_equal(fs::canonical_path(&p, &canonp, &err), false);
+    assert_equal(err.error_code, ELOOP);
+
+    // same results through a resolve cache
+    fs::resolve_cache cache{};
+    fs::init(&cache);
+
+    fs::path_set(&p, SANDBOX_DIR "/canon/link");
+    assert_equal(fs::canonical_path_cached(&p, &canonp, &cache), true);
+    assert_equal_str(canonp, SANDBOX_DIR "/canon/a/b");
+
+    fs::path_set(&p, SANDBOX_DIR "/canon/a");
+    assert_equal(fs::canonical_path_cached(&p, &canonp, &cache), true);
+    assert_equal_str(canonp, SANDBOX_DIR "/canon/a");
+
+    fs::path_set(&p, SANDBOX_DIR "/canon/does_not_exist");
+    assert_equal(fs::canonical_path_cached(&p, &canonp, &cache), false);
+
+    // nullptr is the error, not a cache
+    fs::path_set(&p, SANDBOX_DIR "/canon/a");
+    assert_equal(fs::canonical_path(&p, &canonp, nullptr), true);
+    assert_equal(fs::weakly_canonical_path(&p, &canonp, nullptr), true);
+
+    fs::free(&cache);
+    fs::free(&canonp);
+    fs::free(&p);
+}
+
+define_test(resolve_cache_drops_changed_entries)
+{
+    fs::path canonp{};
+
+    fs::create_directories(SANDBOX_DIR "/rcache/x");
+    fs::create_directories(SANDBOX_DIR "/rcache/y");
+    fs::create_symlink(SANDBOX_DIR "/rcache/x", SANDBOX_DIR "/rcache/link");
+
+    // revalidation
+    fs::resolve_cache cache{};
+    assert_equal(fs::init(&cache, fs::resolve_cache_validation::Revalidate), true);
+
+    assert_equal(fs::resolve_cache_canonical_path(&cache, SANDBOX_DIR "/rcache/link", &canonp), true);
+    assert_equal_str(canonp, SANDBOX_DIR "/rcache/x");
+
+    fs::remove_symlink(SANDBOX_DIR "/rcache/link");
+    fs::create_symlink(SANDBOX_DIR "/rcache/y", SANDBOX_DIR "/rcache/link");
+
+    assert_equal(fs::resolve_cache_canonical_path(&cache, SANDBOX_DIR "/rcache/link", &canonp), true);
+    assert_equal_str(canonp, SANDBOX_DIR "/rcache/y");
+
+    fs::free(&cache);
+
+    // watcher
+    assert_equal(fs::init(&cache, fs::resolve_cache_validation::Watcher), true);
+
+    assert_equal(fs::resolve_cache_canonical_path(&cache, SANDBOX_DIR "/rcache/link", &canonp), true);
+    assert_equal_str(canonp, SANDBOX_DIR "/rcache/y");
+
+    fs::remove_symlink(SANDBOX_DIR "/rcache/link");
+    fs::create_symlink(SANDBOX_DIR "/rcache/x", SANDBOX_DIR "/rcache/link");
+    sleep_ms(100);
+
+    assert_equal(fs::resolve_cache_process_events(&cache), true);
+    assert_equal(fs::resolve_cache_canonical_path(&cache, SANDBOX_DIR "/rcache/link", &canonp), true);
+    assert_equal_str(canonp, SANDBOX_DIR "/rcache/x");
+    assert_greater(cache.watched_directories.size, 0);
+
+    // no entry depends on a directory anymore, so none are watched
+    fs::resolve_cache_clear(&cache);
+    assert_equal(cache.watched_directories.size, 0);
+
+    fs::free(&cache);
+    fs::free(&canonp);
+}
+
+define_test(stat_cache_caches_filesystem_info)
+{
+    error err{};
+    fs::filesystem_info info{};
+    fs::filesystem_type type{};
+    fs::stat_cache_counters counters{};
+    s64 size = -1;
+
+    fs::create_directories(SANDBOX_DIR "/scache");
+    fs::touch(SANDBOX_DIR "/scache/file");
+
+    fs::stat_cache cache{};
+    fs::init(&cache);
+
+    assert_equal(fs::get_filesystem_type(SANDBOX_DIR "/scache/file", &type, &cache), true);
+    assert_equal(type, fs::filesystem_type::File);
+
+    // queried with the default flags, so type and size are cached as well
+    assert_equal(fs::query_filesystem(SANDBOX_DIR "/scache/file", &info, &cache), true);
+    assert_equal(fs::get_filesystem_type(SANDBOX_DIR "/scache/file", &type, &cache), true);
+    assert_equal(fs::get_file_size(SANDBOX_DIR "/scache/file", &size, &cache), true);
+    assert_equal(size, 0);
+
+    fs::stat_cache_get_counters(&cache, &counters);
+    assert_equal(counters.hits, 2);
+    assert_equal(counters.misses, 2);
+
+    // entries stay until they're invalidated
+    fs::remove_file(SANDBOX_DIR "/scache/file");
+    assert_equal(fs::get_filesystem_type(SANDBOX_DIR "/scache/file", &type, &cache), true);
+
+    fs::stat_cache_invalidate(&cache, SANDBOX_DIR "/scache");
+    assert_equal(fs::get_filesystem_type(SANDBOX_DIR "/scache/file", &type, &cache, true, &err), false);
+    assert_equal(err.error_code, ENOENT);
+
+    fs::free(&cache);
+
+    // time to live
+    assert_equal(fs::init(&cache, 50), true);
+    fs::touch(SANDBOX_DIR "/scache/file");
+
+    assert_equal(fs::query_filesystem(SANDBOX_DIR "/scache/file", &info, &cache), true);
+    fs::remove_file(SANDBOX_DIR "/scache/file");
+    sleep_ms(100);
+
+    assert_equal(fs::query_filesystem(SANDBOX_DIR "/scache/file", &info, &cache), false);
+    fs::free(&cache);
+
+    // watcher
+    assert_equal(fs::init(&cache, 0, true), true);
+    fs::touch(SANDBOX_DIR "/scache/file");
+
+    assert_equal(fs::query_filesystem(SANDBOX_DIR "/scache/file", &info, &cache), true);
+    fs::remove_file(SANDBOX_DIR "/scache/file");
+    sleep_ms(100);
+
+    assert_equal(fs::stat_cache_process_events(&cache), true);
+    assert_equal(fs::query_filesystem(SANDBOX_DIR "/scache/file", &info, &cache), false);
+
+    fs::stat_cache_get_counters(&cache, &counters);
+    assert_equal(counters.hits, 0);
+    assert_equal(counters.invalidations, 1);
+
+    fs::free(&cache);
+    fs::remove_directory(SANDBOX_DIR "/scache");
+}
+
+define_test(negative_cache_caches_missing_paths)
+{
+    error err{};
+    fs::filesystem_info info{};
+    fs::negative_cache_counters counters{};
+
+    fs::create_directories(SANDBOX_DIR "/ncache");
+
+    fs::negative_cache cache{};
+    fs::init(&cache);
+
+    assert_equal(fs::exists(SANDBOX_DIR "/ncache/file", &cache), 0);
+    assert_equal(fs::exists(SANDBOX_DIR "/ncache/file", &cache), 0);
+    assert_equal(fs::query_filesystem(SANDBOX_DIR "/ncache/file", &info, &cache, true, fs::query_flag_default, &err), false);
+    assert_equal(err.error_code, ENOENT);
+
+    // existing paths are not cached
+    assert_equal(fs::exists(SANDBOX_DIR "/ncache", &cache), 1);
+    assert_equal(fs::exists(SANDBOX_DIR "/ncache", &cache), 1);
+
+    fs::negative_cache_get_counters(&cache, &counters);
+    assert_equal(counters.hits, 2);
+    assert_equal(counters.misses, 3);
+
+    // entries stay until they're invalidated
+    fs::touch(SANDBOX_DIR "/ncache/file");
+    assert_equal(fs::exists(SANDBOX_DIR "/ncache/file", &cache), 0);
+
+    fs::negative_cache_invalidate(&cache, SANDBOX_DIR "/ncache/file");
+    assert_equal(fs::exists(SANDBOX_DIR "/ncache/file", &cache), 1);
+    fs::remove_file(SANDBOX_DIR "/ncache/file");
+
+    fs::free(&cache);
+
+    // the cache holds at most capacity paths
+    assert_equal(fs::init(&cache, fs::negative_cache_validation::None, 4), true);
+    assert_equal(fs::exists(SANDBOX_DIR "/ncache/a", &cache), 0);
+    assert_equal(fs::exists(SANDBOX_DIR "/ncache/b", &cache), 0);
+    assert_equal(fs::exists(SANDBOX_DIR "/ncache/c", &cache), 0);
+    assert_equal(fs::exists(SANDBOX_DIR "/ncache/d", &cache), 0);
+    assert_equal(fs::exists(SANDBOX_DIR "/ncache/e", &cache), 0);
+
+    fs::negative_cache_get_counters(&cache, &counters);
+    assert_equal(counters.hits, 0);
+
+    assert_equal(fs::exists(SANDBOX_DIR "/ncache/e", &cache), 0);
+    assert_equal(fs::exists(SANDBOX_DIR "/ncache/a", &cache), 0);
+
+    fs::negative_cache_get_counters(&cache, &counters);
+    assert_equal(counters.hits, 1);
+    fs::free(&cache);
+
+    // watcher, the closest existing directory is watched
+    assert_equal(fs::init(&cache, fs::negative_cache_validation::Watcher), true);
+
+    assert_equal(fs::exists(SANDBOX_DIR "/ncache/dir/file", &cache), 0);
+    assert_equal(fs::exists(SANDBOX_DIR "/ncache/dir/file", &cache), 0);
+
+    fs::create_directory(SANDBOX_DIR "/ncache/dir");
+    fs::touch(SANDBOX_DIR "/ncache/dir/file");
+    sleep_ms(100);
+
+    assert_equal(fs::negative_cache_process_events(&cache), true);
+    assert_equal(fs::exists(SANDBOX_DIR "/ncache/dir/file", &cache), 1);
+
+    fs::negative_cache_get_counters(&cache, &counters);
+    assert_equal(counters.hits, 1);
+    assert_equal(counters.misses, 2);
+
+    fs::free(&cache);
+    fs::remove_file(SANDBOX_DIR "/ncache/dir/file");
+    fs::remove_directory(SANDBOX_DIR "/ncache/dir");
+    fs::remove_directory(SANDBOX_DIR "/ncache");
+}
+#endif
+
 define_test(weakly_canonical_path_gets_weakly_canonical_path)
 {
     fs::path p{};
@@ -1348,6 +1901,132 @@ define_test(weakly_canonical_path_gets_weakly_canonical_path)
     fs::free(&p);
 }
 
+define_test(weakly_canonical_all_gets_weakly_canonical_paths)
+{
+    const sys_char *inputs[] = {
+        SANDBOX_TEST_DIR,
+        SANDBOX_TEST_FILE,
+        SANDBOX_TEST_SYMLINK,
+        SANDBOX_TEST_DIR2,
+        SANDBOX_TEST_FILE2,
+        SANDBOX_TEST_DIR2 SYS_CHAR("/does_not_exist"),
+        SANDBOX_DIR SYS_CHAR("/does_not_exist/abc")
+    };
+    const s64 input_count = sizeof(inputs) / sizeof(inputs[0]);
+
+    // enough paths to spread across multiple threads
+    array<fs::path> paths{};
+    array<fs::path> out{};
+    fs::path expected{};
+
+    for (s64 i = 0; i < 1000; ++i)
+    {
+        fs::path *p = ::add_at_end(&paths);
+        *p = fs::path{};
+        fs::path_set(p, inputs[i % input_count]);
+    }
+
+    fs::resolve_cache cache{};
+    fs::init(&cache);
+
+    assert_equal(fs::weakly_canonical_all(&paths, &out, &cache, 4), true);
+    assert_equal(out.size, paths.size);
+
+    for (s64 i = 0; i < paths.size; ++i)
+    {
+        assert_equal(fs::weakly_canonical_path(paths.data + i, &expected), true);
+        assert_equal_str(out[i], to_const_string(expected));
+    }
+
+    // without a cache
+    assert_equal(fs::weakly_canonical_all(&paths, &out), true);
+
+    for (s64 i = 0; i < paths.size; ++i)
+    {
+        assert_equal(fs::weakly_canonical_path(paths.data + i, &expected), true);
+        assert_equal_str(out[i], to_const_string(expected));
+    }
+
+    // normalize_all
+    fs::normalize_all(&paths, 4);
+
+    for (s64 i = 0; i < paths.size; ++i)
+    {
+        fs::path_set(&expected, inputs[i % input_count]);
+        fs::normalize(&expected);
+        assert_equal_str(paths[i], to_const_string(expected));
+    }
+
+    fs::free(&cache);
+    fs::free(&expected);
+
+    for_array(p, &paths) fs::free(p);
+    for_array(p, &out)   fs::free(p);
+    ::free(&paths);
+    ::free(&out);
+}
+
+define_test(query_filesystem_batch_queries_all_paths)
+{
+    const sys_char *inputs[] = {
+        SANDBOX_TEST_DIR,
+        SANDBOX_TEST_FILE,
+        SANDBOX_TEST_SYMLINK,
+        SANDBOX_TEST_SYMLINK_NO_TARGET,
+        SANDBOX_TEST_FILE2,
+        SANDBOX_DIR SYS_CHAR("/does_not_exist")
+    };
+    const s64 input_count = sizeof(inputs) / sizeof(inputs[0]);
+
+    // more paths than the queue depth
+    array<fs::path> paths{};
+    array<fs::filesystem_info> out{};
+    array<error> errs{};
+    error err{};
+
+    for (s64 i = 0; i < 1000; ++i)
+    {
+        fs::path *p = ::add_at_end(&paths);
+        *p = fs::path{};
+        fs::path_set(p, inputs[i % input_count]);
+    }
+
+    assert_equal(fs::query_filesystem_batch(&paths, &out, &errs, true, fs::query_flag::Type, 16, &err), false);
+    assert_equal(out.size, paths.size);
+    assert_equal(errs.size, paths.size);
+
+    for (s64 i = 0; i < paths.size; ++i)
+    {
+        fs::filesystem_info expected{};
+        error expected_err{};
+        bool ok = fs::query_filesystem(paths.data + i, &expected, true, fs::query_flag::Type, &expected_err);
+
+        assert_equal(errs[i].error_code, expected_err.error_code);
+
+        if (ok)
+            assert_equal(fs::get_filesystem_type(out.data + i), fs::get_filesystem_type(&expected));
+    }
+
+#if Windows
+    assert_equal(err.error_code, ERROR_FILE_NOT_FOUND);
+#else
+    assert_equal(err.error_code, ENOENT);
+#endif
+
+    // not following symlinks, every remaining path exists
+    paths.size = 5;
+    assert_equal(fs::query_filesystem_batch(&paths, &out, nullptr, false, fs::query_flag::Type), true);
+    assert_equal(out.size, 5);
+    assert_equal(fs::get_filesystem_type(out.data + 2), fs::filesystem_type::Symlink);
+    assert_equal(fs::get_filesystem_type(out.data + 3), fs::filesystem_type::Symlink);
+    paths.size = 1000;
+
+    for_array(p, &paths) fs::free(p);
+    ::free(&paths);
+    ::free(&out);
+    ::free(&errs);
+}
+
 define_test(get_symlink_target_reads_symlink)
 {
     error err{};
@@ -1415,6 +2094,75 @@ define_test(set_current_path_sets_current_path)
     fs::free(&p2);
 }
 
+define_test(get_platform_string_converts_strings)
+{
+    // ASCII, long enough for the vectorized conversion, and non-ASCII
+    auto a = fs::get_platform_string(::to_const_string(u"/usr/local/share/applications/x.desktop"));
+    auto b = fs::get_platform_string(::to_const_string(U"/tmp/\u00fcber/\u6587\U0001f600"));
+    auto c = fs::get_platform_string(::to_const_string("/tmp/\xc3\xbc" "ber/\xe6\x96\x87\xf0\x9f\x98\x80"));
+
+    assert_equal_str(a, SYS_CHAR("/usr/local/share/applications/x.desktop"));
+    assert_equal(string_compare(to_const_string(b), to_const_string(c)), 0);
+    assert_equal(a.data[a.size], (sys_char)0);
+    assert_equal(b.data[b.size], (sys_char)0);
+
+    // in reverse order of conversion
+    if constexpr (needs_conversion(c8))  fs::_free_platform_string(&c);
+    if constexpr (needs_conversion(c32)) fs::_free_platform_string(&b);
+    if constexpr (needs_conversion(c16)) fs::_free_platform_string(&a);
+
+    // nested conversions, as in functions taking two paths
+    fs::path p{};
+    fs::relative_path(u"/a/b", U"/a/c/d", &p);
+#if Windows
+    assert_equal_str(p, SYS_CHAR(R"(..\c\d)"));
+#else
+    assert_equal_str(p, SYS_CHAR("../c/d"));
+#endif
+
+    fs::free(&p);
+}
+
+define_test(path_hash_extends_parent_hashes)
+{
+    fs::path p{};
+    fs::hashed_path hp{};
+
+    fs::path_set(&p, "/usr/local/include");
+    assert_equal(::hash(&p), fs::path_hash(&p));
+    assert_equal(fs::path_hash_append(fs::path_hash("/usr"), "local/include"), fs::path_hash(&p));
+    assert_equal(fs::path_hash_append(fs::path_hash("/usr/"), "local"), fs::path_hash("/usr/local"));
+    assert_equal(fs::path_hash_append(fs::path_hash("abc"), "xyz"), fs::path_hash("abc/xyz"));
+
+    // absolute segments replace the parent
+    assert_equal(fs::path_hash_append(fs::path_hash("/usr"), "/etc"), fs::path_hash("/etc"));
+
+    assert_not_equal(fs::path_hash("/usr/local"), fs::path_hash("/usr/locale"));
+    assert_not_equal(fs::path_hash("/usr/local"), fs::path_hash("/usrlocal"));
+    assert_not_equal(fs::path_hash("/usr"), fs::path_hash("usr"));
+
+    fs::hashed_path_set(&hp, "/usr");
+    fs::hashed_path_append(&hp, "local");
+    fs::hashed_path_append(&hp, "include");
+    assert_equal(::hash(&hp), fs::path_hash(&p));
+
+    fs::hashed_path_set(&hp, "");
+    fs::hashed_path_append(&hp, "abc");
+    assert_equal_str(hp.path, SYS_CHAR("abc"));
+    assert_equal(::hash(&hp), fs::path_hash("abc"));
+
+    fs::hashed_path hp2{};
+    fs::hashed_path_set(&hp2, "abc");
+    assert_equal(hp == hp2, true);
+
+    fs::hashed_path_set(&hp2, "abd");
+    assert_equal(hp != hp2, true);
+
+    fs::free(&hp2);
+    fs::free(&hp);
+    fs::free(&p);
+}
+
 define_test(append_appends_to_path)
 {
     fs::path p{};
@@ -1657,6 +2405,9 @@ define_test(copy_file_copies_file)
 
     assert_equal(fs::copy_file(&from, &to, fs::copy_file_option::SkipExisting, &err), true);
 
+    // nullptr is the error, not the info
+    assert_equal(fs::copy_file(&from, &to, fs::copy_file_option::SkipExisting, nullptr), true);
+
     // returns true even if not copied
     assert_equal(fs::copy_file(&from, &to, fs::copy_file_option::UpdateExisting, &err), true);
 
@@ -1703,6 +2454,267 @@ define_test(copy_file_copies_file)
     fs::free(&to);
 }
 
+#if Linux
+// writes Size bytes of a pattern to Path
+static void _write_test_file(const char *pth, s64 size)
+{
+    FILE *f = fopen(pth, "wb");
+
+    if (f == nullptr)
+        return;
+
+    for (s64 i = 0; i < size; ++i)
+        fputc((int)((i * 31) & 0xff), f);
+
+    fclose(f);
+}
+
+static bool _same_file_contents(const char *a, const char *b)
+{
+    FILE *fa = fopen(a, "rb");
+    FILE *fb = fopen(b, "rb");
+    bool same = fa != nullptr && fb != nullptr;
+
+    while (same)
+    {
+        int ca = fgetc(fa);
+        int cb = fgetc(fb);
+
+        same = ca == cb;
+
+        if (ca == EOF)
+            break;
+    }
+
+    if (fa) fclose(fa);
+    if (fb) fclose(fb);
+
+    return same;
+}
+
+// whether a block of Path can be read, and written to Probe, with O_DIRECT
+static bool _accepts_direct_io(const char *pth, const char *probe)
+{
+    void *buf = nullptr;
+
+    if (posix_memalign(&buf, 4096, 4096) != 0)
+        return false;
+
+    int from_fd = open(pth, O_RDONLY | O_DIRECT);
+    int to_fd = open(probe, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+
+    bool ret = from_fd >= 0 && to_fd >= 0
+            && read(from_fd, buf, 4096) == 4096
+            && write(to_fd, buf, 4096) == 4096;
+
+    if (from_fd >= 0) close(from_fd);
+    if (to_fd >= 0) close(to_fd);
+
+    unlink(probe);
+    free(buf);
+
+    return ret;
+}
+
+define_test(copy_file_reports_copy_strategy)
+{
+    error err{};
+    fs::copy_file_info info{};
+
+    // larger than the buffer of the read / write fallback
+    s64 size = (3ll << 20) + 123;
+    _write_test_file(SANDBOX_DIR "/copy_big", size);
+
+    assert_equal(fs::copy_file(SANDBOX_DIR "/copy_big", SANDBOX_DIR "/copy_big2", fs::copy_file_option::None, &info, fs::copy_file_flag::None, nullptr, &err), true);
+    assert_not_equal(info.strategy, fs::copy_strategy::None);
+    assert_equal(info.bytes_copied, size);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_big", SANDBOX_DIR "/copy_big2"), true);
+
+    // skipped, nothing copied
+    assert_equal(fs::copy_file(SANDBOX_DIR "/copy_big", SANDBOX_DIR "/copy_big2", fs::copy_file_option::SkipExisting, &info, fs::copy_file_flag::None, nullptr, &err), true);
+    assert_equal(info.strategy, fs::copy_strategy::None);
+    assert_equal(info.bytes_copied, 0);
+
+    // overwriting truncates the destination
+    _write_test_file(SANDBOX_DIR "/copy_big", 100);
+    assert_equal(fs::copy_file(SANDBOX_DIR "/copy_big", SANDBOX_DIR "/copy_big2", fs::copy_file_option::OverwriteExisting, &info, fs::copy_file_flag::None, nullptr, &err), true);
+    assert_equal(info.bytes_copied, 100);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_big", SANDBOX_DIR "/copy_big2"), true);
+
+    // files of pseudo filesystems report a size of 0, but have contents
+    assert_equal(fs::copy_file("/proc/self/status", SANDBOX_DIR "/copy_status", fs::copy_file_option::None, &info, fs::copy_file_flag::None, nullptr, &err), true);
+    assert_greater(info.bytes_copied, 0);
+
+    fs::remove_file(SANDBOX_DIR "/copy_big");
+    fs::remove_file(SANDBOX_DIR "/copy_big2");
+    fs::remove_file(SANDBOX_DIR "/copy_status");
+}
+
+define_test(copy_file_keeps_holes_of_sparse_files)
+{
+    error err{};
+    fs::copy_file_info info{};
+
+    // 4 KiB of data, a 64 MiB hole and another 4 KiB of data
+    FILE *f = fopen(SANDBOX_DIR "/copy_sparse", "wb");
+    assert_equal(f != nullptr, true);
+
+    for (s64 i = 0; i < 4096; ++i)
+        fputc((int)(i & 0xff), f);
+
+    fseek(f, 64ll << 20, SEEK_SET);
+
+    for (s64 i = 0; i < 4096; ++i)
+        fputc((int)(i & 0xff), f);
+
+    fclose(f);
+
+    assert_equal(fs::copy_file(SANDBOX_DIR "/copy_sparse", SANDBOX_DIR "/copy_sparse2", fs::copy_file_option::None, &info, fs::copy_file_flag::None, nullptr, &err), true);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_sparse", SANDBOX_DIR "/copy_sparse2"), true);
+
+    fs::filesystem_info from_info{};
+    fs::filesystem_info to_info{};
+    assert_equal(fs::query_filesystem(SANDBOX_DIR "/copy_sparse", &from_info, false, fs::query_flag_default, &err), true);
+    assert_equal(fs::query_filesystem(SANDBOX_DIR "/copy_sparse2", &to_info, false, fs::query_flag_default, &err), true);
+    assert_equal(to_info.stx_size, from_info.stx_size);
+
+    // cloned files share the extents, holes included
+    if (info.strategy != fs::copy_strategy::Clone)
+    {
+        assert_equal(info.strategy, fs::copy_strategy::Sparse);
+        assert_greater((s64)from_info.stx_size, info.bytes_copied);
+        assert_greater(to_info.stx_size, to_info.stx_blocks * 512);
+    }
+
+    fs::remove_file(SANDBOX_DIR "/copy_sparse");
+    fs::remove_file(SANDBOX_DIR "/copy_sparse2");
+}
+
+define_test(copy_file_bulk_copies_contents)
+{
+    error err{};
+    fs::copy_file_info info{};
+
+    // several bulk chunks, with a tail that is not a whole block
+    s64 size = (20ll << 20) + 123;
+    _write_test_file(SANDBOX_DIR "/copy_bulk", size);
+
+    assert_equal(fs::copy_file(SANDBOX_DIR "/copy_bulk", SANDBOX_DIR "/copy_bulk2", fs::copy_file_option::None, &info, fs::copy_file_flag::Bulk, nullptr, &err), true);
+    assert_equal(info.bytes_copied, size);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_bulk", SANDBOX_DIR "/copy_bulk2"), true);
+
+    // large enough for O_DIRECT, if the filesystem supports it
+    size = (64ll << 20) + 4097;
+    _write_test_file(SANDBOX_DIR "/copy_bulk", size);
+
+    bool direct = _accepts_direct_io(SANDBOX_DIR "/copy_bulk", SANDBOX_DIR "/copy_bulk_probe");
+
+    // a clone copies no data and is still preferred
+    assert_equal(fs::copy_file(SANDBOX_DIR "/copy_bulk", SANDBOX_DIR "/copy_bulk2", fs::copy_file_option::OverwriteExisting, &info, fs::copy_file_flag::DirectIO, nullptr, &err), true);
+    assert_equal(info.bytes_copied, size);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_bulk", SANDBOX_DIR "/copy_bulk2"), true);
+
+    if (direct && info.strategy != fs::copy_strategy::Clone)
+    {
+        assert_equal(info.strategy, fs::copy_strategy::Direct);
+    }
+    else
+    {
+        assert_not_equal(info.strategy, fs::copy_strategy::None);
+    }
+
+    // with Verify the data passes through the buffer, so O_DIRECT is used
+    // wherever the filesystem accepts it.
+    assert_equal(fs::copy_file(SANDBOX_DIR "/copy_bulk", SANDBOX_DIR "/copy_bulk2", fs::copy_file_option::OverwriteExisting, &info, fs::copy_file_flag::DirectIO | fs::copy_file_flag::Verify, nullptr, &err), true);
+    assert_equal(info.bytes_copied, size);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_bulk", SANDBOX_DIR "/copy_bulk2"), true);
+
+    if (direct)
+        assert_equal(info.strategy, fs::copy_strategy::Direct);
+
+    fs::remove_file(SANDBOX_DIR "/copy_bulk");
+    fs::remove_file(SANDBOX_DIR "/copy_bulk2");
+}
+
+define_test(copy_file_verify_returns_checksum)
+{
+    error err{};
+    fs::copy_file_info info{};
+
+    s64 size = (3ll << 20) + 123;
+    _write_test_file(SANDBOX_DIR "/copy_verify", size);
+
+    u32 expected = 0;
+
+    for (s64 i = 0; i < size; ++i)
+    {
+        u8 c = (u8)((i * 31) & 0xff);
+        expected = fs::_crc32c(expected, &c, 1);
+    }
+
+    assert_equal(fs::copy_file(SANDBOX_DIR "/copy_verify", SANDBOX_DIR "/copy_verify2", fs::copy_file_option::None, &info, fs::copy_file_flag::Verify, nullptr, &err), true);
+    assert_equal(info.bytes_copied, size);
+    assert_equal(info.checksum, expected);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_verify", SANDBOX_DIR "/copy_verify2"), true);
+
+    assert_equal(fs::copy_file(SANDBOX_DIR "/copy_verify", SANDBOX_DIR "/copy_verify2", fs::copy_file_option::OverwriteExisting, &info, fs::copy_file_flag::VerifyDestination | fs::copy_file_flag::Bulk, nullptr, &err), true);
+    assert_equal(info.checksum, expected);
+
+    // no checksum without the flags
+    assert_equal(fs::copy_file(SANDBOX_DIR "/copy_verify", SANDBOX_DIR "/copy_verify2", fs::copy_file_option::OverwriteExisting, &info, fs::copy_file_flag::None, nullptr, &err), true);
+    assert_equal(info.checksum, 0u);
+
+    fs::remove_file(SANDBOX_DIR "/copy_verify");
+    fs::remove_file(SANDBOX_DIR "/copy_verify2");
+}
+
+define_test(copy_file_verify_checksums_holes_of_sparse_files)
+{
+    error err{};
+    fs::copy_file_info info{};
+
+    // a hole at the start, between the data and at the end
+    s64 size = (8ll << 20) + 100;
+    const s64 data_offsets[] = {1ll << 20, 4ll << 20};
+    u8 data[5000];
+
+    for (s64 i = 0; i < 5000; ++i)
+        data[i] = (u8)(i * 31 + 7);
+
+    int fd = open(SANDBOX_DIR "/copy_sparse", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    assert_not_equal(fd, -1);
+
+    for (s64 offset : data_offsets)
+        assert_equal(pwrite(fd, data, sizeof(data), (off_t)offset), (ssize_t)sizeof(data));
+
+    assert_equal(ftruncate(fd, (off_t)size), 0);
+    close(fd);
+
+    u32 expected = fs::_crc32c_zeros(0, data_offsets[0]);
+    expected = fs::_crc32c(expected, data, sizeof(data));
+    expected = fs::_crc32c_zeros(expected, data_offsets[1] - data_offsets[0] - (s64)sizeof(data));
+    expected = fs::_crc32c(expected, data, sizeof(data));
+    expected = fs::_crc32c_zeros(expected, size - data_offsets[1] - (s64)sizeof(data));
+
+    struct stat st;
+    assert_equal(stat(SANDBOX_DIR "/copy_sparse", &st), 0);
+    bool sparse = (s64)st.st_blocks * 512 < size;
+
+    assert_equal(fs::copy_file(SANDBOX_DIR "/copy_sparse", SANDBOX_DIR "/copy_sparse2", fs::copy_file_option::None, &info, fs::copy_file_flag::Verify, nullptr, &err), true);
+    assert_equal(info.checksum, expected);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_sparse", SANDBOX_DIR "/copy_sparse2"), true);
+
+    if (sparse)
+        assert_equal(info.strategy, fs::copy_strategy::Sparse);
+
+    assert_equal(fs::copy_file(SANDBOX_DIR "/copy_sparse", SANDBOX_DIR "/copy_sparse2", fs::copy_file_option::OverwriteExisting, &info, fs::copy_file_flag::VerifyDestination, nullptr, &err), true);
+    assert_equal(info.checksum, expected);
+
+    fs::remove_file(SANDBOX_DIR "/copy_sparse");
+    fs::remove_file(SANDBOX_DIR "/copy_sparse2");
+}
+#endif
+
 define_test(copy_directory_copies_directory)
 {
     error err{};
@@ -1792,6 +2804,386 @@ define_test(copy_directory_copies_directory)
     fs::remove(dir_to);
 }
 
+define_test(copy_directory_copies_directory_in_parallel)
+{
+    error err{};
+
+    const sys_char *dir_from = SANDBOX_DIR "/copy_pdir";
+    const sys_char *dir_to = SANDBOX_DIR "/copy_pdir_to";
+
+    fs::create_directories(SANDBOX_DIR "/copy_pdir/dir1/dir2");
+    fs::create_directory(SANDBOX_DIR "/copy_pdir/dir3");
+    fs::touch(SANDBOX_DIR "/copy_pdir/file1");
+    fs::touch(SANDBOX_DIR "/copy_pdir/file2");
+    fs::touch(SANDBOX_DIR "/copy_pdir/dir1/file3");
+    fs::touch(SANDBOX_DIR "/copy_pdir/dir1/file4");
+    fs::touch(SANDBOX_DIR "/copy_pdir/dir1/dir2/file5");
+    fs::touch(SANDBOX_DIR "/copy_pdir/dir1/dir2/file6");
+    fs::touch(SANDBOX_DIR "/copy_pdir/dir3/file7");
+
+    assert_equal(fs::exists(dir_to), 0);
+    assert_equal(fs::copy_directory(dir_from, dir_to, -1, fs::copy_file_option::None, {.thread_count = 4}, &err), true);
+    assert_equal(fs::exists(SANDBOX_DIR "/copy_pdir_to/file1"), 1);
+    assert_equal(fs::exists(SANDBOX_DIR "/copy_pdir_to/file2"), 1);
+    assert_equal(fs::exists(SANDBOX_DIR "/copy_pdir_to/dir1/file3"), 1);
+    assert_equal(fs::exists(SANDBOX_DIR "/copy_pdir_to/dir1/file4"), 1);
+    assert_equal(fs::exists(SANDBOX_DIR "/copy_pdir_to/dir1/dir2/file5"), 1);
+    assert_equal(fs::exists(SANDBOX_DIR "/copy_pdir_to/dir1/dir2/file6"), 1);
+    assert_equal(fs::exists(SANDBOX_DIR "/copy_pdir_to/dir3/file7"), 1);
+
+    // existing files, skipped by every thread
+    assert_equal(fs::copy_directory(dir_from, dir_to, -1, fs::copy_file_option::SkipExisting, {.thread_count = 4}, &err), true);
+
+    fs::remove(dir_to);
+
+    // io_uring, or threads if io_uring is not available
+    assert_equal(fs::copy_directory(dir_from, dir_to, -1, fs::copy_file_option::None, {.method = fs::copy_directory_method::Uring, .thread_count = 4}, &err), true);
+    assert_equal(fs::exists(SANDBOX_DIR "/copy_pdir_to/file1"), 1);
+    assert_equal(fs::exists(SANDBOX_DIR "/copy_pdir_to/dir1/file3"), 1);
+    assert_equal(fs::exists(SANDBOX_DIR "/copy_pdir_to/dir1/dir2/file6"), 1);
+    assert_equal(fs::exists(SANDBOX_DIR "/copy_pdir_to/dir3/file7"), 1);
+
+    // existing destinations fail the chains and are skipped by copy_file
+    assert_equal(fs::copy_directory(dir_from, dir_to, -1, fs::copy_file_option::SkipExisting, {.method = fs::copy_directory_method::Uring, .thread_count = 4}, &err), true);
+
+    fs::remove(dir_to);
+
+    // up to depth 0 only, one thread per hardware thread
+    assert_equal(fs::copy_directory(dir_from, dir_to, 0, fs::copy_file_option::None, {.thread_count = 0}, &err), true);
+    assert_equal(fs::exists(SANDBOX_DIR "/copy_pdir_to/file1"), 1);
+    assert_equal(fs::exists(SANDBOX_DIR "/copy_pdir_to/dir1"), 1);
+    assert_equal(fs::exists(SANDBOX_DIR "/copy_pdir_to/dir1/file3"), 0);
+    assert_equal(fs::exists(SANDBOX_DIR "/copy_pdir_to/dir3/file7"), 0);
+
+    fs::remove(dir_to);
+
+    // target directory exists
+    fs::create_directory(dir_to);
+    assert_equal(fs::copy_directory(dir_from, dir_to, -1, fs::copy_file_option::None, {.thread_count = 4}, &err), false);
+    assert_equal(fs::exists(SANDBOX_DIR "/copy_pdir_to/file1"), 0);
+
+#if Windows
+    assert_equal(err.error_code, ERROR_ALREADY_EXISTS);
+#else
+    assert_equal(err.error_code, EEXIST);
+#endif
+
+    fs::remove(dir_to);
+
+    // the ring can't copy with flags
+    assert_equal(fs::copy_directory(dir_from, dir_to, -1, fs::copy_file_option::None, {.method = fs::copy_directory_method::Uring, .flags = fs::copy_directory_flag::Bulk}, &err), false);
+    assert_equal(fs::exists(dir_to), 0);
+
+#if Windows
+    assert_equal(err.error_code, ERROR_INVALID_PARAMETER);
+#else
+    assert_equal(err.error_code, EINVAL);
+#endif
+
+    // nullptr is the error, not the options
+    assert_equal(fs::copy_directory(dir_from, dir_to, -1, fs::copy_file_option::None, nullptr), true);
+    assert_equal(fs::exists(SANDBOX_DIR "/copy_pdir_to/dir3/file7"), 1);
+
+    fs::remove(dir_to);
+
+    fs::remove(dir_from);
+}
+
+#if Linux
+define_test(copy_directory_with_uring_copies_contents)
+{
+    error err{};
+
+    const sys_char *dir_from = SANDBOX_DIR "/copy_udir";
+    const sys_char *dir_to = SANDBOX_DIR "/copy_udir_to";
+
+    // small files are copied by the ring, files of 16 KiB or more by copy_file
+    const s64 sizes[] = {0, 1, 4096, 16383, 16384, 16385, 100000};
+    char from_name[256];
+    char to_name[256];
+
+    fs::create_directories(SANDBOX_DIR "/copy_udir/dir1");
+
+    for (int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); ++i)
+    {
+        snprintf(from_name, sizeof(from_name), SANDBOX_DIR "/copy_udir/file%d", i);
+        _write_test_file(from_name, sizes[i]);
+        snprintf(from_name, sizeof(from_name), SANDBOX_DIR "/copy_udir/dir1/file%d", i);
+        _write_test_file(from_name, sizes[i]);
+    }
+
+    assert_equal(fs::copy_directory(dir_from, dir_to, -1, fs::copy_file_option::None, {.method = fs::copy_directory_method::Uring}, &err), true);
+
+    for (int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); ++i)
+    {
+        snprintf(from_name, sizeof(from_name), SANDBOX_DIR "/copy_udir/file%d", i);
+        snprintf(to_name, sizeof(to_name), SANDBOX_DIR "/copy_udir_to/file%d", i);
+        assert_equal(_same_file_contents(from_name, to_name), true);
+
+        snprintf(from_name, sizeof(from_name), SANDBOX_DIR "/copy_udir/dir1/file%d", i);
+        snprintf(to_name, sizeof(to_name), SANDBOX_DIR "/copy_udir_to/dir1/file%d", i);
+        assert_equal(_same_file_contents(from_name, to_name), true);
+    }
+
+    // overwritten by the ring, the old contents are longer
+    _write_test_file(SANDBOX_DIR "/copy_udir/file3", 100);
+    _write_test_file(SANDBOX_DIR "/copy_udir_to/file3", 10000);
+    assert_equal(fs::copy_directory(dir_from, dir_to, -1, fs::copy_file_option::OverwriteExisting, {.method = fs::copy_directory_method::Uring}, &err), true);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_udir/file3", SANDBOX_DIR "/copy_udir_to/file3"), true);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_udir/file5", SANDBOX_DIR "/copy_udir_to/file5"), true);
+
+    fs::remove(dir_to);
+    fs::remove(dir_from);
+}
+
+static bool _is_named(fs::const_fs_string pth, const char *name)
+{
+    return ::string_compare(fs::filename(pth), ::to_const_string(name)) == 0;
+}
+
+define_test(copy_directory_in_parallel_reports_first_failed_entry)
+{
+    error err{};
+
+    const sys_char *dir_from = SANDBOX_DIR "/copy_fdir";
+    const sys_char *dir_to = SANDBOX_DIR "/copy_fdir_to";
+
+    fs::create_directory(dir_from);
+
+    for (int i = 0; i < 200; ++i)
+    {
+        char name[256];
+        snprintf(name, sizeof(name), SANDBOX_DIR "/copy_fdir/file%d", i);
+        fs::touch(name);
+    }
+
+    // opening the sources fails, with different errors
+    fs::create_symlink(SANDBOX_DIR "/copy_fdir/missing", SANDBOX_DIR "/copy_fdir/dangling");
+    fs::create_symlink(SANDBOX_DIR "/copy_fdir/loop", SANDBOX_DIR "/copy_fdir/loop");
+
+    int expected = 0;
+
+    for_recursive_path(item, dir_from, fs::iterate_option::StopOnError)
+    {
+        if (_is_named(item->path, "dangling"))
+            expected = ENOENT;
+        else if (_is_named(item->path, "loop"))
+            expected = ELOOP;
+
+        if (expected != 0)
+            break;
+    }
+
+    // whichever thread fails first, the error is the one of the first failed
+    // entry in walk order, and every file before it is copied.
+    for (int run = 0; run < 10; ++run)
+    {
+        err = error{};
+        assert_equal(fs::copy_directory(dir_from, dir_to, -1, fs::copy_file_option::None, {.thread_count = 8}, &err), false);
+        assert_equal(err.error_code, expected);
+
+        for_recursive_path(item, dir_from, fs::iterate_option::StopOnError)
+        {
+            if (_is_named(item->path, "dangling") || _is_named(item->path, "loop"))
+                break;
+
+            fs::path to{};
+            fs::path_set(&to, dir_to);
+            fs::path_append(&to, fs::filename(item->path));
+            assert_equal(fs::exists(&to), 1);
+            fs::free(&to);
+        }
+
+        fs::remove(dir_to);
+    }
+
+    fs::remove(dir_from);
+}
+#endif
+
+#if Linux
+define_test(copy_directory_deduplicates_identical_files)
+{
+    error err{};
+
+    const sys_char *dir_from = SANDBOX_DIR "/copy_ddir";
+    const sys_char *dir_to = SANDBOX_DIR "/copy_ddir_to";
+
+    fs::create_directories(SANDBOX_DIR "/copy_ddir/dir1");
+    _write_test_file(SANDBOX_DIR "/copy_ddir/file1", 20000);
+    _write_test_file(SANDBOX_DIR "/copy_ddir/dir1/file2", 20000);
+    _write_test_file(SANDBOX_DIR "/copy_ddir/dir1/file3", 20000);
+
+    // same size, first and last bytes, but different contents
+    _write_test_file(SANDBOX_DIR "/copy_ddir/file4", 20000);
+    FILE *f = fopen(SANDBOX_DIR "/copy_ddir/file4", "r+b");
+    assert_equal(f != nullptr, true);
+    fseek(f, 10000, SEEK_SET);
+    fputc('x', f);
+    fclose(f);
+
+    // and another one, which is only the same as file4 up to the byte compare
+    _write_test_file(SANDBOX_DIR "/copy_ddir/file5", 20000);
+    f = fopen(SANDBOX_DIR "/copy_ddir/file5", "r+b");
+    assert_equal(f != nullptr, true);
+    fseek(f, 10000, SEEK_SET);
+    fputc('y', f);
+    fclose(f);
+
+    assert_equal(fs::copy_directory(dir_from, dir_to, -1, fs::copy_file_option::None, {.thread_count = 4, .flags = fs::copy_directory_flag::Deduplicate}, &err), true);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_ddir/file1", SANDBOX_DIR "/copy_ddir_to/file1"), true);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_ddir/file1", SANDBOX_DIR "/copy_ddir_to/dir1/file2"), true);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_ddir/file1", SANDBOX_DIR "/copy_ddir_to/dir1/file3"), true);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_ddir/file4", SANDBOX_DIR "/copy_ddir_to/file4"), true);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_ddir/file5", SANDBOX_DIR "/copy_ddir_to/file5"), true);
+
+    fs::filesystem_info info{};
+    assert_equal(fs::query_filesystem(SANDBOX_DIR "/copy_ddir_to/file4", &info, false, fs::query_flag_default, &err), true);
+    assert_equal(info.stx_nlink, 1u);
+    assert_equal(fs::query_filesystem(SANDBOX_DIR "/copy_ddir_to/file5", &info, false, fs::query_flag_default, &err), true);
+    assert_equal(info.stx_nlink, 1u);
+
+    // duplicates are clones (nothing to check) or hard links to the first copy
+    assert_equal(fs::query_filesystem(SANDBOX_DIR "/copy_ddir_to/file1", &info, false, fs::query_flag_default, &err), true);
+
+    if (info.stx_nlink > 1)
+        assert_equal(info.stx_nlink, 3u);
+
+    // existing duplicates are skipped or replaced
+    assert_equal(fs::copy_directory(dir_from, dir_to, -1, fs::copy_file_option::SkipExisting, {.flags = fs::copy_directory_flag::Deduplicate}, &err), true);
+    assert_equal(fs::copy_directory(dir_from, dir_to, -1, fs::copy_file_option::OverwriteExisting, {.flags = fs::copy_directory_flag::Deduplicate}, &err), true);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_ddir/file1", SANDBOX_DIR "/copy_ddir_to/dir1/file3"), true);
+
+    // a source that is no longer a duplicate is copied over its old
+    // destination, which may be a hard link to the others: they must keep
+    // their contents.
+    _write_test_file(SANDBOX_DIR "/copy_ddir/dir1/file2", 30000);
+    assert_equal(fs::copy_directory(dir_from, dir_to, -1, fs::copy_file_option::OverwriteExisting, {.thread_count = 4, .flags = fs::copy_directory_flag::Deduplicate}, &err), true);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_ddir/dir1/file2", SANDBOX_DIR "/copy_ddir_to/dir1/file2"), true);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_ddir/file1", SANDBOX_DIR "/copy_ddir_to/file1"), true);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_ddir/file1", SANDBOX_DIR "/copy_ddir_to/dir1/file3"), true);
+
+    // same when updating, the source is newer than its destination
+    _write_test_file(SANDBOX_DIR "/copy_ddir/dir1/file3", 40000);
+    assert_equal(fs::copy_directory(dir_from, dir_to, -1, fs::copy_file_option::UpdateExisting, {.thread_count = 4, .flags = fs::copy_directory_flag::Deduplicate}, &err), true);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_ddir/dir1/file3", SANDBOX_DIR "/copy_ddir_to/dir1/file3"), true);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_ddir/file1", SANDBOX_DIR "/copy_ddir_to/file1"), true);
+
+    fs::remove(dir_to);
+    fs::remove(dir_from);
+}
+
+define_test(copy_directory_preserves_hard_links)
+{
+    error err{};
+
+    const sys_char *dir_from = SANDBOX_DIR "/copy_hldir";
+    const sys_char *dir_to = SANDBOX_DIR "/copy_hldir_to";
+
+    fs::create_directories(SANDBOX_DIR "/copy_hldir/dir1");
+    _write_test_file(SANDBOX_DIR "/copy_hldir/file1", 20000);
+    _write_test_file(SANDBOX_DIR "/copy_hldir/file2", 20000);
+    assert_equal(fs::create_hard_link(SANDBOX_DIR "/copy_hldir/file1", SANDBOX_DIR "/copy_hldir/dir1/link1", &err), true);
+
+    assert_equal(fs::copy_directory(dir_from, dir_to, -1, fs::copy_file_option::None, {.thread_count = 4, .flags = fs::copy_directory_flag::PreserveHardLinks}, &err), true);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_hldir/file1", SANDBOX_DIR "/copy_hldir_to/dir1/link1"), true);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_hldir/file2", SANDBOX_DIR "/copy_hldir_to/file2"), true);
+
+    fs::filesystem_info info1{};
+    fs::filesystem_info info2{};
+    assert_equal(fs::query_filesystem(SANDBOX_DIR "/copy_hldir_to/file1", &info1, false, fs::query_flag_default, &err), true);
+    assert_equal(fs::query_filesystem(SANDBOX_DIR "/copy_hldir_to/dir1/link1", &info2, false, fs::query_flag_default, &err), true);
+    assert_equal(info1.stx_nlink, 2u);
+    assert_equal(info1.stx_ino, info2.stx_ino);
+
+    // identical contents, but not a hard link in the source
+    assert_equal(fs::query_filesystem(SANDBOX_DIR "/copy_hldir_to/file2", &info2, false, fs::query_flag_default, &err), true);
+    assert_equal(info2.stx_nlink, 1u);
+
+    // the source link is broken, copying over the linked destinations must
+    // not write the new contents of one through to the other.
+    assert_equal(fs::remove_file(SANDBOX_DIR "/copy_hldir/dir1/link1", &err), true);
+    _write_test_file(SANDBOX_DIR "/copy_hldir/dir1/link1", 30000);
+
+    assert_equal(fs::copy_directory(dir_from, dir_to, -1, fs::copy_file_option::OverwriteExisting, {.thread_count = 4, .flags = fs::copy_directory_flag::PreserveHardLinks}, &err), true);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_hldir/file1", SANDBOX_DIR "/copy_hldir_to/file1"), true);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/copy_hldir/dir1/link1", SANDBOX_DIR "/copy_hldir_to/dir1/link1"), true);
+
+    assert_equal(fs::query_filesystem(SANDBOX_DIR "/copy_hldir_to/file1", &info1, false, fs::query_flag_default, &err), true);
+    assert_equal(fs::query_filesystem(SANDBOX_DIR "/copy_hldir_to/dir1/link1", &info2, false, fs::query_flag_default, &err), true);
+    assert_equal(info1.stx_nlink, 1u);
+    assert_equal(info2.stx_nlink, 1u);
+
+    fs::remove(dir_to);
+    fs::remove(dir_from);
+}
+#endif
+
+static bool _cancel_after_first_file(const fs::operation_progress *progress, void *userdata)
+{
+    (void)userdata;
+    return progress->files_done < 1;
+}
+
+define_test(operation_control_reports_progress_and_cancels)
+{
+    error err{};
+
+    const sys_char *dir_from = SANDBOX_DIR "/control_dir";
+    const sys_char *dir_to = SANDBOX_DIR "/control_dir_to";
+
+    fs::create_directories(SANDBOX_DIR "/control_dir/dir1");
+    fs::touch(SANDBOX_DIR "/control_dir/file1");
+    fs::touch(SANDBOX_DIR "/control_dir/file2");
+    fs::touch(SANDBOX_DIR "/control_dir/dir1/file3");
+
+    fs::operation_control control{};
+    fs::init(&control);
+
+    assert_equal(fs::copy_directory(dir_from, dir_to, -1, fs::copy_file_option::None, {.control = &control}, &err), true);
+    assert_equal(control.files_done.load(), 3);
+    assert_equal(control.bytes_done.load(), 0);
+
+    fs::operation_progress progress{};
+    fs::operation_get_progress(&control, &progress);
+    assert_equal(progress.files_done, 3);
+    assert_greater(progress.path.size, 0);
+
+    fs::free(&control);
+
+    // removing counts files, not directories
+    fs::init(&control);
+    assert_equal(fs::remove_directory(dir_to, &control, &err), true);
+    assert_equal(control.files_done.load(), 3);
+    assert_equal(fs::exists(dir_to), 0);
+    fs::free(&control);
+
+    // cancelled before starting
+    fs::init(&control);
+    fs::operation_cancel(&control);
+    assert_equal(fs::copy_directory(dir_from, dir_to, -1, fs::copy_file_option::None, {.thread_count = 4, .control = &control}, &err), false);
+    assert_equal(fs::exists(SANDBOX_DIR "/control_dir_to/file1"), 0);
+    assert_equal(fs::exists(SANDBOX_DIR "/control_dir_to/file2"), 0);
+    fs::free(&control);
+    fs::remove(dir_to);
+
+    // cancelled by the callback after the first file
+    fs::init(&control, _cancel_after_first_file);
+    assert_equal(fs::copy_directory(dir_from, dir_to, -1, fs::copy_file_option::None, {.control = &control}, &err), false);
+    assert_equal(control.files_done.load(), 1);
+    assert_equal(fs::operation_cancelled(&control), true);
+
+#if Windows
+    assert_equal(err.error_code, ERROR_CANCELLED);
+#else
+    assert_equal(err.error_code, ECANCELED);
+#endif
+
+    fs::free(&control);
+    fs::remove(dir_to);
+    fs::remove(dir_from);
+}
+
 define_test(copy_copies_files_and_directories)
 {
     const sys_char *dir_from = SANDBOX_DIR "/copy1_dir";
@@ -1815,6 +3207,100 @@ define_test(copy_copies_files_and_directories)
     assert_equal(fs::exists(file_to), 1);
 }
 
+define_test(sync_directory_copies_only_changes)
+{
+    error err{};
+    fs::sync_stats stats{};
+
+    const sys_char *dir_from = SANDBOX_DIR "/sync_dir";
+    const sys_char *dir_to = SANDBOX_DIR "/sync_dir_to";
+
+    fs::create_directories(SANDBOX_DIR "/sync_dir/dir1/dir2");
+    fs::touch(SANDBOX_DIR "/sync_dir/file1");
+    fs::touch(SANDBOX_DIR "/sync_dir/dir1/file2");
+    fs::touch(SANDBOX_DIR "/sync_dir/dir1/dir2/file3");
+
+    assert_equal(fs::exists(dir_to), 0);
+    assert_equal(fs::sync_directory(dir_from, dir_to, fs::sync_option::None, &stats, &err), true);
+    assert_equal(stats.files_copied, 3);
+    assert_equal(stats.files_skipped, 0);
+    assert_equal(stats.directories_created, 3);
+    assert_equal(fs::exists(SANDBOX_DIR "/sync_dir_to/file1"), 1);
+    assert_equal(fs::exists(SANDBOX_DIR "/sync_dir_to/dir1/file2"), 1);
+    assert_equal(fs::exists(SANDBOX_DIR "/sync_dir_to/dir1/dir2/file3"), 1);
+
+    // nothing changed, nothing copied
+    assert_equal(fs::sync_directory(dir_from, dir_to, fs::sync_option::None, &stats, &err), true);
+    assert_equal(stats.files_copied, 0);
+    assert_equal(stats.files_skipped, 3);
+    assert_equal(stats.directories_created, 0);
+
+    // entries missing from the source are only removed with Prune
+    fs::touch(SANDBOX_DIR "/sync_dir_to/extra");
+    fs::create_directory(SANDBOX_DIR "/sync_dir_to/extra_dir");
+    fs::touch(SANDBOX_DIR "/sync_dir_to/extra_dir/file4");
+    fs::remove(SANDBOX_DIR "/sync_dir/dir1/file2");
+
+    assert_equal(fs::sync_directory(dir_from, dir_to, fs::sync_option::None, &stats, &err), true);
+    assert_equal(stats.entries_removed, 0);
+    assert_equal(fs::exists(SANDBOX_DIR "/sync_dir_to/extra"), 1);
+    assert_equal(fs::exists(SANDBOX_DIR "/sync_dir_to/dir1/file2"), 1);
+
+    assert_equal(fs::sync_directory(dir_from, dir_to, fs::sync_option::Prune, &stats, &err), true);
+    assert_equal(stats.entries_removed, 3);
+    assert_equal(stats.files_skipped, 2);
+    assert_equal(fs::exists(SANDBOX_DIR "/sync_dir_to/extra"), 0);
+    assert_equal(fs::exists(SANDBOX_DIR "/sync_dir_to/extra_dir"), 0);
+    assert_equal(fs::exists(SANDBOX_DIR "/sync_dir_to/dir1/file2"), 0);
+
+#if Linux
+    // changed file
+    _write_test_file(SANDBOX_DIR "/sync_dir/file1", 100);
+
+    assert_equal(fs::sync_directory(dir_from, dir_to, fs::sync_option::None, &stats, &err), true);
+    assert_equal(stats.files_copied, 1);
+    assert_equal(stats.files_skipped, 1);
+    assert_equal(stats.bytes_copied, 100);
+    assert_equal(_same_file_contents(SANDBOX_DIR "/sync_dir/file1", SANDBOX_DIR "/sync_dir_to/file1"), true);
+
+    // same contents, different modification time
+    fs::touch(SANDBOX_DIR "/sync_dir_to/file1");
+
+    assert_equal(fs::sync_directory(dir_from, dir_to, fs::sync_option::CompareContents, &stats, &err), true);
+    assert_equal(stats.files_copied, 0);
+    assert_equal(stats.files_skipped, 2);
+
+    // the modification time of the source was set
+    assert_equal(fs::sync_directory(dir_from, dir_to, fs::sync_option::None, &stats, &err), true);
+    assert_equal(stats.files_copied, 0);
+    assert_equal(stats.files_skipped, 2);
+#endif
+
+    // a file replaced by a directory
+    fs::remove(SANDBOX_DIR "/sync_dir/file1");
+    fs::create_directory(SANDBOX_DIR "/sync_dir/file1");
+
+    assert_equal(fs::sync_directory(dir_from, dir_to, fs::sync_option::Prune, &stats, &err), true);
+    assert_equal(stats.entries_removed, 1);
+    assert_equal(stats.directories_created, 1);
+
+    fs::filesystem_type type;
+    assert_equal(fs::get_filesystem_type(SANDBOX_DIR "/sync_dir_to/file1", &type), true);
+    assert_equal(type, fs::filesystem_type::Directory);
+
+    // the source must be a directory
+    assert_equal(fs::sync_directory(SANDBOX_DIR "/sync_dir/dir1/dir2/file3", dir_to, fs::sync_option::None, &err), false);
+
+#if Windows
+    assert_equal(err.error_code, ERROR_DIRECTORY);
+#else
+    assert_equal(err.error_code, ENOTDIR);
+#endif
+
+    fs::remove(dir_to);
+    fs::remove(dir_from);
+}
+
 define_test(create_directory_creates_directory)
 {
     error err{};
@@ -1919,8 +3405,18 @@ define_test(create_directories_creates_directories_and_parents)
     assert_equal(fs::create_directories(&p), true); 
     assert_equal(fs::exists(&p), 1); 
 
+    // deep paths with repeated and trailing separators
+    fs::path_set(&p, "_create_dirs6/a//b/c/d/e/f/g/");
+    assert_not_equal(fs::exists(&p), 1);
+    assert_equal(fs::create_directories(&p), true); 
+    assert_equal(fs::is_directory("_create_dirs6/a/b/c/d/e/f/g"), true);
+
     error err{};
 
+    // a parent is a file
+    fs::path_set(&p, SANDBOX_TEST_FILE "/abc/def");
+    assert_equal(fs::create_directories(&p, fs::permission::User, &err), false); 
+
     // no permission
     fs::path_set(&p, "/root/_create_dirs3");
     assert_equal(fs::create_directories(&p, fs::permission::User, &err), false); 
@@ -2321,6 +3817,66 @@ define_test(iterator_test)
     free<true>(&descendants);
 }
 
+define_test(dir_handle_operates_relative_to_directory)
+{
+    error err{};
+    fs::dir_handle dir{};
+    fs::dir_handle sub{};
+    fs::filesystem_info info{};
+    array<fs::path> children{};
+
+    fs::create_directories(SANDBOX_DIR "/dh");
+
+    assert_equal(fs::init(&dir, SANDBOX_DIR "/dh", &err), true);
+    assert_equal(fs::init(&sub, &dir, "doesnotexist", &err), false);
+
+    assert_equal(fs::create_directory(&dir, "sub", fs::permission::User, &err), true);
+    assert_equal(fs::create_directory(&dir, "sub", fs::permission::User, &err), true);
+    assert_equal(fs::init(&sub, &dir, "sub", &err), true);
+
+    assert_equal(fs::touch(&sub, "file1", fs::permission::User, &err), true);
+    assert_equal(fs::exists(&sub, "file1"), 1);
+    assert_equal(fs::exists(&dir, "sub/file1"), 1);
+    assert_equal(fs::exists(&dir, "file1"), 0);
+    assert_equal(fs::exists(SANDBOX_DIR "/dh/sub/file1"), 1);
+
+    // file, not a directory
+    assert_equal(fs::create_directory(&sub, "file1", fs::permission::User, &err), false);
+
+    assert_equal(fs::query_filesystem(&sub, "file1", &info, true, fs::query_flag::Type, &err), true);
+    assert_equal(fs::get_filesystem_type(&info), fs::filesystem_type::File);
+    assert_equal(fs::query_filesystem(&sub, "", &info, true, fs::query_flag::Type, &err), true);
+    assert_equal(fs::get_filesystem_type(&info), fs::filesystem_type::Directory);
+
+    assert_equal(fs::copy_file(&sub, "file1", &dir, "file2", fs::copy_file_option::None, &err), true);
+    assert_equal(fs::copy_file(&sub, "file1", &dir, "file2", fs::copy_file_option::None, &err), false);
+    assert_equal(fs::move(&dir, "file2", &sub, "file3", &err), true);
+    assert_equal(fs::exists(&dir, "file2"), 0);
+    assert_equal(fs::exists(&sub, "file3"), 1);
+
+    for_path(item, &sub, fs::iterate_option::None, &err)
+    {
+        fs::path *cp = ::add_at_end(&children);
+        fs::init(cp);
+        fs::path_set(cp, item->path);
+    }
+
+    sort(children.data, children.size, path_comparer);
+
+    assert_equal(children.size, 2);
+    assert_equal_str(children[0], SYS_CHAR("file1"));
+    assert_equal_str(children[1], SYS_CHAR("file3"));
+
+    assert_equal(fs::remove_file(&sub, "file1", &err), true);
+    assert_equal(fs::remove_file(&sub, "file1", &err), false);
+    assert_equal(fs::exists(&sub, "file1"), 0);
+
+    fs::free(&sub);
+    fs::free(&dir);
+    free<true>(&children);
+    fs::remove_directory(SANDBOX_DIR "/dh");
+}
+
 define_test(iterator_type_filter_test)
 {
     error err{};